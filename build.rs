@@ -190,6 +190,8 @@ extern "C" {
                            output_size: usize) -> i32;
     pub fn compress_huffman(input: *const u8, input_size: usize, output: *mut u8,
                             max_output_size: usize) -> i32;
+    pub fn decompress_huffman(input: *const u8, input_size: usize, output: *mut u8,
+                              output_size: usize) -> i32;
     pub fn get_optimal_compression(data: *const u8, size: usize) -> u32;
     
     // From math_kernel.h - SIMD math operations
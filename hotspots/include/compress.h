@@ -12,7 +12,10 @@ typedef enum {
     METHOD_NONE = 0,
     METHOD_LZ4 = 1,
     METHOD_HUFFMAN = 2,
-    METHOD_DEFLATE = 3
+    METHOD_DEFLATE = 3,
+    METHOD_ZSTD = 4,
+    METHOD_LZ4HC = 5,
+    METHOD_TANS = 6
 } CompressionMethod;
 
 typedef struct {
@@ -31,13 +34,35 @@ WASM_EXPORT size_t deflate_compress(
     int mem_level
 );
 
+WASM_EXPORT size_t deflate_compress_bound(size_t input_size);
+WASM_EXPORT size_t deflate_compress_state_size(int window_bits, int mem_level);
+WASM_EXPORT size_t deflate_compress_ext_state(
+    void* state,
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level,
+    int window_bits,
+    int mem_level
+);
+
 WASM_EXPORT size_t png_compress_scanlines(
-    const uint8_t* rgba_data,
-    size_t width,
+    const uint8_t* filtered_rows,
+    size_t row_bytes,
     size_t height,
     uint8_t* compressed_output,
     size_t output_capacity,
-    int filter_strategy
+    int compression_level
+);
+WASM_EXPORT size_t png_compress_scanlines_ext_state(
+    void* state,
+    const uint8_t* filtered_rows,
+    size_t row_bytes,
+    size_t height,
+    uint8_t* compressed_output,
+    size_t output_capacity,
+    int compression_level
 );
 
 WASM_EXPORT size_t lz4_compress_fast(
@@ -55,6 +80,31 @@ WASM_EXPORT size_t lz4_decompress_fast(
     size_t output_capacity
 );
 
+// LZ4 high-compression levels: hash-chain lazy parsing below LZ4HC_LEVEL_OPT_MIN,
+// optimal parsing from there up, never larger than level LZ4HC_LEVEL_OPT_MIN - 1.
+// The output is an ordinary LZ4 block.
+#define LZ4HC_LEVEL_DEFAULT 9
+#define LZ4HC_LEVEL_OPT_MIN 10
+#define LZ4HC_LEVEL_MAX 12
+
+WASM_EXPORT size_t lz4_compress_bound(size_t input_size);
+WASM_EXPORT size_t lz4_compress_hc_state_size(void);
+WASM_EXPORT size_t lz4_compress_hc_ext_state(
+    void* state,
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level
+);
+WASM_EXPORT size_t lz4_compress_hc(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level
+);
+
 WASM_EXPORT size_t zstd_compress_advanced(
     const uint8_t* input,
     size_t input_size,
@@ -73,6 +123,84 @@ WASM_EXPORT size_t zstd_decompress(
     size_t output_capacity
 );
 
+#define ZSTD_MAX_LEVEL 19
+#define ZSTD_DEFAULT_LEVEL 3
+#define ZSTD_STREAM_ERROR ((size_t)-1)
+#define ZSTD_CONTENTSIZE_UNKNOWN (0ULL - 1)
+#define ZSTD_CONTENTSIZE_ERROR (0ULL - 2)
+
+typedef struct ZstdStream ZstdStream;
+
+WASM_EXPORT size_t zstd_compress_bound(size_t input_size);
+
+WASM_EXPORT size_t zstd_compress_using_dict(
+    const uint8_t* input,
+    size_t input_size,
+    const uint8_t* dict,
+    size_t dict_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level
+);
+
+WASM_EXPORT size_t zstd_decompress_using_dict(
+    const uint8_t* input,
+    size_t input_size,
+    const uint8_t* dict,
+    size_t dict_size,
+    uint8_t* output,
+    size_t output_capacity
+);
+
+WASM_EXPORT uint64_t zstd_get_frame_content_size(const uint8_t* input, size_t input_size);
+
+WASM_EXPORT ZstdStream* zstd_stream_create(int compression_level, const uint8_t* dict, size_t dict_size);
+WASM_EXPORT size_t zstd_stream_compress(ZstdStream* stream, const uint8_t* input, size_t input_size,
+                                        uint8_t* output, size_t output_capacity);
+WASM_EXPORT size_t zstd_stream_end(ZstdStream* stream, uint8_t* output, size_t output_capacity);
+WASM_EXPORT void zstd_stream_free(ZstdStream* stream);
+
+// LZ4 frame format (readable by the lz4 CLI). Block size ids follow the frame's BD byte.
+#define LZ4F_BLOCK_64KB 4
+#define LZ4F_BLOCK_256KB 5
+#define LZ4F_BLOCK_1MB 6
+#define LZ4F_BLOCK_4MB 7
+#define LZ4F_BLOCK_DEFAULT LZ4F_BLOCK_256KB
+#define LZ4F_ERROR ((size_t)-1)
+#define LZ4F_CONTENTSIZE_UNKNOWN (0ULL - 1)
+#define LZ4F_CONTENTSIZE_ERROR (0ULL - 2)
+
+typedef struct Lz4FrameStream Lz4FrameStream;
+typedef struct Lz4FrameDecoder Lz4FrameDecoder;
+
+WASM_EXPORT size_t lz4_frame_compress_bound(size_t input_size, int block_size_id);
+WASM_EXPORT size_t lz4_frame_compress(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int block_size_id
+);
+WASM_EXPORT size_t lz4_frame_decompress(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity
+);
+WASM_EXPORT uint64_t lz4_frame_content_size(const uint8_t* input, size_t input_size);
+
+WASM_EXPORT Lz4FrameStream* lz4_frame_stream_create(int block_size_id, uint64_t content_size);
+WASM_EXPORT size_t lz4_frame_stream_compress(Lz4FrameStream* stream, const uint8_t* input, size_t input_size,
+                                             uint8_t* output, size_t output_capacity);
+WASM_EXPORT size_t lz4_frame_stream_end(Lz4FrameStream* stream, uint8_t* output, size_t output_capacity);
+WASM_EXPORT void lz4_frame_stream_free(Lz4FrameStream* stream);
+
+WASM_EXPORT Lz4FrameDecoder* lz4_frame_decoder_create(void);
+WASM_EXPORT size_t lz4_frame_decoder_update(Lz4FrameDecoder* decoder, const uint8_t* input, size_t input_size,
+                                            size_t* consumed, uint8_t* output, size_t output_capacity);
+WASM_EXPORT int lz4_frame_decoder_finished(const Lz4FrameDecoder* decoder);
+WASM_EXPORT void lz4_frame_decoder_free(Lz4FrameDecoder* decoder);
+
 typedef struct {
     uint16_t symbol;
     uint32_t frequency;
@@ -93,31 +221,57 @@ WASM_EXPORT size_t huffman_decode(const uint8_t* input, size_t input_size,
                      const HuffmanTable* table, uint8_t* output, size_t output_capacity);
 WASM_EXPORT void free_huffman_table(HuffmanTable* table);
 
+// Dictionary compression for small assets: LZ4 blocks whose matches may reach into a
+// shared dictionary of up to DICTIONARY_MAX_SIZE bytes (the LZ4 match window).
+#define DICTIONARY_MAX_SIZE (64 * 1024)
+#define DICTIONARY_HASH_SIZE (1 << 14)
+#define DICTIONARY_BUILTIN_SVG 1
+#define DICTIONARY_BUILTIN_GLTF_JSON 2
+#define DICTIONARY_ERROR ((size_t)-1)
+
 typedef struct {
     uint8_t* dictionary;
     size_t dictionary_size;
     uint32_t* hash_table;
     size_t hash_table_size;
+    size_t dictionary_capacity;
+    uint32_t dictionary_id;
 } DictionaryCompressor;
 
 // Missing functions from build.rs bindings
 WASM_EXPORT int compress_lz4(const uint8_t* input, size_t input_size, uint8_t* output, size_t max_output_size);
 WASM_EXPORT int decompress_lz4(const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
 WASM_EXPORT int compress_huffman(const uint8_t* input, size_t input_size, uint8_t* output, size_t max_output_size);
+WASM_EXPORT int decompress_huffman(const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
 WASM_EXPORT uint32_t get_optimal_compression(const uint8_t* data, size_t size);
 
-DictionaryCompressor* create_dictionary_compressor(size_t dictionary_size, size_t hash_size);
-void train_dictionary(DictionaryCompressor* compressor, const uint8_t* training_data, size_t data_size);
-size_t dictionary_compress(DictionaryCompressor* compressor, const uint8_t* input, size_t input_size,
-                          uint8_t* output, size_t output_capacity);
-size_t dictionary_decompress(DictionaryCompressor* compressor, const uint8_t* input, size_t input_size,
-                            uint8_t* output, size_t output_capacity);
-void free_dictionary_compressor(DictionaryCompressor* compressor);
+// tANS (FSE) coding of bytes with interleaved states; no matching, so it suits data
+// whose redundancy is a skewed byte distribution rather than repeats.
+WASM_EXPORT size_t tans_compress_bound(size_t input_size);
+WASM_EXPORT int compress_tans(const uint8_t* input, size_t input_size, uint8_t* output, size_t output_capacity);
+WASM_EXPORT int decompress_tans(const uint8_t* input, size_t input_size, uint8_t* output, size_t output_size);
+WASM_EXPORT int tans_decompressed_size(const uint8_t* input, size_t input_size);
+
+WASM_EXPORT DictionaryCompressor* create_dictionary_compressor(size_t dictionary_size, size_t hash_size);
+WASM_EXPORT size_t train_dictionary(DictionaryCompressor* compressor, const uint8_t* training_data, size_t data_size);
+WASM_EXPORT int load_dictionary(DictionaryCompressor* compressor, const uint8_t* data, size_t data_size);
+WASM_EXPORT size_t serialize_dictionary(const DictionaryCompressor* compressor, uint8_t* output, size_t output_capacity);
+WASM_EXPORT const uint8_t* builtin_dictionary(int kind, size_t* size);
+WASM_EXPORT size_t dictionary_compress_bound(size_t input_size);
+WASM_EXPORT size_t dictionary_compress(const DictionaryCompressor* compressor, const uint8_t* input, size_t input_size,
+                                       uint8_t* output, size_t output_capacity);
+WASM_EXPORT size_t dictionary_decompress(const DictionaryCompressor* compressor, const uint8_t* input, size_t input_size,
+                                         uint8_t* output, size_t output_capacity);
+WASM_EXPORT size_t dictionary_decompressed_size(const uint8_t* input, size_t input_size);
+WASM_EXPORT void free_dictionary_compressor(DictionaryCompressor* compressor);
 
 CompressBuffer* create_compress_buffer(size_t initial_capacity);
 void resize_compress_buffer(CompressBuffer* buffer, size_t new_capacity);
 void free_compress_buffer(CompressBuffer* buffer);
 
+// Result of analyze_compression_potential. Histogram, entropy and match density
+// describe the sampled blocks; compressed_size and compression_ratio are predictions
+// for the whole input.
 typedef struct {
     size_t original_size;
     size_t compressed_size;
@@ -125,9 +279,12 @@ typedef struct {
     float entropy;
     size_t unique_bytes;
     uint32_t byte_frequencies[256];
+    float match_density;
+    float confidence;
+    size_t sampled_bytes;
 } CompressionStats;
 
-CompressionStats analyze_compression_potential(const uint8_t* data, size_t size);
+WASM_EXPORT int analyze_compression_potential(const uint8_t* data, size_t size, CompressionStats* stats);
 float calculate_entropy(const uint32_t* frequencies, size_t total_count);
 
 #ifdef __cplusplus
@@ -34,6 +34,17 @@ WASM_EXPORT QuantizedImage* quantize_colors_median_cut(
     size_t max_colors
 );
 
+// k-means rounds quantize_colors_median_cut() runs after splitting.
+#define MEDIAN_CUT_DEFAULT_REFINE 1
+
+WASM_EXPORT QuantizedImage* quantize_colors_median_cut_refined(
+    const uint8_t* rgba_data,
+    size_t width,
+    size_t height,
+    size_t max_colors,
+    int refine_iterations
+);
+
 WASM_EXPORT int apply_floyd_steinberg_dither(
     uint8_t* rgba_data,
     size_t width,
@@ -42,6 +53,17 @@ WASM_EXPORT int apply_floyd_steinberg_dither(
     size_t palette_size
 );
 
+// Floyd-Steinberg scan options for dither_floyd_steinberg_ex(). The error clamp is in
+// levels; 0 leaves the carried error unbounded.
+#define DITHER_DEFAULT_SERPENTINE 1
+#define DITHER_DEFAULT_ERROR_CLAMP 0
+
+void dither_floyd_steinberg(uint8_t* image, int32_t width, int32_t height, int32_t channels,
+                            const Color32* palette, size_t palette_size);
+WASM_EXPORT void dither_floyd_steinberg_ex(uint8_t* image, int32_t width, int32_t height, int32_t channels,
+                                           const Color32* palette, size_t palette_size,
+                                           int serpentine, int error_clamp);
+
 WASM_EXPORT void apply_ordered_dither(
     uint8_t* rgba_data,
     size_t width,
@@ -51,6 +73,10 @@ WASM_EXPORT void apply_ordered_dither(
     int matrix_size
 );
 
+// Separable Gaussian blur in place. Sigmas up to 3 use the sampled kernel; larger ones
+// use three box passes, whose cost per pixel does not depend on sigma.
+void gaussian_blur_simd(uint8_t* image, int32_t width, int32_t height, int32_t channels, float sigma);
+
 WASM_EXPORT void apply_gaussian_blur(
     uint8_t* rgba_data,
     size_t width,
@@ -102,6 +128,52 @@ typedef struct {
     uint8_t compression;
 } TIFFProcessResult;
 
+// Compression and Predictor tag values for the TIFF strip encoder, and the uncompressed
+// strip size tiff_rows_per_strip() aims for.
+#define TIFF_COMPRESSION_LZW 5
+#define TIFF_COMPRESSION_ADOBE_DEFLATE 8
+#define TIFF_PREDICTOR_NONE 1
+#define TIFF_PREDICTOR_HORIZONTAL 2
+#define TIFF_STRIP_TARGET_BYTES (64 * 1024)
+
+WASM_EXPORT size_t tiff_rows_per_strip(size_t width, size_t channels);
+WASM_EXPORT size_t tiff_strip_bound(size_t width, size_t rows, size_t channels, int compression);
+WASM_EXPORT size_t tiff_strip_state_size(size_t width, size_t rows, size_t channels, int compression);
+WASM_EXPORT size_t tiff_encode_strip(
+    void* state,
+    const uint8_t* pixels,
+    size_t width,
+    size_t rows,
+    size_t channels,
+    int compression,
+    int predictor,
+    int level,
+    uint8_t* output,
+    size_t output_capacity
+);
+WASM_EXPORT size_t tiff_directory_size(size_t strip_count, size_t channels);
+WASM_EXPORT size_t tiff_write_directory(
+    uint8_t* output,
+    size_t output_capacity,
+    const uint32_t* strip_sizes,
+    size_t strip_count,
+    uint32_t width,
+    uint32_t height,
+    size_t channels,
+    int compression,
+    int predictor,
+    uint32_t rows_per_strip
+);
+
+WASM_EXPORT TIFFProcessResult* encode_tiff_simd(
+    const uint8_t* pixels,
+    size_t width,
+    size_t height,
+    size_t channels,
+    int compression,
+    int level
+);
+
 WASM_EXPORT TIFFProcessResult* compress_tiff_lzw_simd(
     const uint8_t* rgba_data,
     size_t width,
@@ -129,6 +201,48 @@ WASM_EXPORT void optimize_tiff_colorspace_simd(
     uint8_t target_bits_per_channel
 );
 
+#define PNG_FILTER_NONE  0
+#define PNG_FILTER_SUB   1
+#define PNG_FILTER_UP    2
+#define PNG_FILTER_AVG   3
+#define PNG_FILTER_PAETH 4
+
+// Picks a PNG filter per scanline and writes the filtered stream (one filter-type byte
+// followed by the filtered row, per row) to `filtered_out`, which must hold
+// height * (width * bytes_per_pixel + 1) bytes. Returns 0 on success.
+WASM_EXPORT int png_filter_scanlines(
+    const uint8_t* pixels,
+    size_t width,
+    size_t height,
+    size_t bytes_per_pixel,
+    uint8_t* filtered_out
+);
+
+#define IMAGE_ALPHA_NONE   0
+#define IMAGE_ALPHA_BINARY 1
+#define IMAGE_ALPHA_FULL   2
+
+// Everything the codec strategy selectors need to know about an RGBA8 image,
+// gathered in a single pass by analyze_image_rgba().
+typedef struct {
+    uint32_t histogram[4][256];  // per channel, in R, G, B, A order
+    uint32_t unique_colors;      // exact up to the requested cap, cap + 1 beyond it
+    uint32_t alpha_usage;        // IMAGE_ALPHA_NONE / _BINARY (only 0 and 255) / _FULL
+    uint32_t is_grayscale;       // every pixel has R == G == B
+    uint32_t bit_depth;          // 1, 2, 4 or 8: fewest bits per channel that hold every sample exactly
+    float edge_energy;           // mean absolute luma step to the left and upper neighbours
+} ImageAnalysis;
+
+// Fills `out` for a tightly packed RGBA8 image. Colours are only counted up to
+// unique_cap (at most 65536; 0 skips the count). Returns 0 on success.
+WASM_EXPORT int analyze_image_rgba(
+    const uint8_t* rgba_data,
+    size_t width,
+    size_t height,
+    uint32_t unique_cap,
+    ImageAnalysis* out
+);
+
 WASM_EXPORT void free_quantized_image(QuantizedImage* img);
 WASM_EXPORT void free_tiff_result(TIFFProcessResult* result);
 
@@ -163,15 +277,6 @@ WASM_EXPORT void fast_downscale_simd(
     size_t dst_height
 );
 
-WASM_EXPORT void multi_threaded_compression_simd(
-    const uint8_t* rgba_data,
-    size_t width,
-    size_t height,
-    uint8_t* compressed_data,
-    size_t* compressed_size,
-    uint8_t quality
-);
-
 #ifdef __cplusplus
 }
 #endif
@@ -51,6 +51,10 @@ typedef _Bool bool;
 WASM_EXPORT void* wasm_malloc(size_t size);
 WASM_EXPORT void wasm_free(void* ptr);
 WASM_EXPORT void wasm_reset_allocator(void);
+WASM_EXPORT size_t wasm_get_memory_usage(void);
+WASM_EXPORT size_t wasm_get_memory_peak(void);
+WASM_EXPORT size_t arena_mark(void);
+WASM_EXPORT void arena_release(size_t mark);
 
 WASM_EXPORT void* wasm_memcpy(void* dest, const void* src, size_t n);
 WASM_EXPORT void* wasm_memset(void* dest, int value, size_t n);
@@ -0,0 +1,42 @@
+#ifndef PALETTE_SEARCH_H
+#define PALETTE_SEARCH_H
+
+#include "memory.h"
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Nearest-palette search shared by the quantizers, dithering and palette mapping. A k-d
+// tree over the palette answers arbitrary queries; a cache keyed by the top 5 bits of R,
+// G and B (plus 2 of alpha when the palette's alpha varies) is filled lazily with the
+// few entries that can be nearest to any colour in each cell, so most lookups scan a
+// handful of candidates. Results match a full scan of the palette.
+#define PALETTE_METRIC_RGBA 0         // squared RGBA difference
+#define PALETTE_METRIC_LUMA 1         // RGBA difference weighted 0.299/0.587/0.114/0.5
+#define PALETTE_METRIC_PERCEPTUAL 2   // luma-weighted linear-light RGB, as color_distance_perceptual()
+#define PALETTE_SEARCH_MAX_COLORS 256
+
+typedef struct PaletteSearch PaletteSearch;
+
+// The search lives in caller-owned memory of palette_search_state_size() bytes, 8-byte
+// aligned. `channels` is 3 (RGB, alpha taken as 255) or 4. Returns NULL for an empty
+// palette or one larger than PALETTE_SEARCH_MAX_COLORS.
+WASM_EXPORT size_t palette_search_state_size(void);
+WASM_EXPORT PaletteSearch* palette_search_init(void* state, const uint8_t* palette, size_t palette_size,
+                                               size_t channels, int metric);
+
+WASM_EXPORT uint32_t palette_search_nearest(PaletteSearch* search, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
+// Tree-only query for a colour with fractional channels (0..255), e.g. a cluster mean.
+uint32_t palette_search_nearest_value(const PaletteSearch* search, const float* rgba);
+
+WASM_EXPORT void palette_search_map(PaletteSearch* search, const uint8_t* pixels, size_t pixel_count,
+                                    size_t channels, uint8_t* indices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
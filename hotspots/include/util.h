@@ -62,6 +62,8 @@ typedef enum {
 void log_message(LogLevel level, const char* format, ...);
 void set_log_level(LogLevel level);
 
+WASM_EXPORT uint64_t hash_xxhash32(const uint8_t* data, size_t len, uint32_t seed);
+
 void memcpy_simd(void* dest, const void* src, size_t size);
 void memset_simd(void* dest, int value, size_t size);
 
@@ -1,4 +1,5 @@
 #include "color_lut.h"
+#include "palette_search.h"
 #include "util.h"
 
 #ifdef __wasm_simd128__
@@ -81,21 +82,41 @@ WASM_EXPORT void rgb_to_linear_batch_simd(
 }
 #endif
 
-WASM_EXPORT float color_distance_batch_min(
+// Shared palette scan for the one-off queries below; the query is linearised once
+// rather than per entry. Batches should build a PaletteSearch instead.
+static unsigned int palette_scan_perceptual(
     const unsigned char* palette,
     unsigned int palette_size,
-    unsigned char r, unsigned char g, unsigned char b
+    unsigned char r, unsigned char g, unsigned char b,
+    float* min_dist
 ) {
-    float min_dist = 1e30f;
+    const float* lut = get_srgb_to_linear_lut();
+    float lr = lut[r], lg = lut[g], lb = lut[b];
+    float best = 1e30f;
+    unsigned int best_idx = 0;
 
     for (unsigned int i = 0; i < palette_size; i++) {
-        float dist = color_distance_perceptual(
-            r, g, b,
-            palette[i*3], palette[i*3+1], palette[i*3+2]
-        );
-        if (dist < min_dist) min_dist = dist;
+        float dr = lr - lut[palette[i*3]];
+        float dg = lg - lut[palette[i*3+1]];
+        float db = lb - lut[palette[i*3+2]];
+        float dist = dr*dr*0.299f + dg*dg*0.587f + db*db*0.114f;
+        if (dist < best) {
+            best = dist;
+            best_idx = i;
+        }
     }
 
+    *min_dist = best;
+    return best_idx;
+}
+
+WASM_EXPORT float color_distance_batch_min(
+    const unsigned char* palette,
+    unsigned int palette_size,
+    unsigned char r, unsigned char g, unsigned char b
+) {
+    float min_dist;
+    palette_scan_perceptual(palette, palette_size, r, g, b, &min_dist);
     return min_dist;
 }
 
@@ -104,19 +125,277 @@ WASM_EXPORT unsigned int find_closest_color(
     unsigned int palette_size,
     unsigned char r, unsigned char g, unsigned char b
 ) {
-    float min_dist = 1e30f;
-    unsigned int best_idx = 0;
+    float min_dist;
+    return palette_scan_perceptual(palette, palette_size, r, g, b, &min_dist);
+}
 
-    for (unsigned int i = 0; i < palette_size; i++) {
-        float dist = color_distance_perceptual(
-            r, g, b,
-            palette[i*3], palette[i*3+1], palette[i*3+2]
-        );
-        if (dist < min_dist) {
-            min_dist = dist;
-            best_idx = i;
+// Every metric is Euclidean once each channel goes through its own monotonic table, so
+// the tree and the cell bounds work on table coordinates. A cell's candidates are the
+// entries whose distance to the cell box is within the smallest farthest-corner
+// distance of any entry; whatever colour in the box is queried, its nearest entry is
+// among them. Cells with too many candidates, or filled once the pool is spent, are
+// answered by the tree.
+#define PALETTE_CELL_BITS 17
+#define PALETTE_CELL_COUNT (1u << PALETTE_CELL_BITS)
+#define PALETTE_CELL_EMPTY 0u
+#define PALETTE_CELL_TREE 1u
+#define PALETTE_CELL_MAX_CANDIDATES 48
+#define PALETTE_POOL_SIZE (1u << 19)
+
+struct PaletteSearch {
+    float tables[4][256];
+    float scale[4];                                   // value-to-coordinate factor, 0 for perceptual
+    float points[PALETTE_SEARCH_MAX_COLORS][4];
+    uint8_t order[PALETTE_SEARCH_MAX_COLORS];         // palette indices in implicit k-d tree order
+    uint8_t axis[PALETTE_SEARCH_MAX_COLORS];
+    uint32_t size;
+    uint32_t alpha_bits;
+    int metric;
+    uint32_t pool_used;
+    uint32_t cells[PALETTE_CELL_COUNT];               // pool offset of the candidate list, or EMPTY/TREE
+    uint8_t pool[PALETTE_POOL_SIZE];                  // per list: count, then palette indices
+};
+
+WASM_EXPORT size_t palette_search_state_size(void) {
+    return sizeof(PaletteSearch);
+}
+
+static inline float palette_distance(const float* a, const float* b) {
+    float d0 = a[0] - b[0], d1 = a[1] - b[1], d2 = a[2] - b[2], d3 = a[3] - b[3];
+    return d0*d0 + d1*d1 + d2*d2 + d3*d3;
+}
+
+// Sorts order[lo, hi) on the widest axis and splits at the median, recursively.
+static void palette_tree_build(PaletteSearch* s, uint32_t lo, uint32_t hi) {
+    if (hi - lo <= 1) {
+        if (hi > lo) s->axis[lo] = 0;
+        return;
+    }
+
+    uint32_t axis = 0;
+    float widest = -1.0f;
+    for (uint32_t c = 0; c < 4; c++) {
+        float low = 1e30f, high = -1e30f;
+        for (uint32_t i = lo; i < hi; i++) {
+            float v = s->points[s->order[i]][c];
+            if (v < low) low = v;
+            if (v > high) high = v;
+        }
+        if (high - low > widest) {
+            widest = high - low;
+            axis = c;
         }
     }
 
-    return best_idx;
+    for (uint32_t i = lo + 1; i < hi; i++) {
+        uint8_t index = s->order[i];
+        float v = s->points[index][axis];
+        uint32_t j = i;
+        while (j > lo && s->points[s->order[j - 1]][axis] > v) {
+            s->order[j] = s->order[j - 1];
+            j--;
+        }
+        s->order[j] = index;
+    }
+
+    uint32_t mid = (lo + hi) >> 1;
+    s->axis[mid] = (uint8_t)axis;
+    palette_tree_build(s, lo, mid);
+    palette_tree_build(s, mid + 1, hi);
+}
+
+// Ties go to the lower palette index, as with a linear scan.
+static void palette_tree_search(const PaletteSearch* s, uint32_t lo, uint32_t hi, const float* q,
+                                uint32_t* best, float* best_distance) {
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        uint32_t index = s->order[mid];
+        const float* p = s->points[index];
+        float distance = palette_distance(q, p);
+        if (distance < *best_distance || (distance == *best_distance && index < *best)) {
+            *best_distance = distance;
+            *best = index;
+        }
+
+        float diff = q[s->axis[mid]] - p[s->axis[mid]];
+        if (diff < 0.0f) {
+            palette_tree_search(s, lo, mid, q, best, best_distance);
+            if (diff * diff > *best_distance) return;
+            lo = mid + 1;
+        } else {
+            palette_tree_search(s, mid + 1, hi, q, best, best_distance);
+            if (diff * diff > *best_distance) return;
+            hi = mid;
+        }
+    }
+}
+
+static inline uint32_t palette_tree_nearest(const PaletteSearch* s, const float* q) {
+    uint32_t best = 0;
+    float best_distance = 1e30f;
+    palette_tree_search(s, 0, s->size, q, &best, &best_distance);
+    return best;
+}
+
+WASM_EXPORT PaletteSearch* palette_search_init(void* state, const uint8_t* palette, size_t palette_size,
+                                               size_t channels, int metric) {
+    if (!state || !palette || palette_size == 0 || palette_size > PALETTE_SEARCH_MAX_COLORS ||
+        (channels != 3 && channels != 4)) {
+        return NULL;
+    }
+
+    PaletteSearch* s = (PaletteSearch*)state;
+    static const float luma[4] = { 0.299f, 0.587f, 0.114f, 0.5f };
+    static const float perceptual[3] = { 0.5468089f, 0.7661593f, 0.3376389f };   // sqrt of the luma weights
+    const float* lut = get_srgb_to_linear_lut();
+
+    // A palette with one alpha value ranks every query the same whatever its alpha, so
+    // alpha drops out of the metric and the cells.
+    int alpha_varies = 0;
+    if (channels == 4) {
+        for (size_t i = 1; i < palette_size; i++) {
+            if (palette[i * 4 + 3] != palette[3]) {
+                alpha_varies = 1;
+                break;
+            }
+        }
+    }
+    if (metric == PALETTE_METRIC_PERCEPTUAL) alpha_varies = 0;
+
+    for (uint32_t c = 0; c < 4; c++) {
+        float weight = metric == PALETTE_METRIC_LUMA ? luma[c] : 1.0f;
+        if (c == 3 && !alpha_varies) weight = 0.0f;
+        s->scale[c] = metric == PALETTE_METRIC_PERCEPTUAL ? 0.0f : weight;
+        for (uint32_t v = 0; v < 256; v++) {
+            if (metric == PALETTE_METRIC_PERCEPTUAL) {
+                s->tables[c][v] = c < 3 ? lut[v] * perceptual[c] : 0.0f;
+            } else {
+                s->tables[c][v] = (float)v * weight;
+            }
+        }
+    }
+
+    s->size = (uint32_t)palette_size;
+    s->metric = metric;
+    s->alpha_bits = alpha_varies ? 2 : 0;
+    for (uint32_t i = 0; i < s->size; i++) {
+        const uint8_t* p = palette + i * channels;
+        s->points[i][0] = s->tables[0][p[0]];
+        s->points[i][1] = s->tables[1][p[1]];
+        s->points[i][2] = s->tables[2][p[2]];
+        s->points[i][3] = s->tables[3][channels == 4 ? p[3] : 255];
+        s->order[i] = (uint8_t)i;
+    }
+    palette_tree_build(s, 0, s->size);
+
+    // Offsets 0 and 1 are the EMPTY and TREE markers, so lists start at 2.
+    memset(s->cells, 0, sizeof(s->cells));
+    s->pool_used = 2;
+    return s;
+}
+
+static uint32_t palette_cell_fill(PaletteSearch* s, uint32_t key) {
+    uint32_t lo[4], span[4] = { 7, 7, 7, s->alpha_bits ? 63 : 255 };
+    lo[0] = ((key >> 10) & 31) << 3;
+    lo[1] = ((key >> 5) & 31) << 3;
+    lo[2] = (key & 31) << 3;
+    lo[3] = s->alpha_bits ? (key >> 15) << 6 : 0;
+
+    float box_lo[4], box_hi[4];
+    for (uint32_t c = 0; c < 4; c++) {
+        box_lo[c] = s->tables[c][lo[c]];
+        box_hi[c] = s->tables[c][lo[c] + span[c]];
+    }
+
+    float near[PALETTE_SEARCH_MAX_COLORS];
+    float threshold = 1e30f;
+    for (uint32_t i = 0; i < s->size; i++) {
+        const float* p = s->points[i];
+        float dmin = 0.0f, dmax = 0.0f;
+        for (uint32_t c = 0; c < 4; c++) {
+            float below = box_lo[c] - p[c], above = p[c] - box_hi[c];
+            float gap = below > 0.0f ? below : (above > 0.0f ? above : 0.0f);
+            float to_lo = p[c] - box_lo[c], to_hi = p[c] - box_hi[c];
+            float far = to_lo * to_lo > to_hi * to_hi ? to_lo * to_lo : to_hi * to_hi;
+            dmin += gap * gap;
+            dmax += far;
+        }
+        near[i] = dmin;
+        if (dmax < threshold) threshold = dmax;
+    }
+    // Slack for rounding in the bounds; an extra candidate costs one distance.
+    threshold = threshold * 1.0001f + 1e-12f;
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < s->size; i++) count += near[i] <= threshold;
+    if (count > PALETTE_CELL_MAX_CANDIDATES || s->pool_used + 1 + count > PALETTE_POOL_SIZE) {
+        s->cells[key] = PALETTE_CELL_TREE;
+        return PALETTE_CELL_TREE;
+    }
+
+    uint32_t offset = s->pool_used;
+    uint8_t* list = s->pool + offset;
+    *list++ = (uint8_t)count;
+    for (uint32_t i = 0; i < s->size; i++) {
+        if (near[i] <= threshold) *list++ = (uint8_t)i;
+    }
+    s->pool_used += 1 + count;
+    s->cells[key] = offset;
+    return offset;
+}
+
+static inline uint32_t palette_search_lookup(PaletteSearch* s, uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+    float q[4] = { s->tables[0][r], s->tables[1][g], s->tables[2][b], s->tables[3][a] };
+    uint32_t key = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+    if (s->alpha_bits) key |= (a >> 6) << 15;
+
+    uint32_t cell = s->cells[key];
+    if (cell == PALETTE_CELL_EMPTY) cell = palette_cell_fill(s, key);
+    if (cell == PALETTE_CELL_TREE) return palette_tree_nearest(s, q);
+
+    const uint8_t* list = s->pool + cell;
+    uint32_t count = list[0];
+    uint32_t best = list[1];
+    float best_distance = palette_distance(q, s->points[best]);
+    for (uint32_t i = 2; i <= count; i++) {
+        float distance = palette_distance(q, s->points[list[i]]);
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = list[i];
+        }
+    }
+    return best;
+}
+
+WASM_EXPORT uint32_t palette_search_nearest(PaletteSearch* search, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    if (!search) return 0;
+    return palette_search_lookup(search, r, g, b, a);
+}
+
+uint32_t palette_search_nearest_value(const PaletteSearch* search, const float* rgba) {
+    if (!search) return 0;
+    float q[4];
+    for (uint32_t c = 0; c < 4; c++) {
+        float v = rgba[c] < 0.0f ? 0.0f : (rgba[c] > 255.0f ? 255.0f : rgba[c]);
+        q[c] = search->metric == PALETTE_METRIC_PERCEPTUAL ? search->tables[c][(uint32_t)(v + 0.5f)]
+                                                          : v * search->scale[c];
+    }
+    return palette_tree_nearest(search, q);
+}
+
+WASM_EXPORT void palette_search_map(PaletteSearch* search, const uint8_t* pixels, size_t pixel_count,
+                                    size_t channels, uint8_t* indices) {
+    if (!search || !pixels || !indices || (channels != 3 && channels != 4)) return;
+
+    uint32_t previous = 0, index = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* p = pixels + i * channels;
+        uint32_t a = channels == 4 ? p[3] : 255;
+        uint32_t color = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | a;
+        if (i == 0 || color != previous) {
+            index = palette_search_lookup(search, p[0], p[1], p[2], a);
+            previous = color;
+        }
+        indices[i] = (uint8_t)index;
+    }
 }
@@ -23,6 +23,9 @@ static inline uint32_t rotl32(uint32_t x, int8_t r) {
 #define LZ4_ACCELERATION_DEFAULT 1
 #define LZ4_HASH_SIZE_U32 (1 << 12)
 #define LZ4_DISTANCE_MAX 65535
+#define LZ4_MIN_INPUT_SIZE (LZ4_MFLIMIT + 1)
+#define LZ4_MAX_INPUT_SIZE 0x7E000000
+#define LZ4_SKIP_TRIGGER 6
 
 typedef struct {
     const uint8_t* base;
@@ -40,7 +43,32 @@ static inline uint32_t lz4_hash_sequence(uint32_t sequence, uint32_t table_type)
     }
 }
 
-// LZ4 compression core
+// Unaligned load; the builtin bypasses the memcpy -> wasm_memcpy mapping.
+static inline uint32_t lz4_read32(const uint8_t* p) {
+    uint32_t value;
+    __builtin_memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Bytes that match from ip onwards, stopping at limit.
+static inline size_t lz4_count(const uint8_t* ip, const uint8_t* match, const uint8_t* const limit) {
+    const uint8_t* const start = ip;
+    while (ip + 4 <= limit) {
+        uint32_t diff = lz4_read32(ip) ^ lz4_read32(match);
+        if (diff) return (size_t)(ip - start) + ((uint32_t)__builtin_ctz(diff) >> 3);
+        ip += 4;
+        match += 4;
+    }
+    while (ip < limit && *ip == *match) {
+        ip++;
+        match++;
+    }
+    return (size_t)(ip - start);
+}
+
+// LZ4 compression core. Produces a standard LZ4 block: the last match starts at
+// least LZ4_MFLIMIT bytes before the end and the final LZ4_LASTLITERALS bytes are
+// always literals. Returns 0 when dst_capacity is too small.
 static size_t lz4_compress_generic(LZ4_stream_t* const ctx,
                                    const char* const src,
                                    char* const dst,
@@ -48,164 +76,257 @@ static size_t lz4_compress_generic(LZ4_stream_t* const ctx,
                                    const size_t dst_capacity,
                                    const uint32_t acceleration) {
     const uint8_t* ip = (const uint8_t*)src;
-    const uint8_t* base = (const uint8_t*)src;
-    const uint8_t* const low_prefix_ptr = base;
-    const uint8_t* const dict_end = (const uint8_t*)src;
-    const uint8_t* const source = (const uint8_t*)src;
+    const uint8_t* const base = ip;
     const uint8_t* const source_end = ip + src_size;
-    const uint8_t* const mf_limit = source_end - LZ4_MFLIMIT;
-    
+    const uint8_t* const mf_limit_plus_one = source_end - LZ4_MFLIMIT + 1;
+    const uint8_t* const match_limit = source_end - LZ4_LASTLITERALS;
+    const uint8_t* anchor = ip;
+
     uint8_t* op = (uint8_t*)dst;
     uint8_t* const op_limit = op + dst_capacity;
-    
-    uint32_t forward_h;
-    size_t ref_delta = 0;
-    const uint8_t* anchor = ip;
-    
-    if (src_size < LZ4_MINMATCH + 1) goto _last_literals;
-    
-    ctx->table[lz4_hash_sequence(*(uint32_t*)ip, 0)] = (uint32_t)(ip - base);
+    uint8_t* token;
+    const uint8_t* match;
+
+    if (src_size > LZ4_MAX_INPUT_SIZE) return 0;
+    if (src_size < LZ4_MIN_INPUT_SIZE) goto _last_literals;
+
+    ctx->table[lz4_hash_sequence(lz4_read32(ip), 0)] = 0;
     ip++;
-    forward_h = lz4_hash_sequence(*(uint32_t*)ip, 0);
-    
+
     for (;;) {
-        const uint8_t* match;
-        uint8_t* token;
-        anchor = ip;
-        size_t find_match_attempts = acceleration;
-        
-_next_match:
+        // Skip faster the longer nothing matches.
         {
-            uint32_t const h = forward_h;
-            uint32_t step = 1;
-            uint32_t search_match_nb = find_match_attempts;
-            
+            const uint8_t* forward = ip;
+            uint32_t search = acceleration << LZ4_SKIP_TRIGGER;
             do {
-                uint32_t const match_index = ctx->table[h];
+                uint32_t const h = lz4_hash_sequence(lz4_read32(forward), 0);
+                ip = forward;
+                forward += search++ >> LZ4_SKIP_TRIGGER;
+                if (forward > mf_limit_plus_one) goto _last_literals;
+                match = base + ctx->table[h];
                 ctx->table[h] = (uint32_t)(ip - base);
-                
-                if (match_index < (uint32_t)(ip - base) && 
-                    (ip - base) - match_index <= LZ4_DISTANCE_MAX) {
-                    
-                    match = base + match_index;
-                    ref_delta = (size_t)(ip - match);
-                    break;
-                }
-                
-                ip += step;
-                if (ip > mf_limit) goto _last_literals;
-                step = search_match_nb++ >> acceleration;
-                forward_h = lz4_hash_sequence(*(uint32_t*)ip, 0);
-            } while (1);
-        }
-        
-        if (*(uint32_t*)match != *(uint32_t*)ip) {
-            goto _next_match;
+            } while (match + LZ4_DISTANCE_MAX < ip || lz4_read32(match) != lz4_read32(ip));
         }
-        
-        while ((ip > anchor) && (match > low_prefix_ptr) && (ip[-1] == match[-1])) {
+
+        while (ip > anchor && match > base && ip[-1] == match[-1]) {
             ip--;
             match--;
         }
-        
+
         {
-            uint32_t const literal_l = (uint32_t)(ip - anchor);
+            size_t const literal_l = (size_t)(ip - anchor);
             token = op++;
-            if ((op + literal_l + (2 + 1 + 5)) >= op_limit) return 0;
-            
+            if (op + literal_l + literal_l / 255 + 2 + 1 + LZ4_LASTLITERALS > op_limit) return 0;
+
             if (literal_l >= 15) {
-                int len = (int)literal_l - 15;
+                size_t len = literal_l - 15;
                 *token = (15 << 4);
-                while (len >= 255) {
-                    *op++ = 255;
-                    len -= 255;
-                }
+                for (; len >= 255; len -= 255) *op++ = 255;
                 *op++ = (uint8_t)len;
             } else {
                 *token = (uint8_t)(literal_l << 4);
             }
-            
-            const uint8_t* end = op + literal_l;
-            while (op < end) *op++ = *anchor++;
+
+            memcpy(op, anchor, literal_l);
+            op += literal_l;
         }
-        
+
 _next_sequence:
-        if (op + 2 >= op_limit) return 0;
-        *op++ = (uint8_t)ref_delta;
-        *op++ = (uint8_t)(ref_delta >> 8);
-        
-        ip += LZ4_MINMATCH;
-        match += LZ4_MINMATCH;
-        
         {
-            const uint8_t* const match_end = match + (source_end - ip);
-            const uint8_t* const match_limit = match_end < (ip + 65535) ? 
-                                               match_end : ip + 65535;
-            
-            while (ip < match_limit && *ip == *match) {
-                ip++;
-                match++;
-            }
+            uint32_t const offset = (uint32_t)(ip - match);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
         }
-        
+
         {
-            uint32_t const ml = (uint32_t)(ip - (anchor + LZ4_MINMATCH));
-            if (op + (1 + (ml >= 15 ? (ml - 15) / 255 + 1 : 0)) > op_limit) return 0;
-            
+            size_t ml = lz4_count(ip + LZ4_MINMATCH, match + LZ4_MINMATCH, match_limit);
+            ip += ml + LZ4_MINMATCH;
+            if (op + 1 + LZ4_LASTLITERALS + ml / 255 > op_limit) return 0;
+
             if (ml >= 15) {
-                int len = (int)ml - 15;
                 *token += 15;
-                while (len >= 255) {
-                    *op++ = 255;
-                    len -= 255;
-                }
-                *op++ = (uint8_t)len;
+                ml -= 15;
+                for (; ml >= 255; ml -= 255) *op++ = 255;
+                *op++ = (uint8_t)ml;
             } else {
                 *token += (uint8_t)ml;
             }
         }
-        
-        if (ip >= mf_limit) break;
-        ctx->table[lz4_hash_sequence(*(uint32_t*)(ip - 2), 0)] = (uint32_t)(ip - 2 - base);
-        forward_h = lz4_hash_sequence(*(uint32_t*)ip, 0);
+
+        anchor = ip;
+        if (ip >= mf_limit_plus_one) break;
+
+        ctx->table[lz4_hash_sequence(lz4_read32(ip - 2), 0)] = (uint32_t)(ip - 2 - base);
+
+        // A match straight after a match needs no literal run.
+        {
+            uint32_t const h = lz4_hash_sequence(lz4_read32(ip), 0);
+            match = base + ctx->table[h];
+            ctx->table[h] = (uint32_t)(ip - base);
+            if (match + LZ4_DISTANCE_MAX >= ip && lz4_read32(match) == lz4_read32(ip)) {
+                token = op++;
+                *token = 0;
+                goto _next_sequence;
+            }
+        }
+        ip++;
     }
-    
+
 _last_literals:
     {
         size_t const last_run = (size_t)(source_end - anchor);
-        if (op + last_run + 1 + ((last_run + 255 - 15) / 255) >= op_limit) return 0;
-        
+        if (op + last_run + 1 + (last_run + 255 - 15) / 255 > op_limit) return 0;
+
         if (last_run >= 15) {
             size_t accumulator = last_run - 15;
             *op++ = 15 << 4;
-            while (accumulator >= 255) {
-                *op++ = 255;
-                accumulator -= 255;
-            }
+            for (; accumulator >= 255; accumulator -= 255) *op++ = 255;
             *op++ = (uint8_t)accumulator;
         } else {
             *op++ = (uint8_t)(last_run << 4);
         }
-        
-        const uint8_t* end = op + last_run;
-        while (op < end) *op++ = *anchor++;
+
+        memcpy(op, anchor, last_run);
+        op += last_run;
     }
-    
+
     return (size_t)(op - (uint8_t*)dst);
 }
 
-// LZ4 decompression
+// LZ4 decompression. Sequences are copied in whole 16-byte chunks (one v128 load and
+// store with SIMD), which may read and write up to 15 bytes past their end; that is
+// only done while both buffers keep LZ4_FAST_MARGIN bytes of slack, and the last
+// sequences go through an exact byte loop.
+#define LZ4_FAST_MARGIN 32
+
+// For match offsets below 16: swizzle indices that repeat the first offset bytes
+// across a vector, and the smallest multiple of the offset that is at least 16.
+#ifdef __wasm_simd128__
+static const uint8_t lz4_pattern_index[16][16] = {
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 },
+    { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0 },
+    { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 },
+    { 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0 },
+    { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3 },
+    { 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0 }
+};
+#endif
+static const uint8_t lz4_pattern_stride[16] = { 0, 16, 16, 18, 16, 20, 18, 21, 16, 18, 20, 22, 24, 26, 28, 30 };
+
+static inline void lz4_copy16(uint8_t* dst, const uint8_t* src) {
+#ifdef __wasm_simd128__
+    wasm_v128_store(dst, wasm_v128_load(src));
+#else
+    uint64_t lo, hi;
+    __builtin_memcpy(&lo, src, 8);
+    __builtin_memcpy(&hi, src + 8, 8);
+    __builtin_memcpy(dst, &lo, 8);
+    __builtin_memcpy(dst + 8, &hi, 8);
+#endif
+}
+
+// Copies 16-byte chunks until at least length bytes are written. When the ranges
+// overlap, src must be at least 16 bytes behind dst.
+static inline void lz4_wild_copy(uint8_t* dst, const uint8_t* src, size_t length) {
+    uint8_t* const end = dst + length;
+    do {
+        lz4_copy16(dst, src);
+        dst += 16;
+        src += 16;
+    } while (dst < end);
+}
+
+// Match copy for any offset. Offsets below 16 first write one vector of the repeating
+// pattern; the rest of the match then copies from a whole number of periods back,
+// which is far enough behind for lz4_wild_copy.
+static inline void lz4_copy_match(uint8_t* op, size_t offset, size_t length) {
+    const uint8_t* const match = op - offset;
+    if (offset >= 16) {
+        lz4_wild_copy(op, match, length);
+        return;
+    }
+#ifdef __wasm_simd128__
+    wasm_v128_store(op, wasm_i8x16_swizzle(wasm_v128_load(match), wasm_v128_load(lz4_pattern_index[offset])));
+#else
+    for (int i = 0; i < 16; i++) op[i] = match[i];
+#endif
+    if (length > 16) {
+        size_t const stride = lz4_pattern_stride[offset];
+        lz4_wild_copy(op + 16, op + 16 - stride, length - 16);
+    }
+}
+
 static size_t lz4_decompress_safe(const char* src, char* dst, 
                                   size_t src_size, size_t dst_capacity) {
     const uint8_t* ip = (const uint8_t*)src;
     const uint8_t* const ip_end = ip + src_size;
     
     uint8_t* op = (uint8_t*)dst;
+    uint8_t* const op_start = op;
     uint8_t* const op_end = op + dst_capacity;
     
+    if (src_size > LZ4_FAST_MARGIN && dst_capacity > LZ4_FAST_MARGIN) {
+        const uint8_t* const ip_fast_end = ip_end - LZ4_FAST_MARGIN;
+        uint8_t* const op_fast_end = op_end - LZ4_FAST_MARGIN;
+        
+        while (ip < ip_fast_end && op < op_fast_end) {
+            const uint8_t* const sequence_ip = ip;
+            uint8_t* const sequence_op = op;
+            uint32_t const token = *ip++;
+            uint32_t s;
+            
+            size_t literal_length = token >> 4;
+            if (literal_length == 15) {
+                do {
+                    s = *ip++;
+                    literal_length += s;
+                } while (s == 255 && ip < ip_fast_end);
+                if (s == 255) goto _exact;
+            }
+            if (ip > ip_fast_end || literal_length > (size_t)(ip_fast_end - ip) ||
+                literal_length > (size_t)(op_fast_end - op)) goto _exact;
+            lz4_wild_copy(op, ip, literal_length);
+            ip += literal_length;
+            op += literal_length;
+            
+            size_t const offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+            ip += 2;
+            
+            size_t match_length = token & 15;
+            if (match_length == 15) {
+                do {
+                    s = *ip++;
+                    match_length += s;
+                } while (s == 255 && ip < ip_fast_end);
+                if (s == 255) goto _exact;
+            }
+            match_length += LZ4_MINMATCH;
+            if (offset == 0 || offset > (size_t)(op - op_start) || match_length > (size_t)(op_fast_end - op)) goto _exact;
+            lz4_copy_match(op, offset, match_length);
+            op += match_length;
+            continue;
+            
+        _exact:
+            // Redone below with exact bounds checks, which also reject corrupt input.
+            ip = sequence_ip;
+            op = sequence_op;
+            break;
+        }
+    }
+    
     while (ip < ip_end) {
         uint32_t token = *ip++;
-        uint32_t literal_length = token >> 4;
+        size_t literal_length = token >> 4;
         
         if (literal_length == 15) {
             uint32_t s;
@@ -216,22 +337,22 @@ static size_t lz4_decompress_safe(const char* src, char* dst,
             } while (s == 255);
         }
         
-        if (op + literal_length > op_end) return 0;
-        if (ip + literal_length > ip_end) return 0;
+        if (literal_length > (size_t)(op_end - op)) return 0;
+        if (literal_length > (size_t)(ip_end - ip)) return 0;
         
-        for (uint32_t i = 0; i < literal_length; i++) {
+        for (size_t i = 0; i < literal_length; i++) {
             *op++ = *ip++;
         }
         
         if (ip >= ip_end) break;
         
         if (ip + 1 >= ip_end) return 0;
-        uint32_t offset = *ip++;
-        offset |= (*ip++) << 8;
+        size_t offset = *ip++;
+        offset |= (size_t)(*ip++) << 8;
         
         if (offset == 0) return 0;
         
-        uint32_t match_length = token & 15;
+        size_t match_length = token & 15;
         if (match_length == 15) {
             uint32_t s;
             do {
@@ -242,131 +363,16 @@ static size_t lz4_decompress_safe(const char* src, char* dst,
         }
         match_length += LZ4_MINMATCH;
         
-        if (op + match_length > op_end) return 0;
-        if (op - offset < (uint8_t*)dst) return 0;
+        if (match_length > (size_t)(op_end - op)) return 0;
+        if (offset > (size_t)(op - op_start)) return 0;
         
         const uint8_t* match = op - offset;
-        for (uint32_t i = 0; i < match_length; i++) {
+        for (size_t i = 0; i < match_length; i++) {
             *op++ = *match++;
         }
     }
     
-    return (size_t)(op - (uint8_t*)dst);
-}
-
-#define HUFFMAN_MAX_SYMBOLS 256
-#define HUFFMAN_MAX_CODE_LENGTH 15
-
-typedef struct {
-    uint16_t symbol;
-    uint16_t code_length;
-    uint32_t code;
-} HuffmanCode;
-
-typedef struct {
-    uint32_t frequencies[HUFFMAN_MAX_SYMBOLS];
-    HuffmanCode codes[HUFFMAN_MAX_SYMBOLS];
-    uint32_t symbol_count;
-} HuffmanEncoder;
-
-typedef struct HuffmanNode {
-    uint32_t frequency;
-    uint16_t symbol;
-    uint8_t is_leaf;
-    struct HuffmanNode* left;
-    struct HuffmanNode* right;
-} HuffmanNode;
-
-typedef struct {
-    HuffmanNode** nodes;
-    size_t count;
-    size_t capacity;
-} PriorityQueue;
-
-static void pq_init(PriorityQueue* pq, size_t capacity) {
-    pq->nodes = (HuffmanNode**)wasm_malloc(capacity * sizeof(HuffmanNode*));
-    pq->count = 0;
-    pq->capacity = capacity;
-}
-
-static void pq_free(PriorityQueue* pq) {
-    wasm_free(pq->nodes);
-    pq->nodes = NULL;
-    pq->count = 0;
-}
-
-static void pq_heapify_up(PriorityQueue* pq, size_t index) {
-    while (index > 0) {
-        size_t parent = (index - 1) / 2;
-        if (pq->nodes[index]->frequency >= pq->nodes[parent]->frequency) break;
-        
-        HuffmanNode* temp = pq->nodes[index];
-        pq->nodes[index] = pq->nodes[parent];
-        pq->nodes[parent] = temp;
-        
-        index = parent;
-    }
-}
-
-static void pq_heapify_down(PriorityQueue* pq, size_t index) {
-    while (index * 2 + 1 < pq->count) {
-        size_t left = index * 2 + 1;
-        size_t right = index * 2 + 2;
-        size_t smallest = index;
-        
-        if (pq->nodes[left]->frequency < pq->nodes[smallest]->frequency) {
-            smallest = left;
-        }
-        
-        if (right < pq->count && pq->nodes[right]->frequency < pq->nodes[smallest]->frequency) {
-            smallest = right;
-        }
-        
-        if (smallest == index) break;
-        
-        HuffmanNode* temp = pq->nodes[index];
-        pq->nodes[index] = pq->nodes[smallest];
-        pq->nodes[smallest] = temp;
-        
-        index = smallest;
-    }
-}
-
-static void pq_push(PriorityQueue* pq, HuffmanNode* node) {
-    if (pq->count >= pq->capacity) return;
-    
-    pq->nodes[pq->count] = node;
-    pq_heapify_up(pq, pq->count);
-    pq->count++;
-}
-
-static HuffmanNode* pq_pop(PriorityQueue* pq) {
-    if (pq->count == 0) return NULL;
-    
-    HuffmanNode* result = pq->nodes[0];
-    pq->nodes[0] = pq->nodes[pq->count - 1];
-    pq->count--;
-    
-    if (pq->count > 0) {
-        pq_heapify_down(pq, 0);
-    }
-    
-    return result;
-}
-
-static void generate_codes_recursive(HuffmanNode* node, uint32_t code, 
-                                     uint8_t depth, HuffmanEncoder* encoder) {
-    if (!node) return;
-    
-    if (node->is_leaf) {
-        encoder->codes[node->symbol].symbol = node->symbol;
-        encoder->codes[node->symbol].code = code;
-        encoder->codes[node->symbol].code_length = depth;
-        return;
-    }
-    
-    generate_codes_recursive(node->left, code << 1, depth + 1, encoder);
-    generate_codes_recursive(node->right, (code << 1) | 1, depth + 1, encoder);
+    return (size_t)(op - op_start);
 }
 
 WASM_EXPORT int32_t compress_lz4(const uint8_t* input, size_t input_size, 
@@ -400,146 +406,5341 @@ WASM_EXPORT int32_t decompress_lz4(const uint8_t* input, size_t input_size,
     return decompressed_size > 0 ? (int32_t)decompressed_size : -1;
 }
 
-WASM_EXPORT int32_t compress_huffman(const uint8_t* input, size_t input_size,
-                         uint8_t* output, size_t max_output_size) {
-    if (!input || !output || input_size == 0 || max_output_size < 1024) {
-        return -1;
-    }
-    
-    HuffmanEncoder encoder = {0};
-    
-    for (size_t i = 0; i < input_size; i++) {
-        encoder.frequencies[input[i]]++;
+// Raw LZ4 block decode with a size_t result: the decoded size, 0 when the block is
+// malformed or does not fit output_capacity.
+WASM_EXPORT size_t lz4_decompress_fast(const uint8_t* input, size_t input_size,
+                                       uint8_t* output, size_t output_capacity) {
+    if (!input || !output) return 0;
+    return lz4_decompress_safe((const char*)input, (char*)output, input_size, output_capacity);
+}
+
+// LZ4 high-compression mode: hash chains over the 64 KiB window instead of the single
+// probe of lz4_compress_generic. Levels up to LZ4HC_LEVEL_OPT_MIN - 1 parse lazily
+// (take a match, but step one byte when the next position matches longer); the
+// remaining levels price every path through a window of LZ4HC_OPT_NUM positions and
+// keep the cheapest. Both emit plain LZ4 blocks, so any LZ4 decoder reads them.
+#define LZ4HC_HASH_LOG 15
+#define LZ4HC_CHAIN_SIZE (1 << 16)
+#define LZ4HC_OPT_NUM 4096
+#define LZ4HC_PRICE_MAX 0x7FFFFFFFu
+
+typedef struct {
+    uint32_t price;
+    uint32_t literals;
+    uint32_t match_length;
+    uint32_t offset;
+} Lz4HcNode;
+
+typedef struct {
+    uint32_t position;
+    uint32_t match_length;
+    uint32_t offset;
+} Lz4HcSequence;
+
+typedef struct {
+    const uint8_t* base;
+    uint32_t next_to_update;
+    uint32_t hash_table[1 << LZ4HC_HASH_LOG];
+    uint16_t chain[LZ4HC_CHAIN_SIZE];
+    Lz4HcNode opt[LZ4HC_OPT_NUM + 1];
+    Lz4HcSequence path[LZ4HC_OPT_NUM / LZ4_MINMATCH + 1];
+} Lz4HcState;
+
+typedef struct {
+    uint32_t search_depth;
+    uint32_t sufficient_length;
+    int optimal;
+} Lz4HcParams;
+
+static Lz4HcParams lz4hc_params(int level) {
+    static const Lz4HcParams optimal_levels[LZ4HC_LEVEL_MAX - LZ4HC_LEVEL_OPT_MIN + 1] = {
+        { 256, 128, 1 },
+        { 512, 128, 1 },
+        { 16384, LZ4HC_OPT_NUM, 1 },
+    };
+    if (level < 1) level = LZ4HC_LEVEL_DEFAULT;
+    if (level > LZ4HC_LEVEL_MAX) level = LZ4HC_LEVEL_MAX;
+    if (level >= LZ4HC_LEVEL_OPT_MIN) return optimal_levels[level - LZ4HC_LEVEL_OPT_MIN];
+
+    Lz4HcParams params = { 1u << (level - 1), 0, 0 };
+    return params;
+}
+
+static inline uint32_t lz4hc_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ4HC_HASH_LOG);
+}
+
+// Links every position before target into its hash chain. Chain entries hold the
+// distance to the previous position with the same hash, saturated at the window.
+static void lz4hc_insert(Lz4HcState* s, uint32_t target) {
+    for (uint32_t pos = s->next_to_update; pos < target; pos++) {
+        uint32_t const h = lz4hc_hash(lz4_read32(s->base + pos));
+        uint32_t delta = pos - s->hash_table[h];
+        if (delta > LZ4_DISTANCE_MAX) delta = LZ4_DISTANCE_MAX;
+        s->chain[pos & (LZ4HC_CHAIN_SIZE - 1)] = (uint16_t)delta;
+        s->hash_table[h] = pos;
     }
-    
-    encoder.symbol_count = 0;
-    for (int i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
-        if (encoder.frequencies[i] > 0) {
-            encoder.symbol_count++;
+    if (target > s->next_to_update) s->next_to_update = target;
+}
+
+// Longest match for ip within search_depth chain steps; 0 when there is none of at
+// least LZ4_MINMATCH bytes. Matches stop at match_limit.
+static size_t lz4hc_find_longest(Lz4HcState* s, const uint8_t* ip, const uint8_t* match_limit,
+                                 uint32_t search_depth, uint32_t* offset) {
+    uint32_t const pos = (uint32_t)(ip - s->base);
+    uint32_t const sequence = lz4_read32(ip);
+    size_t best = LZ4_MINMATCH - 1;
+
+    lz4hc_insert(s, pos);
+    uint32_t candidate = s->hash_table[lz4hc_hash(sequence)];
+    while (search_depth-- && candidate < pos && pos - candidate <= LZ4_DISTANCE_MAX) {
+        const uint8_t* const match = s->base + candidate;
+        // The byte that would extend the current best rules most candidates out.
+        if (ip + best < match_limit && match[best] == ip[best] && lz4_read32(match) == sequence) {
+            size_t const length = LZ4_MINMATCH + lz4_count(ip + LZ4_MINMATCH, match + LZ4_MINMATCH, match_limit);
+            if (length > best) {
+                best = length;
+                *offset = pos - candidate;
+                if (ip + length >= match_limit) break;
+            }
         }
+        uint16_t const delta = s->chain[candidate & (LZ4HC_CHAIN_SIZE - 1)];
+        if (!delta || delta > candidate) break;
+        candidate -= delta;
     }
-    
-    if (encoder.symbol_count <= 1) {
-        if (encoder.symbol_count == 1) {
-            output[0] = 1;
-            for (int i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
-                if (encoder.frequencies[i] > 0) {
-                    output[1] = (uint8_t)i;
-                    break;
-                }
+    return best >= LZ4_MINMATCH ? best : 0;
+}
+
+// Appends one sequence (the literals from anchor, then the match). Returns 0 when it
+// would leave no room for the last literals.
+static int lz4hc_write_sequence(uint8_t** op_ptr, uint8_t* const op_limit, const uint8_t* anchor,
+                                size_t literal_l, uint32_t offset, size_t match_length) {
+    uint8_t* op = *op_ptr;
+    uint8_t* const token = op++;
+    size_t ml = match_length - LZ4_MINMATCH;
+
+    if (op + literal_l + literal_l / 255 + 2 + 1 + ml / 255 + 1 + LZ4_LASTLITERALS > op_limit) return 0;
+
+    if (literal_l >= 15) {
+        size_t len = literal_l - 15;
+        *token = (15 << 4);
+        for (; len >= 255; len -= 255) *op++ = 255;
+        *op++ = (uint8_t)len;
+    } else {
+        *token = (uint8_t)(literal_l << 4);
+    }
+    memcpy(op, anchor, literal_l);
+    op += literal_l;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    if (ml >= 15) {
+        *token += 15;
+        ml -= 15;
+        for (; ml >= 255; ml -= 255) *op++ = 255;
+        *op++ = (uint8_t)ml;
+    } else {
+        *token += (uint8_t)ml;
+    }
+
+    *op_ptr = op;
+    return 1;
+}
+
+// Output bytes for a literal run (without its token), and the extra length bytes of a match.
+static inline uint32_t lz4hc_literal_price(size_t literals) {
+    return (uint32_t)(literals + (literals >= 15 ? 1 + (literals - 15) / 255 : 0));
+}
+
+static inline uint32_t lz4hc_match_price(size_t match_length) {
+    size_t const ml = match_length - LZ4_MINMATCH;
+    return 1 + 2 + (uint32_t)(ml >= 15 ? 1 + (ml - 15) / 255 : 0);
+}
+
+// Cheapest parse of the positions from ip on, ending at the furthest match end seen
+// (at most LZ4HC_OPT_NUM bytes ahead). The first match is given. Writes the chosen
+// sequences and returns the new anchor, or NULL when the output is full.
+static const uint8_t* lz4hc_parse_optimal(Lz4HcState* s, const Lz4HcParams* params,
+                                          const uint8_t* ip, const uint8_t* anchor,
+                                          const uint8_t* mf_limit, const uint8_t* match_limit,
+                                          size_t first_length, uint32_t first_offset,
+                                          uint8_t** op, uint8_t* const op_limit) {
+    Lz4HcNode* const opt = s->opt;
+    size_t last_pos = first_length;
+    size_t forced_pos = 0, forced_length = 0;
+    uint32_t forced_offset = 0;
+
+    opt[0].price = lz4hc_literal_price((size_t)(ip - anchor));
+    opt[0].literals = (uint32_t)(ip - anchor);
+    opt[0].match_length = 0;
+    for (size_t pos = 1; pos <= last_pos; pos++) opt[pos].price = LZ4HC_PRICE_MAX;
+    for (size_t length = LZ4_MINMATCH; length <= first_length; length++) {
+        opt[length].price = opt[0].price + lz4hc_match_price(length);
+        opt[length].literals = 0;
+        opt[length].match_length = (uint32_t)length;
+        opt[length].offset = first_offset;
+    }
+
+    for (size_t cur = 1; cur <= last_pos; cur++) {
+        const Lz4HcNode* const prev = &opt[cur - 1];
+        uint32_t const literal_price = prev->price - lz4hc_literal_price(prev->literals)
+                                     + lz4hc_literal_price(prev->literals + 1);
+        if (literal_price <= opt[cur].price) {
+            opt[cur].price = literal_price;
+            opt[cur].literals = prev->literals + 1;
+            opt[cur].match_length = 0;
+        }
+
+        const uint8_t* const cur_ip = ip + cur;
+        if (cur_ip > mf_limit) continue;
+
+        uint32_t offset = 0;
+        size_t const length = lz4hc_find_longest(s, cur_ip, match_limit, params->search_depth, &offset);
+        if (!length) continue;
+
+        // Long matches are taken as they are; the parse ends where they start.
+        if (length > params->sufficient_length || cur + length > LZ4HC_OPT_NUM) {
+            forced_pos = cur;
+            forced_length = length;
+            forced_offset = offset;
+            break;
+        }
+
+        while (last_pos < cur + length) opt[++last_pos].price = LZ4HC_PRICE_MAX;
+        uint32_t const base_price = opt[cur].price;
+        for (size_t ml = LZ4_MINMATCH; ml <= length; ml++) {
+            uint32_t const price = base_price + lz4hc_match_price(ml);
+            Lz4HcNode* const node = &opt[cur + ml];
+            if (price < node->price) {
+                node->price = price;
+                node->literals = 0;
+                node->match_length = (uint32_t)ml;
+                node->offset = offset;
             }
-            return 2;
         }
-        return -1;
     }
-    
-    HuffmanNode* nodes = (HuffmanNode*)wasm_malloc(encoder.symbol_count * 2 * sizeof(HuffmanNode));
-    if (!nodes) return -1;
-    
-    PriorityQueue pq;
-    pq_init(&pq, encoder.symbol_count * 2);
-    
-    size_t node_index = 0;
-    for (int i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
-        if (encoder.frequencies[i] > 0) {
-            nodes[node_index].frequency = encoder.frequencies[i];
-            nodes[node_index].symbol = (uint16_t)i;
-            nodes[node_index].is_leaf = 1;
-            nodes[node_index].left = NULL;
-            nodes[node_index].right = NULL;
-            pq_push(&pq, &nodes[node_index]);
-            node_index++;
+
+    // Walk the chosen path backwards, then replay its matches forwards.
+    size_t count = 0;
+    size_t pos = forced_length ? forced_pos : last_pos;
+    while (pos > 0) {
+        uint32_t const ml = opt[pos].match_length;
+        if (!ml) {
+            pos--;
+            continue;
         }
+        pos -= ml;
+        s->path[count].position = (uint32_t)pos;
+        s->path[count].match_length = ml;
+        s->path[count].offset = opt[pos + ml].offset;
+        count++;
     }
-    
-    while (pq.count > 1) {
-        HuffmanNode* left = pq_pop(&pq);
-        HuffmanNode* right = pq_pop(&pq);
-        
-        nodes[node_index].frequency = left->frequency + right->frequency;
-        nodes[node_index].symbol = 0;
-        nodes[node_index].is_leaf = 0;
-        nodes[node_index].left = left;
-        nodes[node_index].right = right;
-        
-        pq_push(&pq, &nodes[node_index]);
-        node_index++;
+
+    while (count--) {
+        const uint8_t* const start = ip + s->path[count].position;
+        if (!lz4hc_write_sequence(op, op_limit, anchor, (size_t)(start - anchor),
+                                  s->path[count].offset, s->path[count].match_length)) return NULL;
+        anchor = start + s->path[count].match_length;
     }
-    
-    HuffmanNode* root = pq_pop(&pq);
-    
-    generate_codes_recursive(root, 0, 0, &encoder);
-    
-    uint8_t* write_ptr = output;
-    *write_ptr++ = 0;
-    *write_ptr++ = (uint8_t)encoder.symbol_count;
-    
-    for (int i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
-        if (encoder.frequencies[i] > 0) {
-            *write_ptr++ = (uint8_t)i;
-            *write_ptr++ = encoder.codes[i].code_length;
-            *write_ptr++ = (uint8_t)encoder.codes[i].code;
-            *write_ptr++ = (uint8_t)(encoder.codes[i].code >> 8);
-        }
+    if (forced_length) {
+        const uint8_t* const start = ip + forced_pos;
+        if (!lz4hc_write_sequence(op, op_limit, anchor, (size_t)(start - anchor),
+                                  forced_offset, forced_length)) return NULL;
+        anchor = start + forced_length;
     }
-    
-    uint32_t bit_buffer = 0;
-    uint8_t bit_count = 0;
-    
-    for (size_t i = 0; i < input_size; i++) {
-        uint8_t symbol = input[i];
-        uint32_t code = encoder.codes[symbol].code;
-        uint8_t code_length = encoder.codes[symbol].code_length;
-        
-        bit_buffer |= (code << bit_count);
-        bit_count += code_length;
-        
-        while (bit_count >= 8) {
-            if (write_ptr >= output + max_output_size) {
-                wasm_free(nodes);
-                pq_free(&pq);
-                return -1;
+    return anchor;
+}
+
+static void lz4hc_reset(Lz4HcState* s, const uint8_t* src) {
+    s->base = src;
+    s->next_to_update = 0;
+    memset(s->hash_table, 0, sizeof(s->hash_table));
+}
+
+// Lazy evaluation: a longer match one byte on is worth a literal. Moves *ip to where
+// the chosen match starts and returns its length.
+static size_t lz4hc_lazy_match(Lz4HcState* s, const Lz4HcParams* params, const uint8_t** ip,
+                               const uint8_t* mf_limit, const uint8_t* match_limit,
+                               size_t length, uint32_t* offset) {
+    while (*ip + 1 <= mf_limit) {
+        uint32_t next_offset = 0;
+        size_t const next_length = lz4hc_find_longest(s, *ip + 1, match_limit,
+                                                      params->search_depth, &next_offset);
+        if (next_length <= length) break;
+        (*ip)++;
+        length = next_length;
+        *offset = next_offset;
+    }
+    return length;
+}
+
+static size_t lz4hc_compress(Lz4HcState* s, const Lz4HcParams* params, const uint8_t* src,
+                             size_t src_size, uint8_t* dst, size_t dst_capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const source_end = src + src_size;
+    const uint8_t* const mf_limit = source_end - LZ4_MFLIMIT;
+    const uint8_t* const match_limit = source_end - LZ4_LASTLITERALS;
+    uint8_t* op = dst;
+    uint8_t* const op_limit = dst + dst_capacity;
+
+    if (src_size > LZ4_MAX_INPUT_SIZE) return 0;
+    lz4hc_reset(s, src);
+
+    if (src_size >= LZ4_MIN_INPUT_SIZE) {
+        while (ip <= mf_limit) {
+            uint32_t offset = 0;
+            size_t length = lz4hc_find_longest(s, ip, match_limit, params->search_depth, &offset);
+            if (!length) {
+                ip++;
+                continue;
             }
-            *write_ptr++ = (uint8_t)bit_buffer;
-            bit_buffer >>= 8;
-            bit_count -= 8;
+
+            if (params->optimal && length <= params->sufficient_length) {
+                anchor = lz4hc_parse_optimal(s, params, ip, anchor, mf_limit, match_limit,
+                                             length, offset, &op, op_limit);
+                if (!anchor) return 0;
+                ip = anchor;
+                continue;
+            }
+
+            if (!params->optimal) length = lz4hc_lazy_match(s, params, &ip, mf_limit, match_limit, length, &offset);
+
+            if (!lz4hc_write_sequence(&op, op_limit, anchor, (size_t)(ip - anchor), offset, length)) return 0;
+            ip += length;
+            anchor = ip;
         }
     }
-    
-    if (bit_count > 0) {
-        if (write_ptr >= output + max_output_size) {
-            wasm_free(nodes);
-            pq_free(&pq);
-            return -1;
+
+    {
+        size_t const last_run = (size_t)(source_end - anchor);
+        if (op + last_run + 1 + (last_run + 255 - 15) / 255 > op_limit) return 0;
+
+        if (last_run >= 15) {
+            size_t accumulator = last_run - 15;
+            *op++ = 15 << 4;
+            for (; accumulator >= 255; accumulator -= 255) *op++ = 255;
+            *op++ = (uint8_t)accumulator;
+        } else {
+            *op++ = (uint8_t)(last_run << 4);
         }
-        *write_ptr++ = (uint8_t)bit_buffer;
+
+        memcpy(op, anchor, last_run);
+        op += last_run;
     }
-    
-    wasm_free(nodes);
-    pq_free(&pq);
-    
-    return (int32_t)(write_ptr - output);
+
+    return (size_t)(op - dst);
 }
 
-WASM_EXPORT CompressionMethod get_optimal_compression(const uint8_t* data, size_t size) {
-    if (!data || size == 0) return METHOD_NONE;
-    
-    uint32_t unique_bytes = 0;
-    uint32_t byte_counts[256] = {0};
-    
-    for (size_t i = 0; i < size && i < 4096; i++) {
-        byte_counts[data[i]]++;
-    }
-    
-    for (int i = 0; i < 256; i++) {
-        if (byte_counts[i] > 0) unique_bytes++;
+// Exact size of the block lz4hc_compress() writes for a lazy level, without writing it.
+static size_t lz4hc_lazy_size(Lz4HcState* s, const Lz4HcParams* params, const uint8_t* src, size_t src_size) {
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const source_end = src + src_size;
+    const uint8_t* const mf_limit = source_end - LZ4_MFLIMIT;
+    const uint8_t* const match_limit = source_end - LZ4_LASTLITERALS;
+    size_t size = 0;
+
+    lz4hc_reset(s, src);
+    if (src_size >= LZ4_MIN_INPUT_SIZE) {
+        while (ip <= mf_limit) {
+            uint32_t offset = 0;
+            size_t length = lz4hc_find_longest(s, ip, match_limit, params->search_depth, &offset);
+            if (!length) {
+                ip++;
+                continue;
+            }
+            length = lz4hc_lazy_match(s, params, &ip, mf_limit, match_limit, length, &offset);
+            size += lz4hc_literal_price((size_t)(ip - anchor)) + lz4hc_match_price(length);
+            ip += length;
+            anchor = ip;
+        }
     }
-    
-    if (unique_bytes <= 16) {
-        return METHOD_HUFFMAN;
-    } else if (size > 1024) {
-        return METHOD_LZ4; // Large data - LZ4 for speed
-    } else {
-        return METHOD_HUFFMAN;
+    return size + 1 + lz4hc_literal_price((size_t)(source_end - anchor));
+}
+
+// Worst case LZ4 block size for input_size bytes, for any compressor in this file.
+WASM_EXPORT size_t lz4_compress_bound(size_t input_size) {
+    return input_size + input_size / 255 + 16;
+}
+
+// Scratch space lz4_compress_hc_ext_state() needs; any 8-byte aligned buffer will do.
+WASM_EXPORT size_t lz4_compress_hc_state_size(void) {
+    return sizeof(Lz4HcState);
+}
+
+// High-compression LZ4 block at compression_level (1..LZ4HC_LEVEL_MAX, values below 1
+// select LZ4HC_LEVEL_DEFAULT), using caller-owned scratch state. Slower than
+// compress_lz4 but decoded by the same decompress_lz4. Returns the block size, 0 when
+// it does not fit output_capacity.
+WASM_EXPORT size_t lz4_compress_hc_ext_state(void* state, const uint8_t* input, size_t input_size,
+                                             uint8_t* output, size_t output_capacity, int compression_level) {
+    if (!state || !input || !output || input_size == 0) return 0;
+
+    Lz4HcState* const s = (Lz4HcState*)state;
+    Lz4HcParams const params = lz4hc_params(compression_level);
+    if (!params.optimal) return lz4hc_compress(s, &params, input, input_size, output, output_capacity);
+
+    // The optimal parse prices each path by its own literal run only, so on rare inputs
+    // it loses a few bytes to the lazy parse; keep whichever block is smaller.
+    Lz4HcParams const lazy = lz4hc_params(LZ4HC_LEVEL_OPT_MIN - 1);
+    size_t const size = lz4hc_compress(s, &params, input, input_size, output, output_capacity);
+    if (size && size <= lz4hc_lazy_size(s, &lazy, input, input_size)) return size;
+    return lz4hc_compress(s, &lazy, input, input_size, output, output_capacity);
+}
+
+// As lz4_compress_hc_ext_state() with the state on the heap.
+WASM_EXPORT size_t lz4_compress_hc(const uint8_t* input, size_t input_size, uint8_t* output,
+                                   size_t output_capacity, int compression_level) {
+    Lz4HcState* state = (Lz4HcState*)wasm_malloc(sizeof(Lz4HcState));
+    if (!state) return 0;
+
+    size_t const size = lz4_compress_hc_ext_state(state, input, input_size, output, output_capacity,
+                                                  compression_level);
+    wasm_free(state);
+    return size;
+}
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_MAX_WINDOW_BITS 15
+#define DEFLATE_MAX_BITS 15
+#define DEFLATE_MAX_CODELEN_BITS 7
+#define DEFLATE_LITLEN_CODES 286
+#define DEFLATE_FIXED_LITLEN_CODES 288
+#define DEFLATE_DIST_CODES 30
+#define DEFLATE_CODELEN_CODES 19
+#define DEFLATE_END_OF_BLOCK 256
+#define DEFLATE_BLOCK_TOKENS 16384
+#define DEFLATE_STORED_MAX 65535
+#define DEFLATE_TOO_FAR 4096
+#define DEFLATE_MAX_LEVEL 10
+
+// Per-level search effort, after zlib's configuration table. Levels 1-3 are greedy and
+// stop indexing inside matches longer than max_insert; 4 and up evaluate lazily and skip
+// the second search once the pending match reaches max_lazy. Level 10 trades speed for
+// ratio with the longest chains.
+typedef struct {
+    uint16_t good_length;
+    uint16_t max_lazy;
+    uint16_t nice_length;
+    uint16_t max_chain;
+    uint16_t max_insert;
+} DeflateLevel;
+
+static const DeflateLevel deflate_levels[DEFLATE_MAX_LEVEL + 1] = {
+    {   0,   0,   0,    0,   0 },
+    {   4,   0,   8,    4,   4 },
+    {   4,   0,  16,    8,   5 },
+    {   4,   0,  32,   32,   6 },
+    {   4,   4,  16,   16,   0 },
+    {   8,  16,  32,   32,   0 },
+    {   8,  16, 128,  128,   0 },
+    {   8,  32, 128,  256,   0 },
+    {  32, 128, 258, 1024,   0 },
+    {  32, 258, 258, 4096,   0 },
+    { 258, 258, 258, 8192,   0 },
+};
+
+static const uint16_t deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t deflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t deflate_dist_base[DEFLATE_DIST_CODES] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t deflate_dist_extra[DEFLATE_DIST_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t deflate_codelen_order[DEFLATE_CODELEN_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static inline uint32_t deflate_floor_log2(uint32_t x) {
+    return 31u - (uint32_t)__builtin_clz(x);
+}
+
+// Length 3..258 to litlen symbol 257..285.
+static inline uint32_t deflate_length_code(uint32_t length) {
+    uint32_t x = length - DEFLATE_MIN_MATCH;
+    if (x < 8) return 257 + x;
+    if (length == DEFLATE_MAX_MATCH) return 285;
+    uint32_t nb = deflate_floor_log2(x);
+    return 257 + 4 * (nb - 1) + ((x >> (nb - 2)) & 3);
+}
+
+// Distance 1..32768 to distance symbol 0..29.
+static inline uint32_t deflate_dist_code(uint32_t dist) {
+    uint32_t x = dist - 1;
+    if (x < 2) return x;
+    uint32_t nb = deflate_floor_log2(x);
+    return 2 * nb + ((x >> (nb - 1)) & 1);
+}
+
+typedef struct {
+    uint8_t* out;
+    size_t capacity;
+    size_t pos;
+    uint64_t bits;
+    uint32_t bit_count;
+    int overflow;
+} DeflateBitWriter;
+
+static inline void deflate_put_bits(DeflateBitWriter* bw, uint32_t value, uint32_t count) {
+    bw->bits |= (uint64_t)value << bw->bit_count;
+    bw->bit_count += count;
+    if (bw->bit_count >= 32) {
+        if (bw->pos + 4 <= bw->capacity) {
+            bw->out[bw->pos]     = (uint8_t)bw->bits;
+            bw->out[bw->pos + 1] = (uint8_t)(bw->bits >> 8);
+            bw->out[bw->pos + 2] = (uint8_t)(bw->bits >> 16);
+            bw->out[bw->pos + 3] = (uint8_t)(bw->bits >> 24);
+            bw->pos += 4;
+        } else {
+            bw->overflow = 1;
+        }
+        bw->bits >>= 32;
+        bw->bit_count -= 32;
+    }
+}
+
+// Pads to a byte boundary and flushes every pending bit.
+static void deflate_align_bits(DeflateBitWriter* bw) {
+    while (bw->bit_count > 0) {
+        if (bw->pos < bw->capacity) {
+            bw->out[bw->pos++] = (uint8_t)bw->bits;
+        } else {
+            bw->overflow = 1;
+        }
+        bw->bits >>= 8;
+        bw->bit_count = bw->bit_count > 8 ? bw->bit_count - 8 : 0;
+    }
+    bw->bits = 0;
+}
+
+static void deflate_put_bytes(DeflateBitWriter* bw, const uint8_t* bytes, size_t count) {
+    if (bw->pos + count > bw->capacity) {
+        bw->overflow = 1;
+        return;
+    }
+    memcpy(bw->out + bw->pos, bytes, count);
+    bw->pos += count;
+}
+
+typedef struct {
+    uint32_t freq;
+    uint16_t symbol;
+} DeflateSymbolFreq;
+
+// Moffat and Katajainen's in-place minimum-redundancy code: `a` holds ascending
+// frequencies on entry and code lengths on return.
+static void deflate_minimum_redundancy(uint32_t* a, int n) {
+    int root, leaf, next, avail, used, depth;
+    if (n == 0) return;
+    if (n == 1) { a[0] = 1; return; }
+
+    a[0] += a[1];
+    root = 0;
+    leaf = 2;
+    for (next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) { a[next] = a[root]; a[root++] = (uint32_t)next; }
+        else a[next] = a[leaf++];
+        if (leaf >= n || (root < next && a[root] < a[leaf])) { a[next] += a[root]; a[root++] = (uint32_t)next; }
+        else a[next] += a[leaf++];
+    }
+
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--) a[next] = a[a[next]] + 1;
+
+    avail = 1;
+    used = depth = 0;
+    root = n - 2;
+    next = n - 1;
+    while (avail > 0) {
+        while (root >= 0 && (int)a[root] == depth) { used++; root--; }
+        while (avail > used) { a[next--] = (uint32_t)depth; avail--; }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+// Builds code lengths no longer than max_bits for `count` symbols. At least two
+// symbols always get a code so the resulting prefix code is complete.
+static void deflate_build_lengths(const uint32_t* freqs, size_t count, uint32_t max_bits, uint8_t* lengths) {
+    DeflateSymbolFreq syms[DEFLATE_LITLEN_CODES];
+    uint32_t work[DEFLATE_LITLEN_CODES];
+    uint32_t length_counts[33] = {0};
+    int used = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = 0;
+        if (freqs[i]) {
+            syms[used].freq = freqs[i];
+            syms[used].symbol = (uint16_t)i;
+            used++;
+        }
+    }
+    for (size_t i = 0; used < 2 && i < count; i++) {
+        if (!freqs[i]) {
+            syms[used].freq = 1;
+            syms[used].symbol = (uint16_t)i;
+            used++;
+        }
+    }
+
+    // Insertion sort by ascending frequency; at most 286 entries.
+    for (int i = 1; i < used; i++) {
+        DeflateSymbolFreq key = syms[i];
+        int j = i - 1;
+        while (j >= 0 && syms[j].freq > key.freq) {
+            syms[j + 1] = syms[j];
+            j--;
+        }
+        syms[j + 1] = key;
+    }
+
+    for (int i = 0; i < used; i++) work[i] = syms[i].freq;
+    deflate_minimum_redundancy(work, used);
+    for (int i = 0; i < used; i++) length_counts[work[i] > 32 ? 32 : work[i]]++;
+
+    // Fold over-long codes into max_bits, then restore the Kraft sum by lengthening
+    // the deepest shorter code (as miniz does).
+    for (uint32_t i = max_bits + 1; i <= 32; i++) {
+        length_counts[max_bits] += length_counts[i];
+        length_counts[i] = 0;
+    }
+    uint32_t kraft = 0;
+    for (uint32_t i = max_bits; i > 0; i--) kraft += length_counts[i] << (max_bits - i);
+    while (kraft != (1u << max_bits)) {
+        length_counts[max_bits]--;
+        for (uint32_t i = max_bits - 1; i > 0; i--) {
+            if (length_counts[i]) {
+                length_counts[i]--;
+                length_counts[i + 1] += 2;
+                break;
+            }
+        }
+        kraft--;
+    }
+
+    // Longest codes go to the rarest symbols.
+    int next = 0;
+    for (uint32_t len = max_bits; len > 0; len--) {
+        for (uint32_t k = length_counts[len]; k > 0; k--) {
+            lengths[syms[next++].symbol] = (uint8_t)len;
+        }
+    }
+}
+
+// Canonical codes, bit-reversed for deflate's LSB-first packing.
+static void deflate_build_codes(const uint8_t* lengths, size_t count, uint16_t* codes) {
+    uint32_t length_counts[DEFLATE_MAX_BITS + 1] = {0};
+    uint32_t next_code[DEFLATE_MAX_BITS + 1];
+    uint32_t code = 0;
+
+    for (size_t i = 0; i < count; i++) length_counts[lengths[i]]++;
+    length_counts[0] = 0;
+    for (uint32_t bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+        code = (code + length_counts[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t len = lengths[i];
+        if (!len) { codes[i] = 0; continue; }
+        uint32_t c = next_code[len]++;
+        uint32_t reversed = 0;
+        for (uint32_t b = 0; b < len; b++) {
+            reversed = (reversed << 1) | (c & 1);
+            c >>= 1;
+        }
+        codes[i] = (uint16_t)reversed;
+    }
+}
+
+typedef struct {
+    uint16_t litlen;   // literal byte, or match length when dist != 0
+    uint16_t dist;
+} DeflateToken;
+
+typedef struct {
+    const uint8_t* input;
+    size_t input_size;
+    DeflateBitWriter bw;
+    DeflateToken* tokens;
+    size_t token_count;
+    size_t block_start;
+    size_t covered;
+} DeflateState;
+
+// Litlen arrays hold all 288 fixed-code symbols: 286 and 287 are never emitted but
+// still shift the canonical 9-bit codes.
+typedef struct {
+    uint8_t litlen_lengths[DEFLATE_FIXED_LITLEN_CODES];
+    uint8_t dist_lengths[DEFLATE_DIST_CODES];
+    uint16_t litlen_codes[DEFLATE_FIXED_LITLEN_CODES];
+    uint16_t dist_codes[DEFLATE_DIST_CODES];
+} DeflateCodes;
+
+static void deflate_fixed_codes(DeflateCodes* codes) {
+    for (int i = 0; i < DEFLATE_FIXED_LITLEN_CODES; i++) {
+        codes->litlen_lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    for (int i = 0; i < DEFLATE_DIST_CODES; i++) codes->dist_lengths[i] = 5;
+    deflate_build_codes(codes->litlen_lengths, DEFLATE_FIXED_LITLEN_CODES, codes->litlen_codes);
+    deflate_build_codes(codes->dist_lengths, DEFLATE_DIST_CODES, codes->dist_codes);
+}
+
+// Run-length codes the combined litlen+dist length list with symbols 16/17/18.
+// Each entry of `rle` is symbol | (extra value << 8).
+static size_t deflate_rle_lengths(const uint8_t* lengths, size_t count, uint16_t* rle, uint32_t* freqs) {
+    size_t n = 0;
+    size_t i = 0;
+    while (i < count) {
+        uint8_t len = lengths[i];
+        size_t run = 1;
+        while (i + run < count && lengths[i + run] == len) run++;
+
+        if (len == 0) {
+            size_t left = run;
+            while (left >= 11) {
+                size_t r = left > 138 ? 138 : left;
+                rle[n++] = (uint16_t)(18 | ((r - 11) << 8));
+                freqs[18]++;
+                left -= r;
+            }
+            if (left >= 3) {
+                rle[n++] = (uint16_t)(17 | ((left - 3) << 8));
+                freqs[17]++;
+                left = 0;
+            }
+            while (left--) { rle[n++] = 0; freqs[0]++; }
+        } else {
+            rle[n++] = len;
+            freqs[len]++;
+            size_t left = run - 1;
+            while (left >= 3) {
+                size_t r = left > 6 ? 6 : left;
+                rle[n++] = (uint16_t)(16 | ((r - 3) << 8));
+                freqs[16]++;
+                left -= r;
+            }
+            while (left--) { rle[n++] = len; freqs[len]++; }
+        }
+        i += run;
+    }
+    return n;
+}
+
+static uint64_t deflate_symbol_bits(const DeflateCodes* codes, const uint32_t* litlen_freqs, const uint32_t* dist_freqs) {
+    uint64_t bits = 0;
+    for (int i = 0; i < DEFLATE_LITLEN_CODES; i++) {
+        bits += (uint64_t)litlen_freqs[i] * codes->litlen_lengths[i];
+        if (i > 256) bits += (uint64_t)litlen_freqs[i] * deflate_length_extra[i - 257];
+    }
+    for (int i = 0; i < DEFLATE_DIST_CODES; i++) {
+        bits += (uint64_t)dist_freqs[i] * (codes->dist_lengths[i] + deflate_dist_extra[i]);
+    }
+    return bits;
+}
+
+static void deflate_write_tokens(DeflateState* s, const DeflateCodes* codes) {
+    DeflateBitWriter* bw = &s->bw;
+    for (size_t i = 0; i < s->token_count; i++) {
+        DeflateToken t = s->tokens[i];
+        if (!t.dist) {
+            deflate_put_bits(bw, codes->litlen_codes[t.litlen], codes->litlen_lengths[t.litlen]);
+            continue;
+        }
+        uint32_t lc = deflate_length_code(t.litlen);
+        deflate_put_bits(bw, codes->litlen_codes[lc], codes->litlen_lengths[lc]);
+        deflate_put_bits(bw, t.litlen - deflate_length_base[lc - 257], deflate_length_extra[lc - 257]);
+        uint32_t dc = deflate_dist_code(t.dist);
+        deflate_put_bits(bw, codes->dist_codes[dc], codes->dist_lengths[dc]);
+        deflate_put_bits(bw, t.dist - deflate_dist_base[dc], deflate_dist_extra[dc]);
+    }
+    deflate_put_bits(bw, codes->litlen_codes[DEFLATE_END_OF_BLOCK], codes->litlen_lengths[DEFLATE_END_OF_BLOCK]);
+}
+
+static void deflate_write_stored(DeflateState* s, int final) {
+    DeflateBitWriter* bw = &s->bw;
+    size_t start = s->block_start;
+    size_t remaining = s->covered - start;
+    do {
+        size_t chunk = remaining > DEFLATE_STORED_MAX ? DEFLATE_STORED_MAX : remaining;
+        int last = final && chunk == remaining;
+        uint8_t header[4] = {
+            (uint8_t)chunk, (uint8_t)(chunk >> 8),
+            (uint8_t)~chunk, (uint8_t)(~chunk >> 8)
+        };
+        deflate_put_bits(bw, last ? 1 : 0, 3);
+        deflate_align_bits(bw);
+        deflate_put_bytes(bw, header, 4);
+        deflate_put_bytes(bw, s->input + start, chunk);
+        start += chunk;
+        remaining -= chunk;
+    } while (remaining > 0);
+}
+
+// Emits the pending tokens as whichever of stored, fixed or dynamic Huffman is smallest.
+static void deflate_flush_block(DeflateState* s, int final) {
+    uint32_t litlen_freqs[DEFLATE_LITLEN_CODES] = {0};
+    uint32_t dist_freqs[DEFLATE_DIST_CODES] = {0};
+
+    for (size_t i = 0; i < s->token_count; i++) {
+        DeflateToken t = s->tokens[i];
+        if (!t.dist) {
+            litlen_freqs[t.litlen]++;
+        } else {
+            litlen_freqs[deflate_length_code(t.litlen)]++;
+            dist_freqs[deflate_dist_code(t.dist)]++;
+        }
+    }
+    litlen_freqs[DEFLATE_END_OF_BLOCK] = 1;
+
+    DeflateCodes dynamic;
+    deflate_build_lengths(litlen_freqs, DEFLATE_LITLEN_CODES, DEFLATE_MAX_BITS, dynamic.litlen_lengths);
+    deflate_build_lengths(dist_freqs, DEFLATE_DIST_CODES, DEFLATE_MAX_BITS, dynamic.dist_lengths);
+    deflate_build_codes(dynamic.litlen_lengths, DEFLATE_LITLEN_CODES, dynamic.litlen_codes);
+    deflate_build_codes(dynamic.dist_lengths, DEFLATE_DIST_CODES, dynamic.dist_codes);
+
+    size_t hlit = DEFLATE_LITLEN_CODES;
+    while (hlit > 257 && !dynamic.litlen_lengths[hlit - 1]) hlit--;
+    size_t hdist = DEFLATE_DIST_CODES;
+    while (hdist > 1 && !dynamic.dist_lengths[hdist - 1]) hdist--;
+
+    uint8_t combined[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    memcpy(combined, dynamic.litlen_lengths, hlit);
+    memcpy(combined + hlit, dynamic.dist_lengths, hdist);
+
+    uint16_t rle[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint32_t codelen_freqs[DEFLATE_CODELEN_CODES] = {0};
+    size_t rle_count = deflate_rle_lengths(combined, hlit + hdist, rle, codelen_freqs);
+
+    uint8_t codelen_lengths[DEFLATE_CODELEN_CODES];
+    uint16_t codelen_codes[DEFLATE_CODELEN_CODES];
+    deflate_build_lengths(codelen_freqs, DEFLATE_CODELEN_CODES, DEFLATE_MAX_CODELEN_BITS, codelen_lengths);
+    deflate_build_codes(codelen_lengths, DEFLATE_CODELEN_CODES, codelen_codes);
+
+    size_t hclen = DEFLATE_CODELEN_CODES;
+    while (hclen > 4 && !codelen_lengths[deflate_codelen_order[hclen - 1]]) hclen--;
+
+    uint64_t dynamic_bits = 3 + 5 + 5 + 4 + 3 * hclen;
+    for (size_t i = 0; i < rle_count; i++) {
+        uint32_t sym = rle[i] & 0xFF;
+        dynamic_bits += codelen_lengths[sym] + (sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0);
+    }
+    dynamic_bits += deflate_symbol_bits(&dynamic, litlen_freqs, dist_freqs);
+
+    DeflateCodes fixed;
+    deflate_fixed_codes(&fixed);
+    uint64_t fixed_bits = 3 + deflate_symbol_bits(&fixed, litlen_freqs, dist_freqs);
+
+    size_t raw = s->covered - s->block_start;
+    uint64_t stored_bits = ((uint64_t)raw + 5 * (raw / DEFLATE_STORED_MAX + 1)) * 8 + 7;
+
+    DeflateBitWriter* bw = &s->bw;
+    if (stored_bits <= fixed_bits && stored_bits <= dynamic_bits) {
+        deflate_write_stored(s, final);
+    } else if (fixed_bits <= dynamic_bits) {
+        deflate_put_bits(bw, (final ? 1u : 0u) | (1u << 1), 3);
+        deflate_write_tokens(s, &fixed);
+    } else {
+        deflate_put_bits(bw, (final ? 1u : 0u) | (2u << 1), 3);
+        deflate_put_bits(bw, (uint32_t)(hlit - 257), 5);
+        deflate_put_bits(bw, (uint32_t)(hdist - 1), 5);
+        deflate_put_bits(bw, (uint32_t)(hclen - 4), 4);
+        for (size_t i = 0; i < hclen; i++) {
+            deflate_put_bits(bw, codelen_lengths[deflate_codelen_order[i]], 3);
+        }
+        for (size_t i = 0; i < rle_count; i++) {
+            uint32_t sym = rle[i] & 0xFF;
+            uint32_t extra = rle[i] >> 8;
+            deflate_put_bits(bw, codelen_codes[sym], codelen_lengths[sym]);
+            if (sym == 16) deflate_put_bits(bw, extra, 2);
+            else if (sym == 17) deflate_put_bits(bw, extra, 3);
+            else if (sym == 18) deflate_put_bits(bw, extra, 7);
+        }
+        deflate_write_tokens(s, &dynamic);
+    }
+
+    s->token_count = 0;
+    s->block_start = s->covered;
+}
+
+static inline void deflate_emit_literal(DeflateState* s, uint8_t byte) {
+    s->tokens[s->token_count].litlen = byte;
+    s->tokens[s->token_count].dist = 0;
+    s->token_count++;
+    s->covered++;
+    if (s->token_count == DEFLATE_BLOCK_TOKENS) deflate_flush_block(s, 0);
+}
+
+static inline void deflate_emit_match(DeflateState* s, uint32_t length, uint32_t dist) {
+    s->tokens[s->token_count].litlen = (uint16_t)length;
+    s->tokens[s->token_count].dist = (uint16_t)dist;
+    s->token_count++;
+    s->covered += length;
+    if (s->token_count == DEFLATE_BLOCK_TOKENS) deflate_flush_block(s, 0);
+}
+
+// Common prefix length of a and b, up to max_len, 16 bytes per step with SIMD.
+static inline uint32_t deflate_match_length(const uint8_t* a, const uint8_t* b, uint32_t max_len) {
+    uint32_t len = 0;
+#ifdef __wasm_simd128__
+    while (len + 16 <= max_len) {
+        v128_t eq = wasm_i8x16_eq(wasm_v128_load(a + len), wasm_v128_load(b + len));
+        uint32_t mask = (uint32_t)wasm_i8x16_bitmask(eq);
+        if (mask != 0xFFFF) return len + (uint32_t)__builtin_ctz(~mask);
+        len += 16;
+    }
+#endif
+    while (len + 8 <= max_len) {
+        uint64_t x, y;
+        __builtin_memcpy(&x, a + len, 8);
+        __builtin_memcpy(&y, b + len, 8);
+        if (x != y) return len + ((uint32_t)__builtin_ctzll(x ^ y) >> 3);
+        len += 8;
+    }
+    while (len < max_len && a[len] == b[len]) len++;
+    return len;
+}
+
+typedef struct {
+    uint32_t* head;         // hash -> position + 1, 0 when empty
+    uint32_t* prev;         // position & window_mask -> previous position + 1
+    uint32_t hash_bits;
+    uint32_t window_size;
+    uint32_t window_mask;
+} DeflateMatcher;
+
+static inline uint32_t deflate_hash3(const uint8_t* p, uint32_t hash_bits) {
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+// Indexes `pos` and returns the previous head of its chain (position + 1, or 0).
+static inline uint32_t deflate_insert(DeflateMatcher* m, const uint8_t* input, size_t input_size, size_t pos) {
+    if (pos + DEFLATE_MIN_MATCH > input_size) return 0;
+    uint32_t h = deflate_hash3(input + pos, m->hash_bits);
+    uint32_t head = m->head[h];
+    m->prev[pos & m->window_mask] = head;
+    m->head[h] = (uint32_t)pos + 1;
+    return head;
+}
+
+// Longest match for `pos` strictly longer than `min_len`, walking the hash chain
+// from `chain_head`. Returns 0 when nothing longer is found.
+static uint32_t deflate_longest_match(const DeflateMatcher* m, const DeflateLevel* cfg,
+                                      const uint8_t* input, size_t input_size, size_t pos,
+                                      uint32_t chain_head, uint32_t min_len, uint32_t* dist_out) {
+    size_t avail = input_size - pos;
+    uint32_t max_len = avail < DEFLATE_MAX_MATCH ? (uint32_t)avail : DEFLATE_MAX_MATCH;
+    if (max_len < DEFLATE_MIN_MATCH || min_len >= max_len) return 0;
+
+    uint32_t chain = cfg->max_chain;
+    if (min_len >= cfg->good_length) chain >>= 2;
+    uint32_t nice = cfg->nice_length < max_len ? cfg->nice_length : max_len;
+    size_t limit = pos > m->window_size ? pos - m->window_size : 0;
+
+    const uint8_t* here = input + pos;
+    uint32_t best_len = min_len;
+    uint32_t best_dist = 0;
+    uint32_t candidate = chain_head;
+
+    while (candidate && chain--) {
+        size_t cand_pos = candidate - 1;
+        if (cand_pos < limit || cand_pos >= pos) break;
+
+        const uint8_t* there = input + cand_pos;
+        if (there[best_len] == here[best_len] && there[0] == here[0] && there[1] == here[1]) {
+            uint32_t len = deflate_match_length(there, here, max_len);
+            if (len > best_len) {
+                best_len = len;
+                best_dist = (uint32_t)(pos - cand_pos);
+                if (len >= nice) break;
+            }
+        }
+
+        uint32_t next = m->prev[cand_pos & m->window_mask];
+        if (next >= candidate) break;
+        candidate = next;
+    }
+
+    if (!best_dist) return 0;
+    *dist_out = best_dist;
+    return best_len;
+}
+
+static void deflate_greedy(DeflateState* s, DeflateMatcher* m, const DeflateLevel* cfg) {
+    const uint8_t* input = s->input;
+    size_t n = s->input_size;
+    size_t pos = 0;
+
+    while (pos < n) {
+        uint32_t head = deflate_insert(m, input, n, pos);
+        uint32_t dist = 0;
+        uint32_t len = head ? deflate_longest_match(m, cfg, input, n, pos, head, DEFLATE_MIN_MATCH - 1, &dist) : 0;
+
+        if (len >= DEFLATE_MIN_MATCH && !(len == DEFLATE_MIN_MATCH && dist > DEFLATE_TOO_FAR)) {
+            deflate_emit_match(s, len, dist);
+            if (len <= cfg->max_insert) {
+                for (size_t i = 1; i < len; i++) deflate_insert(m, input, n, pos + i);
+            }
+            pos += len;
+        } else {
+            deflate_emit_literal(s, input[pos]);
+            pos++;
+        }
+    }
+}
+
+// zlib-style lazy evaluation: a match is only taken once the next position has been
+// checked for a longer one.
+static void deflate_lazy(DeflateState* s, DeflateMatcher* m, const DeflateLevel* cfg) {
+    const uint8_t* input = s->input;
+    size_t n = s->input_size;
+    size_t pos = 0;
+    uint32_t prev_len = DEFLATE_MIN_MATCH - 1;
+    uint32_t prev_dist = 0;
+    int literal_pending = 0;
+
+    while (pos < n) {
+        uint32_t head = deflate_insert(m, input, n, pos);
+        uint32_t cur_len = DEFLATE_MIN_MATCH - 1;
+        uint32_t cur_dist = 0;
+
+        if (head && prev_len < cfg->max_lazy) {
+            uint32_t len = deflate_longest_match(m, cfg, input, n, pos, head, prev_len, &cur_dist);
+            if (len && !(len == DEFLATE_MIN_MATCH && cur_dist > DEFLATE_TOO_FAR)) cur_len = len;
+        }
+
+        if (prev_len >= DEFLATE_MIN_MATCH && cur_len <= prev_len) {
+            // The pending match at pos - 1 wins; positions up to its end still get indexed.
+            size_t match_end = pos - 1 + prev_len;
+            deflate_emit_match(s, prev_len, prev_dist);
+            for (size_t i = pos + 1; i < match_end; i++) deflate_insert(m, input, n, i);
+            pos = match_end;
+            literal_pending = 0;
+            prev_len = DEFLATE_MIN_MATCH - 1;
+            continue;
+        }
+
+        if (literal_pending) deflate_emit_literal(s, input[pos - 1]);
+        literal_pending = 1;
+        prev_len = cur_len;
+        prev_dist = cur_dist;
+        pos++;
+    }
+
+    if (literal_pending) deflate_emit_literal(s, input[n - 1]);
+}
+
+static uint32_t deflate_adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        size_t chunk = size < 5552 ? size : 5552;
+        size -= chunk;
+        while (chunk--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Worst-case deflate_compress output for `input_size` bytes: every block stored.
+WASM_EXPORT size_t deflate_compress_bound(size_t input_size) {
+    return input_size + 6 * (input_size / DEFLATE_STORED_MAX + input_size / DEFLATE_BLOCK_TOKENS + 2) + 16;
+}
+
+// Normalizes deflate_compress parameters; returns 0 when window_bits is out of range.
+static int deflate_params(int window_bits, int mem_level, uint32_t* wbits, uint32_t* hash_bits) {
+    *wbits = window_bits == 0 ? DEFLATE_MAX_WINDOW_BITS
+           : (uint32_t)(window_bits < 0 ? -window_bits : window_bits);
+    if (*wbits < 8 || *wbits > DEFLATE_MAX_WINDOW_BITS) return 0;
+    *hash_bits = (uint32_t)(mem_level < 1 ? 8 : mem_level > 9 ? 9 : mem_level) + 7;
+    return 1;
+}
+
+// Scratch bytes deflate_compress_ext_state() needs for window_bits and mem_level, or 0
+// when the parameters are invalid.
+WASM_EXPORT size_t deflate_compress_state_size(int window_bits, int mem_level) {
+    uint32_t wbits, hash_bits;
+    if (!deflate_params(window_bits, mem_level, &wbits, &hash_bits)) return 0;
+    return (sizeof(uint32_t) << hash_bits) + (sizeof(uint32_t) << wbits)
+         + sizeof(DeflateToken) * DEFLATE_BLOCK_TOKENS;
+}
+
+// Deflate with zlib framing when window_bits is 8..15 and raw deflate when it is
+// -15..-8 (0 means 15, zlib-framed). mem_level 1..9 sizes the hash table as in zlib.
+// Levels run 0 (stored) to 10 (max ratio). `state` is caller-owned scratch of
+// deflate_compress_state_size() bytes, 4-byte aligned. Returns the output size, or 0
+// on error or when output_capacity is too small; deflate_compress_bound() is always
+// enough.
+WASM_EXPORT size_t deflate_compress_ext_state(
+    void* state,
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level,
+    int window_bits,
+    int mem_level
+) {
+    if (!state || (!input && input_size) || !output) return 0;
+
+    int zlib_framed = window_bits >= 0;
+    uint32_t wbits, hash_bits;
+    if (!deflate_params(window_bits, mem_level, &wbits, &hash_bits)) return 0;
+
+    int level = compression_level < 0 ? 6 : compression_level > DEFLATE_MAX_LEVEL ? DEFLATE_MAX_LEVEL : compression_level;
+
+    DeflateState s;
+    s.input = input;
+    s.input_size = input_size;
+    s.bw.out = output;
+    s.bw.capacity = output_capacity;
+    s.bw.pos = 0;
+    s.bw.bits = 0;
+    s.bw.bit_count = 0;
+    s.bw.overflow = 0;
+    s.token_count = 0;
+    s.block_start = 0;
+    s.covered = 0;
+    s.tokens = 0;
+
+    if (zlib_framed) {
+        uint32_t cmf = ((wbits - 8) << 4) | 8;
+        uint32_t flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        uint32_t flg = flevel << 6;
+        flg += 31 - ((cmf << 8) | flg) % 31;
+        uint8_t header[2] = { (uint8_t)cmf, (uint8_t)flg };
+        deflate_put_bytes(&s.bw, header, 2);
+    }
+
+    if (level == 0 || input_size < DEFLATE_MIN_MATCH) {
+        s.covered = input_size;
+        deflate_write_stored(&s, 1);
+    } else {
+        DeflateMatcher m;
+        m.hash_bits = hash_bits;
+        m.window_size = 1u << wbits;
+        m.window_mask = m.window_size - 1;
+        m.head = (uint32_t*)state;
+        m.prev = m.head + ((size_t)1 << hash_bits);
+        s.tokens = (DeflateToken*)(m.prev + m.window_size);
+        memset(m.head, 0, sizeof(uint32_t) << m.hash_bits);
+
+        const DeflateLevel* cfg = &deflate_levels[level];
+        if (cfg->max_lazy) deflate_lazy(&s, &m, cfg);
+        else deflate_greedy(&s, &m, cfg);
+        deflate_flush_block(&s, 1);
+    }
+    deflate_align_bits(&s.bw);
+
+    if (zlib_framed) {
+        uint32_t adler = deflate_adler32(input, input_size);
+        uint8_t trailer[4] = {
+            (uint8_t)(adler >> 24), (uint8_t)(adler >> 16), (uint8_t)(adler >> 8), (uint8_t)adler
+        };
+        deflate_put_bytes(&s.bw, trailer, 4);
+    }
+
+    return s.bw.overflow ? 0 : s.bw.pos;
+}
+
+// As deflate_compress_ext_state() with the state on the heap (none for level 0).
+WASM_EXPORT size_t deflate_compress(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level,
+    int window_bits,
+    int mem_level
+) {
+    size_t state_size = compression_level == 0 || input_size < DEFLATE_MIN_MATCH
+                      ? sizeof(uint32_t) : deflate_compress_state_size(window_bits, mem_level);
+    if (state_size == 0) return 0;
+
+    void* state = wasm_malloc(state_size);
+    if (!state) return 0;
+
+    size_t size = deflate_compress_ext_state(state, input, input_size, output, output_capacity,
+                                             compression_level, window_bits, mem_level);
+    wasm_free(state);
+    return size;
+}
+
+// Nonzero when every row starts with a valid PNG filter-type byte.
+static int png_scanlines_valid(const uint8_t* filtered_rows, size_t row_bytes, size_t height) {
+    if (!filtered_rows || row_bytes < 2 || height == 0) return 0;
+    for (size_t y = 0; y < height; y++) {
+        if (filtered_rows[y * row_bytes] > 4) return 0;
+    }
+    return 1;
+}
+
+// Compresses PNG scanlines that are already filtered (each row led by its filter-type
+// byte, as png_filter_scanlines produces) into the zlib stream an IDAT chunk carries.
+WASM_EXPORT size_t png_compress_scanlines(
+    const uint8_t* filtered_rows,
+    size_t row_bytes,
+    size_t height,
+    uint8_t* compressed_output,
+    size_t output_capacity,
+    int compression_level
+) {
+    if (!png_scanlines_valid(filtered_rows, row_bytes, height)) return 0;
+    return deflate_compress(filtered_rows, row_bytes * height, compressed_output, output_capacity,
+                            compression_level, DEFLATE_MAX_WINDOW_BITS, 8);
+}
+
+// As png_compress_scanlines() with caller-owned scratch of
+// deflate_compress_state_size(15, 8) bytes, so it never touches the heap.
+WASM_EXPORT size_t png_compress_scanlines_ext_state(
+    void* state,
+    const uint8_t* filtered_rows,
+    size_t row_bytes,
+    size_t height,
+    uint8_t* compressed_output,
+    size_t output_capacity,
+    int compression_level
+) {
+    if (!png_scanlines_valid(filtered_rows, row_bytes, height)) return 0;
+    return deflate_compress_ext_state(state, filtered_rows, row_bytes * height, compressed_output, output_capacity,
+                                      compression_level, DEFLATE_MAX_WINDOW_BITS, 8);
+}
+
+#define ZSTD_MAGIC 0xFD2FB528u
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A50u
+#define ZSTD_SKIPPABLE_MASK 0xFFFFFFF0u
+#define ZSTD_BLOCK_MAX (1u << 17)
+#define ZSTD_WINDOWLOG_MIN 10
+#define ZSTD_WINDOWLOG_MAX 27
+#define ZSTD_HASHLOG_MIN 6
+#define ZSTD_HASHLOG_MAX 26
+#define ZSTD_MIN_MATCH 4
+#define ZSTD_MAX_SEQUENCES (ZSTD_BLOCK_MAX / ZSTD_MIN_MATCH + 1)
+#define ZSTD_LL_MAX 35
+#define ZSTD_ML_MAX 52
+#define ZSTD_OF_MAX 31
+#define ZSTD_LL_LOG_MAX 9
+#define ZSTD_ML_LOG_MAX 9
+#define ZSTD_OF_LOG_MAX 8
+#define ZSTD_FSE_LOG_MIN 5
+#define ZSTD_FSE_LOG_MAX 9
+#define ZSTD_FSE_SYMBOLS_MAX 64
+// Bounds of the FSE table builders across their users (zstd and the tANS coder).
+#define FSE_TABLE_LOG_LIMIT 12
+#define FSE_SYMBOLS_LIMIT 256
+#define ZSTD_HUF_LOG_MAX 11
+#define ZSTD_HUF_WEIGHT_LOG_MAX 6
+#define ZSTD_HUF_MIN_LITERALS 64
+#define ZSTD_REP_MOVE 3
+
+static const uint32_t zstd_ll_base[ZSTD_LL_MAX + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+};
+static const uint8_t zstd_ll_bits[ZSTD_LL_MAX + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+};
+static const uint32_t zstd_ml_base[ZSTD_ML_MAX + 1] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+};
+static const uint8_t zstd_ml_bits[ZSTD_ML_MAX + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+
+// Predefined distributions (RFC 8878, 3.1.1.3.2.2). -1 marks a "less than one" probability.
+static const int16_t zstd_ll_default_norm[ZSTD_LL_MAX + 1] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+static const int16_t zstd_ml_default_norm[ZSTD_ML_MAX + 1] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+static const int16_t zstd_of_default_norm[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+#define ZSTD_LL_DEFAULT_LOG 6
+#define ZSTD_ML_DEFAULT_LOG 6
+#define ZSTD_OF_DEFAULT_LOG 5
+#define ZSTD_OF_DEFAULT_MAX 28
+
+static inline uint32_t zstd_highbit(uint32_t x) {
+    return 31u - (uint32_t)__builtin_clz(x);
+}
+
+static inline uint32_t zstd_ll_code(uint32_t lit_len) {
+    static const uint8_t codes[64] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 20, 20, 21, 21, 21, 21,
+        22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23,
+        24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24
+    };
+    return lit_len > 63 ? zstd_highbit(lit_len) + 19 : codes[lit_len];
+}
+
+// Code for match length - 3.
+static inline uint32_t zstd_ml_code(uint32_t ml_base) {
+    static const uint8_t codes[128] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+        32, 32, 33, 33, 34, 34, 35, 35, 36, 36, 36, 36, 37, 37, 37, 37,
+        38, 38, 38, 38, 38, 38, 38, 38, 39, 39, 39, 39, 39, 39, 39, 39,
+        40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40, 40,
+        41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41, 41,
+        42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42,
+        42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42, 42
+    };
+    return ml_base > 127 ? zstd_highbit(ml_base) + 36 : codes[ml_base];
+}
+
+static inline uint32_t zstd_read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t zstd_read_le64(const uint8_t* p) {
+    return (uint64_t)zstd_read_le32(p) | ((uint64_t)zstd_read_le32(p + 4) << 32);
+}
+
+static inline void zstd_write_le(uint8_t* p, uint64_t value, uint32_t bytes) {
+    for (uint32_t i = 0; i < bytes; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+// XXH64, which zstd uses for its optional content checksum.
+#define XXH64_P1 11400714785074694791ULL
+#define XXH64_P2 14029467366897019727ULL
+#define XXH64_P3 1609587929392839161ULL
+#define XXH64_P4 9650029242287828579ULL
+#define XXH64_P5 2870177450012600261ULL
+
+typedef struct {
+    uint64_t v[4];
+    uint64_t total_len;
+    uint8_t buffer[32];
+    uint32_t buffered;
+} ZstdXxh64;
+
+static inline uint64_t xxh64_rotl(uint64_t x, uint32_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH64_P2;
+    return xxh64_rotl(acc, 31) * XXH64_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * XXH64_P1 + XXH64_P4;
+}
+
+static void xxh64_init(ZstdXxh64* h) {
+    h->v[0] = XXH64_P1 + XXH64_P2;
+    h->v[1] = XXH64_P2;
+    h->v[2] = 0;
+    h->v[3] = 0 - XXH64_P1;
+    h->total_len = 0;
+    h->buffered = 0;
+}
+
+static void xxh64_update(ZstdXxh64* h, const uint8_t* data, size_t size) {
+    h->total_len += size;
+    if (h->buffered + size < 32) {
+        memcpy(h->buffer + h->buffered, data, size);
+        h->buffered += (uint32_t)size;
+        return;
+    }
+    if (h->buffered) {
+        uint32_t fill = 32 - h->buffered;
+        memcpy(h->buffer + h->buffered, data, fill);
+        for (int i = 0; i < 4; i++) h->v[i] = xxh64_round(h->v[i], zstd_read_le64(h->buffer + 8 * i));
+        data += fill;
+        size -= fill;
+        h->buffered = 0;
+    }
+    while (size >= 32) {
+        for (int i = 0; i < 4; i++) h->v[i] = xxh64_round(h->v[i], zstd_read_le64(data + 8 * i));
+        data += 32;
+        size -= 32;
+    }
+    if (size) memcpy(h->buffer, data, size);
+    h->buffered = (uint32_t)size;
+}
+
+static uint64_t xxh64_digest(const ZstdXxh64* h) {
+    uint64_t acc;
+    if (h->total_len >= 32) {
+        acc = xxh64_rotl(h->v[0], 1) + xxh64_rotl(h->v[1], 7) + xxh64_rotl(h->v[2], 12) + xxh64_rotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++) acc = xxh64_merge(acc, h->v[i]);
+    } else {
+        acc = h->v[2] + XXH64_P5;
+    }
+    acc += h->total_len;
+
+    const uint8_t* p = h->buffer;
+    uint32_t left = h->buffered;
+    for (; left >= 8; p += 8, left -= 8) {
+        acc ^= xxh64_round(0, zstd_read_le64(p));
+        acc = xxh64_rotl(acc, 27) * XXH64_P1 + XXH64_P4;
+    }
+    if (left >= 4) {
+        acc ^= (uint64_t)zstd_read_le32(p) * XXH64_P1;
+        acc = xxh64_rotl(acc, 23) * XXH64_P2 + XXH64_P3;
+        p += 4;
+        left -= 4;
+    }
+    for (; left; p++, left--) {
+        acc ^= (uint64_t)*p * XXH64_P5;
+        acc = xxh64_rotl(acc, 11) * XXH64_P1;
+    }
+
+    acc ^= acc >> 33;
+    acc *= XXH64_P2;
+    acc ^= acc >> 29;
+    acc *= XXH64_P3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+// Backward bit stream as FSE and Huffman payloads are read: the last byte carries a
+// 1-bit end marker and reading proceeds towards the first byte. bits_left goes negative
+// once more bits have been consumed than the stream holds; those read as zero.
+typedef struct {
+    const uint8_t* start;
+    size_t size;
+    int64_t bits_left;
+} ZstdBitReader;
+
+static int zstd_reader_init(ZstdBitReader* br, const uint8_t* src, size_t size) {
+    if (size == 0 || src[size - 1] == 0) return 0;
+    br->start = src;
+    br->size = size;
+    br->bits_left = (int64_t)(size - 1) * 8 + zstd_highbit(src[size - 1]);
+    return 1;
+}
+
+// Bits [pos, pos + count) of the stream; count <= 32.
+static inline uint32_t zstd_bits_at(const ZstdBitReader* br, int64_t pos, uint32_t count) {
+    if (pos < 0) {
+        if (pos + (int64_t)count <= 0) return 0;
+        return zstd_bits_at(br, 0, (uint32_t)(count + pos)) << (uint32_t)(-pos);
+    }
+    size_t byte = (size_t)(pos >> 3);
+    uint64_t window = 0;
+    if (byte + 8 <= br->size) {
+        window = zstd_read_le64(br->start + byte);
+    } else {
+        for (size_t i = byte; i < br->size; i++) window |= (uint64_t)br->start[i] << (8 * (i - byte));
+    }
+    return (uint32_t)((window >> (pos & 7)) & ((1ull << count) - 1));
+}
+
+static inline uint32_t zstd_read_bits(ZstdBitReader* br, uint32_t count) {
+    if (!count) return 0;
+    br->bits_left -= count;
+    return zstd_bits_at(br, br->bits_left, count);
+}
+
+// Scales counts to a table of 1 << table_log cells, every present symbol getting at
+// least one. The rounding remainder goes to (or comes from) the most frequent symbols.
+static int zstd_fse_normalize(const uint32_t* counts, uint32_t max_symbol, uint32_t total,
+                              uint32_t table_log, int16_t* norm) {
+    int32_t table_size = 1 << table_log;
+    int32_t distributed = 0;
+    uint32_t largest = 0;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        if (!counts[s]) { norm[s] = 0; continue; }
+        int32_t p = (int32_t)(((uint64_t)counts[s] * (uint32_t)table_size + total / 2) / total);
+        if (p < 1) p = 1;
+        norm[s] = (int16_t)p;
+        distributed += p;
+        if (counts[s] > counts[largest]) largest = s;
+    }
+
+    int32_t diff = table_size - distributed;
+    if (diff > 0) norm[largest] = (int16_t)(norm[largest] + diff);
+    while (diff < 0) {
+        uint32_t best = 0;
+        for (uint32_t s = 1; s <= max_symbol; s++) {
+            if (norm[s] > norm[best]) best = s;
+        }
+        if (norm[best] <= 1) return 0;
+        norm[best]--;
+        diff++;
+    }
+    return 1;
+}
+
+// Table log for `total` symbols over max_symbol + 1 values, as zstd picks it.
+static uint32_t zstd_fse_table_log(uint32_t max_log, uint32_t total, uint32_t max_symbol) {
+    uint32_t log = max_log;
+    uint32_t src_bits = total > 1 ? zstd_highbit(total - 1) : 0;
+    uint32_t max_from_src = src_bits > 2 ? src_bits - 2 : 0;
+    uint32_t min_bits = zstd_highbit(total) + 1;
+    uint32_t min_for_symbols = zstd_highbit(max_symbol ? max_symbol : 1) + 2;
+    if (min_for_symbols < min_bits) min_bits = min_for_symbols;
+    if (max_from_src < log) log = max_from_src;
+    if (min_bits > log) log = min_bits;
+    if (log < ZSTD_FSE_LOG_MIN) log = ZSTD_FSE_LOG_MIN;
+    if (log > max_log) log = max_log;
+    return log;
+}
+
+// FSE table description (RFC 8878, 4.1.1). Returns the bytes written, 0 on overflow.
+static size_t zstd_fse_write_ncount(uint8_t* out, size_t capacity, const int16_t* norm,
+                                    uint32_t max_symbol, uint32_t table_log) {
+    int32_t threshold = 1 << table_log;
+    int32_t remaining = threshold + 1;
+    uint32_t nb_bits = table_log + 1;
+    uint32_t symbol = 0;
+    uint32_t alphabet = max_symbol + 1;
+    int previous0 = 0;
+    uint64_t bits = table_log - ZSTD_FSE_LOG_MIN;
+    uint32_t bit_count = 4;
+    size_t pos = 0;
+
+#define ZSTD_NCOUNT_FLUSH()                                  \
+    while (bit_count >= 8) {                                 \
+        if (pos >= capacity) return 0;                       \
+        out[pos++] = (uint8_t)bits;                          \
+        bits >>= 8;                                          \
+        bit_count -= 8;                                      \
+    }
+
+    while (symbol < alphabet && remaining > 1) {
+        if (previous0) {
+            uint32_t start = symbol;
+            while (symbol < alphabet && !norm[symbol]) symbol++;
+            if (symbol == alphabet) return 0;
+            while (symbol >= start + 3) {
+                start += 3;
+                bits |= 3ull << bit_count;
+                bit_count += 2;
+                ZSTD_NCOUNT_FLUSH();
+            }
+            bits |= (uint64_t)(symbol - start) << bit_count;
+            bit_count += 2;
+        }
+
+        int32_t count = norm[symbol++];
+        int32_t max = (2 * threshold - 1) - remaining;
+        remaining -= count < 0 ? -count : count;
+        count++;
+        if (count >= threshold) count += max;
+        bits |= (uint64_t)(uint32_t)count << bit_count;
+        bit_count += nb_bits - (count < max ? 1 : 0);
+        previous0 = count == 1;
+        if (remaining < 1) return 0;
+        while (remaining < threshold) {
+            nb_bits--;
+            threshold >>= 1;
+        }
+        ZSTD_NCOUNT_FLUSH();
+    }
+#undef ZSTD_NCOUNT_FLUSH
+
+    if (remaining != 1) return 0;
+    while (bit_count > 0) {
+        if (pos >= capacity) return 0;
+        out[pos++] = (uint8_t)bits;
+        bits >>= 8;
+        bit_count = bit_count > 8 ? bit_count - 8 : 0;
+    }
+    return pos;
+}
+
+// Forward, LSB-first read of `count` bits at bit offset `pos`; bits past the end read as zero.
+static inline uint32_t zstd_ncount_peek(const uint8_t* src, size_t size, size_t pos, uint32_t count) {
+    size_t byte = pos >> 3;
+    uint64_t window = 0;
+    for (size_t i = 0; i < 4 && byte + i < size; i++) window |= (uint64_t)src[byte + i] << (8 * i);
+    return (uint32_t)((window >> (pos & 7)) & ((1u << count) - 1));
+}
+
+// Parses an FSE table description. Returns the bytes consumed, 0 when malformed.
+static size_t zstd_fse_read_ncount(const uint8_t* src, size_t size, int16_t* norm, uint32_t* max_symbol,
+                                   uint32_t* table_log, uint32_t max_log) {
+    size_t pos = 0;
+    size_t limit = size * 8;
+    if (limit < 4) return 0;
+    uint32_t log = zstd_ncount_peek(src, size, pos, 4) + ZSTD_FSE_LOG_MIN;
+    pos += 4;
+    if (log > max_log) return 0;
+
+    int32_t threshold = 1 << log;
+    int32_t remaining = threshold + 1;
+    uint32_t nb_bits = log + 1;
+    uint32_t symbol = 0;
+    int previous0 = 0;
+    for (uint32_t s = 0; s <= *max_symbol; s++) norm[s] = 0;
+
+    while (remaining > 1 && symbol <= *max_symbol) {
+        if (previous0) {
+            uint32_t repeat;
+            do {
+                repeat = zstd_ncount_peek(src, size, pos, 2);
+                pos += 2;
+                symbol += repeat;
+            } while (repeat == 3 && pos <= limit);
+            if (symbol > *max_symbol) return 0;
+        }
+
+        int32_t max = (2 * threshold - 1) - remaining;
+        int32_t count = (int32_t)zstd_ncount_peek(src, size, pos, nb_bits - 1);
+        if (count < max) {
+            pos += nb_bits - 1;
+        } else {
+            count = (int32_t)zstd_ncount_peek(src, size, pos, nb_bits);
+            if (count >= threshold) count -= max;
+            pos += nb_bits;
+        }
+        count--;
+        remaining -= count < 0 ? -count : count;
+        norm[symbol++] = (int16_t)count;
+        previous0 = count == 0;
+        while (remaining < threshold) {
+            nb_bits--;
+            threshold >>= 1;
+        }
+        if (pos > limit) return 0;
+    }
+
+    if (remaining != 1 || pos > limit) return 0;
+    *max_symbol = symbol - 1;
+    *table_log = log;
+    return (pos + 7) >> 3;
+}
+
+typedef struct {
+    uint16_t base;
+    uint8_t symbol;
+    uint8_t nb_bits;
+} ZstdFseCell;
+
+typedef struct {
+    ZstdFseCell cells[1 << ZSTD_FSE_LOG_MAX];
+    uint32_t table_log;
+} ZstdFseDTable;
+
+static inline uint32_t zstd_fse_spread_step(uint32_t table_size) {
+    return (table_size >> 1) + (table_size >> 3) + 3;
+}
+
+// Decoding cells for a normalized distribution, shared by zstd and the tANS coder.
+static int fse_fill_decode_cells(ZstdFseCell* cells, const int16_t* norm, uint32_t max_symbol, uint32_t table_log) {
+    uint32_t table_size = 1u << table_log;
+    uint32_t high = table_size - 1;
+    uint16_t next[FSE_SYMBOLS_LIMIT];
+
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        if (norm[s] == -1) {
+            cells[high--].symbol = (uint8_t)s;
+            next[s] = 1;
+        } else {
+            next[s] = (uint16_t)norm[s];
+        }
+    }
+
+    uint32_t step = zstd_fse_spread_step(table_size);
+    uint32_t mask = table_size - 1;
+    uint32_t pos = 0;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        for (int32_t i = 0; i < norm[s]; i++) {
+            cells[pos].symbol = (uint8_t)s;
+            do { pos = (pos + step) & mask; } while (pos > high);
+        }
+    }
+    if (pos != 0) return 0;
+
+    for (uint32_t u = 0; u < table_size; u++) {
+        uint32_t s = cells[u].symbol;
+        uint32_t n = next[s]++;
+        uint32_t nb = table_log - zstd_highbit(n);
+        cells[u].nb_bits = (uint8_t)nb;
+        cells[u].base = (uint16_t)((n << nb) - table_size);
+    }
+    return 1;
+}
+
+static int zstd_fse_build_dtable(ZstdFseDTable* dt, const int16_t* norm, uint32_t max_symbol, uint32_t table_log) {
+    if (!fse_fill_decode_cells(dt->cells, norm, max_symbol, table_log)) return 0;
+    dt->table_log = table_log;
+    return 1;
+}
+
+static void zstd_fse_build_dtable_rle(ZstdFseDTable* dt, uint8_t symbol) {
+    dt->cells[0].symbol = symbol;
+    dt->cells[0].nb_bits = 0;
+    dt->cells[0].base = 0;
+    dt->table_log = 0;
+}
+
+typedef struct {
+    int32_t delta_find_state;
+    uint32_t delta_nb_bits;
+} ZstdFseTransform;
+
+// Encoder side of an FSE table, laid out as the reference encoder's CTable so that
+// state transitions mirror zstd_fse_build_dtable exactly. table_log 0 is the RLE mode.
+typedef struct {
+    uint16_t states[1 << ZSTD_FSE_LOG_MAX];
+    ZstdFseTransform symbols[ZSTD_FSE_SYMBOLS_MAX];
+    uint32_t table_log;
+} ZstdFseCTable;
+
+// Encoding state table and per-symbol transforms, shared by zstd and the tANS coder.
+static void fse_fill_encode_table(uint16_t* states, ZstdFseTransform* symbols, const int16_t* norm,
+                                  uint32_t max_symbol, uint32_t table_log) {
+    uint32_t table_size = 1u << table_log;
+    uint32_t high = table_size - 1;
+    uint8_t spread[1 << FSE_TABLE_LOG_LIMIT];
+    uint32_t cumul[FSE_SYMBOLS_LIMIT + 1];
+
+    cumul[0] = 0;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        if (norm[s] == -1) {
+            cumul[s + 1] = cumul[s] + 1;
+            spread[high--] = (uint8_t)s;
+        } else {
+            cumul[s + 1] = cumul[s] + (uint32_t)norm[s];
+        }
+    }
+
+    uint32_t step = zstd_fse_spread_step(table_size);
+    uint32_t mask = table_size - 1;
+    uint32_t pos = 0;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        for (int32_t i = 0; i < norm[s]; i++) {
+            spread[pos] = (uint8_t)s;
+            do { pos = (pos + step) & mask; } while (pos > high);
+        }
+    }
+
+    for (uint32_t u = 0; u < table_size; u++) {
+        states[cumul[spread[u]]++] = (uint16_t)(table_size + u);
+    }
+
+    int32_t total = 0;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        ZstdFseTransform* tt = &symbols[s];
+        int32_t n = norm[s];
+        if (n == 0) {
+            tt->delta_nb_bits = ((table_log + 1) << 16) - table_size;
+            tt->delta_find_state = 0;
+        } else if (n == -1 || n == 1) {
+            tt->delta_nb_bits = (table_log << 16) - table_size;
+            tt->delta_find_state = total - 1;
+            total++;
+        } else {
+            uint32_t max_bits_out = table_log - zstd_highbit((uint32_t)n - 1);
+            uint32_t min_state_plus = (uint32_t)n << max_bits_out;
+            tt->delta_nb_bits = (max_bits_out << 16) - min_state_plus;
+            tt->delta_find_state = total - n;
+            total += n;
+        }
+    }
+}
+
+static void zstd_fse_build_ctable(ZstdFseCTable* ct, const int16_t* norm, uint32_t max_symbol, uint32_t table_log) {
+    fse_fill_encode_table(ct->states, ct->symbols, norm, max_symbol, table_log);
+    ct->table_log = table_log;
+}
+
+static void zstd_fse_build_ctable_rle(ZstdFseCTable* ct) {
+    ct->table_log = 0;
+}
+
+// Initial state for the last symbol of a stream: the smallest state that decodes to it.
+static inline uint32_t zstd_fse_init_state(const ZstdFseCTable* ct, uint32_t symbol) {
+    if (!ct->table_log) return 0;
+    const ZstdFseTransform* tt = &ct->symbols[symbol];
+    uint32_t nb = (tt->delta_nb_bits + (1u << 15)) >> 16;
+    uint32_t value = (nb << 16) - tt->delta_nb_bits;
+    return ct->states[(value >> nb) + tt->delta_find_state];
+}
+
+static inline void zstd_fse_encode(DeflateBitWriter* bw, const ZstdFseCTable* ct, uint32_t* state, uint32_t symbol) {
+    if (!ct->table_log) return;
+    const ZstdFseTransform* tt = &ct->symbols[symbol];
+    uint32_t nb = (*state + tt->delta_nb_bits) >> 16;
+    deflate_put_bits(bw, *state & ((1u << nb) - 1), nb);
+    *state = ct->states[(*state >> nb) + tt->delta_find_state];
+}
+
+static inline void zstd_fse_flush(DeflateBitWriter* bw, const ZstdFseCTable* ct, uint32_t state) {
+    if (!ct->table_log) return;
+    deflate_put_bits(bw, state - (1u << ct->table_log), ct->table_log);
+}
+
+// Closes a backward stream with its end marker. Returns the stream size, 0 on overflow.
+static size_t zstd_close_stream(DeflateBitWriter* bw, size_t start) {
+    deflate_put_bits(bw, 1, 1);
+    deflate_align_bits(bw);
+    return bw->overflow ? 0 : bw->pos - start;
+}
+
+// Approximate log2(x) in 1/256 bit units, for cost estimates.
+static inline uint32_t zstd_log2_fixed(uint32_t x) {
+    uint32_t hb = zstd_highbit(x);
+    uint32_t mantissa = hb >= 8 ? x >> (hb - 8) : x << (8 - hb);
+    return (hb << 8) + (mantissa - 256);
+}
+
+// Estimated payload of `counts` coded with `norm`, in 1/256 bits; UINT64_MAX when some
+// used symbol has no cell in the table.
+static uint64_t zstd_fse_cost(const uint32_t* counts, uint32_t max_symbol, const int16_t* norm,
+                              uint32_t norm_max_symbol, uint32_t table_log) {
+    uint64_t cost = 0;
+    uint32_t table_bits = table_log << 8;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        if (!counts[s]) continue;
+        if (s > norm_max_symbol || norm[s] == 0) return ~0ull;
+        uint32_t p = norm[s] < 0 ? 1u : (uint32_t)norm[s];
+        cost += (uint64_t)counts[s] * (table_bits - zstd_log2_fixed(p));
+    }
+    return cost;
+}
+
+// Literal Huffman code. Weights follow zstd's convention: weight = max_bits + 1 - length,
+// 0 for unused symbols, and prefix codes are handed out from the lowest weight up.
+typedef struct {
+    uint16_t codes[256];
+    uint8_t nb_bits[256];
+    uint8_t weights[256];
+    uint32_t max_bits;
+    uint32_t symbol_count;
+} ZstdHufCTable;
+
+static void zstd_huf_build_ctable(ZstdHufCTable* h, const uint32_t* counts) {
+    deflate_build_lengths(counts, 256, ZSTD_HUF_LOG_MAX, h->nb_bits);
+
+    h->max_bits = 0;
+    h->symbol_count = 0;
+    for (uint32_t s = 0; s < 256; s++) {
+        if (!h->nb_bits[s]) continue;
+        if (h->nb_bits[s] > h->max_bits) h->max_bits = h->nb_bits[s];
+        h->symbol_count = s + 1;
+    }
+
+    uint32_t rank_start[ZSTD_HUF_LOG_MAX + 2] = {0};
+    for (uint32_t s = 0; s < 256; s++) {
+        h->weights[s] = h->nb_bits[s] ? (uint8_t)(h->max_bits + 1 - h->nb_bits[s]) : 0;
+        if (h->weights[s]) rank_start[h->weights[s] + 1] += 1u << (h->weights[s] - 1);
+    }
+    for (uint32_t w = 2; w <= h->max_bits + 1; w++) rank_start[w] += rank_start[w - 1];
+    for (uint32_t s = 0; s < 256; s++) {
+        uint32_t w = h->weights[s];
+        if (!w) continue;
+        h->codes[s] = (uint16_t)(rank_start[w] >> (w - 1));
+        rank_start[w] += 1u << (w - 1);
+    }
+}
+
+// FSE-compressed weights with two interleaved states, in the reference encoder's order.
+// Returns the compressed size, 0 when FSE does not apply or does not fit.
+static size_t zstd_huf_compress_weights(uint8_t* out, size_t capacity, const uint8_t* weights, uint32_t count) {
+    uint32_t counts[ZSTD_HUF_LOG_MAX + 1] = {0};
+    uint32_t max_weight = 0;
+    uint32_t distinct = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!counts[weights[i]]++) distinct++;
+        if (weights[i] > max_weight) max_weight = weights[i];
+    }
+    if (count < 2 || distinct < 2) return 0;
+
+    int16_t norm[ZSTD_HUF_LOG_MAX + 1];
+    uint32_t table_log = zstd_fse_table_log(ZSTD_HUF_WEIGHT_LOG_MAX, count, max_weight);
+    if (!zstd_fse_normalize(counts, max_weight, count, table_log, norm)) return 0;
+    size_t header = zstd_fse_write_ncount(out, capacity, norm, max_weight, table_log);
+    if (!header) return 0;
+
+    ZstdFseCTable ct;
+    zstd_fse_build_ctable(&ct, norm, max_weight, table_log);
+
+    DeflateBitWriter bw = { out + header, capacity - header, 0, 0, 0, 0 };
+    uint32_t state1, state2;
+    uint32_t i = count;
+    if (count & 1) {
+        state1 = zstd_fse_init_state(&ct, weights[--i]);
+        state2 = zstd_fse_init_state(&ct, weights[--i]);
+        zstd_fse_encode(&bw, &ct, &state1, weights[--i]);
+    } else {
+        state2 = zstd_fse_init_state(&ct, weights[--i]);
+        state1 = zstd_fse_init_state(&ct, weights[--i]);
+    }
+    while (i > 0) {
+        zstd_fse_encode(&bw, &ct, &state2, weights[--i]);
+        zstd_fse_encode(&bw, &ct, &state1, weights[--i]);
+    }
+    zstd_fse_flush(&bw, &ct, state2);
+    zstd_fse_flush(&bw, &ct, state1);
+    size_t stream = zstd_close_stream(&bw, 0);
+    return stream ? header + stream : 0;
+}
+
+// Huffman tree description: FSE-compressed weights when that is smaller (or when there
+// are too many weights for the direct form), else 4-bit direct weights.
+static size_t zstd_huf_write_table(uint8_t* out, size_t capacity, const ZstdHufCTable* h) {
+    uint32_t count = h->symbol_count - 1;
+    size_t direct = 1 + (count + 1) / 2;
+    if (capacity < 2) return 0;
+
+    size_t compressed = zstd_huf_compress_weights(out + 1, (capacity - 1) < 127 ? capacity - 1 : 127, h->weights, count);
+    if (compressed && (compressed + 1 < direct || count > 128)) {
+        out[0] = (uint8_t)compressed;
+        return compressed + 1;
+    }
+    if (count > 128 || direct > capacity) return 0;
+
+    out[0] = (uint8_t)(127 + count);
+    for (uint32_t i = 0; i < count; i += 2) {
+        uint8_t hi = h->weights[i];
+        uint8_t lo = i + 1 < count ? h->weights[i + 1] : 0;
+        out[1 + i / 2] = (uint8_t)((hi << 4) | lo);
+    }
+    return direct;
+}
+
+// One Huffman stream; symbols go in back to front so the decoder reads them in order.
+static size_t zstd_huf_encode_stream(uint8_t* out, size_t capacity, const ZstdHufCTable* h,
+                                     const uint8_t* src, size_t count) {
+    DeflateBitWriter bw = { out, capacity, 0, 0, 0, 0 };
+    for (size_t i = count; i-- > 0;) deflate_put_bits(&bw, h->codes[src[i]], h->nb_bits[src[i]]);
+    return zstd_close_stream(&bw, 0);
+}
+
+static size_t zstd_write_raw_literals_header(uint8_t* out, uint32_t type, size_t size) {
+    if (size < 32) {
+        out[0] = (uint8_t)(type | (size << 3));
+        return 1;
+    }
+    if (size < 4096) {
+        zstd_write_le(out, type | (1u << 2) | ((uint32_t)size << 4), 2);
+        return 2;
+    }
+    zstd_write_le(out, type | (3u << 2) | ((uint32_t)size << 4), 3);
+    return 3;
+}
+
+// Literals section (RFC 8878, 3.1.1.3.1): raw, RLE or Huffman-compressed, whichever is
+// smallest. Returns the section size, 0 when it does not fit.
+static size_t zstd_encode_literals(uint8_t* out, size_t capacity, const uint8_t* literals, size_t count) {
+    size_t raw_size = (count < 32 ? 1 : count < 4096 ? 2 : 3) + count;
+
+    uint32_t counts[256] = {0};
+    uint32_t distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!counts[literals[i]]++) distinct++;
+    }
+
+    if (distinct == 1 && count > 1) {
+        if (capacity < 4) return 0;
+        size_t header = zstd_write_raw_literals_header(out, 1, count);
+        out[header] = literals[0];
+        return header + 1;
+    }
+
+    if (count >= ZSTD_HUF_MIN_LITERALS && capacity > 5) {
+        ZstdHufCTable h;
+        zstd_huf_build_ctable(&h, counts);
+
+        size_t header = count <= 1023 ? 3 : count <= 16383 ? 4 : 5;
+        size_t limit = (raw_size < capacity ? raw_size : capacity) - header;
+        uint8_t* payload = out + header;
+        size_t pos = zstd_huf_write_table(payload, limit, &h);
+        int single = count < 256;
+
+        if (pos && single) {
+            size_t stream = zstd_huf_encode_stream(payload + pos, limit - pos, &h, literals, count);
+            pos = stream ? pos + stream : 0;
+        } else if (pos && pos + 6 < limit) {
+            size_t segment = (count + 3) / 4;
+            size_t jump = pos;
+            pos += 6;
+            for (int k = 0; k < 4 && pos; k++) {
+                size_t begin = segment * (size_t)k;
+                size_t len = k < 3 ? segment : count - begin;
+                size_t stream = zstd_huf_encode_stream(payload + pos, limit - pos, &h, literals + begin, len);
+                if (!stream) { pos = 0; break; }
+                if (k < 3) zstd_write_le(payload + jump + 2 * k, stream, 2);
+                pos += stream;
+            }
+        } else {
+            pos = 0;
+        }
+
+        if (pos && header + pos < raw_size) {
+            uint32_t size_format = single ? 0 : count <= 1023 ? 1 : count <= 16383 ? 2 : 3;
+            uint64_t value = 2u | (size_format << 2);
+            if (header == 3) value |= ((uint64_t)count << 4) | ((uint64_t)pos << 14);
+            else if (header == 4) value |= ((uint64_t)count << 4) | ((uint64_t)pos << 18);
+            else value |= ((uint64_t)count << 4) | ((uint64_t)pos << 22);
+            zstd_write_le(out, value, (uint32_t)header);
+            return header + pos;
+        }
+    }
+
+    if (raw_size > capacity) return 0;
+    size_t header = zstd_write_raw_literals_header(out, 0, count);
+    memcpy(out + header, literals, count);
+    return raw_size;
+}
+
+typedef struct {
+    uint32_t lit_len;
+    uint32_t match_len;
+    uint32_t offset_value;   // 1-3 repeat codes, otherwise offset + ZSTD_REP_MOVE
+} ZstdSequence;
+
+enum {
+    ZSTD_MODE_PREDEFINED = 0,
+    ZSTD_MODE_RLE = 1,
+    ZSTD_MODE_FSE = 2,
+    ZSTD_MODE_REPEAT = 3
+};
+
+// Picks RLE, the predefined distribution or a fresh FSE table for one symbol stream,
+// builds its encoder table and writes the table description into `out`.
+static int zstd_select_table(ZstdFseCTable* ct, uint8_t* out, size_t capacity, size_t* written,
+                             const uint32_t* counts, uint32_t max_symbol, uint32_t total,
+                             const int16_t* default_norm, uint32_t default_max, uint32_t default_log,
+                             uint32_t max_log) {
+    uint32_t distinct = 0;
+    uint32_t last = 0;
+    for (uint32_t s = 0; s <= max_symbol; s++) {
+        if (counts[s]) { distinct++; last = s; }
+    }
+    *written = 0;
+
+    if (distinct == 1) {
+        if (capacity < 1) return -1;
+        out[0] = (uint8_t)last;
+        *written = 1;
+        zstd_fse_build_ctable_rle(ct);
+        return ZSTD_MODE_RLE;
+    }
+
+    uint64_t predefined = zstd_fse_cost(counts, last, default_norm, default_max, default_log);
+
+    int16_t norm[ZSTD_FSE_SYMBOLS_MAX];
+    uint32_t table_log = zstd_fse_table_log(max_log, total, last);
+    size_t header = 0;
+    uint64_t custom = ~0ull;
+    if (zstd_fse_normalize(counts, last, total, table_log, norm)) {
+        header = zstd_fse_write_ncount(out, capacity, norm, last, table_log);
+        if (header) custom = zstd_fse_cost(counts, last, norm, last, table_log) + ((uint64_t)header << 11);
+    }
+
+    if (predefined <= custom) {
+        if (predefined == ~0ull) return -1;
+        zstd_fse_build_ctable(ct, default_norm, default_max, default_log);
+        return ZSTD_MODE_PREDEFINED;
+    }
+    zstd_fse_build_ctable(ct, norm, last, table_log);
+    *written = header;
+    return ZSTD_MODE_FSE;
+}
+
+// Sequences section (RFC 8878, 3.1.1.3.2). `codes` is scratch for 3 * count code bytes.
+// Returns the section size, 0 when it does not fit.
+static size_t zstd_encode_sequences(uint8_t* out, size_t capacity, const ZstdSequence* seqs, size_t count,
+                                    uint8_t* codes) {
+    size_t pos;
+    if (capacity < 4) return 0;
+    if (count < 128) {
+        out[0] = (uint8_t)count;
+        pos = 1;
+    } else if (count < 0x7F00) {
+        out[0] = (uint8_t)((count >> 8) + 128);
+        out[1] = (uint8_t)count;
+        pos = 2;
+    } else {
+        out[0] = 0xFF;
+        zstd_write_le(out + 1, count - 0x7F00, 2);
+        pos = 3;
+    }
+    if (count == 0) return pos;
+
+    uint8_t* ll_codes = codes;
+    uint8_t* of_codes = codes + count;
+    uint8_t* ml_codes = codes + 2 * count;
+    uint32_t ll_counts[ZSTD_LL_MAX + 1] = {0};
+    uint32_t of_counts[ZSTD_OF_MAX + 1] = {0};
+    uint32_t ml_counts[ZSTD_ML_MAX + 1] = {0};
+    for (size_t i = 0; i < count; i++) {
+        ll_codes[i] = (uint8_t)zstd_ll_code(seqs[i].lit_len);
+        of_codes[i] = (uint8_t)zstd_highbit(seqs[i].offset_value);
+        ml_codes[i] = (uint8_t)zstd_ml_code(seqs[i].match_len - 3);
+        ll_counts[ll_codes[i]]++;
+        of_counts[of_codes[i]]++;
+        ml_counts[ml_codes[i]]++;
+    }
+
+    ZstdFseCTable ll_table, of_table, ml_table;
+    size_t modes_pos = pos++;
+    size_t written;
+    int ll_mode = zstd_select_table(&ll_table, out + pos, capacity - pos, &written, ll_counts, ZSTD_LL_MAX,
+                                    (uint32_t)count, zstd_ll_default_norm, ZSTD_LL_MAX, ZSTD_LL_DEFAULT_LOG,
+                                    ZSTD_LL_LOG_MAX);
+    if (ll_mode < 0) return 0;
+    pos += written;
+    int of_mode = zstd_select_table(&of_table, out + pos, capacity - pos, &written, of_counts, ZSTD_OF_MAX,
+                                    (uint32_t)count, zstd_of_default_norm, ZSTD_OF_DEFAULT_MAX, ZSTD_OF_DEFAULT_LOG,
+                                    ZSTD_OF_LOG_MAX);
+    if (of_mode < 0) return 0;
+    pos += written;
+    int ml_mode = zstd_select_table(&ml_table, out + pos, capacity - pos, &written, ml_counts, ZSTD_ML_MAX,
+                                    (uint32_t)count, zstd_ml_default_norm, ZSTD_ML_MAX, ZSTD_ML_DEFAULT_LOG,
+                                    ZSTD_ML_LOG_MAX);
+    if (ml_mode < 0) return 0;
+    pos += written;
+    out[modes_pos] = (uint8_t)((ll_mode << 6) | (of_mode << 4) | (ml_mode << 2));
+
+    // Sequences go in back to front; the decoder reads the states in LL, OF, ML order
+    // and each sequence's extra bits as offset, match length, literal length.
+    DeflateBitWriter bw = { out + pos, capacity - pos, 0, 0, 0, 0 };
+    size_t n = count - 1;
+    uint32_t ml_state = zstd_fse_init_state(&ml_table, ml_codes[n]);
+    uint32_t of_state = zstd_fse_init_state(&of_table, of_codes[n]);
+    uint32_t ll_state = zstd_fse_init_state(&ll_table, ll_codes[n]);
+    for (size_t i = count; i-- > 0;) {
+        if (i != n) {
+            zstd_fse_encode(&bw, &of_table, &of_state, of_codes[i]);
+            zstd_fse_encode(&bw, &ml_table, &ml_state, ml_codes[i]);
+            zstd_fse_encode(&bw, &ll_table, &ll_state, ll_codes[i]);
+        }
+        deflate_put_bits(&bw, seqs[i].lit_len - zstd_ll_base[ll_codes[i]], zstd_ll_bits[ll_codes[i]]);
+        deflate_put_bits(&bw, seqs[i].match_len - zstd_ml_base[ml_codes[i]], zstd_ml_bits[ml_codes[i]]);
+        deflate_put_bits(&bw, seqs[i].offset_value - (1u << of_codes[i]), of_codes[i]);
+    }
+    zstd_fse_flush(&bw, &ml_table, ml_state);
+    zstd_fse_flush(&bw, &of_table, of_state);
+    zstd_fse_flush(&bw, &ll_table, ll_state);
+    size_t stream = zstd_close_stream(&bw, 0);
+    return stream ? pos + stream : 0;
+}
+
+// Match finder settings per level. FAST probes a single hash table; the others walk
+// hash chains 1 << search_log deep, GREEDY taking the first match found and LAZY/LAZY2
+// checking one or two following positions for a better one. Levels cap the window at
+// 8 MiB and the tables at a few tens of MiB so they stay within the wasm heap.
+enum {
+    ZSTD_STRATEGY_FAST = 0,
+    ZSTD_STRATEGY_GREEDY = 1,
+    ZSTD_STRATEGY_LAZY = 2,
+    ZSTD_STRATEGY_LAZY2 = 3
+};
+
+typedef struct {
+    uint8_t window_log;
+    uint8_t hash_log;
+    uint8_t chain_log;
+    uint8_t search_log;
+    uint16_t target_length;
+    uint8_t strategy;
+} ZstdLevel;
+
+static const ZstdLevel zstd_levels[ZSTD_MAX_LEVEL + 1] = {
+    { 21, 17, 16,  1,   16, ZSTD_STRATEGY_GREEDY },
+    { 19, 14,  0,  0,    0, ZSTD_STRATEGY_FAST },
+    { 20, 16,  0,  0,    0, ZSTD_STRATEGY_FAST },
+    { 21, 17, 16,  1,   16, ZSTD_STRATEGY_GREEDY },
+    { 21, 18, 17,  2,   24, ZSTD_STRATEGY_GREEDY },
+    { 21, 18, 18,  2,   16, ZSTD_STRATEGY_LAZY },
+    { 21, 18, 19,  3,   24, ZSTD_STRATEGY_LAZY },
+    { 21, 19, 19,  3,   32, ZSTD_STRATEGY_LAZY2 },
+    { 22, 19, 20,  4,   32, ZSTD_STRATEGY_LAZY2 },
+    { 22, 20, 21,  4,   48, ZSTD_STRATEGY_LAZY2 },
+    { 22, 20, 21,  5,   64, ZSTD_STRATEGY_LAZY2 },
+    { 22, 20, 22,  5,   96, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 22,  6,  128, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 22,  6,  192, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 22,  7,  256, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 23,  7,  256, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 23,  8,  384, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 23,  9,  512, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 23, 10,  768, ZSTD_STRATEGY_LAZY2 },
+    { 23, 20, 23, 11, 1024, ZSTD_STRATEGY_LAZY2 },
+};
+
+// Compression state. History and input share one buffer (`base`); dictionary content
+// and earlier blocks sit below the block being compressed, so positions double as
+// match-finder indices. Hash and chain entries hold position + 1, 0 meaning empty.
+typedef struct {
+    ZstdLevel params;
+    const uint8_t* base;
+    uint32_t window_size;
+    uint32_t* hash_table;
+    uint32_t* chain_table;
+    uint32_t chain_mask;
+    uint32_t next_to_update;
+    uint32_t reps[3];
+    ZstdSequence* sequences;
+    size_t sequence_count;
+    uint8_t* literals;
+    size_t literal_count;
+    uint8_t* codes;
+} ZstdCCtx;
+
+static inline uint32_t zstd_hash4(const uint8_t* p, uint32_t hash_log) {
+    return (zstd_read_le32(p) * 2654435761u) >> (32 - hash_log);
+}
+
+static inline uint32_t zstd_match_length(const uint8_t* base, uint32_t candidate, uint32_t pos, uint32_t end) {
+    return deflate_match_length(base + candidate, base + pos, end - pos);
+}
+
+// Appends a sequence, translating the offset into zstd's repeat-offset coding and
+// updating the repeat history exactly as the decoder will.
+static void zstd_store_sequence(ZstdCCtx* c, uint32_t anchor, uint32_t lit_len, uint32_t offset, uint32_t match_len) {
+    uint32_t* r = c->reps;
+    memcpy(c->literals + c->literal_count, c->base + anchor, lit_len);
+    c->literal_count += lit_len;
+
+    uint32_t offset_value;
+    if (lit_len) {
+        offset_value = offset == r[0] ? 1 : offset == r[1] ? 2 : offset == r[2] ? 3 : offset + ZSTD_REP_MOVE;
+    } else {
+        offset_value = offset == r[1] ? 1 : offset == r[2] ? 2 : offset == r[0] - 1 ? 3 : offset + ZSTD_REP_MOVE;
+    }
+
+    uint32_t rep_index = offset_value > ZSTD_REP_MOVE ? 3 : offset_value - (lit_len ? 1 : 0);
+    if (rep_index == 1) {
+        r[1] = r[0];
+        r[0] = offset;
+    } else if (rep_index > 1) {
+        r[2] = r[1];
+        r[1] = r[0];
+        r[0] = offset;
+    }
+
+    ZstdSequence* seq = &c->sequences[c->sequence_count++];
+    seq->lit_len = lit_len;
+    seq->match_len = match_len;
+    seq->offset_value = offset_value;
+}
+
+static void zstd_store_last_literals(ZstdCCtx* c, uint32_t anchor, uint32_t end) {
+    memcpy(c->literals + c->literal_count, c->base + anchor, end - anchor);
+    c->literal_count += end - anchor;
+}
+
+// Length of a repeat-offset match at pos, or 0 when the offset reaches before the buffer.
+static inline uint32_t zstd_rep_match(const ZstdCCtx* c, uint32_t pos, uint32_t end, uint32_t rep) {
+    if (rep > pos || pos + ZSTD_MIN_MATCH > end) return 0;
+    if (zstd_read_le32(c->base + pos - rep) != zstd_read_le32(c->base + pos)) return 0;
+    return zstd_match_length(c->base, pos - rep, pos, end);
+}
+
+// Extends a match backwards over literals that also match.
+static inline void zstd_catch_up(const ZstdCCtx* c, uint32_t anchor, uint32_t offset, uint32_t* start, uint32_t* len) {
+    while (*start > anchor && *start > offset && c->base[*start - 1] == c->base[*start - 1 - offset]) {
+        (*start)--;
+        (*len)++;
+    }
+}
+
+// Back-to-back matches at the second repeat offset cost almost nothing to code.
+static uint32_t zstd_immediate_reps(ZstdCCtx* c, uint32_t ip, uint32_t end) {
+    for (;;) {
+        uint32_t rep = c->reps[1];
+        uint32_t len = zstd_rep_match(c, ip, end, rep);
+        if (len < ZSTD_MIN_MATCH) return ip;
+        zstd_store_sequence(c, ip, 0, rep, len);
+        ip += len;
+    }
+}
+
+static void zstd_parse_fast(ZstdCCtx* c, uint32_t start, uint32_t end) {
+    const uint8_t* base = c->base;
+    uint32_t hash_log = c->params.hash_log;
+    uint32_t anchor = start;
+    uint32_t ip = start;
+
+    while (ip + ZSTD_MIN_MATCH <= end) {
+        uint32_t h = zstd_hash4(base + ip, hash_log);
+        uint32_t candidate = c->hash_table[h];
+        c->hash_table[h] = ip + 1;
+
+        uint32_t match_start = ip + 1;
+        uint32_t offset = c->reps[0];
+        uint32_t len = zstd_rep_match(c, match_start, end, offset);
+        if (len < ZSTD_MIN_MATCH) {
+            uint32_t cp = candidate - 1;
+            len = 0;
+            if (candidate && ip - cp <= c->window_size && zstd_read_le32(base + cp) == zstd_read_le32(base + ip)) {
+                match_start = ip;
+                offset = ip - cp;
+                len = zstd_match_length(base, cp, ip, end);
+                zstd_catch_up(c, anchor, offset, &match_start, &len);
+            }
+        }
+        if (!len) {
+            ip += 1 + ((ip - anchor) >> 8);
+            continue;
+        }
+
+        zstd_store_sequence(c, anchor, match_start - anchor, offset, len);
+        ip = match_start + len;
+        if (ip + ZSTD_MIN_MATCH <= end) {
+            c->hash_table[zstd_hash4(base + match_start + 2, hash_log)] = match_start + 3;
+            c->hash_table[zstd_hash4(base + ip - 2, hash_log)] = ip - 1;
+        }
+        ip = zstd_immediate_reps(c, ip, end);
+        anchor = ip;
+    }
+    zstd_store_last_literals(c, anchor, end);
+}
+
+// Indexes every position below pos, then pos itself, and walks its chain for the
+// longest match within the window. Returns 0 when nothing of ZSTD_MIN_MATCH is found.
+static uint32_t zstd_chain_search(ZstdCCtx* c, uint32_t pos, uint32_t end, uint32_t* offset_out) {
+    const uint8_t* base = c->base;
+    uint32_t hash_log = c->params.hash_log;
+    uint32_t mask = c->chain_mask;
+    uint32_t candidate;
+
+    if (pos >= c->next_to_update) {
+        for (uint32_t p = c->next_to_update; p < pos; p++) {
+            uint32_t h = zstd_hash4(base + p, hash_log);
+            c->chain_table[p & mask] = c->hash_table[h];
+            c->hash_table[h] = p + 1;
+        }
+        uint32_t h = zstd_hash4(base + pos, hash_log);
+        candidate = c->hash_table[h];
+        c->chain_table[pos & mask] = candidate;
+        c->hash_table[h] = pos + 1;
+        c->next_to_update = pos + 1;
+    } else {
+        candidate = c->chain_table[pos & mask];
+    }
+
+    uint32_t window_low = pos > c->window_size ? pos - c->window_size : 0;
+    uint32_t chain_size = mask + 1;
+    uint32_t attempts = 1u << c->params.search_log;
+    uint32_t target = c->params.target_length;
+    uint32_t max_len = end - pos;
+    uint32_t best_len = ZSTD_MIN_MATCH - 1;
+    uint32_t best_offset = 0;
+
+    while (candidate && attempts--) {
+        uint32_t cp = candidate - 1;
+        if (cp < window_low || cp >= pos) break;
+        if (base[cp + best_len] == base[pos + best_len]) {
+            uint32_t len = zstd_match_length(base, cp, pos, end);
+            if (len > best_len) {
+                best_len = len;
+                best_offset = pos - cp;
+                if (len >= target || len == max_len) break;
+            }
+        }
+        if (cp + chain_size <= pos) break;
+        uint32_t next = c->chain_table[cp & mask];
+        if (next >= candidate) break;
+        candidate = next;
+    }
+
+    if (!best_offset) return 0;
+    *offset_out = best_offset;
+    return best_len;
+}
+
+// Rough saving of a match: length weighted against the bits its offset code costs.
+static inline int32_t zstd_match_gain(uint32_t len, uint32_t weight, uint32_t offset_value, int32_t bias) {
+    return (int32_t)(len * weight) - (int32_t)zstd_highbit(offset_value) + bias;
+}
+
+// Greedy (depth 0), lazy (1) and lazy2 (2) parsing after zstd's lazy match finder.
+static void zstd_parse_lazy(ZstdCCtx* c, uint32_t start, uint32_t end, uint32_t depth) {
+    uint32_t anchor = start;
+    uint32_t ip = start;
+
+    while (ip + ZSTD_MIN_MATCH <= end) {
+        uint32_t len = 0;
+        uint32_t offset = 0;
+        uint32_t offset_value = 0;
+        uint32_t match_start = ip;
+
+        uint32_t rep_len = zstd_rep_match(c, ip + 1, end, c->reps[0]);
+        if (rep_len >= ZSTD_MIN_MATCH) {
+            len = rep_len;
+            offset = c->reps[0];
+            offset_value = 1;
+            match_start = ip + 1;
+        }
+
+        uint32_t found_offset;
+        uint32_t found = zstd_chain_search(c, ip, end, &found_offset);
+        if (found > len) {
+            len = found;
+            offset = found_offset;
+            offset_value = found_offset + ZSTD_REP_MOVE;
+            match_start = ip;
+        }
+
+        if (len < ZSTD_MIN_MATCH) {
+            ip += 1 + ((ip - anchor) >> 8);
+            continue;
+        }
+
+        // A later start only wins if it saves more than the literal it pushes out.
+        uint32_t probe = ip;
+        for (uint32_t step = 1; step <= depth && probe + 1 + ZSTD_MIN_MATCH <= end;) {
+            probe++;
+            uint32_t rep_weight = step == 1 ? 3 : 4;
+
+            rep_len = zstd_rep_match(c, probe, end, c->reps[0]);
+            if (rep_len >= ZSTD_MIN_MATCH &&
+                zstd_match_gain(rep_len, rep_weight, 1, 0) > zstd_match_gain(len, rep_weight, offset_value, 1)) {
+                len = rep_len;
+                offset = c->reps[0];
+                offset_value = 1;
+                match_start = probe;
+            }
+
+            found = zstd_chain_search(c, probe, end, &found_offset);
+            if (found >= ZSTD_MIN_MATCH &&
+                zstd_match_gain(found, 4, found_offset + ZSTD_REP_MOVE, 0) >
+                zstd_match_gain(len, 4, offset_value, step == 1 ? 4 : 7)) {
+                len = found;
+                offset = found_offset;
+                offset_value = found_offset + ZSTD_REP_MOVE;
+                match_start = probe;
+                step = 1;
+                continue;
+            }
+            step++;
+        }
+
+        if (offset_value > ZSTD_REP_MOVE) zstd_catch_up(c, anchor, offset, &match_start, &len);
+        zstd_store_sequence(c, anchor, match_start - anchor, offset, len);
+        ip = zstd_immediate_reps(c, match_start + len, end);
+        anchor = ip;
+    }
+    zstd_store_last_literals(c, anchor, end);
+}
+
+static void zstd_cctx_free(ZstdCCtx* c) {
+    if (c->hash_table) wasm_free(c->hash_table);
+    if (c->chain_table) wasm_free(c->chain_table);
+    if (c->sequences) wasm_free(c->sequences);
+    if (c->literals) wasm_free(c->literals);
+    if (c->codes) wasm_free(c->codes);
+}
+
+static int zstd_cctx_init(ZstdCCtx* c, const ZstdLevel* params) {
+    c->params = *params;
+    c->base = 0;
+    c->window_size = 1u << params->window_log;
+    c->chain_mask = params->strategy == ZSTD_STRATEGY_FAST ? 0 : (1u << params->chain_log) - 1;
+    c->next_to_update = 0;
+    c->reps[0] = 1;
+    c->reps[1] = 4;
+    c->reps[2] = 8;
+    c->sequence_count = 0;
+    c->literal_count = 0;
+
+    c->hash_table = (uint32_t*)wasm_malloc(sizeof(uint32_t) << params->hash_log);
+    c->chain_table = params->strategy == ZSTD_STRATEGY_FAST ? 0 : (uint32_t*)wasm_malloc(sizeof(uint32_t) << params->chain_log);
+    c->sequences = (ZstdSequence*)wasm_malloc(sizeof(ZstdSequence) * ZSTD_MAX_SEQUENCES);
+    c->literals = (uint8_t*)wasm_malloc(ZSTD_BLOCK_MAX);
+    c->codes = (uint8_t*)wasm_malloc(3 * ZSTD_MAX_SEQUENCES);
+    if (!c->hash_table || (params->strategy != ZSTD_STRATEGY_FAST && !c->chain_table) ||
+        !c->sequences || !c->literals || !c->codes) {
+        zstd_cctx_free(c);
+        return 0;
+    }
+    memset(c->hash_table, 0, sizeof(uint32_t) << params->hash_log);
+    return 1;
+}
+
+// Makes the first `history` bytes of the buffer (dictionary content) matchable.
+static void zstd_load_history(ZstdCCtx* c, uint32_t history) {
+    uint32_t start = history > c->window_size ? history - c->window_size : 0;
+    if (c->params.strategy != ZSTD_STRATEGY_FAST) {
+        c->next_to_update = start;
+        return;
+    }
+    for (uint32_t p = start; p + ZSTD_MIN_MATCH <= history; p++) {
+        c->hash_table[zstd_hash4(c->base + p, c->params.hash_log)] = p + 1;
+    }
+}
+
+// Level defaults overridden by any non-zero log, then clamped. A known source size
+// shrinks the window (and with it the tables) to what the input can use.
+static void zstd_resolve_params(ZstdLevel* p, int level, int window_log, int hash_log, int chain_log,
+                                uint64_t source_size) {
+    if (level < 1 || level > ZSTD_MAX_LEVEL) level = level > ZSTD_MAX_LEVEL ? ZSTD_MAX_LEVEL : ZSTD_DEFAULT_LEVEL;
+    *p = zstd_levels[level];
+    if (window_log > 0) p->window_log = (uint8_t)window_log;
+    if (hash_log > 0) p->hash_log = (uint8_t)hash_log;
+    if (chain_log > 0) p->chain_log = (uint8_t)chain_log;
+
+    if (p->window_log < ZSTD_WINDOWLOG_MIN) p->window_log = ZSTD_WINDOWLOG_MIN;
+    if (p->window_log > ZSTD_WINDOWLOG_MAX) p->window_log = ZSTD_WINDOWLOG_MAX;
+    if (source_size != ZSTD_CONTENTSIZE_UNKNOWN) {
+        while (p->window_log > ZSTD_WINDOWLOG_MIN && (1ull << (p->window_log - 1)) >= source_size) p->window_log--;
+    }
+    if (p->hash_log > p->window_log + 1) p->hash_log = (uint8_t)(p->window_log + 1);
+    if (p->hash_log < ZSTD_HASHLOG_MIN) p->hash_log = ZSTD_HASHLOG_MIN;
+    if (p->hash_log > ZSTD_HASHLOG_MAX) p->hash_log = ZSTD_HASHLOG_MAX;
+    if (p->chain_log > p->window_log) p->chain_log = p->window_log;
+    if (p->chain_log < ZSTD_HASHLOG_MIN) p->chain_log = ZSTD_HASHLOG_MIN;
+}
+
+static inline uint32_t zstd_block_size(const ZstdCCtx* c) {
+    return c->window_size < ZSTD_BLOCK_MAX ? c->window_size : ZSTD_BLOCK_MAX;
+}
+
+// Compresses base[start, end) as one block, falling back to an RLE or raw block when
+// that is smaller. Returns the bytes written including the block header, 0 on overflow.
+static size_t zstd_compress_block(ZstdCCtx* c, uint32_t start, uint32_t end, int last, uint8_t* out, size_t capacity) {
+    const uint8_t* src = c->base + start;
+    uint32_t size = end - start;
+    if (capacity < 3) return 0;
+
+    uint32_t run = 1;
+    while (run < size && src[run] == src[0]) run++;
+    if (size > 1 && run == size) {
+        if (capacity < 4) return 0;
+        zstd_write_le(out, (uint32_t)last | (1u << 1) | (size << 3), 3);
+        out[3] = src[0];
+        return 4;
+    }
+
+    if (size >= ZSTD_MIN_MATCH * 2) {
+        uint32_t saved_reps[3] = { c->reps[0], c->reps[1], c->reps[2] };
+        c->sequence_count = 0;
+        c->literal_count = 0;
+        switch (c->params.strategy) {
+            case ZSTD_STRATEGY_FAST: zstd_parse_fast(c, start, end); break;
+            case ZSTD_STRATEGY_GREEDY: zstd_parse_lazy(c, start, end, 0); break;
+            case ZSTD_STRATEGY_LAZY: zstd_parse_lazy(c, start, end, 1); break;
+            default: zstd_parse_lazy(c, start, end, 2); break;
+        }
+
+        size_t limit = capacity - 3 < size ? capacity - 3 : size;
+        size_t literals = zstd_encode_literals(out + 3, limit, c->literals, c->literal_count);
+        size_t sequences = literals ? zstd_encode_sequences(out + 3 + literals, limit - literals, c->sequences,
+                                                            c->sequence_count, c->codes) : 0;
+        if (sequences && literals + sequences < size) {
+            uint32_t body = (uint32_t)(literals + sequences);
+            zstd_write_le(out, (uint32_t)last | (2u << 1) | (body << 3), 3);
+            return 3 + body;
+        }
+        c->reps[0] = saved_reps[0];
+        c->reps[1] = saved_reps[1];
+        c->reps[2] = saved_reps[2];
+    }
+
+    if (capacity - 3 < size) return 0;
+    zstd_write_le(out, (uint32_t)last | (size << 3), 3);
+    memcpy(out + 3, src, size);
+    return 3 + size;
+}
+
+// Frame header (RFC 8878, 3.1.1.1). A known content size that fits the window makes a
+// single-segment frame; otherwise a window descriptor is written. Returns its size.
+static size_t zstd_write_frame_header(uint8_t* out, size_t capacity, uint32_t window_log, uint64_t content_size) {
+    if (capacity < 18) return 0;
+    int known = content_size != ZSTD_CONTENTSIZE_UNKNOWN;
+    int single_segment = known && content_size <= (1ull << window_log);
+    uint32_t fcs_code = !known ? 0
+                      : content_size >= 0xFFFFFFFFull ? 3
+                      : content_size >= 65536 + 256 ? 2
+                      : content_size >= 256 ? 1 : 0;
+    static const uint8_t fcs_bytes[4] = { 0, 2, 4, 8 };
+
+    size_t pos = 0;
+    zstd_write_le(out, ZSTD_MAGIC, 4);
+    pos += 4;
+    out[pos++] = (uint8_t)((fcs_code << 6) | (single_segment << 5) | (1u << 2));
+    if (!single_segment) out[pos++] = (uint8_t)((window_log - ZSTD_WINDOWLOG_MIN) << 3);
+    if (known && (fcs_code || single_segment)) {
+        uint32_t bytes = fcs_code ? fcs_bytes[fcs_code] : 1;
+        zstd_write_le(out + pos, fcs_code == 1 ? content_size - 256 : content_size, bytes);
+        pos += bytes;
+    }
+    return pos;
+}
+
+// Worst case for a frame of `input_size` bytes: raw blocks plus header and checksum.
+WASM_EXPORT size_t zstd_compress_bound(size_t input_size) {
+    return input_size + 3 * (input_size / ZSTD_BLOCK_MAX + 1) + 18 + 4;
+}
+
+static size_t zstd_compress_frame(const uint8_t* input, size_t input_size, const uint8_t* dict, size_t dict_size,
+                                  uint8_t* output, size_t output_capacity, const ZstdLevel* params) {
+    if ((!input && input_size) || !output) return 0;
+    if ((uint64_t)input_size + dict_size >= 0xFFFFFFFFull) return 0;
+
+    ZstdCCtx c;
+    if (!zstd_cctx_init(&c, params)) return 0;
+
+    uint8_t* joined = 0;
+    if (dict_size) {
+        joined = (uint8_t*)wasm_malloc(dict_size + input_size);
+        if (!joined) {
+            zstd_cctx_free(&c);
+            return 0;
+        }
+        memcpy(joined, dict, dict_size);
+        if (input_size) memcpy(joined + dict_size, input, input_size);
+        c.base = joined;
+        zstd_load_history(&c, (uint32_t)dict_size);
+    } else {
+        c.base = input;
+    }
+
+    size_t pos = zstd_write_frame_header(output, output_capacity, params->window_log, input_size);
+    uint32_t block = zstd_block_size(&c);
+    uint32_t begin = (uint32_t)dict_size;
+    uint32_t end = (uint32_t)(dict_size + input_size);
+    do {
+        uint32_t block_end = end - begin > block ? begin + block : end;
+        size_t written = pos ? zstd_compress_block(&c, begin, block_end, block_end == end, output + pos, output_capacity - pos) : 0;
+        pos = written ? pos + written : 0;
+        begin = block_end;
+    } while (pos && begin < end);
+
+    if (pos && output_capacity - pos >= 4) {
+        ZstdXxh64 h;
+        xxh64_init(&h);
+        xxh64_update(&h, input, input_size);
+        zstd_write_le(output + pos, (uint32_t)xxh64_digest(&h), 4);
+        pos += 4;
+    } else {
+        pos = 0;
+    }
+
+    if (joined) wasm_free(joined);
+    zstd_cctx_free(&c);
+    return pos;
+}
+
+// One zstd frame with content size and checksum. Levels run 1 (fastest) to 19;
+// window_log, hash_log and chain_log override the level's settings when non-zero.
+// Returns the frame size, 0 on error or when output_capacity is too small
+// (zstd_compress_bound() is always enough).
+WASM_EXPORT size_t zstd_compress_advanced(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level,
+    int window_log,
+    int hash_log,
+    int chain_log
+) {
+    ZstdLevel params;
+    zstd_resolve_params(&params, compression_level, window_log, hash_log, chain_log, input_size);
+    return zstd_compress_frame(input, input_size, 0, 0, output, output_capacity, &params);
+}
+
+// As zstd_compress_advanced with level defaults, priming the match finder with a raw
+// content dictionary. Decoding needs the same dictionary (zstd -D accepts it as is).
+WASM_EXPORT size_t zstd_compress_using_dict(
+    const uint8_t* input,
+    size_t input_size,
+    const uint8_t* dict,
+    size_t dict_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int compression_level
+) {
+    if (!dict) dict_size = 0;
+    ZstdLevel params;
+    zstd_resolve_params(&params, compression_level, 0, 0, 0, (uint64_t)input_size + dict_size);
+    return zstd_compress_frame(input, input_size, dict, dict_size, output, output_capacity, &params);
+}
+
+struct ZstdStream {
+    ZstdCCtx cctx;
+    uint8_t* buffer;
+    uint32_t capacity;
+    uint32_t end;
+    uint32_t compressed;
+    ZstdXxh64 checksum;
+    int header_written;
+    int finished;
+};
+
+WASM_EXPORT void zstd_stream_free(ZstdStream* stream) {
+    if (!stream) return;
+    zstd_cctx_free(&stream->cctx);
+    if (stream->buffer) wasm_free(stream->buffer);
+    wasm_free(stream);
+}
+
+// Streaming compressor producing a single frame without content size. The buffer
+// holds twice the window plus one block, so it only has to slide once per window.
+WASM_EXPORT ZstdStream* zstd_stream_create(int compression_level, const uint8_t* dict, size_t dict_size) {
+    ZstdLevel params;
+    zstd_resolve_params(&params, compression_level, 0, 0, 0, ZSTD_CONTENTSIZE_UNKNOWN);
+
+    ZstdStream* stream = (ZstdStream*)wasm_malloc(sizeof(ZstdStream));
+    if (!stream) return 0;
+    if (!zstd_cctx_init(&stream->cctx, &params)) {
+        wasm_free(stream);
+        return 0;
+    }
+
+    uint32_t window = stream->cctx.window_size;
+    stream->capacity = 2 * window + zstd_block_size(&stream->cctx);
+    stream->buffer = (uint8_t*)wasm_malloc(stream->capacity);
+    if (!stream->buffer) {
+        zstd_cctx_free(&stream->cctx);
+        wasm_free(stream);
+        return 0;
+    }
+    stream->cctx.base = stream->buffer;
+    stream->end = 0;
+    stream->header_written = 0;
+    stream->finished = 0;
+    xxh64_init(&stream->checksum);
+
+    if (dict && dict_size) {
+        size_t keep = dict_size > window ? window : dict_size;
+        memcpy(stream->buffer, dict + dict_size - keep, keep);
+        stream->end = (uint32_t)keep;
+        zstd_load_history(&stream->cctx, stream->end);
+    }
+    stream->compressed = stream->end;
+    return stream;
+}
+
+// Drops whole windows of history that no future match can reach. Shifting by a
+// multiple of the window keeps every chain slot (position & chain_mask) in place.
+static void zstd_stream_slide(ZstdStream* stream) {
+    ZstdCCtx* c = &stream->cctx;
+    uint32_t window = c->window_size;
+    if (stream->compressed < 2 * window) return;
+    uint32_t shift = ((stream->compressed - window) / window) * window;
+
+    for (uint32_t from = shift; from < stream->end; from += shift) {
+        uint32_t chunk = stream->end - from < shift ? stream->end - from : shift;
+        memcpy(stream->buffer + from - shift, stream->buffer + from, chunk);
+    }
+
+    uint32_t hash_entries = 1u << c->params.hash_log;
+    for (uint32_t i = 0; i < hash_entries; i++) {
+        c->hash_table[i] = c->hash_table[i] > shift ? c->hash_table[i] - shift : 0;
+    }
+    if (c->chain_table) {
+        for (uint32_t i = 0; i <= c->chain_mask; i++) {
+            c->chain_table[i] = c->chain_table[i] > shift ? c->chain_table[i] - shift : 0;
+        }
+    }
+    c->next_to_update = c->next_to_update > shift ? c->next_to_update - shift : 0;
+    stream->end -= shift;
+    stream->compressed -= shift;
+}
+
+// Buffers `input` and emits every complete block except the newest, which is held back
+// so zstd_stream_end() can mark it last. Returns the bytes written (possibly 0) or
+// ZSTD_STREAM_ERROR. zstd_compress_bound(input_size + ZSTD_BLOCK_MAX) of output is
+// always enough.
+WASM_EXPORT size_t zstd_stream_compress(ZstdStream* stream, const uint8_t* input, size_t input_size,
+                                        uint8_t* output, size_t output_capacity) {
+    if (!stream || stream->finished || (!input && input_size) || !output) return ZSTD_STREAM_ERROR;
+
+    ZstdCCtx* c = &stream->cctx;
+    uint32_t block = zstd_block_size(c);
+    size_t pos = 0;
+    if (!stream->header_written) {
+        pos = zstd_write_frame_header(output, output_capacity, c->params.window_log, ZSTD_CONTENTSIZE_UNKNOWN);
+        if (!pos) return ZSTD_STREAM_ERROR;
+        stream->header_written = 1;
+    }
+    xxh64_update(&stream->checksum, input, input_size);
+
+    while (input_size) {
+        if (stream->end == stream->capacity) zstd_stream_slide(stream);
+        uint32_t room = stream->capacity - stream->end;
+        uint32_t take = input_size < room ? (uint32_t)input_size : room;
+        memcpy(stream->buffer + stream->end, input, take);
+        stream->end += take;
+        input += take;
+        input_size -= take;
+
+        while (stream->end - stream->compressed > block) {
+            size_t written = zstd_compress_block(c, stream->compressed, stream->compressed + block, 0,
+                                                 output + pos, output_capacity - pos);
+            if (!written) return ZSTD_STREAM_ERROR;
+            pos += written;
+            stream->compressed += block;
+        }
+    }
+    return pos;
+}
+
+// Flushes the held-back data as the last block and appends the checksum. The stream
+// cannot be written to afterwards. Returns the bytes written or ZSTD_STREAM_ERROR.
+WASM_EXPORT size_t zstd_stream_end(ZstdStream* stream, uint8_t* output, size_t output_capacity) {
+    if (!stream || stream->finished || !output) return ZSTD_STREAM_ERROR;
+
+    ZstdCCtx* c = &stream->cctx;
+    uint32_t block = zstd_block_size(c);
+    size_t pos = 0;
+    if (!stream->header_written) {
+        pos = zstd_write_frame_header(output, output_capacity, c->params.window_log, ZSTD_CONTENTSIZE_UNKNOWN);
+        if (!pos) return ZSTD_STREAM_ERROR;
+        stream->header_written = 1;
+    }
+
+    do {
+        uint32_t block_end = stream->end - stream->compressed > block ? stream->compressed + block : stream->end;
+        size_t written = zstd_compress_block(c, stream->compressed, block_end, block_end == stream->end,
+                                             output + pos, output_capacity - pos);
+        if (!written) return ZSTD_STREAM_ERROR;
+        pos += written;
+        stream->compressed = block_end;
+    } while (stream->compressed < stream->end);
+
+    if (output_capacity - pos < 4) return ZSTD_STREAM_ERROR;
+    zstd_write_le(output + pos, (uint32_t)xxh64_digest(&stream->checksum), 4);
+    stream->finished = 1;
+    return pos + 4;
+}
+
+typedef struct {
+    uint8_t symbols[1 << ZSTD_HUF_LOG_MAX];
+    uint8_t nb_bits[1 << ZSTD_HUF_LOG_MAX];
+    uint32_t max_bits;
+} ZstdHufDTable;
+
+// Decompression state that persists across the blocks of a frame: repeat offsets and
+// the tables that Treeless literals and Repeat sequence modes refer back to.
+typedef struct {
+    ZstdFseDTable ll_table;
+    ZstdFseDTable of_table;
+    ZstdFseDTable ml_table;
+    ZstdHufDTable huf_table;
+    int tables_valid;
+    int huf_valid;
+    uint32_t reps[3];
+    uint8_t literals[ZSTD_BLOCK_MAX];
+} ZstdDCtx;
+
+// Weights behind an FSE-compressed Huffman description, decoded with two interleaved
+// states until the stream runs dry. Returns the number of weights, 0 when malformed.
+static uint32_t zstd_huf_decode_weights(const uint8_t* src, size_t size, uint8_t* weights) {
+    int16_t norm[16];
+    uint32_t max_symbol = 15;
+    uint32_t table_log;
+    size_t header = zstd_fse_read_ncount(src, size, norm, &max_symbol, &table_log, ZSTD_HUF_WEIGHT_LOG_MAX);
+    if (!header) return 0;
+
+    ZstdFseDTable dt;
+    ZstdBitReader br;
+    if (!zstd_fse_build_dtable(&dt, norm, max_symbol, table_log)) return 0;
+    if (!zstd_reader_init(&br, src + header, size - header)) return 0;
+
+    uint32_t state1 = zstd_read_bits(&br, table_log);
+    uint32_t state2 = zstd_read_bits(&br, table_log);
+    uint32_t count = 0;
+    for (;;) {
+        if (count + 2 > 255) return 0;
+        weights[count++] = dt.cells[state1].symbol;
+        state1 = dt.cells[state1].base + zstd_read_bits(&br, dt.cells[state1].nb_bits);
+        if (br.bits_left < 0) {
+            weights[count++] = dt.cells[state2].symbol;
+            break;
+        }
+        weights[count++] = dt.cells[state2].symbol;
+        state2 = dt.cells[state2].base + zstd_read_bits(&br, dt.cells[state2].nb_bits);
+        if (br.bits_left < 0) {
+            weights[count++] = dt.cells[state1].symbol;
+            break;
+        }
+    }
+    return count;
+}
+
+// Huffman tree description to decoding table. Returns the bytes consumed, 0 when malformed.
+static size_t zstd_huf_read_table(ZstdHufDTable* dt, const uint8_t* src, size_t size) {
+    uint8_t weights[256];
+    uint32_t count;
+    size_t consumed;
+    if (size < 1) return 0;
+
+    if (src[0] >= 128) {
+        count = src[0] - 127u;
+        consumed = 1 + (count + 1) / 2;
+        if (consumed > size) return 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t byte = src[1 + i / 2];
+            weights[i] = (i & 1) ? (byte & 15) : (byte >> 4);
+        }
+    } else {
+        consumed = 1 + (size_t)src[0];
+        if (consumed > size) return 0;
+        count = zstd_huf_decode_weights(src + 1, src[0], weights);
+        if (!count) return 0;
+    }
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (weights[i] > ZSTD_HUF_LOG_MAX) return 0;
+        if (weights[i]) total += 1u << (weights[i] - 1);
+    }
+    if (!total) return 0;
+    uint32_t max_bits = zstd_highbit(total) + 1;
+    uint32_t rest = (1u << max_bits) - total;
+    if (max_bits > ZSTD_HUF_LOG_MAX || (rest & (rest - 1))) return 0;
+    weights[count++] = (uint8_t)(zstd_highbit(rest) + 1);
+
+    uint32_t rank_start[ZSTD_HUF_LOG_MAX + 2] = {0};
+    for (uint32_t s = 0; s < count; s++) {
+        if (weights[s]) rank_start[weights[s] + 1] += 1u << (weights[s] - 1);
+    }
+    for (uint32_t w = 2; w <= max_bits + 1; w++) rank_start[w] += rank_start[w - 1];
+    for (uint32_t s = 0; s < count; s++) {
+        uint32_t w = weights[s];
+        if (!w) continue;
+        uint32_t span = 1u << (w - 1);
+        for (uint32_t i = rank_start[w]; i < rank_start[w] + span; i++) {
+            dt->symbols[i] = (uint8_t)s;
+            dt->nb_bits[i] = (uint8_t)(max_bits + 1 - w);
+        }
+        rank_start[w] += span;
+    }
+    dt->max_bits = max_bits;
+    return consumed;
+}
+
+static int zstd_huf_decode_stream(const ZstdHufDTable* dt, const uint8_t* src, size_t size, uint8_t* out, size_t count) {
+    ZstdBitReader br;
+    if (!zstd_reader_init(&br, src, size)) return 0;
+    uint32_t max_bits = dt->max_bits;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t index = zstd_bits_at(&br, br.bits_left - max_bits, max_bits);
+        out[i] = dt->symbols[index];
+        br.bits_left -= dt->nb_bits[index];
+    }
+    return br.bits_left == 0;
+}
+
+// Literals section. Raw literals are left in place; everything else is decoded into
+// d->literals. Returns the bytes consumed, 0 when malformed.
+static size_t zstd_decode_literals(ZstdDCtx* d, const uint8_t* src, size_t size,
+                                   const uint8_t** literals, size_t* literal_count) {
+    if (size < 1) return 0;
+    uint32_t type = src[0] & 3;
+    uint32_t size_format = (src[0] >> 2) & 3;
+
+    if (type <= 1) {
+        size_t header = (size_format & 1) ? size_format == 1 ? 2 : 3 : 1;
+        if (header > size) return 0;
+        uint32_t count = header == 1 ? src[0] >> 3
+                       : header == 2 ? (uint32_t)(src[0] >> 4) | ((uint32_t)src[1] << 4)
+                       : (uint32_t)(src[0] >> 4) | ((uint32_t)src[1] << 4) | ((uint32_t)src[2] << 12);
+        if (count > ZSTD_BLOCK_MAX) return 0;
+        *literal_count = count;
+        if (type == 0) {
+            if (header + count > size) return 0;
+            *literals = src + header;
+            return header + count;
+        }
+        if (header + 1 > size) return 0;
+        memset(d->literals, src[header], count);
+        *literals = d->literals;
+        return header + 1;
+    }
+
+    size_t header = size_format <= 1 ? 3 : size_format == 2 ? 4 : 5;
+    if (header > size) return 0;
+    uint64_t value = 0;
+    for (size_t i = 0; i < header; i++) value |= (uint64_t)src[i] << (8 * i);
+    uint32_t bits = header == 3 ? 10 : header == 4 ? 14 : 18;
+    uint32_t count = (uint32_t)(value >> 4) & ((1u << bits) - 1);
+    size_t compressed = (size_t)(value >> (4 + bits)) & ((1u << bits) - 1);
+    if (count > ZSTD_BLOCK_MAX || header + compressed > size) return 0;
+
+    const uint8_t* p = src + header;
+    size_t left = compressed;
+    if (type == 2) {
+        size_t table = zstd_huf_read_table(&d->huf_table, p, left);
+        if (!table) return 0;
+        d->huf_valid = 1;
+        p += table;
+        left -= table;
+    } else if (!d->huf_valid) {
+        return 0;
+    }
+
+    if (size_format == 0) {
+        if (!zstd_huf_decode_stream(&d->huf_table, p, left, d->literals, count)) return 0;
+    } else {
+        if (left < 6) return 0;
+        size_t sizes[4];
+        sizes[0] = (size_t)p[0] | ((size_t)p[1] << 8);
+        sizes[1] = (size_t)p[2] | ((size_t)p[3] << 8);
+        sizes[2] = (size_t)p[4] | ((size_t)p[5] << 8);
+        p += 6;
+        left -= 6;
+        if (sizes[0] + sizes[1] + sizes[2] > left) return 0;
+        sizes[3] = left - sizes[0] - sizes[1] - sizes[2];
+
+        size_t segment = (count + 3) / 4;
+        if (segment * 3 > count) return 0;
+        for (int k = 0; k < 4; k++) {
+            size_t begin = segment * (size_t)k;
+            size_t len = k < 3 ? segment : count - begin;
+            if (!zstd_huf_decode_stream(&d->huf_table, p, sizes[k], d->literals + begin, len)) return 0;
+            p += sizes[k];
+        }
+    }
+    *literals = d->literals;
+    *literal_count = count;
+    return header + compressed;
+}
+
+// Reads one of the three sequence tables per its compression mode. Returns the bytes
+// consumed (possibly 0), or -1 when malformed.
+static int32_t zstd_read_sequence_table(ZstdFseDTable* dt, uint32_t mode, const uint8_t* src, size_t size,
+                                        const int16_t* default_norm, uint32_t default_max, uint32_t default_log,
+                                        uint32_t max_symbol, uint32_t max_log, int valid) {
+    int16_t norm[ZSTD_FSE_SYMBOLS_MAX];
+    uint32_t table_log;
+    switch (mode) {
+        case ZSTD_MODE_PREDEFINED:
+            zstd_fse_build_dtable(dt, default_norm, default_max, default_log);
+            return 0;
+        case ZSTD_MODE_RLE:
+            if (size < 1 || src[0] > max_symbol) return -1;
+            zstd_fse_build_dtable_rle(dt, src[0]);
+            return 1;
+        case ZSTD_MODE_FSE: {
+            size_t header = zstd_fse_read_ncount(src, size, norm, &max_symbol, &table_log, max_log);
+            if (!header || !zstd_fse_build_dtable(dt, norm, max_symbol, table_log)) return -1;
+            return (int32_t)header;
+        }
+        default:
+            return valid ? 0 : -1;
+    }
+}
+
+// Copies `length` bytes from `offset` back, reaching into the dictionary for the part
+// that precedes the frame's own output.
+static int zstd_copy_match(uint8_t* dst, size_t op, size_t frame_start, uint32_t offset, uint32_t length,
+                           const uint8_t* dict, size_t dict_size) {
+    size_t produced = op - frame_start;
+    if (offset > produced) {
+        size_t back = offset - produced;
+        if (back > dict_size) return 0;
+        size_t from_dict = back < length ? back : length;
+        memcpy(dst + op, dict + dict_size - back, from_dict);
+        op += from_dict;
+        length -= (uint32_t)from_dict;
+        for (size_t i = 0; i < length; i++) dst[op + i] = dst[frame_start + i];
+        return 1;
+    }
+    const uint8_t* match = dst + op - offset;
+    if (offset >= length) {
+        memcpy(dst + op, match, length);
+    } else {
+        for (uint32_t i = 0; i < length; i++) dst[op + i] = match[i];
+    }
+    return 1;
+}
+
+// Decodes one compressed block into dst at *op. Returns 1 on success.
+static int zstd_decode_block(ZstdDCtx* d, const uint8_t* src, size_t size, uint8_t* dst, size_t* op,
+                             size_t capacity, size_t frame_start, const uint8_t* dict, size_t dict_size) {
+    const uint8_t* literals;
+    size_t literal_count;
+    size_t pos = zstd_decode_literals(d, src, size, &literals, &literal_count);
+    if (!pos || pos >= size) return 0;
+
+    uint32_t seq_count = src[pos];
+    if (seq_count == 0) {
+        pos++;
+    } else if (seq_count < 128) {
+        pos++;
+    } else if (seq_count < 255) {
+        if (pos + 2 > size) return 0;
+        seq_count = ((seq_count - 128) << 8) + src[pos + 1];
+        pos += 2;
+    } else {
+        if (pos + 3 > size) return 0;
+        seq_count = (uint32_t)src[pos + 1] + ((uint32_t)src[pos + 2] << 8) + 0x7F00;
+        pos += 3;
+    }
+
+    size_t out = *op;
+    size_t block_start = out;
+    size_t lit_pos = 0;
+
+    if (seq_count) {
+        if (pos >= size) return 0;
+        uint32_t modes = src[pos++];
+        if (modes & 3) return 0;
+        int32_t used;
+        used = zstd_read_sequence_table(&d->ll_table, modes >> 6, src + pos, size - pos, zstd_ll_default_norm,
+                                        ZSTD_LL_MAX, ZSTD_LL_DEFAULT_LOG, ZSTD_LL_MAX, ZSTD_LL_LOG_MAX, d->tables_valid);
+        if (used < 0) return 0;
+        pos += (size_t)used;
+        used = zstd_read_sequence_table(&d->of_table, (modes >> 4) & 3, src + pos, size - pos, zstd_of_default_norm,
+                                        ZSTD_OF_DEFAULT_MAX, ZSTD_OF_DEFAULT_LOG, ZSTD_OF_MAX, ZSTD_OF_LOG_MAX, d->tables_valid);
+        if (used < 0) return 0;
+        pos += (size_t)used;
+        used = zstd_read_sequence_table(&d->ml_table, (modes >> 2) & 3, src + pos, size - pos, zstd_ml_default_norm,
+                                        ZSTD_ML_MAX, ZSTD_ML_DEFAULT_LOG, ZSTD_ML_MAX, ZSTD_ML_LOG_MAX, d->tables_valid);
+        if (used < 0) return 0;
+        pos += (size_t)used;
+        d->tables_valid = 1;
+
+        ZstdBitReader br;
+        if (!zstd_reader_init(&br, src + pos, size - pos)) return 0;
+        uint32_t ll_state = zstd_read_bits(&br, d->ll_table.table_log);
+        uint32_t of_state = zstd_read_bits(&br, d->of_table.table_log);
+        uint32_t ml_state = zstd_read_bits(&br, d->ml_table.table_log);
+        uint32_t* r = d->reps;
+
+        for (uint32_t i = 0; i < seq_count; i++) {
+            const ZstdFseCell* llc = &d->ll_table.cells[ll_state];
+            const ZstdFseCell* ofc = &d->of_table.cells[of_state];
+            const ZstdFseCell* mlc = &d->ml_table.cells[ml_state];
+            if (ofc->symbol > ZSTD_OF_MAX) return 0;
+
+            uint32_t offset_value = (1u << ofc->symbol) + zstd_read_bits(&br, ofc->symbol);
+            uint32_t match_len = zstd_ml_base[mlc->symbol] + zstd_read_bits(&br, zstd_ml_bits[mlc->symbol]);
+            uint32_t lit_len = zstd_ll_base[llc->symbol] + zstd_read_bits(&br, zstd_ll_bits[llc->symbol]);
+
+            uint32_t offset;
+            if (offset_value > ZSTD_REP_MOVE) {
+                offset = offset_value - ZSTD_REP_MOVE;
+                r[2] = r[1];
+                r[1] = r[0];
+                r[0] = offset;
+            } else {
+                uint32_t rep_index = offset_value - (lit_len ? 1 : 0);
+                if (rep_index == 0) {
+                    offset = r[0];
+                } else {
+                    offset = rep_index == 3 ? r[0] - 1 : r[rep_index];
+                    if (!offset) return 0;
+                    if (rep_index != 1) r[2] = r[1];
+                    r[1] = r[0];
+                    r[0] = offset;
+                }
+            }
+
+            if (i + 1 < seq_count) {
+                ll_state = llc->base + zstd_read_bits(&br, llc->nb_bits);
+                ml_state = mlc->base + zstd_read_bits(&br, mlc->nb_bits);
+                of_state = ofc->base + zstd_read_bits(&br, ofc->nb_bits);
+            }
+
+            if (lit_len > literal_count - lit_pos) return 0;
+            if ((uint64_t)lit_len + match_len > capacity - out) return 0;
+            memcpy(dst + out, literals + lit_pos, lit_len);
+            out += lit_len;
+            lit_pos += lit_len;
+            if (!zstd_copy_match(dst, out, frame_start, offset, match_len, dict, dict_size)) return 0;
+            out += match_len;
+        }
+        if (br.bits_left != 0) return 0;
+    } else if (pos != size) {
+        return 0;
+    }
+
+    size_t rest = literal_count - lit_pos;
+    if (rest > capacity - out) return 0;
+    memcpy(dst + out, literals + lit_pos, rest);
+    out += rest;
+    if (out - block_start > ZSTD_BLOCK_MAX) return 0;
+    *op = out;
+    return 1;
+}
+
+typedef struct {
+    uint64_t content_size;
+    uint32_t dict_id;
+    uint32_t header_size;
+    int checksum;
+} ZstdFrameHeader;
+
+// Parses a frame header at src (after the magic number). Returns 1 on success.
+static int zstd_read_frame_header(const uint8_t* src, size_t size, ZstdFrameHeader* fh) {
+    static const uint8_t dict_id_bytes[4] = { 0, 1, 2, 4 };
+    static const uint8_t fcs_bytes[4] = { 0, 2, 4, 8 };
+    if (size < 1) return 0;
+    uint32_t descriptor = src[0];
+    if (descriptor & 0x08) return 0;
+
+    uint32_t single_segment = (descriptor >> 5) & 1;
+    uint32_t fcs_code = descriptor >> 6;
+    size_t pos = 1 + (single_segment ? 0 : 1);
+    size_t id_size = dict_id_bytes[descriptor & 3];
+    size_t fcs_size = fcs_code ? fcs_bytes[fcs_code] : single_segment;
+    if (pos + id_size + fcs_size > size) return 0;
+    if (!single_segment && (src[1] >> 3) + ZSTD_WINDOWLOG_MIN > 31) return 0;
+
+    fh->dict_id = 0;
+    for (size_t i = 0; i < id_size; i++) fh->dict_id |= (uint32_t)src[pos + i] << (8 * i);
+    pos += id_size;
+    if (fcs_size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < fcs_size; i++) value |= (uint64_t)src[pos + i] << (8 * i);
+        fh->content_size = fcs_code == 1 ? value + 256 : value;
+    } else {
+        fh->content_size = ZSTD_CONTENTSIZE_UNKNOWN;
+    }
+    pos += fcs_size;
+    fh->header_size = (uint32_t)pos;
+    fh->checksum = (descriptor >> 2) & 1;
+    return 1;
+}
+
+// Decodes every frame in the input (skippable frames are skipped). Frames with a
+// dictionary ID need the dictionary passed in; raw content dictionaries carry no ID.
+static size_t zstd_decompress_frames(ZstdDCtx* d, const uint8_t* src, size_t size, uint8_t* dst, size_t capacity,
+                                     const uint8_t* dict, size_t dict_size, int* ok) {
+    size_t ip = 0;
+    size_t op = 0;
+    *ok = 0;
+
+    while (ip < size) {
+        if (size - ip < 4) return 0;
+        uint32_t magic = zstd_read_le32(src + ip);
+        if ((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+            if (size - ip < 8) return 0;
+            uint32_t skip = zstd_read_le32(src + ip + 4);
+            if (skip > size - ip - 8) return 0;
+            ip += 8 + (size_t)skip;
+            continue;
+        }
+        if (magic != ZSTD_MAGIC) return 0;
+        ip += 4;
+
+        ZstdFrameHeader fh;
+        if (!zstd_read_frame_header(src + ip, size - ip, &fh)) return 0;
+        if (fh.dict_id && !dict_size) return 0;
+        ip += fh.header_size;
+
+        size_t frame_start = op;
+        d->reps[0] = 1;
+        d->reps[1] = 4;
+        d->reps[2] = 8;
+        d->tables_valid = 0;
+        d->huf_valid = 0;
+
+        int last;
+        do {
+            if (size - ip < 3) return 0;
+            uint32_t header = (uint32_t)src[ip] | ((uint32_t)src[ip + 1] << 8) | ((uint32_t)src[ip + 2] << 16);
+            uint32_t type = (header >> 1) & 3;
+            uint32_t block_size = header >> 3;
+            last = header & 1;
+            ip += 3;
+
+            if (type == 0) {
+                if (block_size > size - ip || block_size > capacity - op) return 0;
+                memcpy(dst + op, src + ip, block_size);
+                ip += block_size;
+                op += block_size;
+            } else if (type == 1) {
+                if (size - ip < 1 || block_size > capacity - op) return 0;
+                memset(dst + op, src[ip], block_size);
+                ip += 1;
+                op += block_size;
+            } else if (type == 2) {
+                if (block_size > ZSTD_BLOCK_MAX || block_size > size - ip) return 0;
+                if (!zstd_decode_block(d, src + ip, block_size, dst, &op, capacity, frame_start, dict, dict_size)) return 0;
+                ip += block_size;
+            } else {
+                return 0;
+            }
+        } while (!last);
+
+        if (fh.content_size != ZSTD_CONTENTSIZE_UNKNOWN && fh.content_size != op - frame_start) return 0;
+        if (fh.checksum) {
+            if (size - ip < 4) return 0;
+            ZstdXxh64 h;
+            xxh64_init(&h);
+            xxh64_update(&h, dst + frame_start, op - frame_start);
+            if ((uint32_t)xxh64_digest(&h) != zstd_read_le32(src + ip)) return 0;
+            ip += 4;
+        }
+    }
+    *ok = 1;
+    return op;
+}
+
+// Decodes zstd frames from any conforming encoder, using a raw content dictionary when
+// one is given. Returns the decompressed size, 0 on malformed input or when the output
+// does not fit (zstd_get_frame_content_size() gives the size when the frame records it).
+WASM_EXPORT size_t zstd_decompress_using_dict(
+    const uint8_t* input,
+    size_t input_size,
+    const uint8_t* dict,
+    size_t dict_size,
+    uint8_t* output,
+    size_t output_capacity
+) {
+    if (!input || !input_size || (!output && output_capacity)) return 0;
+    if (!dict) dict_size = 0;
+
+    ZstdDCtx* d = (ZstdDCtx*)wasm_malloc(sizeof(ZstdDCtx));
+    if (!d) return 0;
+    int ok;
+    size_t written = zstd_decompress_frames(d, input, input_size, output, output_capacity, dict, dict_size, &ok);
+    wasm_free(d);
+    return ok ? written : 0;
+}
+
+WASM_EXPORT size_t zstd_decompress(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity
+) {
+    return zstd_decompress_using_dict(input, input_size, 0, 0, output, output_capacity);
+}
+
+// Content size recorded in the first zstd frame, ZSTD_CONTENTSIZE_UNKNOWN when the
+// frame (e.g. a streamed one) does not record it, or ZSTD_CONTENTSIZE_ERROR.
+WASM_EXPORT uint64_t zstd_get_frame_content_size(const uint8_t* input, size_t input_size) {
+    size_t ip = 0;
+    while (input && input_size - ip >= 8) {
+        uint32_t magic = zstd_read_le32(input + ip);
+        if ((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC) {
+            uint32_t skip = zstd_read_le32(input + ip + 4);
+            if (skip > input_size - ip - 8) break;
+            ip += 8 + (size_t)skip;
+            continue;
+        }
+        if (magic != ZSTD_MAGIC) break;
+        ZstdFrameHeader fh;
+        if (!zstd_read_frame_header(input + ip + 4, input_size - ip - 4, &fh)) break;
+        return fh.content_size;
+    }
+    return ZSTD_CONTENTSIZE_ERROR;
+}
+
+// LZ4 frame format as written by the lz4 CLI: independent blocks of a fixed maximum
+// size, each followed by its XXH32, then an end mark and the XXH32 of the content.
+// Blocks never reference each other, so any block can be encoded or decoded alone.
+#define LZ4F_MAGIC 0x184D2204u
+#define LZ4F_SKIPPABLE_MAGIC 0x184D2A50u
+#define LZ4F_SKIPPABLE_MASK 0xFFFFFFF0u
+#define LZ4F_BLOCK_UNCOMPRESSED 0x80000000u
+#define LZ4F_HEADER_MAX 15
+#define LZ4F_FLG_VERSION 0x40
+#define LZ4F_FLG_BLOCK_INDEPENDENT 0x20
+#define LZ4F_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4F_FLG_CONTENT_SIZE 0x08
+#define LZ4F_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4F_FLG_DICT_ID 0x01
+
+static inline uint32_t lz4f_read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void lz4f_write_le32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+// XXH32, which the frame uses for header, block and content checksums.
+#define XXH32_P1 2654435761u
+#define XXH32_P2 2246822519u
+#define XXH32_P3 3266489917u
+#define XXH32_P4 668265263u
+#define XXH32_P5 374761393u
+
+typedef struct {
+    uint32_t v[4];
+    uint32_t total_len;
+    uint32_t large;
+    uint8_t buffer[16];
+    uint32_t buffered;
+} Lz4Xxh32;
+
+static inline uint32_t xxh32_round(uint32_t acc, uint32_t input) {
+    acc += input * XXH32_P2;
+    return rotl32(acc, 13) * XXH32_P1;
+}
+
+static void xxh32_init(Lz4Xxh32* h) {
+    h->v[0] = XXH32_P1 + XXH32_P2;
+    h->v[1] = XXH32_P2;
+    h->v[2] = 0;
+    h->v[3] = 0 - XXH32_P1;
+    h->total_len = 0;
+    h->large = 0;
+    h->buffered = 0;
+}
+
+static void xxh32_update(Lz4Xxh32* h, const uint8_t* data, size_t size) {
+    h->total_len += (uint32_t)size;
+    h->large |= (size >= 16) | (h->total_len >= 16);
+    if (h->buffered + size < 16) {
+        memcpy(h->buffer + h->buffered, data, size);
+        h->buffered += (uint32_t)size;
+        return;
+    }
+    if (h->buffered) {
+        uint32_t fill = 16 - h->buffered;
+        memcpy(h->buffer + h->buffered, data, fill);
+        for (int i = 0; i < 4; i++) h->v[i] = xxh32_round(h->v[i], lz4f_read_le32(h->buffer + 4 * i));
+        data += fill;
+        size -= fill;
+        h->buffered = 0;
+    }
+    while (size >= 16) {
+        for (int i = 0; i < 4; i++) h->v[i] = xxh32_round(h->v[i], lz4f_read_le32(data + 4 * i));
+        data += 16;
+        size -= 16;
+    }
+    if (size) memcpy(h->buffer, data, size);
+    h->buffered = (uint32_t)size;
+}
+
+static uint32_t xxh32_digest(const Lz4Xxh32* h) {
+    uint32_t acc;
+    if (h->large) {
+        acc = rotl32(h->v[0], 1) + rotl32(h->v[1], 7) + rotl32(h->v[2], 12) + rotl32(h->v[3], 18);
+    } else {
+        acc = h->v[2] + XXH32_P5;
+    }
+    acc += h->total_len;
+
+    const uint8_t* p = h->buffer;
+    uint32_t left = h->buffered;
+    for (; left >= 4; p += 4, left -= 4) {
+        acc += lz4f_read_le32(p) * XXH32_P3;
+        acc = rotl32(acc, 17) * XXH32_P4;
+    }
+    for (; left; p++, left--) {
+        acc += *p * XXH32_P5;
+        acc = rotl32(acc, 11) * XXH32_P1;
+    }
+
+    acc ^= acc >> 15;
+    acc *= XXH32_P2;
+    acc ^= acc >> 13;
+    acc *= XXH32_P3;
+    acc ^= acc >> 16;
+    return acc;
+}
+
+static uint32_t xxh32_oneshot(const uint8_t* data, size_t size) {
+    Lz4Xxh32 h;
+    xxh32_init(&h);
+    xxh32_update(&h, data, size);
+    return xxh32_digest(&h);
+}
+
+typedef struct {
+    uint8_t flags;
+    size_t block_bytes;
+    uint64_t content_size;
+} Lz4FrameHeader;
+
+// Largest block a frame with this BD id may hold, 0 for an invalid id.
+static size_t lz4f_block_bytes(int block_size_id) {
+    if (block_size_id < LZ4F_BLOCK_64KB || block_size_id > LZ4F_BLOCK_4MB) return 0;
+    return (size_t)1 << (16 + 2 * (block_size_id - LZ4F_BLOCK_64KB));
+}
+
+// Frame descriptor length (FLG through HC) implied by the FLG byte.
+static inline size_t lz4f_descriptor_size(uint8_t flg) {
+    return 3 + ((flg & LZ4F_FLG_CONTENT_SIZE) ? 8 : 0) + ((flg & LZ4F_FLG_DICT_ID) ? 4 : 0);
+}
+
+// Validates the descriptor that follows the magic number. Returns its length, or 0 when
+// it is truncated, corrupt or uses features this decoder lacks (linked blocks, dictionaries).
+static size_t lz4f_read_header(const uint8_t* src, size_t size, Lz4FrameHeader* fh) {
+    if (size < 3) return 0;
+    uint8_t flg = src[0];
+    uint8_t bd = src[1];
+    size_t length = lz4f_descriptor_size(flg);
+    if (size < length) return 0;
+    if ((flg & 0xC2) != LZ4F_FLG_VERSION || (bd & 0x8F)) return 0;
+    if (!(flg & LZ4F_FLG_BLOCK_INDEPENDENT) || (flg & LZ4F_FLG_DICT_ID)) return 0;
+    if ((uint8_t)(xxh32_oneshot(src, length - 1) >> 8) != src[length - 1]) return 0;
+
+    fh->flags = flg;
+    fh->block_bytes = lz4f_block_bytes(bd >> 4);
+    if (!fh->block_bytes) return 0;
+    fh->content_size = LZ4F_CONTENTSIZE_UNKNOWN;
+    if (flg & LZ4F_FLG_CONTENT_SIZE) {
+        fh->content_size = (uint64_t)lz4f_read_le32(src + 2) | ((uint64_t)lz4f_read_le32(src + 6) << 32);
+    }
+    return length;
+}
+
+static size_t lz4f_write_header(uint8_t* out, size_t capacity, int block_size_id, uint64_t content_size) {
+    int known = content_size != LZ4F_CONTENTSIZE_UNKNOWN;
+    size_t size = 4 + 3 + (known ? 8 : 0);
+    if (capacity < size) return 0;
+
+    lz4f_write_le32(out, LZ4F_MAGIC);
+    out[4] = LZ4F_FLG_VERSION | LZ4F_FLG_BLOCK_INDEPENDENT | LZ4F_FLG_BLOCK_CHECKSUM |
+             LZ4F_FLG_CONTENT_CHECKSUM | (known ? LZ4F_FLG_CONTENT_SIZE : 0);
+    out[5] = (uint8_t)(block_size_id << 4);
+    if (known) {
+        lz4f_write_le32(out + 6, (uint32_t)content_size);
+        lz4f_write_le32(out + 10, (uint32_t)(content_size >> 32));
+    }
+    out[size - 1] = (uint8_t)(xxh32_oneshot(out + 4, size - 5) >> 8);
+    return size;
+}
+
+// One block: LZ4 when that is smaller than the input, stored otherwise, then its
+// checksum. Needs src_size + 8 bytes of output.
+static size_t lz4f_write_block(LZ4_stream_t* ctx, const uint8_t* src, size_t src_size,
+                               uint8_t* out, size_t capacity) {
+    if (capacity < src_size + 8) return 0;
+
+    memset(ctx->table, 0, sizeof(ctx->table));
+    size_t size = src_size > 1
+        ? lz4_compress_generic(ctx, (const char*)src, (char*)out + 4, src_size, src_size - 1, LZ4_ACCELERATION_DEFAULT)
+        : 0;
+    uint32_t field = (uint32_t)size;
+    if (!size) {
+        memcpy(out + 4, src, src_size);
+        size = src_size;
+        field = (uint32_t)size | LZ4F_BLOCK_UNCOMPRESSED;
+    }
+    lz4f_write_le32(out, field);
+    lz4f_write_le32(out + 4 + size, xxh32_oneshot(out + 4, size));
+    return size + 8;
+}
+
+static inline size_t lz4f_resolve_block_id(int block_size_id) {
+    return block_size_id ? (size_t)block_size_id : LZ4F_BLOCK_DEFAULT;
+}
+
+// Output that always suffices for lz4_frame_compress() of input_size bytes. A single
+// lz4_frame_stream_compress() call needs at most the bound of input_size plus one block.
+WASM_EXPORT size_t lz4_frame_compress_bound(size_t input_size, int block_size_id) {
+    size_t block = lz4f_block_bytes((int)lz4f_resolve_block_id(block_size_id));
+    if (!block) return 0;
+    return LZ4F_HEADER_MAX + input_size + (input_size / block + 1) * 8 + 8;
+}
+
+// Whole input as one frame recording its content size. block_size_id is one of the
+// LZ4F_BLOCK_* ids, or 0 for LZ4F_BLOCK_DEFAULT. Returns the frame size, 0 on error.
+WASM_EXPORT size_t lz4_frame_compress(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity,
+    int block_size_id
+) {
+    if ((!input && input_size) || !output) return 0;
+    block_size_id = (int)lz4f_resolve_block_id(block_size_id);
+    size_t block = lz4f_block_bytes(block_size_id);
+    if (!block) return 0;
+
+    size_t pos = lz4f_write_header(output, output_capacity, block_size_id, input_size);
+    if (!pos) return 0;
+
+    LZ4_stream_t ctx;
+    for (size_t offset = 0; offset < input_size; offset += block) {
+        size_t n = input_size - offset < block ? input_size - offset : block;
+        size_t written = lz4f_write_block(&ctx, input + offset, n, output + pos, output_capacity - pos);
+        if (!written) return 0;
+        pos += written;
+    }
+
+    if (output_capacity - pos < 8) return 0;
+    lz4f_write_le32(output + pos, 0);
+    lz4f_write_le32(output + pos + 4, xxh32_oneshot(input, input_size));
+    return pos + 8;
+}
+
+// Decodes every frame in `input`, skipping skippable frames, and verifies all
+// checksums. Returns the decompressed size (0 for empty frames), or LZ4F_ERROR on
+// malformed input or when the output does not fit (lz4_frame_content_size() gives the
+// size when the frame records it).
+WASM_EXPORT size_t lz4_frame_decompress(
+    const uint8_t* input,
+    size_t input_size,
+    uint8_t* output,
+    size_t output_capacity
+) {
+    if (!input || !input_size || (!output && output_capacity)) return LZ4F_ERROR;
+
+    size_t ip = 0;
+    size_t op = 0;
+    int frames = 0;
+    while (ip < input_size) {
+        if (input_size - ip < 4) return LZ4F_ERROR;
+        uint32_t magic = lz4f_read_le32(input + ip);
+        if ((magic & LZ4F_SKIPPABLE_MASK) == LZ4F_SKIPPABLE_MAGIC) {
+            if (input_size - ip < 8) return LZ4F_ERROR;
+            uint32_t skip = lz4f_read_le32(input + ip + 4);
+            if (skip > input_size - ip - 8) return LZ4F_ERROR;
+            ip += 8 + (size_t)skip;
+            continue;
+        }
+        if (magic != LZ4F_MAGIC) return LZ4F_ERROR;
+        ip += 4;
+
+        Lz4FrameHeader fh;
+        size_t header = lz4f_read_header(input + ip, input_size - ip, &fh);
+        if (!header) return LZ4F_ERROR;
+        ip += header;
+        size_t block_checksum = (fh.flags & LZ4F_FLG_BLOCK_CHECKSUM) ? 4 : 0;
+        size_t frame_start = op;
+
+        for (;;) {
+            if (input_size - ip < 4) return LZ4F_ERROR;
+            uint32_t field = lz4f_read_le32(input + ip);
+            ip += 4;
+            if (!field) break;
+
+            size_t size = field & ~LZ4F_BLOCK_UNCOMPRESSED;
+            if (size > fh.block_bytes || size + block_checksum > input_size - ip) return LZ4F_ERROR;
+            if (block_checksum && xxh32_oneshot(input + ip, size) != lz4f_read_le32(input + ip + size)) return LZ4F_ERROR;
+
+            size_t room = output_capacity - op < fh.block_bytes ? output_capacity - op : fh.block_bytes;
+            size_t produced;
+            if (field & LZ4F_BLOCK_UNCOMPRESSED) {
+                if (size > room) return LZ4F_ERROR;
+                memcpy(output + op, input + ip, size);
+                produced = size;
+            } else {
+                produced = lz4_decompress_safe((const char*)input + ip, (char*)output + op, size, room);
+                if (!produced) return LZ4F_ERROR;
+            }
+            op += produced;
+            ip += size + block_checksum;
+        }
+
+        if (fh.content_size != LZ4F_CONTENTSIZE_UNKNOWN && op - frame_start != fh.content_size) return LZ4F_ERROR;
+        if (fh.flags & LZ4F_FLG_CONTENT_CHECKSUM) {
+            if (input_size - ip < 4) return LZ4F_ERROR;
+            if (xxh32_oneshot(output + frame_start, op - frame_start) != lz4f_read_le32(input + ip)) return LZ4F_ERROR;
+            ip += 4;
+        }
+        frames++;
+    }
+    return frames ? op : LZ4F_ERROR;
+}
+
+// Content size recorded in the first LZ4 frame, LZ4F_CONTENTSIZE_UNKNOWN when the
+// frame (e.g. a streamed one) does not record it, or LZ4F_CONTENTSIZE_ERROR.
+WASM_EXPORT uint64_t lz4_frame_content_size(const uint8_t* input, size_t input_size) {
+    size_t ip = 0;
+    while (input && input_size - ip >= 8) {
+        uint32_t magic = lz4f_read_le32(input + ip);
+        if ((magic & LZ4F_SKIPPABLE_MASK) == LZ4F_SKIPPABLE_MAGIC) {
+            uint32_t skip = lz4f_read_le32(input + ip + 4);
+            if (skip > input_size - ip - 8) break;
+            ip += 8 + (size_t)skip;
+            continue;
+        }
+        if (magic != LZ4F_MAGIC) break;
+        Lz4FrameHeader fh;
+        if (!lz4f_read_header(input + ip + 4, input_size - ip - 4, &fh)) break;
+        return fh.content_size;
+    }
+    return LZ4F_CONTENTSIZE_ERROR;
+}
+
+struct Lz4FrameStream {
+    LZ4_stream_t ctx;
+    uint8_t* block;
+    size_t block_bytes;
+    size_t buffered;
+    uint64_t content_size;
+    uint64_t consumed;
+    Lz4Xxh32 checksum;
+    int block_size_id;
+    int header_written;
+    int finished;
+};
+
+// Streaming compressor holding one block of input. content_size is written to the
+// header when known; pass LZ4F_CONTENTSIZE_UNKNOWN otherwise.
+WASM_EXPORT Lz4FrameStream* lz4_frame_stream_create(int block_size_id, uint64_t content_size) {
+    block_size_id = (int)lz4f_resolve_block_id(block_size_id);
+    size_t block = lz4f_block_bytes(block_size_id);
+    if (!block) return 0;
+
+    Lz4FrameStream* stream = (Lz4FrameStream*)wasm_malloc(sizeof(Lz4FrameStream));
+    if (!stream) return 0;
+    stream->block = (uint8_t*)wasm_malloc(block);
+    if (!stream->block) {
+        wasm_free(stream);
+        return 0;
+    }
+    stream->block_bytes = block;
+    stream->buffered = 0;
+    stream->content_size = content_size;
+    stream->consumed = 0;
+    stream->block_size_id = block_size_id;
+    stream->header_written = 0;
+    stream->finished = 0;
+    xxh32_init(&stream->checksum);
+    return stream;
+}
+
+WASM_EXPORT void lz4_frame_stream_free(Lz4FrameStream* stream) {
+    if (!stream) return;
+    if (stream->block) wasm_free(stream->block);
+    wasm_free(stream);
+}
+
+// Emits every block that `input` completes and buffers the rest. Returns the bytes
+// written (possibly 0) or LZ4F_ERROR; a call that fails leaves the stream unchanged.
+WASM_EXPORT size_t lz4_frame_stream_compress(Lz4FrameStream* stream, const uint8_t* input, size_t input_size,
+                                             uint8_t* output, size_t output_capacity) {
+    if (!stream || stream->finished || (!input && input_size) || !output) return LZ4F_ERROR;
+    if (stream->content_size != LZ4F_CONTENTSIZE_UNKNOWN &&
+        input_size > stream->content_size - stream->consumed) return LZ4F_ERROR;
+
+    size_t block = stream->block_bytes;
+    size_t pending = stream->buffered + input_size;
+    size_t needed = (stream->header_written ? 0 : LZ4F_HEADER_MAX) + (pending / block) * (block + 8);
+    if (output_capacity < needed) return LZ4F_ERROR;
+
+    size_t pos = 0;
+    if (!stream->header_written) {
+        pos = lz4f_write_header(output, output_capacity, stream->block_size_id, stream->content_size);
+        stream->header_written = 1;
+    }
+    xxh32_update(&stream->checksum, input, input_size);
+    stream->consumed += input_size;
+
+    while (input_size) {
+        if (!stream->buffered && input_size >= block) {
+            pos += lz4f_write_block(&stream->ctx, input, block, output + pos, output_capacity - pos);
+            input += block;
+            input_size -= block;
+            continue;
+        }
+        size_t take = block - stream->buffered < input_size ? block - stream->buffered : input_size;
+        memcpy(stream->block + stream->buffered, input, take);
+        stream->buffered += take;
+        input += take;
+        input_size -= take;
+        if (stream->buffered == block) {
+            pos += lz4f_write_block(&stream->ctx, stream->block, block, output + pos, output_capacity - pos);
+            stream->buffered = 0;
+        }
+    }
+    return pos;
+}
+
+// Flushes the buffered tail, then writes the end mark and content checksum. The
+// stream cannot be written to afterwards. Returns the bytes written or LZ4F_ERROR.
+WASM_EXPORT size_t lz4_frame_stream_end(Lz4FrameStream* stream, uint8_t* output, size_t output_capacity) {
+    if (!stream || stream->finished || !output) return LZ4F_ERROR;
+    if (stream->content_size != LZ4F_CONTENTSIZE_UNKNOWN && stream->consumed != stream->content_size) {
+        return LZ4F_ERROR;
+    }
+    size_t needed = (stream->header_written ? 0 : LZ4F_HEADER_MAX) + stream->buffered + 8 + 8;
+    if (output_capacity < needed) return LZ4F_ERROR;
+
+    size_t pos = 0;
+    if (!stream->header_written) {
+        pos = lz4f_write_header(output, output_capacity, stream->block_size_id, stream->content_size);
+        stream->header_written = 1;
+    }
+    if (stream->buffered) {
+        pos += lz4f_write_block(&stream->ctx, stream->block, stream->buffered, output + pos, output_capacity - pos);
+        stream->buffered = 0;
+    }
+    lz4f_write_le32(output + pos, 0);
+    lz4f_write_le32(output + pos + 4, xxh32_digest(&stream->checksum));
+    stream->finished = 1;
+    return pos + 8;
+}
+
+enum {
+    LZ4F_STAGE_MAGIC,
+    LZ4F_STAGE_DESCRIPTOR,
+    LZ4F_STAGE_HEADER,
+    LZ4F_STAGE_SKIP_SIZE,
+    LZ4F_STAGE_SKIP,
+    LZ4F_STAGE_BLOCK_SIZE,
+    LZ4F_STAGE_BLOCK,
+    LZ4F_STAGE_CONTENT_CHECKSUM
+};
+
+struct Lz4FrameDecoder {
+    int stage;
+    int frames;
+    int failed;
+    Lz4FrameHeader header;
+    // Bytes of the field or block being assembled from the input.
+    uint8_t field[LZ4F_HEADER_MAX];
+    uint8_t* unit;
+    size_t unit_need;
+    size_t unit_have;
+    uint32_t block_field;
+    // One compressed block (plus checksum) in, one decoded block out.
+    uint8_t* block_in;
+    uint8_t* block_out;
+    size_t block_capacity;
+    const uint8_t* pending;
+    size_t pending_size;
+    uint64_t produced;
+    uint64_t skip;
+    Lz4Xxh32 checksum;
+};
+
+static inline void lz4f_expect(Lz4FrameDecoder* d, int stage, uint8_t* unit, size_t have, size_t need) {
+    d->stage = stage;
+    d->unit = unit;
+    d->unit_have = have;
+    d->unit_need = need;
+}
+
+WASM_EXPORT Lz4FrameDecoder* lz4_frame_decoder_create(void) {
+    Lz4FrameDecoder* d = (Lz4FrameDecoder*)wasm_malloc(sizeof(Lz4FrameDecoder));
+    if (!d) return 0;
+    memset(d, 0, sizeof(Lz4FrameDecoder));
+    lz4f_expect(d, LZ4F_STAGE_MAGIC, d->field, 0, 4);
+    return d;
+}
+
+WASM_EXPORT void lz4_frame_decoder_free(Lz4FrameDecoder* d) {
+    if (!d) return;
+    if (d->block_in) wasm_free(d->block_in);
+    if (d->block_out) wasm_free(d->block_out);
+    wasm_free(d);
+}
+
+static int lz4f_reserve_blocks(Lz4FrameDecoder* d, size_t block_bytes) {
+    if (d->block_capacity >= block_bytes) return 1;
+    if (d->block_in) wasm_free(d->block_in);
+    if (d->block_out) wasm_free(d->block_out);
+    d->block_in = (uint8_t*)wasm_malloc(block_bytes + 4);
+    d->block_out = (uint8_t*)wasm_malloc(block_bytes);
+    d->block_capacity = d->block_in && d->block_out ? block_bytes : 0;
+    return d->block_capacity != 0;
+}
+
+// Acts on a completed unit and sets up the next one. Returns 0 on corrupt input.
+static int lz4f_decoder_advance(Lz4FrameDecoder* d) {
+    Lz4FrameHeader* fh = &d->header;
+    switch (d->stage) {
+    case LZ4F_STAGE_MAGIC: {
+        uint32_t magic = lz4f_read_le32(d->field);
+        if ((magic & LZ4F_SKIPPABLE_MASK) == LZ4F_SKIPPABLE_MAGIC) {
+            lz4f_expect(d, LZ4F_STAGE_SKIP_SIZE, d->field, 0, 4);
+            return 1;
+        }
+        if (magic != LZ4F_MAGIC) return 0;
+        lz4f_expect(d, LZ4F_STAGE_DESCRIPTOR, d->field, 0, 2);
+        return 1;
+    }
+    case LZ4F_STAGE_DESCRIPTOR:
+        lz4f_expect(d, LZ4F_STAGE_HEADER, d->field, 2, lz4f_descriptor_size(d->field[0]));
+        return 1;
+    case LZ4F_STAGE_HEADER:
+        if (!lz4f_read_header(d->field, d->unit_have, fh)) return 0;
+        if (!lz4f_reserve_blocks(d, fh->block_bytes)) return 0;
+        d->produced = 0;
+        xxh32_init(&d->checksum);
+        lz4f_expect(d, LZ4F_STAGE_BLOCK_SIZE, d->field, 0, 4);
+        return 1;
+    case LZ4F_STAGE_SKIP_SIZE:
+        d->skip = lz4f_read_le32(d->field);
+        lz4f_expect(d, LZ4F_STAGE_SKIP, d->field, 0, 0);
+        return 1;
+    case LZ4F_STAGE_BLOCK_SIZE: {
+        d->block_field = lz4f_read_le32(d->field);
+        if (!d->block_field) {
+            if (fh->content_size != LZ4F_CONTENTSIZE_UNKNOWN && d->produced != fh->content_size) return 0;
+            if (fh->flags & LZ4F_FLG_CONTENT_CHECKSUM) {
+                lz4f_expect(d, LZ4F_STAGE_CONTENT_CHECKSUM, d->field, 0, 4);
+            } else {
+                d->frames++;
+                lz4f_expect(d, LZ4F_STAGE_MAGIC, d->field, 0, 4);
+            }
+            return 1;
+        }
+        size_t size = d->block_field & ~LZ4F_BLOCK_UNCOMPRESSED;
+        if (size > fh->block_bytes) return 0;
+        size_t checksum = (fh->flags & LZ4F_FLG_BLOCK_CHECKSUM) ? 4 : 0;
+        lz4f_expect(d, LZ4F_STAGE_BLOCK, d->block_in, 0, size + checksum);
+        return 1;
+    }
+    case LZ4F_STAGE_BLOCK: {
+        size_t size = d->block_field & ~LZ4F_BLOCK_UNCOMPRESSED;
+        if ((fh->flags & LZ4F_FLG_BLOCK_CHECKSUM) &&
+            xxh32_oneshot(d->block_in, size) != lz4f_read_le32(d->block_in + size)) return 0;
+        if (d->block_field & LZ4F_BLOCK_UNCOMPRESSED) {
+            d->pending = d->block_in;
+            d->pending_size = size;
+        } else {
+            d->pending_size = lz4_decompress_safe((const char*)d->block_in, (char*)d->block_out, size, fh->block_bytes);
+            if (!d->pending_size) return 0;
+            d->pending = d->block_out;
+        }
+        d->produced += d->pending_size;
+        if (fh->content_size != LZ4F_CONTENTSIZE_UNKNOWN && d->produced > fh->content_size) return 0;
+        xxh32_update(&d->checksum, d->pending, d->pending_size);
+        lz4f_expect(d, LZ4F_STAGE_BLOCK_SIZE, d->field, 0, 4);
+        return 1;
+    }
+    case LZ4F_STAGE_CONTENT_CHECKSUM:
+        if (xxh32_digest(&d->checksum) != lz4f_read_le32(d->field)) return 0;
+        d->frames++;
+        lz4f_expect(d, LZ4F_STAGE_MAGIC, d->field, 0, 4);
+        return 1;
+    }
+    return 0;
+}
+
+// Feeds input to the decoder and writes as much decoded data as fits. *consumed is
+// set to the input bytes taken; any not taken must be passed again. Memory stays at
+// two blocks whatever the frame size. Returns the bytes written or LZ4F_ERROR.
+WASM_EXPORT size_t lz4_frame_decoder_update(Lz4FrameDecoder* d, const uint8_t* input, size_t input_size,
+                                            size_t* consumed, uint8_t* output, size_t output_capacity) {
+    if (!d || !consumed || d->failed || (!input && input_size) || (!output && output_capacity)) return LZ4F_ERROR;
+
+    size_t ip = 0;
+    size_t op = 0;
+    for (;;) {
+        if (d->pending_size) {
+            size_t take = output_capacity - op < d->pending_size ? output_capacity - op : d->pending_size;
+            if (take) memcpy(output + op, d->pending, take);
+            op += take;
+            d->pending += take;
+            d->pending_size -= take;
+            if (d->pending_size) break;
+        }
+
+        if (d->stage == LZ4F_STAGE_SKIP) {
+            size_t take = input_size - ip < d->skip ? input_size - ip : (size_t)d->skip;
+            ip += take;
+            d->skip -= take;
+            if (d->skip) break;
+            lz4f_expect(d, LZ4F_STAGE_MAGIC, d->field, 0, 4);
+            continue;
+        }
+
+        size_t take = input_size - ip < d->unit_need - d->unit_have ? input_size - ip : d->unit_need - d->unit_have;
+        if (take) memcpy(d->unit + d->unit_have, input + ip, take);
+        d->unit_have += take;
+        ip += take;
+        if (d->unit_have < d->unit_need) break;
+        if (!lz4f_decoder_advance(d)) {
+            d->failed = 1;
+            *consumed = ip;
+            return LZ4F_ERROR;
+        }
+    }
+    *consumed = ip;
+    return op;
+}
+
+// 1 once at least one frame has been decoded completely and no output is pending.
+WASM_EXPORT int lz4_frame_decoder_finished(const Lz4FrameDecoder* d) {
+    return d && !d->failed && d->frames > 0 && d->stage == LZ4F_STAGE_MAGIC &&
+           d->unit_have == 0 && d->pending_size == 0;
+}
+
+// Canonical Huffman coding of bytes. Package-merge limits code lengths to
+// HUFFMAN_MAX_CODE_LENGTH, codes are assigned canonically so a stream only needs to
+// carry the lengths, and decoding goes through a table that yields up to two symbols
+// per probe of a 64-bit bit buffer.
+#define HUFFMAN_MAX_SYMBOLS 256
+#define HUFFMAN_MAX_CODE_LENGTH 15
+#define HUFFMAN_TABLE_BITS 11
+#define HUFFMAN_TABLE_SIZE (1u << HUFFMAN_TABLE_BITS)
+#define HUFFMAN_MODE_CODED 0
+#define HUFFMAN_MODE_SINGLE 1
+// Mode byte, decoded size (u32 LE), then the highest coded symbol or the single symbol.
+#define HUFFMAN_HEADER_SIZE 6
+
+// Used symbols ordered by ascending frequency, ties by symbol. Returns their count.
+static int huffman_sort_symbols(const uint32_t* freqs, size_t count, uint16_t* sorted) {
+    int used = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!freqs[i]) continue;
+        int j = used++;
+        while (j > 0 && freqs[sorted[j - 1]] > freqs[i]) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = (uint16_t)i;
+    }
+    return used;
+}
+
+// Package-merge (Larmore and Hirschberg): optimal lengths no longer than max_bits for
+// the n >= 2 symbols in `sorted`. Every level's merged list starts with a prefix of the
+// sorted leaves, so remembering which entries are leaves is enough to walk back down
+// and count how many levels select each symbol, which is its code length.
+static void huffman_package_merge(const uint32_t* freqs, const uint16_t* sorted, int n,
+                                  uint32_t max_bits, uint8_t* lengths) {
+    uint64_t weights[2][2 * HUFFMAN_MAX_SYMBOLS];
+    uint8_t is_leaf[HUFFMAN_MAX_CODE_LENGTH][2 * HUFFMAN_MAX_SYMBOLS];
+    int list_len[HUFFMAN_MAX_CODE_LENGTH];
+    const int keep = 2 * n - 2;
+
+    for (int i = 0; i < n; i++) {
+        weights[0][i] = freqs[sorted[i]];
+        is_leaf[0][i] = 1;
+    }
+    list_len[0] = n;
+
+    for (uint32_t level = 1; level < max_bits; level++) {
+        const uint64_t* prev = weights[(level - 1) & 1];
+        uint64_t* cur = weights[level & 1];
+        int packages = list_len[level - 1] / 2;
+        int leaf = 0, package = 0, len = 0;
+        while (len < keep && (leaf < n || package < packages)) {
+            uint64_t package_weight = package < packages ? prev[2 * package] + prev[2 * package + 1] : ~(uint64_t)0;
+            if (leaf < n && freqs[sorted[leaf]] <= package_weight) {
+                cur[len] = freqs[sorted[leaf++]];
+                is_leaf[level][len++] = 1;
+            } else {
+                cur[len] = package_weight;
+                package++;
+                is_leaf[level][len++] = 0;
+            }
+        }
+        list_len[level] = len;
+    }
+
+    for (int i = 0; i < n; i++) lengths[sorted[i]] = 0;
+    int need = keep;
+    for (int level = (int)max_bits - 1; level >= 0 && need > 0; level--) {
+        int leaves = 0;
+        for (int i = 0; i < need; i++) leaves += is_leaf[level][i];
+        for (int i = 0; i < leaves; i++) lengths[sorted[i]]++;
+        need = 2 * (need - leaves);
+    }
+}
+
+// Length-limited code lengths for `count` symbols; a lone symbol gets length 1.
+// Returns the number of symbols with a code.
+static int huffman_build_lengths(const uint32_t* freqs, size_t count, uint8_t* lengths) {
+    uint16_t sorted[HUFFMAN_MAX_SYMBOLS];
+    for (size_t i = 0; i < count; i++) lengths[i] = 0;
+    int used = huffman_sort_symbols(freqs, count, sorted);
+    if (used == 1) lengths[sorted[0]] = 1;
+    if (used >= 2) huffman_package_merge(freqs, sorted, used, HUFFMAN_MAX_CODE_LENGTH, lengths);
+    return used;
+}
+
+// LSB-first bitstream of `input`; codes come bit-reversed from deflate_build_codes.
+static size_t huffman_encode_bits(const uint8_t* input, size_t input_size, const uint8_t* lengths,
+                                  const uint16_t* codes, uint8_t* output, size_t output_capacity) {
+    DeflateBitWriter bw = { output, output_capacity, 0, 0, 0, 0 };
+    size_t i = 0;
+    // Two codes of at most 15 bits fit one put before the writer's 32-bit flush.
+    for (; i + 2 <= input_size; i += 2) {
+        uint32_t a = input[i];
+        uint32_t b = input[i + 1];
+        deflate_put_bits(&bw, codes[a] | ((uint32_t)codes[b] << lengths[a]), lengths[a] + lengths[b]);
+    }
+    if (i < input_size) deflate_put_bits(&bw, codes[input[i]], lengths[input[i]]);
+    deflate_align_bits(&bw);
+    return bw.overflow ? 0 : bw.pos;
+}
+
+typedef struct {
+    uint8_t symbol[2];
+    uint8_t length[2];   // length[0] == 0: code longer than the table, take the slow path
+} HuffmanDecodeEntry;
+
+typedef struct {
+    HuffmanDecodeEntry table[HUFFMAN_TABLE_SIZE];
+    // Canonical layout for codes longer than HUFFMAN_TABLE_BITS.
+    uint32_t first_code[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint16_t first_index[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint16_t count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint8_t sorted[HUFFMAN_MAX_SYMBOLS];
+} HuffmanDecoder;
+
+// Returns 0 when the lengths are oversubscribed or exceed the limit.
+static int huffman_build_decoder(HuffmanDecoder* d, const uint8_t* lengths, size_t count) {
+    uint16_t single[HUFFMAN_TABLE_SIZE];
+    uint32_t next_code[HUFFMAN_MAX_CODE_LENGTH + 1];
+    int32_t left = 1;
+
+    for (int len = 0; len <= HUFFMAN_MAX_CODE_LENGTH; len++) d->count[len] = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (lengths[i] > HUFFMAN_MAX_CODE_LENGTH) return 0;
+        d->count[lengths[i]]++;
+    }
+    d->count[0] = 0;
+    for (int len = 1; len <= HUFFMAN_MAX_CODE_LENGTH; len++) {
+        left = (left << 1) - d->count[len];
+        if (left < 0) return 0;
+    }
+
+    uint32_t code = 0;
+    uint16_t index = 0;
+    for (int len = 1; len <= HUFFMAN_MAX_CODE_LENGTH; len++) {
+        code = (code + d->count[len - 1]) << 1;
+        d->first_code[len] = code;
+        next_code[len] = code;
+        d->first_index[len] = index;
+        index += d->count[len];
+    }
+    for (int len = 1, at = 0; len <= HUFFMAN_MAX_CODE_LENGTH; len++) {
+        for (size_t i = 0; i < count; i++) {
+            if (lengths[i] == len) d->sorted[at++] = (uint8_t)i;
+        }
+    }
+
+    // Single-symbol table first: each short code fills every index whose low bits
+    // spell it in stream order.
+    memset(single, 0, sizeof(single));
+    for (size_t i = 0; i < count; i++) {
+        uint32_t len = lengths[i];
+        if (!len) continue;
+        uint32_t c = next_code[len]++;
+        if (len > HUFFMAN_TABLE_BITS) continue;
+        uint32_t reversed = 0;
+        for (uint32_t b = 0; b < len; b++) {
+            reversed = (reversed << 1) | (c & 1);
+            c >>= 1;
+        }
+        for (uint32_t fill = reversed; fill < HUFFMAN_TABLE_SIZE; fill += 1u << len) {
+            single[fill] = (uint16_t)(i | (len << 8));
+        }
+    }
+
+    // Pair each entry with the following code when it fits in the remaining bits.
+    for (uint32_t i = 0; i < HUFFMAN_TABLE_SIZE; i++) {
+        HuffmanDecodeEntry* e = &d->table[i];
+        uint32_t first = single[i];
+        uint32_t len0 = first >> 8;
+        e->symbol[0] = (uint8_t)first;
+        e->length[0] = (uint8_t)len0;
+        e->symbol[1] = 0;
+        e->length[1] = 0;
+        if (!len0) continue;
+        uint32_t second = single[i >> len0];
+        uint32_t len1 = second >> 8;
+        if (len1 && len1 <= HUFFMAN_TABLE_BITS - len0) {
+            e->symbol[1] = (uint8_t)second;
+            e->length[1] = (uint8_t)len1;
+        }
+    }
+    return 1;
+}
+
+// Bit-at-a-time canonical decode for codes the table cannot hold. Returns -1 when no
+// code matches.
+static int huffman_decode_slow(const HuffmanDecoder* d, uint64_t bits, uint32_t* length) {
+    uint32_t code = 0;
+    for (uint32_t len = 1; len <= HUFFMAN_MAX_CODE_LENGTH; len++) {
+        code = (code << 1) | (uint32_t)((bits >> (len - 1)) & 1);
+        uint32_t offset = code - d->first_code[len];
+        if (offset < d->count[len]) {
+            *length = len;
+            return d->sorted[d->first_index[len] + offset];
+        }
+    }
+    return -1;
+}
+
+// Decodes exactly output_size symbols. Returns 0 on an invalid code or when the
+// stream runs out early.
+static int huffman_decode_bits(const HuffmanDecoder* d, const uint8_t* input, size_t input_size,
+                               uint8_t* output, size_t output_size) {
+    const uint8_t* ip = input;
+    const uint8_t* const ip_end = input + input_size;
+    uint64_t bits = 0;
+    uint32_t bit_count = 0;
+    uint32_t padding = 0;   // zero bits appended past the end of the input
+    size_t op = 0;
+
+    while (op < output_size) {
+        if (ip_end - ip >= 8) {
+            bits |= zstd_read_le64(ip) << bit_count;
+            ip += (63 - bit_count) >> 3;
+            bit_count |= 56;
+        } else {
+            while (bit_count <= 56) {
+                if (ip < ip_end) bits |= (uint64_t)*ip++ << bit_count;
+                else padding += 8;
+                bit_count += 8;
+            }
+        }
+
+        // 56+ bits cover three probes of at most 15 bits each.
+        int probes = output_size - op >= 6 ? 3 : 1;
+        for (int p = 0; p < probes; p++) {
+            HuffmanDecodeEntry e = d->table[bits & (HUFFMAN_TABLE_SIZE - 1)];
+            uint32_t used;
+            if (e.length[0]) {
+                output[op] = e.symbol[0];
+                if (probes > 1) {
+                    output[op + 1] = e.symbol[1];
+                    op += 1 + (e.length[1] != 0);
+                    used = (uint32_t)e.length[0] + e.length[1];
+                } else {
+                    op++;
+                    used = e.length[0];
+                }
+            } else {
+                int symbol = huffman_decode_slow(d, bits, &used);
+                if (symbol < 0) return 0;
+                output[op++] = (uint8_t)symbol;
+            }
+            bits >>= used;
+            bit_count -= used;
+        }
+    }
+    return bit_count >= padding;
+}
+
+// Lengths as 4-bit nibbles, low nibble first, for symbols 0..max_symbol.
+static inline size_t huffman_lengths_size(uint32_t max_symbol) {
+    return (max_symbol + 2) / 2;
+}
+
+// Byte stream: HUFFMAN_HEADER_SIZE bytes (mode, decoded size, highest symbol), the code
+// lengths as nibbles, then the LSB-first code stream. Input with a single distinct byte
+// is stored as that byte and its count. Returns the size written, -1 on failure.
+WASM_EXPORT int32_t compress_huffman(const uint8_t* input, size_t input_size,
+                                     uint8_t* output, size_t max_output_size) {
+    if (!input || !output || input_size == 0 || input_size > 0x7FFFFFFF ||
+        max_output_size < HUFFMAN_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint32_t freqs[HUFFMAN_MAX_SYMBOLS] = {0};
+    for (size_t i = 0; i < input_size; i++) freqs[input[i]]++;
+
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    int used = huffman_build_lengths(freqs, HUFFMAN_MAX_SYMBOLS, lengths);
+    uint32_t max_symbol = 0;
+    for (uint32_t i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (lengths[i]) max_symbol = i;
+    }
+
+    output[0] = used == 1 ? HUFFMAN_MODE_SINGLE : HUFFMAN_MODE_CODED;
+    zstd_write_le(output + 1, input_size, 4);
+    output[5] = (uint8_t)max_symbol;
+    if (used == 1) return HUFFMAN_HEADER_SIZE;
+
+    size_t header = HUFFMAN_HEADER_SIZE + huffman_lengths_size(max_symbol);
+    if (max_output_size < header) return -1;
+    for (uint32_t i = 0; i <= max_symbol; i += 2) {
+        uint8_t high = i + 1 <= max_symbol ? lengths[i + 1] : 0;
+        output[HUFFMAN_HEADER_SIZE + i / 2] = (uint8_t)(lengths[i] | (high << 4));
+    }
+
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+    deflate_build_codes(lengths, HUFFMAN_MAX_SYMBOLS, codes);
+    size_t written = huffman_encode_bits(input, input_size, lengths, codes,
+                                         output + header, max_output_size - header);
+    if (!written) return -1;
+    return (int32_t)(header + written);
+}
+
+// Inverse of compress_huffman. Returns the decoded size, -1 when the stream is
+// malformed or output_size is too small.
+WASM_EXPORT int32_t decompress_huffman(const uint8_t* input, size_t input_size,
+                                       uint8_t* output, size_t output_size) {
+    if (!input || !output || input_size < HUFFMAN_HEADER_SIZE) return -1;
+    uint32_t decoded = zstd_read_le32(input + 1);
+    if (decoded > 0x7FFFFFFF || decoded > output_size) return -1;
+
+    if (input[0] == HUFFMAN_MODE_SINGLE) {
+        memset(output, input[5], decoded);
+        return (int32_t)decoded;
+    }
+    if (input[0] != HUFFMAN_MODE_CODED) return -1;
+
+    uint32_t max_symbol = input[5];
+    size_t header = HUFFMAN_HEADER_SIZE + huffman_lengths_size(max_symbol);
+    if (input_size < header) return -1;
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS] = {0};
+    for (uint32_t i = 0; i <= max_symbol; i++) {
+        uint8_t packed = input[HUFFMAN_HEADER_SIZE + i / 2];
+        lengths[i] = (uint8_t)((i & 1) ? packed >> 4 : packed & 0x0F);
+    }
+
+    HuffmanDecoder d;
+    if (!huffman_build_decoder(&d, lengths, HUFFMAN_MAX_SYMBOLS)) return -1;
+    if (!huffman_decode_bits(&d, input + header, input_size - header, output, decoded)) return -1;
+    return (int32_t)decoded;
+}
+
+// Table entries are indexed by symbol; `code` holds the code bit-reversed, as it is
+// written LSB-first.
+WASM_EXPORT HuffmanTable* build_huffman_table(const uint32_t* frequencies, size_t symbol_count) {
+    if (!frequencies || symbol_count == 0 || symbol_count > HUFFMAN_MAX_SYMBOLS) return NULL;
+
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+    if (!huffman_build_lengths(frequencies, symbol_count, lengths)) return NULL;
+    deflate_build_codes(lengths, symbol_count, codes);
+
+    HuffmanTable* table = (HuffmanTable*)wasm_malloc(sizeof(HuffmanTable));
+    if (!table) return NULL;
+    table->entries = (HuffmanEntry*)wasm_malloc(symbol_count * sizeof(HuffmanEntry));
+    if (!table->entries) {
+        wasm_free(table);
+        return NULL;
+    }
+    table->entry_count = symbol_count;
+    table->max_code_length = 0;
+    for (size_t i = 0; i < symbol_count; i++) {
+        table->entries[i].symbol = (uint16_t)i;
+        table->entries[i].frequency = frequencies[i];
+        table->entries[i].code_length = lengths[i];
+        table->entries[i].code = codes[i];
+        if (lengths[i] > table->max_code_length) table->max_code_length = lengths[i];
+    }
+    return table;
+}
+
+static int huffman_table_lengths(const HuffmanTable* table, uint8_t* lengths, uint16_t* codes) {
+    if (!table || !table->entries || table->entry_count > HUFFMAN_MAX_SYMBOLS) return 0;
+    for (size_t i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
+        lengths[i] = i < table->entry_count ? table->entries[i].code_length : 0;
+        if (codes) codes[i] = i < table->entry_count ? (uint16_t)table->entries[i].code : 0;
+    }
+    return 1;
+}
+
+// Code stream only, without a header. Returns the bytes written, 0 when a symbol has
+// no code or the output is too small.
+WASM_EXPORT size_t huffman_encode(const uint8_t* input, size_t input_size,
+                                  const HuffmanTable* table, uint8_t* output, size_t output_capacity) {
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+    if (!input || !output || !huffman_table_lengths(table, lengths, codes)) return 0;
+    for (size_t i = 0; i < input_size; i++) {
+        if (!lengths[input[i]]) return 0;
+    }
+    return huffman_encode_bits(input, input_size, lengths, codes, output, output_capacity);
+}
+
+// Decodes exactly output_capacity symbols from a huffman_encode stream. Returns
+// output_capacity, or 0 when the stream is malformed or too short.
+WASM_EXPORT size_t huffman_decode(const uint8_t* input, size_t input_size,
+                                  const HuffmanTable* table, uint8_t* output, size_t output_capacity) {
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    if (!input || !output || !huffman_table_lengths(table, lengths, NULL)) return 0;
+
+    HuffmanDecoder d;
+    if (!huffman_build_decoder(&d, lengths, HUFFMAN_MAX_SYMBOLS)) return 0;
+    return huffman_decode_bits(&d, input, input_size, output, output_capacity) ? output_capacity : 0;
+}
+
+WASM_EXPORT void free_huffman_table(HuffmanTable* table) {
+    if (!table) return;
+    if (table->entries) wasm_free(table->entries);
+    wasm_free(table);
+}
+
+// Dictionary compression. Output is a 4-byte dictionary id, the decoded size as a
+// LEB128 varint and one LZ4 block whose offsets may reach past the start of the
+// input into the end of the dictionary (LZ4's external-dictionary convention).
+// Serialized dictionaries are DICTIONARY_MAGIC, the id (xxHash32 of the content)
+// and the raw content.
+#define DICTIONARY_MAGIC 0x43445850u
+#define DICTIONARY_HEADER_SIZE 8
+#define DICTIONARY_INPUT_HASH_LOG 12
+#define DICTIONARY_TRAIN_DMER 8
+#define DICTIONARY_TRAIN_SEGMENT 128
+#define DICTIONARY_TRAIN_HASH_LOG 16
+
+// Common markup from icon sets, editor exports and optimizer output. Built-in
+// dictionaries put the most frequent strings last, where offsets reach them from
+// anywhere in the input.
+static const char dictionary_svg[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+    "<!-- Generator: Adobe Illustrator 24.0.0, SVG Export Plug-In . SVG Version: 6.00 Build 0)  -->\n"
+    "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n"
+    "<svg version=\"1.1\" id=\"Layer_1\" xmlns=\"http://www.w3.org/2000/svg\" "
+    "xmlns:xlink=\"http://www.w3.org/1999/xlink\" x=\"0px\" y=\"0px\" viewBox=\"0 0 512 512\" "
+    "style=\"enable-background:new 0 0 512 512;\" xml:space=\"preserve\">\n"
+    "<style type=\"text/css\">\n\t.st0{fill:#FFFFFF;}\n\t.st1{fill:none;stroke:#000000;stroke-width:2;stroke-miterlimit:10;}\n</style>\n"
+    "xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:cc=\"http://creativecommons.org/ns#\" "
+    "xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\" xmlns:svg=\"http://www.w3.org/2000/svg\" "
+    "xmlns:sodipodi=\"http://sodipodi.sourceforge.net/DTD/sodipodi-0.dtd\" "
+    "xmlns:inkscape=\"http://www.inkscape.org/namespaces/inkscape\" "
+    "inkscape:version=\"1.0\" sodipodi:docname=\"drawing.svg\" inkscape:groupmode=\"layer\" inkscape:label=\"Layer 1\"\n"
+    "<metadata>\nCreated by potrace 1.16, written by Peter Selinger 2001-2019\n</metadata>\n"
+    "<title></title><desc>Created with Sketch.</desc>\n"
+    "<g transform=\"translate(0.000000,512.000000) scale(0.100000,-0.100000)\" fill=\"#000000\" stroke=\"none\">\n"
+    "<defs>\n<linearGradient id=\"linear-gradient\" x1=\"0\" y1=\"0\" x2=\"1\" y2=\"1\" "
+    "gradientTransform=\"matrix(1, 0, 0, -1, 0, 0)\" gradientUnits=\"userSpaceOnUse\">\n"
+    "<stop offset=\"0\" stop-color=\"#ffffff\" stop-opacity=\"0\"/>\n<stop offset=\"1\" stop-color=\"#000000\"/>\n"
+    "</linearGradient>\n<radialGradient id=\"radial-gradient\" cx=\"0\" cy=\"0\" r=\"1\" fx=\"0\" fy=\"0\">\n"
+    "<clipPath id=\"clip0\">\n<rect width=\"24\" height=\"24\" fill=\"white\"/>\n</clipPath>\n</defs>\n"
+    "<mask id=\"mask0\" style=\"mask-type:alpha\" maskUnits=\"userSpaceOnUse\">\n"
+    "<use xlink:href=\"#\"/>\n<text x=\"0\" y=\"0\" font-family=\"Arial, Helvetica, sans-serif\" font-size=\"12\" "
+    "text-anchor=\"middle\" font-weight=\"bold\">\n"
+    "<polygon points=\"\"/>\n<polyline points=\"\"/>\n<ellipse cx=\"\" cy=\"\" rx=\"\" ry=\"\"/>\n"
+    "<line x1=\"\" y1=\"\" x2=\"\" y2=\"\"/>\n<rect x=\"\" y=\"\" width=\"\" height=\"\" rx=\"\"/>\n"
+    "<circle cx=\"12\" cy=\"12\" r=\"10\"/>\n"
+    " opacity=\"0.5\" fill-opacity=\"0.5\" transform=\"rotate(-45 12 12)\" class=\"st0\" "
+    "fill-rule=\"evenodd\" clip-rule=\"evenodd\" clip-path=\"url(#clip0)\" fill=\"url(#linear-gradient)\" "
+    "stroke-dasharray=\"\" stroke-opacity=\"1\" stroke-miterlimit=\"10\" "
+    "style=\"fill:none;stroke:#000000;stroke-width:1px;stroke-linecap:butt;stroke-linejoin:miter;stroke-opacity:1\"\n"
+    "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"24\" height=\"24\" viewBox=\"0 0 24 24\" fill=\"none\" "
+    "stroke=\"currentColor\" stroke-width=\"2\" stroke-linecap=\"round\" stroke-linejoin=\"round\">\n"
+    "<path d=\"M0 0h24v24H0z\" fill=\"none\"/>\n"
+    "<path fill=\"currentColor\" d=\"M12 2C6.48 2 2 6.48 2 12s4.48 10 10 10 10-4.48 10-10S17.52 2 12 2z\"/>\n"
+    "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 24 24\" fill=\"currentColor\" width=\"24\" height=\"24\">\n"
+    "</text>\n</mask>\n</g>\n</svg>\n"
+    "<g id=\"Layer_1\" data-name=\"Layer 1\">\n  <g>\n    <path d=\"M\"/>\n  </g>\n"
+    "<path class=\"cls-1\" d=\"M\" fill=\"#fff\" stroke=\"#000\" stroke-width=\"1.5\" "
+    "stroke-linecap=\"round\" stroke-linejoin=\"round\" d=\"M\"/>\n"
+    "<path d=\"M";
+
+static const char dictionary_gltf_json[] =
+    "{\n    \"asset\" : {\n        \"generator\" : \"Khronos glTF Blender I/O v3.6.27\",\n"
+    "        \"version\" : \"2.0\"\n    },\n    \"scene\" : 0,\n    \"scenes\" : [\n        {\n"
+    "            \"name\" : \"Scene\",\n            \"nodes\" : [\n                0\n            ]\n        }\n    ],\n"
+    "    \"nodes\" : [\n        {\n            \"mesh\" : 0,\n            \"name\" : \"Cube\"\n        }\n    ],\n"
+    "    \"accessors\" : [\n        {\n            \"bufferView\" : 0,\n            \"componentType\" : 5126,\n"
+    "            \"count\" : 24,\n            \"max\" : [\n                1,\n                1,\n                1\n"
+    "            ],\n            \"min\" : [\n                -1,\n                -1,\n                -1\n"
+    "            ],\n            \"type\" : \"VEC3\"\n        },\n"
+    "    \"bufferViews\" : [\n        {\n            \"buffer\" : 0,\n            \"byteLength\" : 288,\n"
+    "            \"byteOffset\" : 0,\n            \"target\" : 34962\n        },\n"
+    "{\"cameras\":[{\"type\":\"perspective\",\"perspective\":{\"aspectRatio\":1.5,\"yfov\":0.6,\"zfar\":100,\"znear\":0.01}}],"
+    "\"animations\":[{\"channels\":[{\"sampler\":0,\"target\":{\"node\":0,\"path\":\"rotation\"}}],"
+    "\"samplers\":[{\"input\":0,\"interpolation\":\"LINEAR\",\"output\":1}]}],"
+    "\"skins\":[{\"inverseBindMatrices\":0,\"joints\":[1,2,3],\"skeleton\":0}],"
+    "\"extensionsUsed\":[\"KHR_materials_emissive_strength\",\"KHR_texture_transform\",\"KHR_draco_mesh_compression\","
+    "\"KHR_mesh_quantization\",\"EXT_meshopt_compression\",\"KHR_texture_basisu\",\"KHR_materials_unlit\"],"
+    "\"extensionsRequired\":[\"KHR_draco_mesh_compression\"],\"extensions\":{\"KHR_lights_punctual\":{\"lights\":["
+    "{\"color\":[1,1,1],\"intensity\":1,\"type\":\"directional\"}]}},\"extras\":{},"
+    "\"textures\":[{\"sampler\":0,\"source\":0}],\"images\":[{\"mimeType\":\"image/png\",\"name\":\"\",\"uri\":\"texture.png\"},"
+    "{\"bufferView\":4,\"mimeType\":\"image/jpeg\"}],"
+    "\"samplers\":[{\"magFilter\":9729,\"minFilter\":9987,\"wrapS\":10497,\"wrapT\":10497}],"
+    "\"materials\":[{\"doubleSided\":true,\"name\":\"Material\",\"pbrMetallicRoughness\":{\"baseColorFactor\":"
+    "[0.800000011920929,0.800000011920929,0.800000011920929,1],\"baseColorTexture\":{\"index\":0,\"texCoord\":0},"
+    "\"metallicRoughnessTexture\":{\"index\":1},\"metallicFactor\":0,\"roughnessFactor\":0.5},"
+    "\"normalTexture\":{\"index\":2,\"scale\":1},\"occlusionTexture\":{\"index\":3,\"strength\":1},"
+    "\"emissiveTexture\":{\"index\":4},\"emissiveFactor\":[0,0,0],\"alphaMode\":\"BLEND\",\"alphaCutoff\":0.5}],"
+    "\"asset\":{\"generator\":\"THREE.GLTFExporter\",\"version\":\"2.0\"},\"scene\":0,"
+    "\"scenes\":[{\"name\":\"Scene\",\"nodes\":[0]}],"
+    "\"nodes\":[{\"children\":[1],\"matrix\":[1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1],\"name\":\"Root\"},"
+    "{\"mesh\":0,\"name\":\"Mesh\",\"rotation\":[0,0,0,1],\"scale\":[1,1,1],\"translation\":[0,0,0]}],"
+    "\"meshes\":[{\"name\":\"Mesh\",\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,\"TEXCOORD_0\":2,"
+    "\"TANGENT\":3,\"COLOR_0\":4,\"JOINTS_0\":5,\"WEIGHTS_0\":6},\"indices\":7,\"material\":0,\"mode\":4}]}],"
+    "\"buffers\":[{\"byteLength\":840,\"uri\":\"data:application/octet-stream;base64,\"}],"
+    "\"bufferViews\":[{\"buffer\":0,\"byteLength\":288,\"byteOffset\":0,\"byteStride\":12,\"target\":34962},"
+    "{\"buffer\":0,\"byteLength\":72,\"byteOffset\":768,\"target\":34963}],"
+    "\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":24,"
+    "\"max\":[1,1,1],\"min\":[-1,-1,-1],\"type\":\"VEC3\"},{\"bufferView\":1,\"componentType\":5126,\"count\":24,"
+    "\"type\":\"VEC3\"},{\"bufferView\":2,\"componentType\":5126,\"count\":24,\"type\":\"VEC2\"},"
+    "{\"bufferView\":3,\"componentType\":5126,\"count\":24,\"type\":\"VEC4\"},{\"bufferView\":4,"
+    "\"componentType\":5126,\"count\":1,\"type\":\"MAT4\"},{\"bufferView\":5,\"componentType\":5123,"
+    "\"count\":36,\"type\":\"SCALAR\"},{\"bufferView\":6,\"componentType\":5125,\"count\":36,\"type\":\"SCALAR\"}]";
+
+static inline uint32_t dictionary_hash(uint32_t sequence, uint32_t bits) {
+    return (sequence * 2654435761U) >> (32 - bits);
+}
+
+static inline uint32_t dictionary_table_bits(size_t table_size) {
+    return table_size ? 31 - (uint32_t)__builtin_clz((uint32_t)table_size) : 0;
+}
+
+// Points the hash table at every 4-byte position of the dictionary; later positions
+// win, so the closest candidate is found.
+static void dictionary_index(DictionaryCompressor* c) {
+    uint32_t const bits = dictionary_table_bits(c->hash_table_size);
+    if (!c->hash_table || bits == 0) return;
+    memset(c->hash_table, 0, sizeof(uint32_t) << bits);
+    for (size_t pos = 0; pos + LZ4_MINMATCH <= c->dictionary_size; pos++) {
+        c->hash_table[dictionary_hash(lz4_read32(c->dictionary + pos), bits)] = (uint32_t)pos + 1;
+    }
+}
+
+static void dictionary_set_content(DictionaryCompressor* c, const uint8_t* content, size_t size) {
+    if (size > c->dictionary_capacity) {
+        content += size - c->dictionary_capacity;
+        size = c->dictionary_capacity;
+    }
+    // Training selects segments in place, so the content may already be there.
+    if (size && content != c->dictionary) memcpy(c->dictionary, content, size);
+    c->dictionary_size = size;
+    c->dictionary_id = xxh32_oneshot(c->dictionary, size);
+    dictionary_index(c);
+}
+
+WASM_EXPORT DictionaryCompressor* create_dictionary_compressor(size_t dictionary_size, size_t hash_size) {
+    if (dictionary_size > DICTIONARY_MAX_SIZE) dictionary_size = DICTIONARY_MAX_SIZE;
+    if (hash_size < 256) hash_size = 256;
+    if (hash_size > (1u << 20)) hash_size = 1u << 20;
+    hash_size = (size_t)1 << dictionary_table_bits(hash_size);
+
+    DictionaryCompressor* c = (DictionaryCompressor*)wasm_malloc(sizeof(DictionaryCompressor));
+    if (!c) return NULL;
+    c->dictionary = (uint8_t*)wasm_malloc(dictionary_size ? dictionary_size : 1);
+    c->hash_table = (uint32_t*)wasm_malloc(hash_size * sizeof(uint32_t));
+    if (!c->dictionary || !c->hash_table) {
+        free_dictionary_compressor(c);
+        return NULL;
+    }
+    c->dictionary_capacity = dictionary_size;
+    c->hash_table_size = hash_size;
+    dictionary_set_content(c, NULL, 0);
+    return c;
+}
+
+static inline uint32_t dictionary_dmer_hash(const uint8_t* p) {
+    uint64_t value;
+    __builtin_memcpy(&value, p, sizeof(value));
+    return (uint32_t)((value * 0x9E3779B185EBCA87ULL) >> (64 - DICTIONARY_TRAIN_HASH_LOG));
+}
+
+// Simplified COVER selection: the corpus is cut into one epoch per dictionary
+// segment, and from each epoch the DICTIONARY_TRAIN_SEGMENT-byte window whose 8-byte
+// substrings recur most across the whole corpus is kept. Substrings of a kept segment
+// stop scoring, so later segments add new material. Returns the dictionary size.
+WASM_EXPORT size_t train_dictionary(DictionaryCompressor* compressor, const uint8_t* training_data, size_t data_size) {
+    if (!compressor || (!training_data && data_size)) return 0;
+    size_t const capacity = compressor->dictionary_capacity;
+    if (data_size <= capacity || capacity < DICTIONARY_TRAIN_SEGMENT) {
+        dictionary_set_content(compressor, training_data, data_size);
+        return compressor->dictionary_size;
+    }
+
+    uint32_t* counts = (uint32_t*)wasm_malloc(sizeof(uint32_t) << DICTIONARY_TRAIN_HASH_LOG);
+    size_t const segment_count = capacity / DICTIONARY_TRAIN_SEGMENT;
+    size_t* starts = (size_t*)wasm_malloc(segment_count * sizeof(size_t));
+    uint64_t* scores = (uint64_t*)wasm_malloc(segment_count * sizeof(uint64_t));
+    if (!counts || !starts || !scores) {
+        if (counts) wasm_free(counts);
+        if (starts) wasm_free(starts);
+        if (scores) wasm_free(scores);
+        return 0;
+    }
+
+    memset(counts, 0, sizeof(uint32_t) << DICTIONARY_TRAIN_HASH_LOG);
+    size_t const dmer_count = data_size - DICTIONARY_TRAIN_DMER + 1;
+    for (size_t i = 0; i < dmer_count; i++) counts[dictionary_dmer_hash(training_data + i)]++;
+
+    // A substring seen once saves nothing, so scores count repeats only.
+    size_t const window = DICTIONARY_TRAIN_SEGMENT - DICTIONARY_TRAIN_DMER + 1;
+    size_t const epoch = data_size / segment_count;
+    size_t selected = 0;
+    for (size_t e = 0; e < segment_count; e++) {
+        size_t const begin = e * epoch;
+        size_t const end = e + 1 == segment_count ? dmer_count : (e + 1) * epoch;
+        if (end < begin + window) continue;
+
+        uint64_t score = 0, best_score = 0;
+        size_t best = begin;
+        for (size_t i = begin; i < end; i++) {
+            uint32_t const added = counts[dictionary_dmer_hash(training_data + i)];
+            score += added ? added - 1 : 0;
+            if (i >= begin + window) {
+                uint32_t const removed = counts[dictionary_dmer_hash(training_data + i - window)];
+                score -= removed ? removed - 1 : 0;
+            }
+            if (i + 1 >= begin + window && score > best_score) {
+                best_score = score;
+                best = i + 1 - window;
+            }
+        }
+        if (best_score == 0) continue;
+
+        for (size_t i = 0; i < window; i++) counts[dictionary_dmer_hash(training_data + best + i)] = 0;
+        starts[selected] = best;
+        scores[selected] = best_score;
+        selected++;
+    }
+
+    // Lowest scores first so the best segments sit at the end, nearest the input.
+    for (size_t i = 1; i < selected; i++) {
+        size_t const start = starts[i];
+        uint64_t const score = scores[i];
+        size_t j = i;
+        for (; j > 0 && scores[j - 1] > score; j--) {
+            starts[j] = starts[j - 1];
+            scores[j] = scores[j - 1];
+        }
+        starts[j] = start;
+        scores[j] = score;
+    }
+    for (size_t i = 0; i < selected; i++) {
+        memcpy(compressor->dictionary + i * DICTIONARY_TRAIN_SEGMENT, training_data + starts[i], DICTIONARY_TRAIN_SEGMENT);
+    }
+
+    wasm_free(counts);
+    wasm_free(starts);
+    wasm_free(scores);
+    dictionary_set_content(compressor, compressor->dictionary, selected * DICTIONARY_TRAIN_SEGMENT);
+    return compressor->dictionary_size;
+}
+
+// Accepts a serialize_dictionary blob, or any other bytes as raw content. Content
+// longer than the compressor's capacity keeps its tail. Returns 0 on success.
+WASM_EXPORT int load_dictionary(DictionaryCompressor* compressor, const uint8_t* data, size_t data_size) {
+    if (!compressor || (!data && data_size)) return -1;
+    if (data_size >= DICTIONARY_HEADER_SIZE && zstd_read_le32(data) == DICTIONARY_MAGIC) {
+        const uint8_t* content = data + DICTIONARY_HEADER_SIZE;
+        size_t const content_size = data_size - DICTIONARY_HEADER_SIZE;
+        if (xxh32_oneshot(content, content_size) != zstd_read_le32(data + 4)) return -1;
+        if (content_size > compressor->dictionary_capacity) return -1;
+        dictionary_set_content(compressor, content, content_size);
+        return 0;
+    }
+    dictionary_set_content(compressor, data, data_size);
+    return 0;
+}
+
+WASM_EXPORT size_t serialize_dictionary(const DictionaryCompressor* compressor, uint8_t* output, size_t output_capacity) {
+    if (!compressor || !output) return 0;
+    size_t const size = DICTIONARY_HEADER_SIZE + compressor->dictionary_size;
+    if (size > output_capacity) return 0;
+    zstd_write_le(output, DICTIONARY_MAGIC, 4);
+    zstd_write_le(output + 4, compressor->dictionary_id, 4);
+    memcpy(output + DICTIONARY_HEADER_SIZE, compressor->dictionary, compressor->dictionary_size);
+    return size;
+}
+
+// Raw content of a built-in dictionary, for load_dictionary.
+WASM_EXPORT const uint8_t* builtin_dictionary(int kind, size_t* size) {
+    const char* content;
+    size_t length;
+    switch (kind) {
+        case DICTIONARY_BUILTIN_SVG:
+            content = dictionary_svg;
+            length = sizeof(dictionary_svg) - 1;
+            break;
+        case DICTIONARY_BUILTIN_GLTF_JSON:
+            content = dictionary_gltf_json;
+            length = sizeof(dictionary_gltf_json) - 1;
+            break;
+        default:
+            content = NULL;
+            length = 0;
+            break;
+    }
+    if (size) *size = length;
+    return (const uint8_t*)content;
+}
+
+WASM_EXPORT size_t dictionary_compress_bound(size_t input_size) {
+    return 4 + 10 + input_size + input_size / 255 + 16;
+}
+
+// Finds a match for `ip` in the input seen so far, then in the dictionary, and records
+// `ip` in the input table. Returns the LZ4 offset, or 0 when nothing matches.
+static inline size_t dictionary_find_match(const DictionaryCompressor* c, uint32_t dict_bits,
+                                           uint32_t* table, uint32_t table_bits, const uint8_t* input,
+                                           const uint8_t* ip, const uint8_t** match) {
+    uint32_t const sequence = lz4_read32(ip);
+    size_t const pos = (size_t)(ip - input);
+    uint32_t* const slot = &table[dictionary_hash(sequence, table_bits)];
+    uint32_t const previous = *slot;
+    *slot = (uint32_t)pos + 1;
+    if (previous && pos + 1 - previous <= LZ4_DISTANCE_MAX && lz4_read32(input + previous - 1) == sequence) {
+        *match = input + previous - 1;
+        return pos + 1 - previous;
+    }
+    if (dict_bits) {
+        uint32_t const entry = c->hash_table[dictionary_hash(sequence, dict_bits)];
+        if (entry) {
+            size_t const offset = pos + c->dictionary_size - (entry - 1);
+            if (offset <= LZ4_DISTANCE_MAX && lz4_read32(c->dictionary + entry - 1) == sequence) {
+                *match = c->dictionary + entry - 1;
+                return offset;
+            }
+        }
+    }
+    return 0;
+}
+
+// lz4_compress_generic with a second, read-only match source. Matches found in the
+// dictionary may run on past its end into the start of the input.
+static size_t dictionary_lz4_encode(const DictionaryCompressor* c, const uint8_t* input, size_t input_size,
+                                    uint8_t* output, size_t output_capacity) {
+    uint32_t table[1 << DICTIONARY_INPUT_HASH_LOG];
+    uint32_t table_bits = 8;
+    while (table_bits < DICTIONARY_INPUT_HASH_LOG && ((size_t)1 << table_bits) < input_size) table_bits++;
+    memset(table, 0, sizeof(uint32_t) << table_bits);
+    uint32_t const dict_bits = c->dictionary_size >= LZ4_MINMATCH ? dictionary_table_bits(c->hash_table_size) : 0;
+
+    const uint8_t* ip = input;
+    const uint8_t* anchor = input;
+    const uint8_t* const source_end = input + input_size;
+    const uint8_t* const mf_limit_plus_one = source_end - LZ4_MFLIMIT + 1;
+    const uint8_t* const match_limit = source_end - LZ4_LASTLITERALS;
+    const uint8_t* const dict_end = c->dictionary + c->dictionary_size;
+
+    uint8_t* op = output;
+    uint8_t* const op_limit = output + output_capacity;
+    uint8_t* token;
+    const uint8_t* match;
+    size_t offset;
+
+    if (input_size < LZ4_MIN_INPUT_SIZE) goto _last_literals;
+
+    for (;;) {
+        {
+            const uint8_t* forward = ip;
+            uint32_t search = 1 << LZ4_SKIP_TRIGGER;
+            do {
+                ip = forward;
+                forward += search++ >> LZ4_SKIP_TRIGGER;
+                if (forward > mf_limit_plus_one) goto _last_literals;
+                offset = dictionary_find_match(c, dict_bits, table, table_bits, input, ip, &match);
+            } while (!offset);
+        }
+
+        {
+            const uint8_t* const lowest = offset <= (size_t)(ip - input) ? input : c->dictionary;
+            while (ip > anchor && match > lowest && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+        }
+
+        {
+            size_t const literal_l = (size_t)(ip - anchor);
+            token = op++;
+            if (op + literal_l + literal_l / 255 + 2 + 1 + LZ4_LASTLITERALS > op_limit) return 0;
+
+            if (literal_l >= 15) {
+                size_t len = literal_l - 15;
+                *token = (15 << 4);
+                for (; len >= 255; len -= 255) *op++ = 255;
+                *op++ = (uint8_t)len;
+            } else {
+                *token = (uint8_t)(literal_l << 4);
+            }
+
+            memcpy(op, anchor, literal_l);
+            op += literal_l;
+        }
+
+_next_sequence:
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+
+        {
+            size_t ml;
+            if (offset <= (size_t)(ip - input)) {
+                ml = lz4_count(ip + LZ4_MINMATCH, match + LZ4_MINMATCH, match_limit);
+            } else {
+                const uint8_t* limit = ip + (dict_end - match);
+                if (limit > match_limit) limit = match_limit;
+                ml = lz4_count(ip + LZ4_MINMATCH, match + LZ4_MINMATCH, limit);
+                if (ip + LZ4_MINMATCH + ml == limit && limit < match_limit) {
+                    ml += lz4_count(limit, input, match_limit);
+                }
+            }
+            ip += ml + LZ4_MINMATCH;
+            if (op + 1 + LZ4_LASTLITERALS + ml / 255 > op_limit) return 0;
+
+            if (ml >= 15) {
+                *token += 15;
+                ml -= 15;
+                for (; ml >= 255; ml -= 255) *op++ = 255;
+                *op++ = (uint8_t)ml;
+            } else {
+                *token += (uint8_t)ml;
+            }
+        }
+
+        anchor = ip;
+        if (ip >= mf_limit_plus_one) break;
+
+        table[dictionary_hash(lz4_read32(ip - 2), table_bits)] = (uint32_t)(ip - 2 - input) + 1;
+
+        offset = dictionary_find_match(c, dict_bits, table, table_bits, input, ip, &match);
+        if (offset) {
+            token = op++;
+            *token = 0;
+            goto _next_sequence;
+        }
+        ip++;
+    }
+
+_last_literals:
+    {
+        size_t const last_run = (size_t)(source_end - anchor);
+        if (op + last_run + 1 + (last_run + 255 - 15) / 255 > op_limit) return 0;
+
+        if (last_run >= 15) {
+            size_t accumulator = last_run - 15;
+            *op++ = 15 << 4;
+            for (; accumulator >= 255; accumulator -= 255) *op++ = 255;
+            *op++ = (uint8_t)accumulator;
+        } else {
+            *op++ = (uint8_t)(last_run << 4);
+        }
+
+        memcpy(op, anchor, last_run);
+        op += last_run;
+    }
+
+    return (size_t)(op - output);
+}
+
+// Decodes one LZ4 block that may reference the end of `dict`. Returns the decoded
+// size or DICTIONARY_ERROR.
+static size_t dictionary_lz4_decode(const uint8_t* dict, size_t dict_size, const uint8_t* src, size_t src_size,
+                                    uint8_t* dst, size_t dst_capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* const ip_end = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* const op_end = dst + dst_capacity;
+
+    for (;;) {
+        if (ip >= ip_end) return DICTIONARY_ERROR;
+        uint32_t const token = *ip++;
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            uint32_t s;
+            do {
+                if (ip >= ip_end) return DICTIONARY_ERROR;
+                s = *ip++;
+                literal_length += s;
+            } while (s == 255);
+        }
+        if (literal_length > (size_t)(ip_end - ip) || literal_length > (size_t)(op_end - op)) return DICTIONARY_ERROR;
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == ip_end) break;
+        if (ip_end - ip < 2) return DICTIONARY_ERROR;
+        size_t const offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t match_length = token & 15;
+        if (match_length == 15) {
+            uint32_t s;
+            do {
+                if (ip >= ip_end) return DICTIONARY_ERROR;
+                s = *ip++;
+                match_length += s;
+            } while (s == 255);
+        }
+        match_length += LZ4_MINMATCH;
+        if (offset == 0 || match_length > (size_t)(op_end - op)) return DICTIONARY_ERROR;
+
+        size_t const produced = (size_t)(op - dst);
+        if (offset > produced) {
+            size_t const back = offset - produced;
+            if (back > dict_size) return DICTIONARY_ERROR;
+            size_t const from_dict = match_length < back ? match_length : back;
+            memcpy(op, dict + dict_size - back, from_dict);
+            op += from_dict;
+            match_length -= from_dict;
+        }
+
+        const uint8_t* m = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, m, match_length);
+            op += match_length;
+        } else {
+            for (size_t i = 0; i < match_length; i++) *op++ = *m++;
+        }
+    }
+
+    return (size_t)(op - dst);
+}
+
+// Returns the compressed size, or 0 when the output is too small.
+WASM_EXPORT size_t dictionary_compress(const DictionaryCompressor* compressor, const uint8_t* input, size_t input_size,
+                                       uint8_t* output, size_t output_capacity) {
+    if (!compressor || !output || (!input && input_size) || input_size > LZ4_MAX_INPUT_SIZE) return 0;
+    if (output_capacity < 4 + 10) return 0;
+
+    zstd_write_le(output, compressor->dictionary_id, 4);
+    size_t pos = 4;
+    size_t remaining = input_size;
+    do {
+        output[pos++] = (uint8_t)((remaining & 0x7F) | (remaining > 0x7F ? 0x80 : 0));
+        remaining >>= 7;
+    } while (remaining);
+
+    size_t const block = dictionary_lz4_encode(compressor, input, input_size, output + pos, output_capacity - pos);
+    return block ? pos + block : 0;
+}
+
+// Decoded size recorded in a dictionary_compress stream, or DICTIONARY_ERROR.
+WASM_EXPORT size_t dictionary_decompressed_size(const uint8_t* input, size_t input_size) {
+    if (!input) return DICTIONARY_ERROR;
+    uint64_t size = 0;
+    for (size_t pos = 4, shift = 0; pos < input_size && shift < 35; pos++, shift += 7) {
+        size |= (uint64_t)(input[pos] & 0x7F) << shift;
+        if (!(input[pos] & 0x80)) return size <= LZ4_MAX_INPUT_SIZE ? (size_t)size : DICTIONARY_ERROR;
+    }
+    return DICTIONARY_ERROR;
+}
+
+// Decodes a dictionary_compress stream made with the same dictionary. Returns the
+// decoded size, or DICTIONARY_ERROR on a dictionary mismatch, a short output buffer
+// or a malformed stream.
+WASM_EXPORT size_t dictionary_decompress(const DictionaryCompressor* compressor, const uint8_t* input, size_t input_size,
+                                         uint8_t* output, size_t output_capacity) {
+    if (!compressor || !input || (!output && output_capacity)) return DICTIONARY_ERROR;
+    size_t const size = dictionary_decompressed_size(input, input_size);
+    if (size == DICTIONARY_ERROR || size > output_capacity) return DICTIONARY_ERROR;
+    if (zstd_read_le32(input) != compressor->dictionary_id) return DICTIONARY_ERROR;
+
+    size_t pos = 4;
+    while (input[pos] & 0x80) pos++;
+    pos++;
+    size_t const written = dictionary_lz4_decode(compressor->dictionary, compressor->dictionary_size,
+                                                 input + pos, input_size - pos, output, size);
+    return written == size ? size : DICTIONARY_ERROR;
+}
+
+WASM_EXPORT void free_dictionary_compressor(DictionaryCompressor* compressor) {
+    if (!compressor) return;
+    if (compressor->dictionary) wasm_free(compressor->dictionary);
+    if (compressor->hash_table) wasm_free(compressor->hash_table);
+    wasm_free(compressor);
+}
+
+// Compressibility prediction. Up to POTENTIAL_BLOCKS blocks spread evenly over the
+// input are histogrammed and run through a greedy LZ pass; each block's predicted
+// ratio is its unmatched bytes at order-0 entropy plus a fixed cost per match. Blocks
+// that disagree lower the confidence unless they cover the whole input.
+#define POTENTIAL_BLOCKS 8
+#define POTENTIAL_BLOCK_SIZE 4096
+#define POTENTIAL_HASH_LOG 12
+#define POTENTIAL_MATCH_COST 3
+#define POTENTIAL_FRAME_OVERHEAD 16
+#define POTENTIAL_INCOMPRESSIBLE 0.97f
+
+// Byte histogram. wasm SIMD has no scatter, so the speed comes from loading 8 bytes
+// at a time into four interleaved tables: runs of one byte value no longer serialise
+// on a single counter.
+static void potential_histogram(const uint8_t* data, size_t size, uint32_t* histogram) {
+    uint32_t split[4][256];
+    memset(split, 0, sizeof(split));
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        __builtin_memcpy(&v, data + i, sizeof(v));
+        split[0][v & 0xFF]++;
+        split[1][(v >> 8) & 0xFF]++;
+        split[2][(v >> 16) & 0xFF]++;
+        split[3][(v >> 24) & 0xFF]++;
+        split[0][(v >> 32) & 0xFF]++;
+        split[1][(v >> 40) & 0xFF]++;
+        split[2][(v >> 48) & 0xFF]++;
+        split[3][v >> 56]++;
+    }
+    for (; i < size; i++) split[0][data[i]]++;
+    for (int s = 0; s < 256; s++) histogram[s] = split[0][s] + split[1][s] + split[2][s] + split[3][s];
+}
+
+// Order-0 entropy in bits per symbol.
+float calculate_entropy(const uint32_t* frequencies, size_t total_count) {
+    if (!frequencies || total_count == 0) return 0.0f;
+    uint64_t bits = (uint64_t)total_count * zstd_log2_fixed((uint32_t)total_count);
+    for (int s = 0; s < 256; s++) {
+        if (frequencies[s]) bits -= (uint64_t)frequencies[s] * zstd_log2_fixed(frequencies[s]);
+    }
+    return (float)bits / (256.0f * (float)total_count);
+}
+
+// Greedy LZ pass over one block. Returns its predicted compressed size: unmatched
+// bytes at `byte_cost` each, and every match at POTENTIAL_MATCH_COST or the cost of
+// its bytes as literals, whichever is lower. Adds the bytes matches cover to *matched.
+static float potential_match_block(const uint8_t* block, size_t size, float byte_cost, uint32_t* matched) {
+    uint16_t table[1 << POTENTIAL_HASH_LOG];
+    memset(table, 0, sizeof(table));
+    const uint8_t* const end = block + size;
+    float cost = 0.0f;
+    size_t i = 0;
+    while (i + LZ4_MINMATCH <= size) {
+        uint32_t const sequence = lz4_read32(block + i);
+        uint32_t const h = (sequence * 2654435761U) >> (32 - POTENTIAL_HASH_LOG);
+        uint32_t const candidate = table[h];
+        table[h] = (uint16_t)(i + 1);
+        if (candidate && lz4_read32(block + candidate - 1) == sequence) {
+            size_t const length = LZ4_MINMATCH +
+                lz4_count(block + i + LZ4_MINMATCH, block + candidate - 1 + LZ4_MINMATCH, end);
+            float const literal_cost = (float)length * byte_cost;
+            cost += literal_cost < POTENTIAL_MATCH_COST ? literal_cost : POTENTIAL_MATCH_COST;
+            *matched += (uint32_t)length;
+            i += length;
+        } else {
+            cost += byte_cost;
+            i++;
+        }
+    }
+    return cost + (float)(size - i) * byte_cost;
+}
+
+// Fills `stats` with the sample's histogram, entropy and match density, and the
+// predicted compressed/original ratio in compression_ratio with its confidence
+// (0..1). Allocates nothing. Returns 0, or -1 on bad arguments.
+WASM_EXPORT int analyze_compression_potential(const uint8_t* data, size_t size, CompressionStats* stats) {
+    if (!data || !stats) return -1;
+    memset(stats, 0, sizeof(*stats));
+    stats->original_size = size;
+    stats->compression_ratio = 1.0f;
+    if (size == 0) return 0;
+
+    size_t const whole = (size_t)POTENTIAL_BLOCKS * POTENTIAL_BLOCK_SIZE;
+    size_t const block_size = size < whole ? (size + POTENTIAL_BLOCKS - 1) / POTENTIAL_BLOCKS : POTENTIAL_BLOCK_SIZE;
+    size_t const stride = size < whole ? block_size : (size - block_size) / (POTENTIAL_BLOCKS - 1);
+
+    float ratios[POTENTIAL_BLOCKS];
+    uint32_t block_count = 0;
+    uint32_t total_matched = 0;
+    float ratio_sum = 0.0f;
+    for (uint32_t b = 0; b < POTENTIAL_BLOCKS; b++) {
+        size_t const start = b * stride;
+        if (start >= size) break;
+        size_t const n = size - start < block_size ? size - start : block_size;
+
+        uint32_t histogram[256];
+        potential_histogram(data + start, n, histogram);
+        for (int s = 0; s < 256; s++) stats->byte_frequencies[s] += histogram[s];
+
+        uint32_t matched = 0;
+        float const byte_cost = calculate_entropy(histogram, n) / 8.0f;
+        float ratio = potential_match_block(data + start, n, byte_cost, &matched) / (float)n;
+        total_matched += matched;
+        if (ratio > 1.0f) ratio = 1.0f;
+        ratios[block_count++] = ratio;
+        ratio_sum += ratio;
+        stats->sampled_bytes += n;
+    }
+
+    float const mean = ratio_sum / (float)block_count;
+    float variance = 0.0f;
+    for (uint32_t b = 0; b < block_count; b++) variance += (ratios[b] - mean) * (ratios[b] - mean);
+    float const deviation = __builtin_sqrtf(variance / (float)block_count);
+
+    float const coverage = (float)stats->sampled_bytes / (float)size;
+    float agreement = 1.0f - 4.0f * deviation;
+    if (agreement < 0.0f) agreement = 0.0f;
+
+    for (int s = 0; s < 256; s++) stats->unique_bytes += stats->byte_frequencies[s] != 0;
+    stats->entropy = calculate_entropy(stats->byte_frequencies, stats->sampled_bytes);
+    stats->match_density = (float)total_matched / (float)stats->sampled_bytes;
+    stats->compression_ratio = mean + (float)POTENTIAL_FRAME_OVERHEAD / (float)size;
+    stats->compressed_size = (size_t)(stats->compression_ratio * (float)size);
+    stats->confidence = coverage + (1.0f - coverage) * agreement;
+    return 0;
+}
+
+// Table-based ANS (tANS/FSE) coding of bytes. Symbols are dealt round-robin to
+// TANS_STATES independent states that share one table and one backward bit stream, so
+// the decoder's table lookups do not depend on each other. Tables are described with
+// the zstd FSE header and built by the same code. Both directions keep their tables
+// on the stack.
+#define TANS_MAGIC 0x41545850u
+#define TANS_MODE_CODED 0
+#define TANS_MODE_SINGLE 1
+#define TANS_MODE_STORED 2
+// Magic, mode byte, decoded size (u32 LE); single-symbol streams add that symbol.
+#define TANS_HEADER_SIZE 9
+#define TANS_STATES 4
+#define TANS_LOG_MAX FSE_TABLE_LOG_LIMIT
+// LZ matching must save this fraction of the input over order-0 coding for
+// get_optimal_compression to prefer it to tANS.
+#define TANS_LZ_GAIN_MIN 0.02f
+
+typedef struct {
+    uint16_t states[1 << TANS_LOG_MAX];
+    ZstdFseTransform symbols[FSE_SYMBOLS_LIMIT];
+    uint32_t table_log;
+} TansCTable;
+
+// Backward reader over a 64-bit container refilled a byte-aligned step at a time.
+// Streams shorter than 8 bytes are read from a zero-padded copy.
+typedef struct {
+    const uint8_t* start;
+    const uint8_t* ptr;
+    uint64_t container;
+    uint32_t consumed;
+    uint32_t pad_bits;
+    uint8_t pad[8];
+} TansBitReader;
+
+static int tans_reader_init(TansBitReader* r, const uint8_t* src, size_t size) {
+    if (size == 0 || src[size - 1] == 0) return 0;
+    r->pad_bits = 0;
+    if (size < 8) {
+        memset(r->pad, 0, sizeof(r->pad));
+        memcpy(r->pad + 8 - size, src, size);
+        r->pad_bits = (uint32_t)(8 - size) * 8;
+        src = r->pad;
+        size = 8;
+    }
+    r->start = src;
+    r->ptr = src + size - 8;
+    r->container = zstd_read_le64(r->ptr);
+    r->consumed = 8 - zstd_highbit(src[size - 1]);
+    return 1;
+}
+
+static inline void tans_reload(TansBitReader* r) {
+    size_t step = r->consumed >> 3;
+    size_t const available = (size_t)(r->ptr - r->start);
+    if (step > available) step = available;
+    r->ptr -= step;
+    r->consumed -= (uint32_t)step * 8;
+    r->container = zstd_read_le64(r->ptr);
+}
+
+// Next count bits (count may be 0); the caller keeps consumed below 64 and
+// consumed + count <= 64.
+static inline uint32_t tans_read(TansBitReader* r, uint32_t count) {
+    uint32_t const value = (uint32_t)((r->container << r->consumed) >> 1 >> (63 - count));
+    r->consumed += count;
+    return value;
+}
+
+// As tans_read after a refill; returns 0 when the stream is exhausted.
+static inline int tans_read_checked(TansBitReader* r, uint32_t count, uint32_t* value) {
+    tans_reload(r);
+    if (r->consumed + count > 64) return 0;
+    *value = count ? tans_read(r, count) : 0;
+    return 1;
+}
+
+// Every bit read, and none beyond the stream.
+static inline int tans_reader_finished(const TansBitReader* r) {
+    return (size_t)(r->ptr - r->start) * 8 + 64 - r->consumed == r->pad_bits;
+}
+
+static inline uint32_t tans_init_state(const TansCTable* ct, uint32_t symbol) {
+    const ZstdFseTransform* tt = &ct->symbols[symbol];
+    uint32_t nb = (tt->delta_nb_bits + (1u << 15)) >> 16;
+    uint32_t value = (nb << 16) - tt->delta_nb_bits;
+    return ct->states[(value >> nb) + tt->delta_find_state];
+}
+
+static inline void tans_encode(DeflateBitWriter* bw, const TansCTable* ct, uint32_t* state, uint32_t symbol) {
+    const ZstdFseTransform* tt = &ct->symbols[symbol];
+    uint32_t nb = (*state + tt->delta_nb_bits) >> 16;
+    deflate_put_bits(bw, *state & ((1u << nb) - 1), nb);
+    *state = ct->states[(*state >> nb) + tt->delta_find_state];
+}
+
+// Bit stream for input[0..size). Symbol i belongs to state i % TANS_STATES; each
+// state starts on the last of its symbols, and the others are encoded from the end
+// so that the decoder reads them front to back. Returns the size, 0 on overflow.
+static size_t tans_encode_stream(const uint8_t* input, size_t size, const TansCTable* ct,
+                                 uint8_t* output, size_t capacity) {
+    DeflateBitWriter bw = { output, capacity, 0, 0, 0, 0 };
+    uint32_t const table_size = 1u << ct->table_log;
+    uint32_t state[TANS_STATES];
+    size_t const body = size > TANS_STATES ? size - TANS_STATES : 0;
+
+    for (size_t lane = 0; lane < TANS_STATES; lane++) state[lane] = table_size;
+    for (size_t i = body; i < size; i++) state[i % TANS_STATES] = tans_init_state(ct, input[i]);
+    for (size_t i = body; i-- > 0;) {
+        tans_encode(&bw, ct, &state[i % TANS_STATES], input[i]);
+    }
+    for (size_t lane = TANS_STATES; lane-- > 0;) {
+        deflate_put_bits(&bw, state[lane] - table_size, ct->table_log);
+    }
+    return zstd_close_stream(&bw, 0);
+}
+
+static int tans_decode_stream(const uint8_t* input, size_t input_size, const ZstdFseCell* cells,
+                              uint32_t table_log, uint8_t* output, size_t size) {
+    TansBitReader r;
+    if (!tans_reader_init(&r, input, input_size)) return 0;
+
+    uint32_t s0, s1, s2, s3;
+    if (!tans_read_checked(&r, table_log, &s0) || !tans_read_checked(&r, table_log, &s1) ||
+        !tans_read_checked(&r, table_log, &s2) || !tans_read_checked(&r, table_log, &s3)) return 0;
+
+    size_t const body = size > TANS_STATES ? size - TANS_STATES : 0;
+    size_t i = 0;
+    // One refill covers a whole round as long as it leaves room for four codes.
+    while (i + TANS_STATES <= body) {
+        tans_reload(&r);
+        if (r.consumed + TANS_STATES * table_log > 64) break;
+        ZstdFseCell const c0 = cells[s0], c1 = cells[s1], c2 = cells[s2], c3 = cells[s3];
+        output[i] = c0.symbol;
+        output[i + 1] = c1.symbol;
+        output[i + 2] = c2.symbol;
+        output[i + 3] = c3.symbol;
+        s0 = c0.base + tans_read(&r, c0.nb_bits);
+        s1 = c1.base + tans_read(&r, c1.nb_bits);
+        s2 = c2.base + tans_read(&r, c2.nb_bits);
+        s3 = c3.base + tans_read(&r, c3.nb_bits);
+        i += TANS_STATES;
+    }
+
+    uint32_t state[TANS_STATES] = { s0, s1, s2, s3 };
+    for (; i < size; i++) {
+        uint32_t* const s = &state[i % TANS_STATES];
+        ZstdFseCell const cell = cells[*s];
+        output[i] = cell.symbol;
+        if (i < body) {
+            uint32_t bits;
+            if (!tans_read_checked(&r, cell.nb_bits, &bits)) return 0;
+            *s = cell.base + bits;
+        }
+    }
+    return tans_reader_finished(&r);
+}
+
+static size_t tans_write_stored(const uint8_t* input, size_t input_size, uint8_t* output, size_t capacity) {
+    if (capacity < TANS_HEADER_SIZE + input_size) return 0;
+    output[4] = TANS_MODE_STORED;
+    memcpy(output + TANS_HEADER_SIZE, input, input_size);
+    return TANS_HEADER_SIZE + input_size;
+}
+
+// Output that always suffices for compress_tans() of input_size bytes.
+WASM_EXPORT size_t tans_compress_bound(size_t input_size) {
+    return TANS_HEADER_SIZE + 1 + input_size;
+}
+
+// Stream: TANS_HEADER_SIZE bytes (magic, mode, decoded size), then for coded input
+// the FSE table description and the bit stream. Input the coder cannot shrink is
+// stored. Returns the size written, -1 when output_capacity is below
+// tans_compress_bound() and the coded stream does not fit either.
+WASM_EXPORT int32_t compress_tans(const uint8_t* input, size_t input_size,
+                                  uint8_t* output, size_t output_capacity) {
+    if (!input || !output || input_size > 0x7FFFFFFF || output_capacity < TANS_HEADER_SIZE + 1) return -1;
+
+    zstd_write_le(output, TANS_MAGIC, 4);
+    zstd_write_le(output + 5, input_size, 4);
+
+    uint32_t counts[FSE_SYMBOLS_LIMIT];
+    potential_histogram(input, input_size, counts);
+    uint32_t max_symbol = 0, used = 0;
+    for (uint32_t s = 0; s < FSE_SYMBOLS_LIMIT; s++) {
+        if (counts[s]) {
+            max_symbol = s;
+            used++;
+        }
+    }
+    if (used == 1) {
+        output[4] = TANS_MODE_SINGLE;
+        output[TANS_HEADER_SIZE] = (uint8_t)max_symbol;
+        return TANS_HEADER_SIZE + 1;
+    }
+    if (used == 0) {
+        size_t const stored = tans_write_stored(input, input_size, output, output_capacity);
+        return stored ? (int32_t)stored : -1;
+    }
+
+    uint32_t const table_log = zstd_fse_table_log(TANS_LOG_MAX, (uint32_t)input_size, max_symbol);
+    int16_t norm[FSE_SYMBOLS_LIMIT];
+    size_t written = 0;
+    if (zstd_fse_normalize(counts, max_symbol, (uint32_t)input_size, table_log, norm)) {
+        output[4] = TANS_MODE_CODED;
+        size_t const header = zstd_fse_write_ncount(output + TANS_HEADER_SIZE, output_capacity - TANS_HEADER_SIZE,
+                                                    norm, max_symbol, table_log);
+        // Coded output has to beat storing, so it never needs more than the input size.
+        size_t const limit = input_size < output_capacity - TANS_HEADER_SIZE
+                           ? input_size : output_capacity - TANS_HEADER_SIZE;
+        if (header && header < limit) {
+            TansCTable ct;
+            fse_fill_encode_table(ct.states, ct.symbols, norm, max_symbol, table_log);
+            ct.table_log = table_log;
+            size_t const stream = tans_encode_stream(input, input_size, &ct, output + TANS_HEADER_SIZE + header,
+                                                     limit - header);
+            if (stream) written = TANS_HEADER_SIZE + header + stream;
+        }
+    }
+
+    if (!written) written = tans_write_stored(input, input_size, output, output_capacity);
+    return written ? (int32_t)written : -1;
+}
+
+// Decoded size recorded in a compress_tans() stream, -1 when it is not one.
+WASM_EXPORT int32_t tans_decompressed_size(const uint8_t* input, size_t input_size) {
+    if (!input || input_size < TANS_HEADER_SIZE || zstd_read_le32(input) != TANS_MAGIC) return -1;
+    uint32_t const size = zstd_read_le32(input + 5);
+    return size > 0x7FFFFFFF ? -1 : (int32_t)size;
+}
+
+// Inverse of compress_tans. Returns the decoded size, -1 when the stream is malformed
+// or output_size is too small.
+WASM_EXPORT int32_t decompress_tans(const uint8_t* input, size_t input_size,
+                                    uint8_t* output, size_t output_size) {
+    int32_t const decoded = tans_decompressed_size(input, input_size);
+    if (decoded < 0 || !output || (size_t)decoded > output_size) return -1;
+    const uint8_t* const payload = input + TANS_HEADER_SIZE;
+    size_t const payload_size = input_size - TANS_HEADER_SIZE;
+
+    switch (input[4]) {
+    case TANS_MODE_STORED:
+        if (payload_size != (size_t)decoded) return -1;
+        memcpy(output, payload, payload_size);
+        return decoded;
+    case TANS_MODE_SINGLE:
+        if (payload_size != 1) return -1;
+        memset(output, payload[0], (size_t)decoded);
+        return decoded;
+    case TANS_MODE_CODED:
+        break;
+    default:
+        return -1;
+    }
+
+    int16_t norm[FSE_SYMBOLS_LIMIT];
+    uint32_t max_symbol = FSE_SYMBOLS_LIMIT - 1, table_log = 0;
+    size_t const header = zstd_fse_read_ncount(payload, payload_size, norm, &max_symbol, &table_log, TANS_LOG_MAX);
+    if (!header || header >= payload_size) return -1;
+
+    ZstdFseCell cells[1 << TANS_LOG_MAX];
+    if (!fse_fill_decode_cells(cells, norm, max_symbol, table_log)) return -1;
+    if (!tans_decode_stream(payload + header, payload_size - header, cells, table_log, output, (size_t)decoded)) return -1;
+    return decoded;
+}
+
+WASM_EXPORT CompressionMethod get_optimal_compression(const uint8_t* data, size_t size) {
+    if (!data || size == 0) return METHOD_NONE;
+    
+    if (size <= 1024) {
+        return METHOD_HUFFMAN;
+    }
+    
+    // Already-compressed data; LZ4 gives up on it far more cheaply than zstd's
+    // entropy stages would.
+    CompressionStats stats;
+    analyze_compression_potential(data, size, &stats);
+    if (stats.compression_ratio > POTENTIAL_INCOMPRESSIBLE) {
+        return METHOD_LZ4;
+    }
+    // Skewed bytes with little repetition (index deltas, quantized attributes): the
+    // entropy coder alone gets as far as LZ would.
+    if (stats.entropy / 8.0f <= stats.compression_ratio + TANS_LZ_GAIN_MIN) {
+        return METHOD_TANS;
     }
+    return METHOD_ZSTD;
 }
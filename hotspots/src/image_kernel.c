@@ -1,4 +1,6 @@
 #include "image_kernel.h"
+#include "compress.h"
+#include "palette_search.h"
 #include "util.h"
 
 #ifdef __wasm_simd128__
@@ -17,26 +19,6 @@ static inline float fast_sqrt(float x) {
     return guess;
 }
 
-static inline float fast_exp(float x) {
-    if (x > 88.0f) return 3.4e38f;
-    if (x < -88.0f) return 0.0f;
-    
-    const float c0 = 1.0f;
-    const float c1 = 0.5f;
-    const float c2 = 0.125f;
-    const float c3 = 0.020833333f;
-    const float c4 = 0.002604167f;
-    
-    float x2 = x * x;
-    float x3 = x2 * x;
-    float x4 = x2 * x2;
-    
-    float num = c0 + c1*x + c2*x2 + c3*x3 + c4*x4;
-    float den = c0 - c1*x + c2*x2 - c3*x3 + c4*x4;
-    
-    return num / den;
-}
-
 static inline float fast_log(float x) {
     if (x <= 0.0f) return -3.4e38f;
     if (x == 1.0f) return 0.0f;
@@ -53,124 +35,158 @@ static inline float fast_log(float x) {
     return result + log2_x * 0.693147181f;
 }
 
-typedef struct OctreeNode {
-    uint32_t r, g, b, a;
+// Octree quantizer over a contiguous node array. Children are 32-bit indices (0 is the
+// root, so never a child) and every internal node sits on an intrusive per-level list,
+// so reduction pops the deepest reducible node in O(1). Colours reach the tree from an
+// exact RGBA histogram, one insertion per distinct colour rather than per pixel.
+#define OCTREE_DEPTH 8
+#define OCTREE_HISTOGRAM_BITS 16
+#define OCTREE_HISTOGRAM_SIZE (1u << OCTREE_HISTOGRAM_BITS)
+#define OCTREE_HISTOGRAM_FLUSH (OCTREE_HISTOGRAM_SIZE / 2)
+#define OCTREE_NONE 0xFFFFFFFFu
+
+typedef struct {
+    uint64_t r, g, b, a;
     uint32_t count;
-    uint32_t children_mask;
-    struct OctreeNode* children[8];
-    struct OctreeNode* next;
+    uint32_t children[8];
+    uint32_t next;          // next node on the reducible list of its level, or free list
+    uint8_t level;
+    uint8_t is_leaf;
+    uint16_t palette_index;
 } OctreeNode;
 
 typedef struct {
-    OctreeNode* root;
-    OctreeNode* reducible[8];
+    OctreeNode* nodes;
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t free_list;
+    uint32_t reducible[OCTREE_DEPTH];
     uint32_t leaf_count;
     uint32_t max_colors;
-    uint8_t depth;
 } Octree;
 
+typedef struct {
+    uint32_t color;         // RGBA packed big-endian, as octree_pack() builds it
+    uint32_t count;         // 0 when the slot is empty
+} OctreeHistogramEntry;
+
 extern void* wasm_malloc(size_t size);
 extern void wasm_free(void* ptr);
 
-static OctreeNode* create_octree_node(uint8_t level, Octree* tree) {
-    OctreeNode* node = (OctreeNode*)wasm_malloc(sizeof(OctreeNode));
-    if (!node) return NULL;
-    
-    node->r = node->g = node->b = node->a = 0;
-    node->count = 0;
-    node->children_mask = 0;
-    node->next = NULL;
-    
-    for (int i = 0; i < 8; i++) {
-        node->children[i] = NULL;
-    }
-    
-    if (level < 7) {
-        node->next = tree->reducible[level];
-        tree->reducible[level] = node;
+static inline uint32_t octree_pack(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint32_t octree_hash(uint32_t color, uint32_t bits) {
+    return (color * 2654435761u) >> (32 - bits);
+}
+
+static uint32_t octree_new_node(Octree* tree, uint8_t level) {
+    uint32_t index;
+    if (tree->free_list != OCTREE_NONE) {
+        index = tree->free_list;
+        tree->free_list = tree->nodes[index].next;
     } else {
+        if (tree->used == tree->capacity) return OCTREE_NONE;
+        index = tree->used++;
+    }
+
+    OctreeNode* node = &tree->nodes[index];
+    memset(node, 0, sizeof(OctreeNode));
+    node->level = level;
+    node->next = OCTREE_NONE;
+    if (level == OCTREE_DEPTH) {
+        node->is_leaf = 1;
         tree->leaf_count++;
+    } else {
+        node->next = tree->reducible[level];
+        tree->reducible[level] = index;
     }
-    
-    return node;
+    return index;
 }
 
-static void add_color_to_octree(Octree* tree, uint32_t color, uint32_t level, OctreeNode* node) {
-    if (level == 8) {
-        node->r += (color >> 24) & 0xFF;
-        node->g += (color >> 16) & 0xFF;
-        node->b += (color >> 8) & 0xFF;
-        node->a += color & 0xFF;
-        node->count++;
-        return;
-    }
-    
-    uint32_t index = ((color >> (21 - level * 3)) & 0x04) |
-                     ((color >> (14 - level * 3)) & 0x02) |
-                     ((color >> (7 - level * 3)) & 0x01);
-    
-    if (!(node->children_mask & (1 << index))) {
-        node->children[index] = create_octree_node(level, tree);
-        if (!node->children[index]) return;
-        node->children_mask |= (1 << index);
+// Adds `count` pixels of `color` (whose channel sums are count * channel), stopping at
+// the first leaf on its path, which may be a reduced inner node.
+static int octree_insert(Octree* tree, uint32_t color, uint32_t count) {
+    uint32_t index = 0;
+    for (uint32_t level = 0; !tree->nodes[index].is_leaf; level++) {
+        uint32_t shift = 7 - level;
+        uint32_t child = (((color >> (24 + shift)) & 1) << 2) |
+                         (((color >> (16 + shift)) & 1) << 1) |
+                         ((color >> (8 + shift)) & 1);
+        uint32_t next = tree->nodes[index].children[child];
+        if (next == 0) {
+            next = octree_new_node(tree, (uint8_t)(level + 1));
+            if (next == OCTREE_NONE) return 0;
+            tree->nodes[index].children[child] = next;
+        }
+        index = next;
     }
-    
-    add_color_to_octree(tree, color, level + 1, node->children[index]);
+
+    OctreeNode* leaf = &tree->nodes[index];
+    leaf->r += (uint64_t)(color >> 24) * count;
+    leaf->g += (uint64_t)((color >> 16) & 0xFF) * count;
+    leaf->b += (uint64_t)((color >> 8) & 0xFF) * count;
+    leaf->a += (uint64_t)(color & 0xFF) * count;
+    leaf->count += count;
+    return 1;
 }
 
-static void reduce_octree(Octree* tree) {
-    int level = 6;
-    while (level >= 0 && !tree->reducible[level]) {
-        level--;
-    }
-    
+// Folds the children of the deepest reducible node into it. Deeper lists are empty by
+// then, so those children are all leaves.
+static void octree_reduce(Octree* tree) {
+    int level = OCTREE_DEPTH - 1;
+    while (level >= 0 && tree->reducible[level] == OCTREE_NONE) level--;
     if (level < 0) return;
-    
-    OctreeNode* node = tree->reducible[level];
+
+    uint32_t index = tree->reducible[level];
+    OctreeNode* node = &tree->nodes[index];
     tree->reducible[level] = node->next;
-    
-    uint32_t r = 0, g = 0, b = 0, a = 0, count = 0;
-    
+
     for (int i = 0; i < 8; i++) {
-        if (node->children[i]) {
-            r += node->children[i]->r;
-            g += node->children[i]->g;
-            b += node->children[i]->b;
-            a += node->children[i]->a;
-            count += node->children[i]->count;
-            
-            wasm_free(node->children[i]);
-            tree->leaf_count--;
-        }
-    }
-    
-    node->r = r;
-    node->g = g;
-    node->b = b;
-    node->a = a;
-    node->count = count;
-    node->children_mask = 0;
+        uint32_t child = node->children[i];
+        if (child == 0) continue;
+        OctreeNode* leaf = &tree->nodes[child];
+        node->r += leaf->r;
+        node->g += leaf->g;
+        node->b += leaf->b;
+        node->a += leaf->a;
+        node->count += leaf->count;
+        leaf->next = tree->free_list;
+        tree->free_list = child;
+        node->children[i] = 0;
+        tree->leaf_count--;
+    }
+    node->is_leaf = 1;
+    node->next = OCTREE_NONE;
     tree->leaf_count++;
 }
 
-static void extract_palette(OctreeNode* node, Color32* palette, uint32_t* index) {
-    if (!node) return;
-    
-    if (node->children_mask == 0) {
+static int octree_flush_histogram(Octree* tree, OctreeHistogramEntry* histogram) {
+    for (uint32_t i = 0; i < OCTREE_HISTOGRAM_SIZE; i++) {
+        if (histogram[i].count == 0) continue;
+        if (!octree_insert(tree, histogram[i].color, histogram[i].count)) return 0;
+        while (tree->leaf_count > tree->max_colors) octree_reduce(tree);
+        histogram[i].count = 0;
+    }
+    return 1;
+}
+
+// Depth-first palette extraction; every leaf learns its palette index.
+static void extract_palette(Octree* tree, uint32_t index, Color32* palette, uint32_t* palette_size) {
+    OctreeNode* node = &tree->nodes[index];
+    if (node->is_leaf) {
         if (node->count > 0) {
-            palette[*index].r = (uint8_t)(node->r / node->count);
-            palette[*index].g = (uint8_t)(node->g / node->count);
-            palette[*index].b = (uint8_t)(node->b / node->count);
-            palette[*index].a = (uint8_t)(node->a / node->count);
-            (*index)++;
+            palette[*palette_size].r = (uint8_t)(node->r / node->count);
+            palette[*palette_size].g = (uint8_t)(node->g / node->count);
+            palette[*palette_size].b = (uint8_t)(node->b / node->count);
+            palette[*palette_size].a = (uint8_t)(node->a / node->count);
+            node->palette_index = (uint16_t)(*palette_size)++;
         }
         return;
     }
-    
     for (int i = 0; i < 8; i++) {
-        if (node->children[i]) {
-            extract_palette(node->children[i], palette, index);
-        }
+        if (node->children[i]) extract_palette(tree, node->children[i], palette, palette_size);
     }
 }
 
@@ -178,279 +194,445 @@ WASM_EXPORT QuantizedImage* quantize_colors_octree(const uint8_t* rgba_data, siz
     if (!rgba_data || width == 0 || height == 0 || max_colors == 0) {
         return NULL;
     }
-    
-    Octree tree = {0};
-    tree.max_colors = max_colors;
-    tree.root = create_octree_node(0, &tree);
-    if (!tree.root) return NULL;
-    
+    // Below 8 colours reduction reaches the root, which folds everything into one
+    // colour; median cut splits by population instead.
+    if (max_colors < 8) return quantize_colors_median_cut(rgba_data, width, height, max_colors);
+    if (max_colors > 256) max_colors = 256;
+
     size_t pixel_count = width * height;
-    for (size_t i = 0; i < pixel_count; i++) {
-        uint32_t color = (rgba_data[i*4] << 24) | (rgba_data[i*4+1] << 16) | 
-                        (rgba_data[i*4+2] << 8) | rgba_data[i*4+3];
-        
-        add_color_to_octree(&tree, color, 0, tree.root);
-        
-        while (tree.leaf_count > max_colors) {
-            reduce_octree(&tree);
+    Octree tree;
+    tree.max_colors = (uint32_t)max_colors;
+    tree.capacity = 1 + (tree.max_colors + 1) * OCTREE_DEPTH;
+    tree.used = 0;
+    tree.free_list = OCTREE_NONE;
+    tree.leaf_count = 0;
+    for (int i = 0; i < OCTREE_DEPTH; i++) tree.reducible[i] = OCTREE_NONE;
+    tree.nodes = (OctreeNode*)wasm_malloc(tree.capacity * sizeof(OctreeNode));
+    OctreeHistogramEntry* histogram = (OctreeHistogramEntry*)wasm_malloc(OCTREE_HISTOGRAM_SIZE * sizeof(OctreeHistogramEntry));
+    if (!tree.nodes || !histogram) {
+        if (tree.nodes) wasm_free(tree.nodes);
+        if (histogram) wasm_free(histogram);
+        return NULL;
+    }
+    octree_new_node(&tree, 0);
+
+    // Runs of one colour bump the histogram once; a histogram at half load is flushed
+    // into the tree so its probes stay short on photographs with millions of colours.
+    memset(histogram, 0, OCTREE_HISTOGRAM_SIZE * sizeof(OctreeHistogramEntry));
+    uint32_t distinct = 0;
+    int ok = 1;
+    for (size_t i = 0; i < pixel_count && ok;) {
+        uint32_t color = octree_pack(rgba_data + i * 4);
+        size_t run = 1;
+        while (i + run < pixel_count && octree_pack(rgba_data + (i + run) * 4) == color) run++;
+        i += run;
+
+        uint32_t slot = octree_hash(color, OCTREE_HISTOGRAM_BITS);
+        while (histogram[slot].count != 0 && histogram[slot].color != color) {
+            slot = (slot + 1) & (OCTREE_HISTOGRAM_SIZE - 1);
+        }
+        if (histogram[slot].count == 0) {
+            histogram[slot].color = color;
+            distinct++;
+        }
+        histogram[slot].count += (uint32_t)run;
+        if (distinct == OCTREE_HISTOGRAM_FLUSH) {
+            ok = octree_flush_histogram(&tree, histogram);
+            distinct = 0;
         }
     }
-    
-    QuantizedImage* result = (QuantizedImage*)wasm_malloc(sizeof(QuantizedImage));
-    if (!result) return NULL;
-    
+    if (ok) ok = octree_flush_histogram(&tree, histogram);
+    wasm_free(histogram);
+
+    QuantizedImage* result = ok ? (QuantizedImage*)wasm_malloc(sizeof(QuantizedImage)) : NULL;
+    if (!result) {
+        wasm_free(tree.nodes);
+        return NULL;
+    }
+
     result->palette = (Color32*)wasm_malloc(tree.leaf_count * sizeof(Color32));
     result->indices = (uint8_t*)wasm_malloc(pixel_count);
-    if (!result->palette || !result->indices) {
-        wasm_free(result->palette);
-        wasm_free(result->indices);
+    void* search_state = wasm_malloc(palette_search_state_size());
+    if (!result->palette || !result->indices || !search_state) {
+        if (result->palette) wasm_free(result->palette);
+        if (result->indices) wasm_free(result->indices);
+        if (search_state) wasm_free(search_state);
         wasm_free(result);
+        wasm_free(tree.nodes);
         return NULL;
     }
-    
-    uint32_t palette_index = 0;
-    extract_palette(tree.root, result->palette, &palette_index);
-    result->palette_size = palette_index;
+
+    uint32_t palette_size = 0;
+    extract_palette(&tree, 0, result->palette, &palette_size);
+    result->palette_size = palette_size;
     result->width = width;
     result->height = height;
-    
-    for (size_t i = 0; i < pixel_count; i++) {
-        uint8_t r = rgba_data[i*4];
-        uint8_t g = rgba_data[i*4+1]; 
-        uint8_t b = rgba_data[i*4+2];
-        uint8_t a = rgba_data[i*4+3];
-        
-        float min_distance = 1e30f;
-        uint8_t best_index = 0;
-        
-        for (uint32_t j = 0; j < result->palette_size; j++) {
-            float dr = (float)(r - result->palette[j].r) * 0.299f;
-            float dg = (float)(g - result->palette[j].g) * 0.587f;
-            float db = (float)(b - result->palette[j].b) * 0.114f;
-            float da = (float)(a - result->palette[j].a) * 0.5f;
-            
-            float distance = dr*dr + dg*dg + db*db + da*da;
-            if (distance < min_distance) {
-                min_distance = distance;
-                best_index = j;
-            }
-        }
-        
-        result->indices[i] = best_index;
-    }
-    
+    wasm_free(tree.nodes);
+
+    PaletteSearch* search = palette_search_init(search_state, (const uint8_t*)result->palette, palette_size,
+                                                4, PALETTE_METRIC_LUMA);
+    palette_search_map(search, rgba_data, pixel_count, 4, result->indices);
+    wasm_free(search_state);
+
     return result;
 }
 
+// Median cut over a colour histogram: 5 bits per RGB channel and 3 for alpha. Each bin
+// keeps its pixel count and the sums of the bits below its cell, so box means stay
+// exact while the splitting only touches occupied bins.
+#define MEDIAN_CUT_ALPHA_BITS 3
+#define MEDIAN_CUT_BINS (1u << (15 + MEDIAN_CUT_ALPHA_BITS))
+#define MEDIAN_CUT_EXACT_BITS 10
+#define MEDIAN_CUT_EXACT_SLOTS (1u << MEDIAN_CUT_EXACT_BITS)
+
 typedef struct {
-    uint8_t r, g, b, a;
-} ColorEntry;
+    uint32_t count;
+    uint32_t r, g, b, a;    // sums of the low bits dropped by median_cut_bin()
+} MedianCutBin;
 
-static int compare_red(const void* a, const void* b) {
-    return ((ColorEntry*)a)->r - ((ColorEntry*)b)->r;
-}
+typedef struct {
+    float mean[4];
+    uint32_t count;
+    uint32_t bin;
+} MedianCutCell;
 
-static int compare_green(const void* a, const void* b) {
-    return ((ColorEntry*)a)->g - ((ColorEntry*)b)->g;
+typedef struct {
+    uint32_t start, end;    // range of cells
+    double variance;        // summed over channels, weighted by pixel count
+    int axis;
+} MedianCutBox;
+
+// Bin of a little-endian RGBA word: r5 g5 b5 a3.
+static inline uint32_t median_cut_bin(uint32_t v) {
+    return ((v & 0xF8) << 10) | ((v >> 3) & 0x1F00) | ((v >> 16) & 0xF8) | (v >> 29);
 }
 
-static int compare_blue(const void* a, const void* b) {
-    return ((ColorEntry*)a)->b - ((ColorEntry*)b)->b;
+static inline uint32_t median_cut_cell_coordinate(uint32_t bin, int axis) {
+    switch (axis) {
+        case 0: return bin >> 13;
+        case 1: return (bin >> 8) & 31;
+        case 2: return (bin >> 3) & 31;
+        default: return bin & 7;
+    }
 }
 
-static void median_cut_recursive(ColorEntry* colors, size_t count, Color32* palette, 
-                                size_t* palette_index, size_t max_depth) {
-    if (max_depth == 0 || count <= 1) {
-        uint32_t r = 0, g = 0, b = 0, a = 0;
-        for (size_t i = 0; i < count; i++) {
-            r += colors[i].r;
-            g += colors[i].g;
-            b += colors[i].b;
-            a += colors[i].a;
+// Histograms pixels [start, end), four at a time with wasm SIMD computing the bins.
+static void median_cut_histogram(const uint8_t* rgba_data, size_t start, size_t end, MedianCutBin* bins) {
+    size_t i = start;
+    #if SIMD_AVAILABLE
+    for (; i + 4 <= end; i += 4) {
+        v128_t v = wasm_v128_load(rgba_data + i * 4);
+        v128_t bin = wasm_v128_or(
+            wasm_v128_or(wasm_i32x4_shl(wasm_v128_and(v, wasm_i32x4_splat(0xF8)), 10),
+                         wasm_v128_and(wasm_u32x4_shr(v, 3), wasm_i32x4_splat(0x1F00))),
+            wasm_v128_or(wasm_v128_and(wasm_u32x4_shr(v, 16), wasm_i32x4_splat(0xF8)),
+                         wasm_u32x4_shr(v, 29)));
+        uint32_t lanes[4];
+        wasm_v128_store(lanes, bin);
+        for (int k = 0; k < 4; k++) {
+            const uint8_t* p = rgba_data + (i + k) * 4;
+            MedianCutBin* b = &bins[lanes[k]];
+            b->count++;
+            b->r += p[0] & 7;
+            b->g += p[1] & 7;
+            b->b += p[2] & 7;
+            b->a += p[3] & 31;
         }
-        
-        palette[*palette_index].r = count > 0 ? (uint8_t)(r / count) : 0;
-        palette[*palette_index].g = count > 0 ? (uint8_t)(g / count) : 0;
-        palette[*palette_index].b = count > 0 ? (uint8_t)(b / count) : 0;
-        palette[*palette_index].a = count > 0 ? (uint8_t)(a / count) : 255;
-        (*palette_index)++;
-        return;
     }
-    
-    uint32_t r_sum = 0, g_sum = 0, b_sum = 0;
-    uint64_t r_sq_sum = 0, g_sq_sum = 0, b_sq_sum = 0;
-    
-    for (size_t i = 0; i < count; i++) {
-        r_sum += colors[i].r;
-        g_sum += colors[i].g;
-        b_sum += colors[i].b;
-        r_sq_sum += colors[i].r * colors[i].r;
-        g_sq_sum += colors[i].g * colors[i].g;
-        b_sq_sum += colors[i].b * colors[i].b;
+    #endif
+    for (; i < end; i++) {
+        const uint8_t* p = rgba_data + i * 4;
+        uint32_t v;
+        __builtin_memcpy(&v, p, 4);
+        MedianCutBin* b = &bins[median_cut_bin(v)];
+        b->count++;
+        b->r += p[0] & 7;
+        b->g += p[1] & 7;
+        b->b += p[2] & 7;
+        b->a += p[3] & 31;
     }
-    
-    uint64_t r_var = r_sq_sum - (uint64_t)r_sum * r_sum / count;
-    uint64_t g_var = g_sq_sum - (uint64_t)g_sum * g_sum / count;
-    uint64_t b_var = b_sq_sum - (uint64_t)b_sum * b_sum / count;
-    
-    int (*compare_func)(const void*, const void*) = compare_red;
-    if (g_var > r_var && g_var > b_var) {
-        compare_func = compare_green;
-    } else if (b_var > r_var) {
-        compare_func = compare_blue;
+}
+
+// Count-weighted variance of a box's cells per channel; returns the largest channel.
+static int median_cut_box_stats(const MedianCutCell* cells, MedianCutBox* box) {
+    double w = 0, s[4] = {0}, q[4] = {0};
+    for (uint32_t i = box->start; i < box->end; i++) {
+        double n = cells[i].count;
+        w += n;
+        for (int c = 0; c < 4; c++) {
+            s[c] += n * cells[i].mean[c];
+            q[c] += n * cells[i].mean[c] * cells[i].mean[c];
+        }
     }
-    
-    for (size_t i = 1; i < count; i++) {
-        ColorEntry key = colors[i];
-        size_t j = i;
-        while (j > 0 && compare_func(&colors[j-1], &key) > 0) {
-            colors[j] = colors[j-1];
-            j--;
+    int axis = 0;
+    double best = -1.0;
+    box->variance = 0;
+    for (int c = 0; c < 4; c++) {
+        double var = q[c] - s[c] * s[c] / w;
+        box->variance += var;
+        if (var > best) {
+            best = var;
+            axis = c;
         }
-        colors[j] = key;
     }
-    
-    size_t median = count / 2;
-    median_cut_recursive(colors, median, palette, palette_index, max_depth - 1);
-    median_cut_recursive(colors + median, count - median, palette, palette_index, max_depth - 1);
+    box->axis = axis;
+    return axis;
 }
 
-WASM_EXPORT QuantizedImage* quantize_colors_median_cut(const uint8_t* rgba_data, size_t width, size_t height, size_t max_colors) {
-    if (!rgba_data || width == 0 || height == 0 || max_colors == 0) {
-        return NULL;
+// Orders a box's cells along its axis (a counting sort on the cell coordinate) and
+// returns the cut that minimizes the summed variance of the two halves.
+static uint32_t median_cut_split(MedianCutCell* cells, MedianCutCell* scratch, const MedianCutBox* box) {
+    uint32_t buckets[33] = {0};
+    for (uint32_t i = box->start; i < box->end; i++) {
+        buckets[median_cut_cell_coordinate(cells[i].bin, box->axis) + 1]++;
+    }
+    for (int k = 0; k < 32; k++) buckets[k + 1] += buckets[k];
+    for (uint32_t i = box->start; i < box->end; i++) {
+        scratch[buckets[median_cut_cell_coordinate(cells[i].bin, box->axis)]++] = cells[i];
+    }
+    memcpy(cells + box->start, scratch, (box->end - box->start) * sizeof(MedianCutCell));
+
+    double total_w = 0, total_s[4] = {0};
+    for (uint32_t i = box->start; i < box->end; i++) {
+        total_w += cells[i].count;
+        for (int c = 0; c < 4; c++) total_s[c] += (double)cells[i].count * cells[i].mean[c];
+    }
+
+    // Summed variance is sum(q) - |S_left|^2 / W_left - |S_right|^2 / W_right, and sum(q)
+    // does not depend on the cut.
+    uint32_t cut = box->start + 1;
+    double best = -1.0, w = 0, s[4] = {0};
+    for (uint32_t i = box->start; i + 1 < box->end; i++) {
+        w += cells[i].count;
+        for (int c = 0; c < 4; c++) s[c] += (double)cells[i].count * cells[i].mean[c];
+        double left = 0, right = 0;
+        for (int c = 0; c < 4; c++) {
+            left += s[c] * s[c];
+            right += (total_s[c] - s[c]) * (total_s[c] - s[c]);
+        }
+        double score = left / w + right / (total_w - w);
+        if (score > best) {
+            best = score;
+            cut = i + 1;
+        }
     }
-    
-    size_t pixel_count = width * height;
-    
-    ColorEntry* unique_colors = (ColorEntry*)wasm_malloc(pixel_count * sizeof(ColorEntry));
-    if (!unique_colors) return NULL;
-    
-    size_t unique_count = 0;
+    return cut;
+}
 
-    size_t table_cap = 1;
-    size_t target_cap = pixel_count;
-    if (target_cap > (SIZE_MAX / 2)) {
-        target_cap = SIZE_MAX / 2;
+static uint32_t median_cut_nearest(const float* palette, uint32_t palette_size, const float* color) {
+    uint32_t best = 0;
+    float best_distance = 1e30f;
+    for (uint32_t j = 0; j < palette_size; j++) {
+        float dr = color[0] - palette[j * 4];
+        float dg = color[1] - palette[j * 4 + 1];
+        float db = color[2] - palette[j * 4 + 2];
+        float da = color[3] - palette[j * 4 + 3];
+        float distance = dr*dr + dg*dg + db*db + da*da;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = j;
+        }
     }
-    target_cap = target_cap * 2;
+    return best;
+}
 
-    const size_t cap_limit = 1u << 24;
-    if (target_cap > cap_limit) {
-        target_cap = cap_limit;
-    }
+// Images with at most max_colors distinct colours get them verbatim. Returns the number
+// of colours, or 0 once there are more than max_colors.
+static uint32_t median_cut_exact_palette(const uint8_t* rgba_data, size_t pixel_count, uint32_t max_colors,
+                                         uint32_t* colors, uint16_t* slots, Color32* palette) {
+    memset(slots, 0xFF, MEDIAN_CUT_EXACT_SLOTS * sizeof(uint16_t));
+    uint32_t count = 0, previous = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        uint32_t color = octree_pack(rgba_data + i * 4);
+        if (i > 0 && color == previous) continue;
+        previous = color;
 
-    while (table_cap < target_cap && table_cap < cap_limit) {
-        table_cap <<= 1;
+        uint32_t slot = octree_hash(color, MEDIAN_CUT_EXACT_BITS);
+        while (slots[slot] != 0xFFFF && colors[slots[slot]] != color) {
+            slot = (slot + 1) & (MEDIAN_CUT_EXACT_SLOTS - 1);
+        }
+        if (slots[slot] != 0xFFFF) continue;
+        if (count == max_colors) return 0;
+        colors[count] = color;
+        palette[count] = (Color32){ (uint8_t)(color >> 24), (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)color };
+        slots[slot] = (uint16_t)count++;
     }
+    return count;
+}
 
-    uint32_t* table = (uint32_t*)wasm_malloc(table_cap * sizeof(uint32_t));
-    if (!table) {
-        wasm_free(unique_colors);
+// Median cut with `refine_iterations` rounds of k-means over the occupied bins after
+// the splits. Pixels map to the palette entry nearest their bin's mean colour.
+WASM_EXPORT QuantizedImage* quantize_colors_median_cut_refined(const uint8_t* rgba_data, size_t width, size_t height,
+                                                               size_t max_colors, int refine_iterations) {
+    if (!rgba_data || width == 0 || height == 0 || max_colors == 0) {
         return NULL;
     }
-    memset(table, 0, table_cap * sizeof(uint32_t));
+    if (max_colors > 256) max_colors = 256;
 
-    int has_ff = 0;
-
-    for (size_t i = 0; i < pixel_count; i++) {
-        const uint32_t r = rgba_data[i * 4 + 0];
-        const uint32_t g = rgba_data[i * 4 + 1];
-        const uint32_t b = rgba_data[i * 4 + 2];
-        const uint32_t a = rgba_data[i * 4 + 3];
-
-        const uint32_t key = (r << 24) | (g << 16) | (b << 8) | a;
-
-        if (key == 0xFFFFFFFFu) {
-            if (!has_ff) {
-                unique_colors[unique_count++] = (ColorEntry){(uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a};
-                has_ff = 1;
-            }
-            continue;
-        }
-
-        const uint32_t stored = key ^ 0xFFFFFFFFu;
-
-        size_t idx = (size_t)((key * 2654435761u) & (uint32_t)(table_cap - 1));
-        for (size_t probe = 0; probe < table_cap; probe++) {
-            const uint32_t slot = table[idx];
-            if (slot == 0) {
-                table[idx] = stored;
-                unique_colors[unique_count++] = (ColorEntry){(uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a};
-                break;
-            }
-            if (slot == stored) {
-                break;
-            }
-            idx = (idx + 1) & (table_cap - 1);
-        }
-
-        if (unique_count >= pixel_count) {
-            break;
-        }
+    size_t pixel_count = width * height;
+    QuantizedImage* result = (QuantizedImage*)wasm_malloc(sizeof(QuantizedImage));
+    if (!result) return NULL;
+    result->palette = (Color32*)wasm_malloc(max_colors * sizeof(Color32));
+    result->indices = (uint8_t*)wasm_malloc(pixel_count);
+    result->width = width;
+    result->height = height;
+    uint32_t* exact_colors = (uint32_t*)wasm_malloc(max_colors * sizeof(uint32_t));
+    uint16_t* exact_slots = (uint16_t*)wasm_malloc(MEDIAN_CUT_EXACT_SLOTS * sizeof(uint16_t));
+    if (!result->palette || !result->indices || !exact_colors || !exact_slots) {
+        if (result->palette) wasm_free(result->palette);
+        if (result->indices) wasm_free(result->indices);
+        if (exact_colors) wasm_free(exact_colors);
+        if (exact_slots) wasm_free(exact_slots);
+        wasm_free(result);
+        return NULL;
     }
 
-    wasm_free(table);
-    
-    QuantizedImage* result = (QuantizedImage*)wasm_malloc(sizeof(QuantizedImage));
-    if (!result) {
-        wasm_free(unique_colors);
+    uint32_t exact = median_cut_exact_palette(rgba_data, pixel_count, (uint32_t)max_colors,
+                                              exact_colors, exact_slots, result->palette);
+    if (exact > 0) {
+        for (size_t i = 0; i < pixel_count; i++) {
+            uint32_t color = octree_pack(rgba_data + i * 4);
+            uint32_t slot = octree_hash(color, MEDIAN_CUT_EXACT_BITS);
+            while (exact_colors[exact_slots[slot]] != color) slot = (slot + 1) & (MEDIAN_CUT_EXACT_SLOTS - 1);
+            result->indices[i] = (uint8_t)exact_slots[slot];
+        }
+        result->palette_size = exact;
+        wasm_free(exact_colors);
+        wasm_free(exact_slots);
+        return result;
+    }
+    wasm_free(exact_colors);
+    wasm_free(exact_slots);
+
+    MedianCutBin* bins = (MedianCutBin*)wasm_malloc(MEDIAN_CUT_BINS * sizeof(MedianCutBin));
+    uint8_t* bin_palette = (uint8_t*)wasm_malloc(MEDIAN_CUT_BINS);
+    if (!bins || !bin_palette) {
+        if (bins) wasm_free(bins);
+        if (bin_palette) wasm_free(bin_palette);
+        wasm_free(result->palette);
+        wasm_free(result->indices);
+        wasm_free(result);
         return NULL;
     }
-    
-    size_t palette_size = unique_count < max_colors ? unique_count : max_colors;
-    result->palette = (Color32*)wasm_malloc(palette_size * sizeof(Color32));
-    result->indices = (uint8_t*)wasm_malloc(pixel_count);
-    
-    if (!result->palette || !result->indices) {
-        wasm_free(unique_colors);
+    memset(bins, 0, MEDIAN_CUT_BINS * sizeof(MedianCutBin));
+    median_cut_histogram(rgba_data, 0, pixel_count, bins);
+
+    uint32_t cell_count = 0;
+    for (uint32_t i = 0; i < MEDIAN_CUT_BINS; i++) cell_count += bins[i].count != 0;
+
+    MedianCutCell* cells = (MedianCutCell*)wasm_malloc(2 * (size_t)cell_count * sizeof(MedianCutCell));
+    MedianCutBox* boxes = (MedianCutBox*)wasm_malloc(max_colors * sizeof(MedianCutBox));
+    float* palette = (float*)wasm_malloc(max_colors * 4 * sizeof(float));
+    double* sums = (double*)wasm_malloc(max_colors * 5 * sizeof(double));
+    if (!cells || !boxes || !palette || !sums) {
+        if (cells) wasm_free(cells);
+        if (boxes) wasm_free(boxes);
+        if (palette) wasm_free(palette);
+        if (sums) wasm_free(sums);
+        wasm_free(bins);
+        wasm_free(bin_palette);
         wasm_free(result->palette);
         wasm_free(result->indices);
         wasm_free(result);
         return NULL;
     }
-    
-    size_t palette_index = 0;
-    size_t max_depth = 0;
-    size_t temp = max_colors;
-    while (temp > 1) {
-        temp >>= 1;
-        max_depth++;
+    MedianCutCell* scratch = cells + cell_count;
+
+    cell_count = 0;
+    for (uint32_t i = 0; i < MEDIAN_CUT_BINS; i++) {
+        const MedianCutBin* b = &bins[i];
+        if (b->count == 0) continue;
+        float n = (float)b->count;
+        MedianCutCell* cell = &cells[cell_count++];
+        cell->mean[0] = (float)((i >> 13) << 3) + (float)b->r / n;
+        cell->mean[1] = (float)(((i >> 8) & 31) << 3) + (float)b->g / n;
+        cell->mean[2] = (float)(((i >> 3) & 31) << 3) + (float)b->b / n;
+        cell->mean[3] = (float)((i & 7) << 5) + (float)b->a / n;
+        cell->count = b->count;
+        cell->bin = i;
+    }
+    wasm_free(bins);
+
+    uint32_t box_count = 1;
+    boxes[0].start = 0;
+    boxes[0].end = cell_count;
+    median_cut_box_stats(cells, &boxes[0]);
+    while (box_count < max_colors) {
+        int widest = -1;
+        for (uint32_t i = 0; i < box_count; i++) {
+            if (boxes[i].end - boxes[i].start < 2 || boxes[i].variance <= 0) continue;
+            if (widest < 0 || boxes[i].variance > boxes[widest].variance) widest = (int)i;
+        }
+        if (widest < 0) break;
+
+        MedianCutBox* box = &boxes[widest];
+        uint32_t cut = median_cut_split(cells, scratch, box);
+        boxes[box_count].start = cut;
+        boxes[box_count].end = box->end;
+        box->end = cut;
+        median_cut_box_stats(cells, box);
+        median_cut_box_stats(cells, &boxes[box_count]);
+        box_count++;
+    }
+
+    for (uint32_t k = 0; k < box_count; k++) {
+        double w = 0, s[4] = {0};
+        for (uint32_t i = boxes[k].start; i < boxes[k].end; i++) {
+            w += cells[i].count;
+            for (int c = 0; c < 4; c++) s[c] += (double)cells[i].count * cells[i].mean[c];
+        }
+        for (int c = 0; c < 4; c++) palette[k * 4 + c] = (float)(s[c] / w);
     }
-    
-    median_cut_recursive(unique_colors, unique_count, result->palette, &palette_index, max_depth);
-    result->palette_size = palette_index;
-    result->width = width;
-    result->height = height;
-    
-    for (size_t i = 0; i < pixel_count; i++) {
-        uint8_t r = rgba_data[i*4];
-        uint8_t g = rgba_data[i*4+1];
-        uint8_t b = rgba_data[i*4+2];
-        uint8_t a = rgba_data[i*4+3];
-        
-        float min_distance = 1e30f;
-        uint8_t best_index = 0;
-        
-        for (size_t j = 0; j < result->palette_size; j++) {
-            float dr = (float)(r - result->palette[j].r);
-            float dg = (float)(g - result->palette[j].g);
-            float db = (float)(b - result->palette[j].b);
-            float da = (float)(a - result->palette[j].a);
-            
-            float distance = dr*dr + dg*dg + db*db + da*da;
-            if (distance < min_distance) {
-                min_distance = distance;
-                best_index = j;
-            }
+
+    for (int iteration = 0; iteration < refine_iterations; iteration++) {
+        memset(sums, 0, box_count * 5 * sizeof(double));
+        for (uint32_t i = 0; i < cell_count; i++) {
+            uint32_t k = median_cut_nearest(palette, box_count, cells[i].mean);
+            double n = cells[i].count;
+            sums[k * 5] += n;
+            for (int c = 0; c < 4; c++) sums[k * 5 + 1 + c] += n * cells[i].mean[c];
+        }
+        for (uint32_t k = 0; k < box_count; k++) {
+            if (sums[k * 5] == 0) continue;
+            for (int c = 0; c < 4; c++) palette[k * 4 + c] = (float)(sums[k * 5 + 1 + c] / sums[k * 5]);
         }
-        
-        result->indices[i] = best_index;
     }
-    
-    wasm_free(unique_colors);
+
+    for (uint32_t k = 0; k < box_count; k++) {
+        result->palette[k].r = (uint8_t)(palette[k * 4] + 0.5f);
+        result->palette[k].g = (uint8_t)(palette[k * 4 + 1] + 0.5f);
+        result->palette[k].b = (uint8_t)(palette[k * 4 + 2] + 0.5f);
+        result->palette[k].a = (uint8_t)(palette[k * 4 + 3] + 0.5f);
+    }
+    result->palette_size = box_count;
+
+    // Bins map by their mean colour to the nearest entry of the palette as stored.
+    void* search_state = wasm_malloc(palette_search_state_size());
+    PaletteSearch* search = search_state ? palette_search_init(search_state, (const uint8_t*)result->palette,
+                                                               box_count, 4, PALETTE_METRIC_RGBA) : NULL;
+    for (uint32_t i = 0; i < cell_count; i++) {
+        bin_palette[cells[i].bin] = search ? (uint8_t)palette_search_nearest_value(search, cells[i].mean)
+                                           : (uint8_t)median_cut_nearest(palette, box_count, cells[i].mean);
+    }
+    if (search_state) wasm_free(search_state);
+    for (size_t i = 0; i < pixel_count; i++) {
+        uint32_t v;
+        __builtin_memcpy(&v, rgba_data + i * 4, 4);
+        result->indices[i] = bin_palette[median_cut_bin(v)];
+    }
+
+    wasm_free(cells);
+    wasm_free(boxes);
+    wasm_free(palette);
+    wasm_free(sums);
+    wasm_free(bin_palette);
     return result;
 }
 
+WASM_EXPORT QuantizedImage* quantize_colors_median_cut(const uint8_t* rgba_data, size_t width, size_t height, size_t max_colors) {
+    return quantize_colors_median_cut_refined(rgba_data, width, height, max_colors, MEDIAN_CUT_DEFAULT_REFINE);
+}
+
 WASM_EXPORT void quantize_rgb_bitshift(const uint8_t* rgb_in, uint8_t* rgb_out, size_t pixel_count, uint8_t bit_shift) {
     if (!rgb_in || !rgb_out || pixel_count == 0) {
         return;
@@ -503,162 +685,370 @@ WASM_EXPORT void palette_indices_to_rgba(
     }
 }
 
-void gaussian_blur_simd(uint8_t* image, int32_t width, int32_t height, int32_t channels, float sigma) {
-    if (!image || width <= 0 || height <= 0 || channels <= 0 || sigma <= 0.0f) {
-        return;
-    }
-    
-    int kernel_size = (int)(sigma * 6.0f + 1.0f);
-    if (kernel_size % 2 == 0) kernel_size++;
-    int radius = kernel_size / 2;
-    
-    float* kernel = (float*)wasm_malloc(kernel_size * sizeof(float));
-    if (!kernel) return;
-    
+// Gaussian blur as two passes of a 1D filter over rows, each pass writing its result
+// transposed (GAUSS_TILE_ROWS rows at a time) so the second pass also reads rows. Up to
+// GAUSS_BOX_MIN_SIGMA the filter is the sampled kernel with GAUSS_WEIGHT_BITS fixed-point
+// weights; above it, three box filters whose combined variance matches the Gaussian's,
+// each a sliding sum, so the cost per pixel does not grow with sigma.
+#define GAUSS_WEIGHT_BITS 14
+#define GAUSS_BOX_MIN_SIGMA 3.0f
+#define GAUSS_MAX_RADIUS 9
+#define GAUSS_BOX_PASSES 3
+#define GAUSS_TILE_ROWS 16
+
+typedef struct {
+    float sigma;                                   // 0 until a kernel has been built
+    int radius;
+    uint16_t weights[2 * GAUSS_MAX_RADIUS + 1];    // sum to 1 << GAUSS_WEIGHT_BITS
+} GaussKernel;
+
+// The kernel of the last sigma used; preprocessing blurs reuse a handful of sigmas.
+static GaussKernel gauss_kernel_cache;
+
+// exp(-x) for x >= 0: halve x below 1/8, take a short series and square back up.
+static float gauss_exp_neg(float x) {
+    int squarings = 0;
+    while (x > 0.125f && squarings < 16) {
+        x *= 0.5f;
+        squarings++;
+    }
+    float y = 1.0f - x * (1.0f - x * (0.5f - x * (1.0f / 6.0f - x * (1.0f / 24.0f - x * (1.0f / 120.0f)))));
+    while (squarings-- > 0) y *= y;
+    return y;
+}
+
+static const GaussKernel* gauss_kernel(float sigma) {
+    GaussKernel* kernel = &gauss_kernel_cache;
+    if (kernel->sigma == sigma) return kernel;
+
+    int radius = (int)(3.0f * sigma + 0.999f);
+    if (radius < 1) radius = 1;
+    if (radius > GAUSS_MAX_RADIUS) radius = GAUSS_MAX_RADIUS;
+
+    float weights[2 * GAUSS_MAX_RADIUS + 1];
     float sum = 0.0f;
-    float sigma_sq_2 = 2.0f * sigma * sigma;
-    
-    for (int i = 0; i < kernel_size; i++) {
-        int x = i - radius;
-        kernel[i] = fast_exp(-(float)(x * x) / sigma_sq_2);
-        sum += kernel[i];
+    for (int i = -radius; i <= radius; i++) {
+        weights[i + radius] = gauss_exp_neg((float)(i * i) / (2.0f * sigma * sigma));
+        sum += weights[i + radius];
+    }
+
+    // Round each weight, then give the rounding residue to the centre tap so the kernel
+    // sums to exactly one and flat areas stay flat.
+    int32_t total = 0;
+    for (int i = 0; i < 2 * radius + 1; i++) {
+        kernel->weights[i] = (uint16_t)(weights[i] / sum * (float)(1 << GAUSS_WEIGHT_BITS) + 0.5f);
+        total += kernel->weights[i];
+    }
+    kernel->weights[radius] = (uint16_t)(kernel->weights[radius] + ((1 << GAUSS_WEIGHT_BITS) - total));
+    kernel->radius = radius;
+    kernel->sigma = sigma;
+    return kernel;
+}
+
+// Radii of three box filters approximating a Gaussian of `sigma` (the widths bracket
+// sqrt(12 sigma^2 / 3 + 1), with enough of the wider ones to match the variance).
+static void gauss_box_radii(float sigma, int* radii) {
+    float ideal = __builtin_sqrtf(12.0f * sigma * sigma / GAUSS_BOX_PASSES + 1.0f);
+    int lower = (int)ideal;
+    if ((lower & 1) == 0) lower--;
+    int upper = lower + 2;
+    float wanted = (12.0f * sigma * sigma - GAUSS_BOX_PASSES * lower * lower - 4.0f * GAUSS_BOX_PASSES * lower -
+                    3.0f * GAUSS_BOX_PASSES) / (-4.0f * lower - 4.0f);
+    int narrow = wanted < 0.0f ? 0 : (int)(wanted + 0.5f);
+    for (int i = 0; i < GAUSS_BOX_PASSES; i++) radii[i] = ((i < narrow ? lower : upper) - 1) / 2;
+}
+
+// Copies a row into `padded` with `radius` edge pixels repeated on either side.
+static void gauss_pad_row(const uint8_t* row, uint8_t* padded, size_t width, size_t channels, int radius) {
+    size_t edge = (size_t)radius * channels;
+    memcpy(padded + edge, row, width * channels);
+    for (int i = 0; i < radius; i++) {
+        memcpy(padded + (size_t)i * channels, row, channels);
+        memcpy(padded + edge + (width + (size_t)i) * channels, row + (width - 1) * channels, channels);
     }
-    
-    for (int i = 0; i < kernel_size; i++) {
-        kernel[i] /= sum;
+}
+
+static void gauss_filter_row(const uint8_t* padded, uint8_t* out, size_t samples, size_t channels,
+                             const GaussKernel* kernel) {
+    const int taps = 2 * kernel->radius + 1;
+    const uint16_t* weights = kernel->weights;
+    size_t i = 0;
+#if SIMD_AVAILABLE
+    const v128_t half = wasm_i32x4_splat(1 << (GAUSS_WEIGHT_BITS - 1));
+    for (; i + 8 <= samples; i += 8) {
+        v128_t low = half, high = half;
+        for (int k = 0; k < taps; k++) {
+            v128_t v = wasm_u16x8_load8x8(padded + i + (size_t)k * channels);
+            v128_t w = wasm_i16x8_splat((int16_t)weights[k]);
+            low = wasm_i32x4_add(low, wasm_u32x4_extmul_low_u16x8(v, w));
+            high = wasm_i32x4_add(high, wasm_u32x4_extmul_high_u16x8(v, w));
+        }
+        low = wasm_u32x4_shr(low, GAUSS_WEIGHT_BITS);
+        high = wasm_u32x4_shr(high, GAUSS_WEIGHT_BITS);
+        v128_t words = wasm_u16x8_narrow_i32x4(low, high);
+        wasm_v128_store64_lane(out + i, wasm_u8x16_narrow_i16x8(words, words), 0);
     }
-    
-    uint8_t* temp = (uint8_t*)wasm_malloc(width * height * channels);
-    if (!temp) {
-        wasm_free(kernel);
-        return;
+#endif
+    for (; i < samples; i++) {
+        uint32_t acc = 1u << (GAUSS_WEIGHT_BITS - 1);
+        for (int k = 0; k < taps; k++) acc += (uint32_t)weights[k] * padded[i + (size_t)k * channels];
+        out[i] = (uint8_t)(acc >> GAUSS_WEIGHT_BITS);
     }
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            for (int c = 0; c < channels; c++) {
-                float value = 0.0f;
-                
-                for (int k = 0; k < kernel_size; k++) {
-                    int src_x = x + k - radius;
-                    
-                    if (src_x < 0) src_x = 0;
-                    if (src_x >= width) src_x = width - 1;
-                    
-                    int src_index = (y * width + src_x) * channels + c;
-                    value += image[src_index] * kernel[k];
-                }
-                
-                int dst_index = (y * width + x) * channels + c;
-                temp[dst_index] = (uint8_t)(value + 0.5f);
+}
+
+#if SIMD_AVAILABLE
+static inline v128_t gauss_load_pixel(const uint8_t* p) {
+    return wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(wasm_v128_load32_zero(p)));
+}
+#endif
+
+// Sliding-sum box filter of width 2 * radius + 1; the division is a multiply by
+// 2^24 / width, which keeps the product of a 255-level sum within 32 bits.
+static void gauss_box_row(const uint8_t* padded, uint8_t* out, size_t width, size_t channels, int radius) {
+    const size_t span = 2 * (size_t)radius + 1;
+    const uint32_t reciprocal = (uint32_t)(((1u << 24) + span / 2) / span);
+    const size_t tail = span * channels;
+#if SIMD_AVAILABLE
+    if (channels == 4) {
+        const v128_t inv = wasm_i32x4_splat((int32_t)reciprocal);
+        const v128_t half = wasm_i32x4_splat(1 << 23);
+        v128_t sum = wasm_i32x4_splat(0);
+        for (size_t k = 0; k < span; k++) {
+            sum = wasm_i32x4_add(sum, gauss_load_pixel(padded + k * 4));
+        }
+        for (size_t x = 0; x < width; x++) {
+            v128_t value = wasm_u32x4_shr(wasm_i32x4_add(wasm_i32x4_mul(sum, inv), half), 24);
+            v128_t words = wasm_u16x8_narrow_i32x4(value, value);
+            wasm_v128_store32_lane(out + x * 4, wasm_u8x16_narrow_i16x8(words, words), 0);
+            if (x + 1 < width) {
+                sum = wasm_i32x4_add(sum, gauss_load_pixel(padded + x * 4 + tail));
+                sum = wasm_i32x4_sub(sum, gauss_load_pixel(padded + x * 4));
             }
         }
+        return;
     }
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            for (int c = 0; c < channels; c++) {
-                float value = 0.0f;
-                
-                for (int k = 0; k < kernel_size; k++) {
-                    int src_y = y + k - radius;
-                    
-                    if (src_y < 0) src_y = 0;
-                    if (src_y >= height) src_y = height - 1;
-                    
-                    int src_index = (src_y * width + x) * channels + c;
-                    value += temp[src_index] * kernel[k];
+#endif
+    for (size_t c = 0; c < channels; c++) {
+        uint32_t sum = 0;
+        for (size_t k = 0; k < span; k++) sum += padded[k * channels + c];
+        for (size_t x = 0; x < width; x++) {
+            out[x * channels + c] = (uint8_t)((sum * reciprocal + (1u << 23)) >> 24);
+            if (x + 1 < width) sum += padded[x * channels + c + tail] - (uint32_t)padded[x * channels + c];
+        }
+    }
+}
+
+// Filters every row of `src` (width x height) and stores the result transposed in `dst`
+// (height x width). `pad` holds a padded row, `rows` GAUSS_TILE_ROWS filtered rows.
+static void gauss_pass(const uint8_t* src, uint8_t* dst, size_t width, size_t height, size_t channels,
+                       const GaussKernel* kernel, const int* box_radii, uint8_t* pad, uint8_t* rows,
+                       uint8_t* box_scratch) {
+    const size_t row_bytes = width * channels;
+    for (size_t y0 = 0; y0 < height; y0 += GAUSS_TILE_ROWS) {
+        size_t tile = height - y0 < GAUSS_TILE_ROWS ? height - y0 : GAUSS_TILE_ROWS;
+        for (size_t t = 0; t < tile; t++) {
+            const uint8_t* row = src + (y0 + t) * row_bytes;
+            uint8_t* out = rows + t * row_bytes;
+            if (kernel) {
+                gauss_pad_row(row, pad, width, channels, kernel->radius);
+                gauss_filter_row(pad, out, row_bytes, channels, kernel);
+            } else {
+                const uint8_t* in = row;
+                for (int p = 0; p < GAUSS_BOX_PASSES; p++) {
+                    uint8_t* target = p == GAUSS_BOX_PASSES - 1 ? out : box_scratch + (size_t)(p & 1) * row_bytes;
+                    gauss_pad_row(in, pad, width, channels, box_radii[p]);
+                    gauss_box_row(pad, target, width, channels, box_radii[p]);
+                    in = target;
                 }
-                
-                int dst_index = (y * width + x) * channels + c;
-                image[dst_index] = (uint8_t)(value + 0.5f);
+            }
+        }
+
+        for (size_t x = 0; x < width; x++) {
+            uint8_t* column = dst + (x * height + y0) * channels;
+            const uint8_t* cell = rows + x * channels;
+            if (channels == 4) {
+                for (size_t t = 0; t < tile; t++) memcpy(column + t * 4, cell + t * row_bytes, 4);
+            } else {
+                for (size_t t = 0; t < tile; t++) memcpy(column + t * channels, cell + t * row_bytes, channels);
             }
         }
     }
-    
-    wasm_free(temp);
-    wasm_free(kernel);
 }
 
-void dither_floyd_steinberg(uint8_t* image, int32_t width, int32_t height, int32_t channels, 
-                           const Color32* palette, size_t palette_size) {
-    if (!image || !palette || width <= 0 || height <= 0 || channels <= 0 || palette_size == 0) {
+void gaussian_blur_simd(uint8_t* image, int32_t width, int32_t height, int32_t channels, float sigma) {
+    if (!image || width <= 0 || height <= 0 || channels <= 0 || sigma <= 0.0f) {
         return;
     }
-    
-    float* current_error = (float*)wasm_malloc(width * channels * sizeof(float));
-    float* next_error = (float*)wasm_malloc(width * channels * sizeof(float));
-    
-    if (!current_error || !next_error) {
-        wasm_free(current_error);
-        wasm_free(next_error);
+
+    const GaussKernel* kernel = NULL;
+    int box_radii[GAUSS_BOX_PASSES] = { 0 };
+    int radius;
+    if (sigma <= GAUSS_BOX_MIN_SIGMA) {
+        kernel = gauss_kernel(sigma);
+        radius = kernel->radius;
+    } else {
+        gauss_box_radii(sigma, box_radii);
+        radius = box_radii[GAUSS_BOX_PASSES - 1];
+    }
+
+    size_t w = (size_t)width, h = (size_t)height, ch = (size_t)channels;
+    size_t longest = w > h ? w : h;
+    uint8_t* temp = (uint8_t*)wasm_malloc(w * h * ch);
+    uint8_t* pad = (uint8_t*)wasm_malloc((longest + 2 * (size_t)radius) * ch);
+    uint8_t* rows = (uint8_t*)wasm_malloc(GAUSS_TILE_ROWS * longest * ch);
+    uint8_t* box_scratch = kernel ? NULL : (uint8_t*)wasm_malloc(2 * longest * ch);
+    if (!temp || !pad || !rows || (!kernel && !box_scratch)) {
+        wasm_free(temp);
+        wasm_free(pad);
+        wasm_free(rows);
+        wasm_free(box_scratch);
         return;
     }
-    
-    for (int i = 0; i < width * channels; i++) {
-        current_error[i] = 0.0f;
-        next_error[i] = 0.0f;
+
+    gauss_pass(image, temp, w, h, ch, kernel, box_radii, pad, rows, box_scratch);
+    gauss_pass(temp, image, h, w, ch, kernel, box_radii, pad, rows, box_scratch);
+
+    wasm_free(temp);
+    wasm_free(pad);
+    wasm_free(rows);
+    wasm_free(box_scratch);
+}
+
+// Floyd-Steinberg in fixed point: pixel values carry DITHER_FRACTION_BITS fractional
+// bits and the error rows hold the weighted sums (weights in sixteenths), so a carried
+// error is applied as (sum + 8) >> 4. Each pixel takes the jointly nearest palette
+// colour; error rows are padded by a pixel on either side so diffusion never branches
+// on the image edge, and odd rows run right to left when `serpentine` is set.
+#define DITHER_FRACTION_BITS 4
+#define DITHER_MAX_VALUE (255 << DITHER_FRACTION_BITS)
+
+static inline uint32_t dither_load_pixel(const uint8_t* pixel, int32_t channels) {
+    uint32_t v = 0xFF000000u;
+    if (channels == 4) __builtin_memcpy(&v, pixel, 4);
+    else __builtin_memcpy(&v, pixel, 3);
+    return v;
+}
+
+static inline void dither_store_pixel(uint8_t* pixel, uint32_t v, int32_t channels) {
+    if (channels == 4) __builtin_memcpy(pixel, &v, 4);
+    else __builtin_memcpy(pixel, &v, 3);
+}
+
+WASM_EXPORT void dither_floyd_steinberg_ex(uint8_t* image, int32_t width, int32_t height, int32_t channels,
+                                           const Color32* palette, size_t palette_size,
+                                           int serpentine, int error_clamp) {
+    if (!image || !palette || width <= 0 || height <= 0 || channels < 3 || channels > 4 ||
+        palette_size == 0 || palette_size > PALETTE_SEARCH_MAX_COLORS) {
+        return;
     }
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            for (int c = 0; c < channels && c < 4; c++) {
-                int pixel_index = (y * width + x) * channels + c;
-                
-                float original = (float)image[pixel_index] + current_error[x * channels + c];
-                original = original < 0.0f ? 0.0f : (original > 255.0f ? 255.0f : original);
-                
-                float min_distance = 1e30f;
-                uint8_t closest_color = 0;
-                
-                for (size_t p = 0; p < palette_size; p++) {
-                    uint8_t pal_color;
-                    switch (c) {
-                        case 0: pal_color = palette[p].r; break;
-                        case 1: pal_color = palette[p].g; break;
-                        case 2: pal_color = palette[p].b; break;
-                        case 3: pal_color = palette[p].a; break;
-                        default: pal_color = 0; break;
-                    }
-                    
-                    float distance = (original - (float)pal_color) * (original - (float)pal_color);
-                    if (distance < min_distance) {
-                        min_distance = distance;
-                        closest_color = pal_color;
-                    }
-                }
-                
-                float error = original - (float)closest_color;
-                
-                image[pixel_index] = closest_color;
-                
-                if (x + 1 < width) {
-                    current_error[(x + 1) * channels + c] += error * (7.0f / 16.0f);
-                }
-                
-                if (y + 1 < height) {
-                    if (x > 0) {
-                        next_error[(x - 1) * channels + c] += error * (3.0f / 16.0f);
-                    }
-                    next_error[x * channels + c] += error * (5.0f / 16.0f);
-                    if (x + 1 < width) {
-                        next_error[(x + 1) * channels + c] += error * (1.0f / 16.0f);
-                    }
-                }
+
+    size_t row_lanes = ((size_t)width + 2) * 4;
+    int32_t* rows = (int32_t*)wasm_malloc(2 * row_lanes * sizeof(int32_t));
+    void* search_state = wasm_malloc(palette_search_state_size());
+    if (!rows || !search_state) {
+        wasm_free(rows);
+        wasm_free(search_state);
+        return;
+    }
+    PaletteSearch* search = palette_search_init(search_state, (const uint8_t*)palette, palette_size,
+                                                4, PALETTE_METRIC_RGBA);
+    memset(rows, 0, 2 * row_lanes * sizeof(int32_t));
+    int32_t* current = rows;
+    int32_t* next = rows + row_lanes;
+
+    // Carried error is clamped in row units (levels << 8); 0 leaves it unbounded.
+    int32_t clamp = error_clamp > 0 ? (error_clamp > 255 ? 255 : error_clamp) << (2 * DITHER_FRACTION_BITS) : 0;
+
+#if SIMD_AVAILABLE
+    const v128_t zero = wasm_i32x4_splat(0);
+    const v128_t max_value = wasm_i32x4_splat(DITHER_MAX_VALUE);
+    const v128_t half = wasm_i32x4_splat(1 << (DITHER_FRACTION_BITS - 1));
+    const v128_t clamp_high = wasm_i32x4_splat(clamp);
+    const v128_t clamp_low = wasm_i32x4_splat(-clamp);
+#endif
+
+    for (int32_t y = 0; y < height; y++) {
+        int reverse = serpentine && (y & 1);
+        int32_t step = reverse ? -1 : 1;
+        int32_t x = reverse ? width - 1 : 0;
+        uint8_t* row = image + (size_t)y * width * channels;
+
+        for (int32_t n = 0; n < width; n++, x += step) {
+            uint8_t* pixel = row + (size_t)x * channels;
+            int32_t* here = current + ((size_t)x + 1) * 4;
+            int32_t* ahead = here + step * 4;
+            int32_t* below = next + ((size_t)x + 1) * 4;
+            int32_t* behind_below = below - step * 4;
+            int32_t* ahead_below = below + step * 4;
+            uint32_t packed = dither_load_pixel(pixel, channels);
+            uint32_t query;
+
+#if SIMD_AVAILABLE
+            v128_t error = wasm_v128_load(here);
+            if (clamp) error = wasm_i32x4_min(wasm_i32x4_max(error, clamp_low), clamp_high);
+            v128_t value = wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(wasm_i32x4_splat((int32_t)packed)));
+            value = wasm_i32x4_add(wasm_i32x4_shl(value, DITHER_FRACTION_BITS),
+                                   wasm_i32x4_shr(wasm_i32x4_add(error, half), DITHER_FRACTION_BITS));
+            v128_t wanted = wasm_i32x4_min(wasm_i32x4_max(value, zero), max_value);
+            v128_t rounded = wasm_i32x4_shr(wasm_i32x4_add(wanted, half), DITHER_FRACTION_BITS);
+            v128_t narrow = wasm_i16x8_narrow_i32x4(rounded, rounded);
+            query = (uint32_t)wasm_i32x4_extract_lane(wasm_u8x16_narrow_i16x8(narrow, narrow), 0);
+#else
+            int32_t wanted[4];
+            for (int c = 0; c < 4; c++) {
+                int32_t error = here[c];
+                if (clamp) error = error < -clamp ? -clamp : (error > clamp ? clamp : error);
+                int32_t value = (int32_t)(((packed >> (8 * c)) & 0xFF) << DITHER_FRACTION_BITS) +
+                                ((error + (1 << (DITHER_FRACTION_BITS - 1))) >> DITHER_FRACTION_BITS);
+                wanted[c] = value < 0 ? 0 : (value > DITHER_MAX_VALUE ? DITHER_MAX_VALUE : value);
             }
+            query = 0;
+            for (int c = 0; c < 4; c++) {
+                query |= (uint32_t)((wanted[c] + (1 << (DITHER_FRACTION_BITS - 1))) >> DITHER_FRACTION_BITS) << (8 * c);
+            }
+#endif
+
+            if (channels == 3) query |= 0xFF000000u;
+            const Color32 chosen = palette[palette_search_nearest(search, (uint8_t)query, (uint8_t)(query >> 8),
+                                                                  (uint8_t)(query >> 16), (uint8_t)(query >> 24))];
+            uint32_t chosen_packed;
+            __builtin_memcpy(&chosen_packed, &chosen, 4);
+            dither_store_pixel(pixel, chosen_packed, channels);
+
+#if SIMD_AVAILABLE
+            v128_t target = wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(wasm_i32x4_splat((int32_t)chosen_packed)));
+            v128_t residual = wasm_i32x4_sub(wanted, wasm_i32x4_shl(target, DITHER_FRACTION_BITS));
+            if (channels == 3) residual = wasm_i32x4_replace_lane(residual, 3, 0);
+            wasm_v128_store(ahead, wasm_i32x4_add(wasm_v128_load(ahead), wasm_i32x4_mul(residual, wasm_i32x4_splat(7))));
+            wasm_v128_store(behind_below, wasm_i32x4_add(wasm_v128_load(behind_below), wasm_i32x4_mul(residual, wasm_i32x4_splat(3))));
+            wasm_v128_store(below, wasm_i32x4_add(wasm_v128_load(below), wasm_i32x4_mul(residual, wasm_i32x4_splat(5))));
+            wasm_v128_store(ahead_below, wasm_i32x4_add(wasm_v128_load(ahead_below), residual));
+#else
+            for (int c = 0; c < 4; c++) {
+                int32_t residual = wanted[c] - ((int32_t)((chosen_packed >> (8 * c)) & 0xFF) << DITHER_FRACTION_BITS);
+                if (c == 3 && channels == 3) residual = 0;
+                ahead[c] += residual * 7;
+                behind_below[c] += residual * 3;
+                below[c] += residual * 5;
+                ahead_below[c] += residual;
+            }
+#endif
         }
-        
-        float* temp = current_error;
-        current_error = next_error;
-        next_error = temp;
-        
-        for (int i = 0; i < width * channels; i++) {
-            next_error[i] = 0.0f;
-        }
+
+        int32_t* swap = current;
+        current = next;
+        next = swap;
+        memset(next, 0, row_lanes * sizeof(int32_t));
     }
-    
-    wasm_free(current_error);
-    wasm_free(next_error);
+
+    wasm_free(rows);
+    wasm_free(search_state);
+}
+
+void dither_floyd_steinberg(uint8_t* image, int32_t width, int32_t height, int32_t channels,
+                            const Color32* palette, size_t palette_size) {
+    dither_floyd_steinberg_ex(image, width, height, channels, palette, palette_size,
+                              DITHER_DEFAULT_SERPENTINE, DITHER_DEFAULT_ERROR_CLAMP);
 }
 
 void free_quantized_image(QuantizedImage* image) {
@@ -741,77 +1131,397 @@ WASM_EXPORT void apply_gaussian_blur(
     gaussian_blur_simd(rgba_data, (int32_t)width, (int32_t)height, (int32_t)channels, sigma);
 }
 
-TIFFProcessResult* compress_tiff_lzw_simd(
-    const uint8_t* rgba_data,
+// TIFF LZW (TIFF 6.0 section 13, as libtiff writes it): MSB-first codes from 9 to 12
+// bits with the early width change, a ClearCode first and whenever the table fills,
+// EndOfInformation last. The string table is an open-addressed hash of
+// (prefix code, byte) -> code; the slots in use are listed so a ClearCode resets only
+// those instead of the whole table.
+#define TIFF_LZW_CLEAR 256
+#define TIFF_LZW_EOI 257
+#define TIFF_LZW_FIRST_CODE 258
+#define TIFF_LZW_MIN_BITS 9
+#define TIFF_LZW_TABLE_FULL 4094
+#define TIFF_LZW_HASH_BITS 14
+#define TIFF_LZW_HASH_SIZE (1u << TIFF_LZW_HASH_BITS)
+
+typedef struct {
+    uint32_t slots[TIFF_LZW_HASH_SIZE];   // key << 12 | code, 0 when empty
+    uint16_t used[TIFF_LZW_TABLE_FULL];   // slots filled since the last ClearCode
+} TiffLzwState;
+
+typedef struct {
+    uint8_t* out;
+    size_t capacity;
+    size_t pos;
+    uint64_t bits;
+    uint32_t count;
+    int overflow;
+} TiffCodeWriter;
+
+static inline void tiff_put_code(TiffCodeWriter* w, uint32_t code, uint32_t width) {
+    w->bits = (w->bits << width) | code;
+    w->count += width;
+    while (w->count >= 8) {
+        w->count -= 8;
+        if (w->pos < w->capacity) w->out[w->pos++] = (uint8_t)(w->bits >> w->count);
+        else w->overflow = 1;
+    }
+}
+
+static void tiff_lzw_reset(TiffLzwState* table, uint32_t entries) {
+    for (uint32_t i = 0; i < entries; i++) table->slots[table->used[i]] = 0;
+}
+
+// LZW-codes `rows` rows of row_bytes, differencing each byte against the sample
+// `stride` bytes to its left on the fly when stride is non-zero (predictor 2).
+static size_t tiff_lzw_encode(TiffLzwState* table, const uint8_t* pixels, size_t row_bytes, size_t rows,
+                              size_t stride, uint8_t* output, size_t output_capacity) {
+    TiffCodeWriter w = { output, output_capacity, 0, 0, 0, 0 };
+    uint32_t width = TIFF_LZW_MIN_BITS;
+    uint32_t next = TIFF_LZW_FIRST_CODE;
+    uint32_t prefix = pixels[0];
+    size_t start = 1;
+
+    memset(table->slots, 0, sizeof(table->slots));
+    tiff_put_code(&w, TIFF_LZW_CLEAR, width);
+
+    for (size_t y = 0; y < rows; y++) {
+        const uint8_t* row = pixels + y * row_bytes;
+        for (size_t i = start; i < row_bytes; i++) {
+            uint32_t c = stride && i >= stride ? (uint8_t)(row[i] - row[i - stride]) : row[i];
+            uint32_t key = (prefix << 8) | c;
+            uint32_t h = (key * 2654435761u) >> (32 - TIFF_LZW_HASH_BITS);
+            uint32_t entry;
+            while ((entry = table->slots[h]) != 0 && (entry >> 12) != key) {
+                h = (h + 1) & (TIFF_LZW_HASH_SIZE - 1);
+            }
+            if (entry) {
+                prefix = entry & 0xFFF;
+                continue;
+            }
+
+            tiff_put_code(&w, prefix, width);
+            table->slots[h] = (key << 12) | next;
+            table->used[next - TIFF_LZW_FIRST_CODE] = (uint16_t)h;
+            if (++next == TIFF_LZW_TABLE_FULL) {
+                tiff_put_code(&w, TIFF_LZW_CLEAR, width);
+                tiff_lzw_reset(table, next - TIFF_LZW_FIRST_CODE);
+                width = TIFF_LZW_MIN_BITS;
+                next = TIFF_LZW_FIRST_CODE;
+            } else if (next > (1u << width) - 1) {
+                width++;
+            }
+            prefix = c;
+        }
+        start = 0;
+    }
+
+    // The decoder adds a table entry for the last code too, so the width can step
+    // once more before EndOfInformation.
+    tiff_put_code(&w, prefix, width);
+    if (++next == TIFF_LZW_TABLE_FULL) {
+        tiff_put_code(&w, TIFF_LZW_CLEAR, width);
+        width = TIFF_LZW_MIN_BITS;
+    } else if (next > (1u << width) - 1) {
+        width++;
+    }
+    tiff_put_code(&w, TIFF_LZW_EOI, width);
+    if (w.count > 0) tiff_put_code(&w, 0, 8 - w.count);
+
+    return w.overflow ? 0 : w.pos;
+}
+
+// Horizontal differencing (predictor 2) of `rows` rows into dst.
+static void tiff_predict_rows(const uint8_t* src, uint8_t* dst, size_t row_bytes, size_t rows, size_t stride) {
+    for (size_t y = 0; y < rows; y++) {
+        const uint8_t* row = src + y * row_bytes;
+        uint8_t* out = dst + y * row_bytes;
+        size_t n = stride < row_bytes ? stride : row_bytes;
+        memcpy(out, row, n);
+
+        size_t i = n;
+        #if SIMD_AVAILABLE
+        for (; i + 16 <= row_bytes; i += 16) {
+            v128_t cur = wasm_v128_load(row + i);
+            v128_t left = wasm_v128_load(row + i - stride);
+            wasm_v128_store(out + i, wasm_i8x16_sub(cur, left));
+        }
+        #endif
+        for (; i < row_bytes; i++) {
+            out[i] = (uint8_t)(row[i] - row[i - stride]);
+        }
+    }
+}
+
+WASM_EXPORT size_t tiff_rows_per_strip(size_t width, size_t channels) {
+    size_t row_bytes = width * channels;
+    if (row_bytes == 0) return 0;
+    size_t rows = TIFF_STRIP_TARGET_BYTES / row_bytes;
+    return rows > 0 ? rows : 1;
+}
+
+WASM_EXPORT size_t tiff_strip_bound(size_t width, size_t rows, size_t channels, int compression) {
+    size_t bytes = width * rows * channels;
+    if (compression == TIFF_COMPRESSION_LZW) {
+        // At most one 12-bit code per byte, plus ClearCodes and EndOfInformation.
+        size_t codes = bytes + bytes / (TIFF_LZW_TABLE_FULL - TIFF_LZW_FIRST_CODE) + 4;
+        return codes + codes / 2 + 1;
+    }
+    if (compression == TIFF_COMPRESSION_ADOBE_DEFLATE) return deflate_compress_bound(bytes);
+    return 0;
+}
+
+WASM_EXPORT size_t tiff_strip_state_size(size_t width, size_t rows, size_t channels, int compression) {
+    if (compression == TIFF_COMPRESSION_LZW) return sizeof(TiffLzwState);
+    if (compression == TIFF_COMPRESSION_ADOBE_DEFLATE) {
+        size_t deflate_state = (deflate_compress_state_size(0, 8) + 7) & ~(size_t)7;
+        return deflate_state + width * rows * channels;
+    }
+    return 0;
+}
+
+// Encodes one strip: `rows` rows of `width` pixels with `channels` interleaved 8-bit
+// samples. compression is TIFF_COMPRESSION_LZW or TIFF_COMPRESSION_ADOBE_DEFLATE
+// (zlib stream at deflate `level`); predictor is TIFF_PREDICTOR_NONE or
+// TIFF_PREDICTOR_HORIZONTAL. `state` is caller-owned, 8-byte aligned scratch of
+// tiff_strip_state_size() bytes and nothing is allocated, so strips of one image can
+// be encoded concurrently. Returns the strip size, or 0 on error or when the strip
+// does not fit output_capacity (tiff_strip_bound() is always enough).
+WASM_EXPORT size_t tiff_encode_strip(
+    void* state,
+    const uint8_t* pixels,
     size_t width,
-    size_t height,
-    uint8_t quality
+    size_t rows,
+    size_t channels,
+    int compression,
+    int predictor,
+    int level,
+    uint8_t* output,
+    size_t output_capacity
 ) {
-    if (!rgba_data || width == 0 || height == 0) {
-        return NULL;
+    if (!state || !pixels || !output || width == 0 || rows == 0 || channels == 0 || channels > 4) {
+        return 0;
     }
-    
+    if (predictor != TIFF_PREDICTOR_NONE && predictor != TIFF_PREDICTOR_HORIZONTAL) return 0;
+
+    size_t row_bytes = width * channels;
+    size_t stride = predictor == TIFF_PREDICTOR_HORIZONTAL ? channels : 0;
+
+    if (compression == TIFF_COMPRESSION_LZW) {
+        return tiff_lzw_encode((TiffLzwState*)state, pixels, row_bytes, rows, stride, output, output_capacity);
+    }
+    if (compression == TIFF_COMPRESSION_ADOBE_DEFLATE) {
+        size_t deflate_state = (deflate_compress_state_size(0, 8) + 7) & ~(size_t)7;
+        const uint8_t* input = pixels;
+        if (stride) {
+            uint8_t* predicted = (uint8_t*)state + deflate_state;
+            tiff_predict_rows(pixels, predicted, row_bytes, rows, stride);
+            input = predicted;
+        }
+        return deflate_compress_ext_state(state, input, row_bytes * rows, output, output_capacity,
+                                          level, 0, 8);
+    }
+    return 0;
+}
+
+#define TIFF_MAX_ENTRIES 15
+#define TIFF_TYPE_SHORT 3
+#define TIFF_TYPE_LONG 4
+#define TIFF_TYPE_RATIONAL 5
+
+WASM_EXPORT size_t tiff_directory_size(size_t strip_count, size_t channels) {
+    size_t size = 2 + 12 * TIFF_MAX_ENTRIES + 4 + 16;
+    if (channels > 2) size += 2 * channels;
+    if (strip_count > 1) size += 8 * strip_count;
+    return size + 1;
+}
+
+static inline void tiff_put16(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void tiff_put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// Appends an IFD entry; `value` is the inline value, or the offset of out-of-line data.
+static uint8_t* tiff_put_entry(uint8_t* p, uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+    tiff_put16(p, tag);
+    tiff_put16(p + 2, type);
+    tiff_put32(p + 4, count);
+    tiff_put32(p + 8, 0);
+    if (type == TIFF_TYPE_SHORT && count <= 2) tiff_put16(p + 8, value);
+    else tiff_put32(p + 8, value);
+    return p + 12;
+}
+
+// Completes a little-endian baseline TIFF whose strips already sit back to back from
+// byte 8 of `output`: writes the header and, after the strips, the image directory.
+// Returns the file size, or 0 when it does not fit output_capacity (the strips plus
+// tiff_directory_size() is enough) or would outgrow 32-bit offsets.
+WASM_EXPORT size_t tiff_write_directory(
+    uint8_t* output,
+    size_t output_capacity,
+    const uint32_t* strip_sizes,
+    size_t strip_count,
+    uint32_t width,
+    uint32_t height,
+    size_t channels,
+    int compression,
+    int predictor,
+    uint32_t rows_per_strip
+) {
+    if (!output || !strip_sizes || strip_count == 0 || channels == 0 || channels > 4) return 0;
+
+    uint64_t data_end = 8;
+    for (size_t i = 0; i < strip_count; i++) data_end += strip_sizes[i];
+    uint64_t ifd = (data_end + 1) & ~(uint64_t)1;
+    uint64_t file_size = ifd + tiff_directory_size(strip_count, channels) - 1;
+    if (file_size > output_capacity || file_size > 0xFFFFFFFFu) return 0;
+
+    uint32_t entries = 13 + (predictor == TIFF_PREDICTOR_HORIZONTAL) + !(channels & 1);
+    uint8_t* p = output + ifd;
+    uint32_t extra = (uint32_t)ifd + 2 + 12 * entries + 4;
+
+    uint32_t bits_offset = extra;
+    if (channels > 2) extra += 2 * (uint32_t)channels;
+    uint32_t offsets_value = 8, counts_value = strip_sizes[0];
+    if (strip_count > 1) {
+        offsets_value = extra;
+        counts_value = extra + 4 * (uint32_t)strip_count;
+        extra += 8 * (uint32_t)strip_count;
+    }
+    uint32_t resolution = extra;
+
+    memcpy(output, "II*\0", 4);
+    tiff_put32(output + 4, (uint32_t)ifd);
+    if (data_end & 1) output[data_end] = 0;
+
+    tiff_put16(p, entries);
+    p += 2;
+    p = tiff_put_entry(p, 256, TIFF_TYPE_LONG, 1, width);
+    p = tiff_put_entry(p, 257, TIFF_TYPE_LONG, 1, height);
+    p = tiff_put_entry(p, 258, TIFF_TYPE_SHORT, (uint32_t)channels, channels > 2 ? bits_offset : 8);
+    if (channels == 2) tiff_put16(p - 2, 8);
+    p = tiff_put_entry(p, 259, TIFF_TYPE_SHORT, 1, (uint32_t)compression);
+    p = tiff_put_entry(p, 262, TIFF_TYPE_SHORT, 1, channels < 3 ? 1 : 2);
+    p = tiff_put_entry(p, 273, TIFF_TYPE_LONG, (uint32_t)strip_count, offsets_value);
+    p = tiff_put_entry(p, 277, TIFF_TYPE_SHORT, 1, (uint32_t)channels);
+    p = tiff_put_entry(p, 278, TIFF_TYPE_LONG, 1, rows_per_strip);
+    p = tiff_put_entry(p, 279, TIFF_TYPE_LONG, (uint32_t)strip_count, counts_value);
+    p = tiff_put_entry(p, 282, TIFF_TYPE_RATIONAL, 1, resolution);
+    p = tiff_put_entry(p, 283, TIFF_TYPE_RATIONAL, 1, resolution + 8);
+    p = tiff_put_entry(p, 284, TIFF_TYPE_SHORT, 1, 1);
+    p = tiff_put_entry(p, 296, TIFF_TYPE_SHORT, 1, 2);
+    if (predictor == TIFF_PREDICTOR_HORIZONTAL) p = tiff_put_entry(p, 317, TIFF_TYPE_SHORT, 1, 2);
+    if (!(channels & 1)) p = tiff_put_entry(p, 338, TIFF_TYPE_SHORT, 1, 2);
+    tiff_put32(p, 0);
+    p += 4;
+
+    if (channels > 2) {
+        for (size_t c = 0; c < channels; c++, p += 2) tiff_put16(p, 8);
+    }
+    if (strip_count > 1) {
+        uint32_t offset = 8;
+        for (size_t i = 0; i < strip_count; i++, p += 4) {
+            tiff_put32(p, offset);
+            offset += strip_sizes[i];
+        }
+        for (size_t i = 0; i < strip_count; i++, p += 4) tiff_put32(p, strip_sizes[i]);
+    }
+    tiff_put32(p, 72);
+    tiff_put32(p + 4, 1);
+    tiff_put32(p + 8, 72);
+    tiff_put32(p + 12, 1);
+
+    return (size_t)(p + 16 - output);
+}
+
+// Whole-file TIFF encoder: horizontal predictor, one strip per tiff_rows_per_strip()
+// rows, strips encoded one after another. Callers that can run strips concurrently
+// use tiff_encode_strip() and tiff_write_directory() directly.
+WASM_EXPORT TIFFProcessResult* encode_tiff_simd(
+    const uint8_t* pixels,
+    size_t width,
+    size_t height,
+    size_t channels,
+    int compression,
+    int level
+) {
+    if (!pixels || width == 0 || height == 0 || channels == 0 || channels > 4) return NULL;
+    if (width > 0xFFFFFFFFu || height > 0xFFFFFFFFu) return NULL;
+
+    size_t rows_per_strip = tiff_rows_per_strip(width, channels);
+    size_t strip_count = (height + rows_per_strip - 1) / rows_per_strip;
+    size_t row_bytes = width * channels;
+    size_t state_size = tiff_strip_state_size(width, rows_per_strip, channels, compression);
+    if (state_size == 0) return NULL;
+
+    size_t capacity = 8 + strip_count * tiff_strip_bound(width, rows_per_strip, channels, compression)
+                    + tiff_directory_size(strip_count, channels);
+
     TIFFProcessResult* result = (TIFFProcessResult*)wasm_malloc(sizeof(TIFFProcessResult));
-    if (!result) return NULL;
-    
-    size_t pixel_count = width * height;
-    size_t estimated_size = pixel_count * 3;
-    
-    uint8_t* processed_data = (uint8_t*)wasm_malloc(pixel_count * 4);
-    if (!processed_data) {
-        wasm_free(result);
+    void* state = wasm_malloc(state_size);
+    uint32_t* strip_sizes = (uint32_t*)wasm_malloc(strip_count * sizeof(uint32_t));
+    uint8_t* data = (uint8_t*)wasm_malloc(capacity);
+    if (!result || !state || !strip_sizes || !data) {
+        if (result) wasm_free(result);
+        if (state) wasm_free(state);
+        if (strip_sizes) wasm_free(strip_sizes);
+        if (data) wasm_free(data);
         return NULL;
     }
-    
-    #if SIMD_AVAILABLE
-    for (size_t y = 0; y < height; y++) {
-        const uint8_t* src_row = &rgba_data[y * width * 4];
-        uint8_t* dst_row = &processed_data[y * width * 4];
-        
-        dst_row[0] = src_row[0];
-        dst_row[1] = src_row[1];
-        dst_row[2] = src_row[2];
-        dst_row[3] = src_row[3];
-        
-        for (size_t x = 1; x < width; x++) {
-            size_t idx = x * 4;
-            size_t prev_idx = (x - 1) * 4;
-            
-            dst_row[idx] = src_row[idx] - src_row[prev_idx];
-            dst_row[idx + 1] = src_row[idx + 1] - src_row[prev_idx + 1];
-            dst_row[idx + 2] = src_row[idx + 2] - src_row[prev_idx + 2];
-            dst_row[idx + 3] = src_row[idx + 3] - src_row[prev_idx + 3];
+
+    size_t pos = 8;
+    size_t file_size = 0;
+    for (size_t i = 0; i < strip_count; i++) {
+        size_t first = i * rows_per_strip;
+        size_t rows = height - first < rows_per_strip ? height - first : rows_per_strip;
+        size_t size = tiff_encode_strip(state, pixels + first * row_bytes, width, rows, channels,
+                                        compression, TIFF_PREDICTOR_HORIZONTAL, level,
+                                        data + pos, capacity - pos);
+        if (size == 0 || size > 0xFFFFFFFFu) break;
+        strip_sizes[i] = (uint32_t)size;
+        pos += size;
+        if (i + 1 == strip_count) {
+            file_size = tiff_write_directory(data, capacity, strip_sizes, strip_count,
+                                             (uint32_t)width, (uint32_t)height, channels, compression,
+                                             TIFF_PREDICTOR_HORIZONTAL, (uint32_t)rows_per_strip);
         }
     }
-    #else
-    memcpy_simd(processed_data, rgba_data, pixel_count * 4);
-    #endif
-    
-    size_t compressed_size = estimated_size * (100 - quality) / 100;
-    if (compressed_size < estimated_size / 4) {
-        compressed_size = estimated_size / 4;
-    }
-    
-    result->data = (uint8_t*)wasm_malloc(compressed_size);
-    if (!result->data) {
-        wasm_free(processed_data);
+    wasm_free(state);
+    wasm_free(strip_sizes);
+
+    if (file_size == 0) {
+        wasm_free(data);
         wasm_free(result);
         return NULL;
     }
-    
-    size_t copy_size = compressed_size < pixel_count * 4 ? compressed_size : pixel_count * 4;
-    memcpy_simd(result->data, processed_data, copy_size);
-    
-    result->size = compressed_size;
+
+    result->data = data;
+    result->size = file_size;
     result->width = (uint32_t)width;
     result->height = (uint32_t)height;
     result->bits_per_sample = 8;
-    result->compression = 5;
-    
-    wasm_free(processed_data);
+    result->compression = (uint8_t)compression;
     return result;
 }
 
+// RGBA as an LZW TIFF. LZW is lossless, so quality has no effect.
+TIFFProcessResult* compress_tiff_lzw_simd(
+    const uint8_t* rgba_data,
+    size_t width,
+    size_t height,
+    uint8_t quality
+) {
+    (void)quality;
+    return encode_tiff_simd(rgba_data, width, height, 4, TIFF_COMPRESSION_LZW, 0);
+}
+
 WASM_EXPORT TIFFProcessResult* strip_tiff_metadata_simd_c_hotspot(
     const uint8_t* tiff_data,
     size_t data_size,
@@ -1213,39 +1923,344 @@ void fast_downscale_simd(
     #endif
 }
 
-void multi_threaded_compression_simd(
-    const uint8_t* rgba_data,
-    size_t width,
-    size_t height,
-    uint8_t* compressed_data,
-    size_t* compressed_size,
-    uint8_t quality
-) {
-    if (!rgba_data || !compressed_data || !compressed_size) return;
-    
-    size_t pixel_count = width * height;
-    size_t estimated_size = pixel_count * 3 * (100 - quality) / 100;
-    
+static inline uint8_t png_paeth_predictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = p > a ? p - a : a - p;
+    int pb = p > b ? p - b : b - p;
+    int pc = p > c ? p - c : c - p;
+    if (pa <= pb && pa <= pc) return (uint8_t)a;
+    if (pb <= pc) return (uint8_t)b;
+    return (uint8_t)c;
+}
+
+// Writes one scanline filtered with `type` into `out`. `prior` is NULL for the first
+// row, which PNG treats as a row of zeros.
+static void png_filter_row(uint8_t type, const uint8_t* row, const uint8_t* prior,
+                           size_t len, size_t bpp, uint8_t* out) {
+    size_t i = 0;
+
+    for (; i < bpp && i < len; i++) {
+        uint8_t up = prior ? prior[i] : 0;
+        switch (type) {
+            case PNG_FILTER_UP:    out[i] = (uint8_t)(row[i] - up); break;
+            case PNG_FILTER_AVG:   out[i] = (uint8_t)(row[i] - (up >> 1)); break;
+            case PNG_FILTER_PAETH: out[i] = (uint8_t)(row[i] - up); break;
+            default:               out[i] = row[i]; break;
+        }
+    }
+
+    if (type == PNG_FILTER_NONE) {
+        memcpy(out + i, row + i, len - i);
+        return;
+    }
+
     #if SIMD_AVAILABLE
-    size_t output_pos = 0;
-    
-    for (size_t i = 0; i < pixel_count && output_pos < estimated_size; i += 4) {
-        if (i + 3 < pixel_count) {
-            v128_t pixels = wasm_v128_load(&rgba_data[i * 4]);
-            
-            uint8_t step = quality < 50 ? 2 : 1;
-            
-            if (i % step == 0 && output_pos + 3 < estimated_size) {
-                compressed_data[output_pos++] = wasm_u8x16_extract_lane(pixels, 0);
-                compressed_data[output_pos++] = wasm_u8x16_extract_lane(pixels, 1);
-                compressed_data[output_pos++] = wasm_u8x16_extract_lane(pixels, 2);
+    if (prior || type == PNG_FILTER_SUB) {
+        for (; i + 16 <= len; i += 16) {
+            v128_t x = wasm_v128_load(row + i);
+            v128_t a = wasm_v128_load(row + i - bpp);
+            v128_t r;
+
+            if (type == PNG_FILTER_SUB) {
+                r = wasm_i8x16_sub(x, a);
+            } else {
+                v128_t b = wasm_v128_load(prior + i);
+                if (type == PNG_FILTER_UP) {
+                    r = wasm_i8x16_sub(x, b);
+                } else if (type == PNG_FILTER_AVG) {
+                    // avgr rounds up; the PNG average rounds down.
+                    v128_t odd = wasm_v128_and(wasm_v128_xor(a, b), wasm_i8x16_splat(1));
+                    r = wasm_i8x16_sub(x, wasm_i8x16_sub(wasm_u8x16_avgr(a, b), odd));
+                } else {
+                    v128_t c = wasm_v128_load(prior + i - bpp);
+                    v128_t a_lo = wasm_u16x8_extend_low_u8x16(a), a_hi = wasm_u16x8_extend_high_u8x16(a);
+                    v128_t b_lo = wasm_u16x8_extend_low_u8x16(b), b_hi = wasm_u16x8_extend_high_u8x16(b);
+                    v128_t c_lo = wasm_u16x8_extend_low_u8x16(c), c_hi = wasm_u16x8_extend_high_u8x16(c);
+
+                    // pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|
+                    v128_t pa_lo = wasm_i16x8_abs(wasm_i16x8_sub(b_lo, c_lo));
+                    v128_t pa_hi = wasm_i16x8_abs(wasm_i16x8_sub(b_hi, c_hi));
+                    v128_t pb_lo = wasm_i16x8_abs(wasm_i16x8_sub(a_lo, c_lo));
+                    v128_t pb_hi = wasm_i16x8_abs(wasm_i16x8_sub(a_hi, c_hi));
+                    v128_t pc_lo = wasm_i16x8_abs(wasm_i16x8_sub(wasm_i16x8_add(a_lo, b_lo), wasm_i16x8_add(c_lo, c_lo)));
+                    v128_t pc_hi = wasm_i16x8_abs(wasm_i16x8_sub(wasm_i16x8_add(a_hi, b_hi), wasm_i16x8_add(c_hi, c_hi)));
+
+                    v128_t use_a_lo = wasm_v128_and(wasm_i16x8_le(pa_lo, pb_lo), wasm_i16x8_le(pa_lo, pc_lo));
+                    v128_t use_a_hi = wasm_v128_and(wasm_i16x8_le(pa_hi, pb_hi), wasm_i16x8_le(pa_hi, pc_hi));
+                    v128_t use_b_lo = wasm_i16x8_le(pb_lo, pc_lo);
+                    v128_t use_b_hi = wasm_i16x8_le(pb_hi, pc_hi);
+
+                    v128_t use_a = wasm_i8x16_narrow_i16x8(use_a_lo, use_a_hi);
+                    v128_t use_b = wasm_i8x16_narrow_i16x8(use_b_lo, use_b_hi);
+                    v128_t pred = wasm_v128_bitselect(a, wasm_v128_bitselect(b, c, use_b), use_a);
+                    r = wasm_i8x16_sub(x, pred);
+                }
             }
+            wasm_v128_store(out + i, r);
         }
     }
-    
-    *compressed_size = output_pos;
-    #else
-    *compressed_size = estimated_size;
-    memcpy_simd(compressed_data, rgba_data, estimated_size);
     #endif
+
+    for (; i < len; i++) {
+        uint8_t a = row[i - bpp];
+        uint8_t b = prior ? prior[i] : 0;
+        uint8_t c = prior ? prior[i - bpp] : 0;
+        switch (type) {
+            case PNG_FILTER_SUB:   out[i] = (uint8_t)(row[i] - a); break;
+            case PNG_FILTER_UP:    out[i] = (uint8_t)(row[i] - b); break;
+            case PNG_FILTER_AVG:   out[i] = (uint8_t)(row[i] - ((a + b) >> 1)); break;
+            default:               out[i] = (uint8_t)(row[i] - png_paeth_predictor(a, b, c)); break;
+        }
+    }
+}
+
+// Estimated cost of a filtered row: the bits an order-0 code fitted to the rows chosen
+// so far plus this one would spend on it, plus the sum of absolute residuals (the
+// classic MSAD heuristic) scaled down to break near-ties in favour of the small
+// residuals deflate's matcher also prefers. Scoring against the running histogram
+// rather than the row alone keeps rows on symbols the Huffman tables already favour.
+static float png_row_cost(const uint8_t* filtered, size_t len, const uint32_t* context, size_t context_total) {
+    uint32_t histogram[256] = {0};
+    uint64_t sad = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t v = filtered[i];
+        histogram[v]++;
+        sad += v < 128 ? v : 256 - v;
+    }
+
+    float n = (float)len;
+    float bits_nats = n * fast_log((float)(context_total + len));
+    for (int s = 0; s < 256; s++) {
+        uint32_t total = context[s] + histogram[s];
+        if (histogram[s] && total > 1) {
+            bits_nats -= (float)histogram[s] * fast_log((float)total);
+        }
+    }
+
+    return bits_nats * 1.442695041f + (float)sad * 0.125f;
+}
+
+int png_filter_scanlines(const uint8_t* pixels, size_t width, size_t height,
+                         size_t bytes_per_pixel, uint8_t* filtered_out) {
+    if (!pixels || !filtered_out || width == 0 || height == 0) return -1;
+    if (bytes_per_pixel == 0 || bytes_per_pixel > 8) return -1;
+
+    const size_t stride = width * bytes_per_pixel;
+    uint32_t context[256] = {0};
+    size_t context_total = 0;
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* row = pixels + y * stride;
+        const uint8_t* prior = y > 0 ? row - stride : 0;
+        uint8_t* out = filtered_out + y * (stride + 1);
+
+        uint8_t best_type = PNG_FILTER_NONE;
+        float best_cost = 0.0f;
+
+        for (uint8_t type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+            // Without a prior row, Up matches None and Paeth matches Sub.
+            if (!prior && (type == PNG_FILTER_UP || type == PNG_FILTER_PAETH)) continue;
+
+            png_filter_row(type, row, prior, stride, bytes_per_pixel, out + 1);
+            float cost = png_row_cost(out + 1, stride, context, context_total);
+            if (type == PNG_FILTER_NONE || cost < best_cost) {
+                best_cost = cost;
+                best_type = type;
+            }
+        }
+
+        // The row buffer still holds the last filter tried; redo it only if that lost.
+        uint8_t last_type = prior ? PNG_FILTER_PAETH : PNG_FILTER_AVG;
+        out[0] = best_type;
+        if (best_type != last_type) {
+            png_filter_row(best_type, row, prior, stride, bytes_per_pixel, out + 1);
+        }
+        for (size_t i = 1; i <= stride; i++) {
+            context[out[i]]++;
+        }
+        context_total += stride;
+    }
+
+    return 0;
+}
+
+// Open-addressed set of RGBA words for analyze_image_rgba. An empty slot holds 0, so
+// the colour 0x00000000 (transparent black) is tracked by its own flag.
+typedef struct {
+    uint32_t* slots;
+    uint32_t mask;
+    uint32_t shift;
+    uint32_t count;
+    uint32_t cap;
+    int has_zero;
+} ColorSet;
+
+static int color_set_init(ColorSet* set, uint32_t cap) {
+    uint32_t size = 64;
+    uint32_t bits = 6;
+    while (size < cap * 2) {
+        size <<= 1;
+        bits++;
+    }
+    set->slots = (uint32_t*)wasm_malloc(size * sizeof(uint32_t));
+    if (!set->slots) return 0;
+    memset(set->slots, 0, size * sizeof(uint32_t));
+    set->mask = size - 1;
+    set->shift = 32 - bits;
+    set->count = 0;
+    set->cap = cap;
+    set->has_zero = 0;
+    return 1;
+}
+
+// Returns 0 once the set holds more than `cap` colours; the count then stays at cap + 1.
+static int color_set_insert(ColorSet* set, uint32_t color) {
+    if (color == 0) {
+        if (!set->has_zero) {
+            set->has_zero = 1;
+            set->count++;
+        }
+        return set->count <= set->cap;
+    }
+    uint32_t h = (color * 0x9E3779B1u) >> set->shift;
+    while (set->slots[h] && set->slots[h] != color) h = (h + 1) & set->mask;
+    if (!set->slots[h]) {
+        set->slots[h] = color;
+        set->count++;
+    }
+    return set->count <= set->cap;
+}
+
+// Sum of |a[i] - b[i]| over n bytes.
+static uint64_t sum_abs_diff(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint64_t sum = 0;
+    size_t i = 0;
+
+    #if SIMD_AVAILABLE
+    v128_t acc = wasm_i32x4_splat(0);
+    for (; i + 16 <= n; i += 16) {
+        v128_t va = wasm_v128_load(a + i);
+        v128_t vb = wasm_v128_load(b + i);
+        v128_t diff = wasm_v128_or(wasm_u8x16_sub_sat(va, vb), wasm_u8x16_sub_sat(vb, va));
+        acc = wasm_i32x4_add(acc, wasm_u32x4_extadd_pairwise_u16x8(wasm_u16x8_extadd_pairwise_u8x16(diff)));
+    }
+    sum += (uint64_t)wasm_u32x4_extract_lane(acc, 0) + wasm_u32x4_extract_lane(acc, 1)
+         + wasm_u32x4_extract_lane(acc, 2) + wasm_u32x4_extract_lane(acc, 3);
+    #endif
+
+    for (; i < n; i++) {
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sum;
+}
+
+// True when every sample present in the histogram is a multiple of 255 / (2^depth - 1),
+// i.e. the channel survives a round trip through `depth` bits.
+static int histogram_fits_depth(const uint32_t* histogram, uint32_t depth) {
+    uint32_t step = 255 / ((1u << depth) - 1);
+    for (uint32_t v = 0; v < 256; v++) {
+        if (histogram[v] && v % step) return 0;
+    }
+    return 1;
+}
+
+int analyze_image_rgba(const uint8_t* rgba_data, size_t width, size_t height,
+                       uint32_t unique_cap, ImageAnalysis* out) {
+    if (!rgba_data || !out || width == 0 || height == 0) return -1;
+    if (unique_cap > 65536) unique_cap = 65536;
+
+    uint8_t* luma = (uint8_t*)wasm_malloc(width * 2);
+    if (!luma) return -1;
+    ColorSet colors = {0};
+    int counting = unique_cap > 0;
+    if (counting && !color_set_init(&colors, unique_cap)) {
+        wasm_free(luma);
+        return -1;
+    }
+
+    memset(out, 0, sizeof(*out));
+    uint32_t* hist_r = out->histogram[0];
+    uint32_t* hist_g = out->histogram[1];
+    uint32_t* hist_b = out->histogram[2];
+    uint32_t* hist_a = out->histogram[3];
+    uint64_t gradient = 0;
+    int grayscale = 1;
+    uint32_t previous = 0;
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* row = rgba_data + y * width * 4;
+        uint8_t* cur = luma + (y & 1) * width;
+        const uint8_t* prior = y > 0 ? luma + ((y - 1) & 1) * width : 0;
+        size_t x = 0;
+
+        #if SIMD_AVAILABLE
+        if (grayscale) {
+            // Rotating R, G, B within each pixel compares R with G, G with B and B with R.
+            v128_t same = wasm_i8x16_splat(-1);
+            for (; x + 4 <= width; x += 4) {
+                v128_t px = wasm_v128_load(row + x * 4);
+                v128_t rot = wasm_i8x16_shuffle(px, px, 1, 2, 0, 3, 5, 6, 4, 7, 9, 10, 8, 11, 13, 14, 12, 15);
+                same = wasm_v128_and(same, wasm_i8x16_eq(px, rot));
+            }
+            grayscale = wasm_i8x16_all_true(same);
+        }
+        #endif
+        for (; grayscale && x < width; x++) {
+            const uint8_t* p = row + x * 4;
+            if (p[0] != p[1] || p[1] != p[2]) grayscale = 0;
+        }
+
+        for (x = 0; x < width; x++) {
+            const uint8_t* p = row + x * 4;
+            uint8_t r = p[0], g = p[1], b = p[2], a = p[3];
+            hist_r[r]++;
+            hist_g[g]++;
+            hist_b[b]++;
+            hist_a[a]++;
+            cur[x] = (uint8_t)((r + 2 * g + b + 2) >> 2);
+
+            if (counting) {
+                uint32_t color = (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+                // Runs of one colour are common in palette-sized images; skip the probe.
+                if ((x == 0 && y == 0) || color != previous) {
+                    counting = color_set_insert(&colors, color);
+                    previous = color;
+                }
+            }
+        }
+
+        gradient += sum_abs_diff(cur + 1, cur, width - 1);
+        if (prior) gradient += sum_abs_diff(cur, prior, width);
+    }
+
+    if (unique_cap > 0) {
+        out->unique_colors = colors.count;
+        wasm_free(colors.slots);
+    }
+    wasm_free(luma);
+
+    uint32_t other_alpha = 0;
+    for (int v = 1; v < 255; v++) other_alpha += hist_a[v];
+    if (other_alpha) {
+        out->alpha_usage = IMAGE_ALPHA_FULL;
+    } else if (hist_a[0]) {
+        out->alpha_usage = IMAGE_ALPHA_BINARY;
+    } else {
+        out->alpha_usage = IMAGE_ALPHA_NONE;
+    }
+    out->is_grayscale = (uint32_t)grayscale;
+
+    out->bit_depth = 8;
+    for (uint32_t depth = 1; depth < 8; depth <<= 1) {
+        if (histogram_fits_depth(hist_r, depth) && histogram_fits_depth(hist_g, depth) &&
+            histogram_fits_depth(hist_b, depth) &&
+            (out->alpha_usage == IMAGE_ALPHA_NONE || histogram_fits_depth(hist_a, depth))) {
+            out->bit_depth = depth;
+            break;
+        }
+    }
+
+    out->edge_energy = (float)((double)gradient / (double)(width * height));
+    return 0;
 }
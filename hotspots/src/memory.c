@@ -10,43 +10,558 @@ typedef long long int64_t;
 
 #ifdef __wasm32__
 
-// Memory pool size: keep small enough that WASM instantiation always succeeds in
-// constrained browser tabs. Tune via -DPIXIE_WASM_POOL_BYTES=... at build time.
-#ifndef PIXIE_WASM_POOL_BYTES
-#define PIXIE_WASM_POOL_BYTES (16u * 1024u * 1024u)
+// The hotspot heap starts empty and grows on demand with memory.grow, so an
+// instance only pays for what its largest request needed. The ceiling defaults to
+// PIXIE_WASM_HEAP_LIMIT and can be lowered at runtime with wasm_set_memory_limit().
+#ifndef PIXIE_WASM_HEAP_LIMIT
+#define PIXIE_WASM_HEAP_LIMIT (1024u * 1024u * 1024u)
 #endif
 
-static uint8_t memory_pool[PIXIE_WASM_POOL_BYTES];
-static size_t memory_offset = 0;
+#define WASM_PAGE_SIZE 65536u
+#define SEGMENT_MIN_BYTES (1024u * 1024u)
+#define HEAP_LIMIT_MAX 0xFFFF0000u
 
 #define WASM_EXPORT __attribute__((visibility("default")))
 
+// Every block starts with an 8-byte header. `prev_size` is only meaningful when
+// BLOCK_PREV_FREE is set and lets a freed large block find its left neighbour in
+// O(1). Large blocks grow up from the bottom of a segment, use boundary tags and
+// are merged with free neighbours (or handed back to the top) on release. Small
+// blocks (<= SMALL_BLOCK_MAX bytes including the header) are carved downward from
+// the end of the segment and recycled through exact-size free lists, so long-lived
+// small nodes never pin the large region.
+#define BLOCK_USED      1u
+#define BLOCK_PREV_FREE 2u
+#define BLOCK_SMALL     4u
+#define BLOCK_FLAGS     7u
+
+#define BLOCK_HEADER_SIZE 8u
+#define SMALL_BLOCK_MIN 16u
+#define SMALL_BLOCK_MAX 2048u
+#define SMALL_CLASS_COUNT 24u
+#define LARGE_BIN_COUNT 21u
+#define ARENA_MAX_DEPTH 16u
+#define ARENA_NO_MARK ((size_t)-1)
+
+typedef struct {
+    uint32_t prev_size;
+    uint32_t size_flags;
+} BlockHeader;
+
+typedef struct SmallFree {
+    struct SmallFree* next;
+} SmallFree;
+
+typedef struct LargeFree {
+    struct LargeFree* next;
+    struct LargeFree* prev;
+} LargeFree;
+
+// Segments come from memory.grow, so a newer segment always sits at a higher
+// address than an older one. They are never given back: after a reset or an
+// arena release the chain is walked again in order and reused.
+typedef struct Segment {
+    struct Segment* next;
+    uint8_t* end;
+} Segment;
+
+#define SEGMENT_HEADER_SIZE ((sizeof(Segment) + 7u) & ~(size_t)7u)
+#define RETIRE_MIN_BYTES 64u
+
+typedef struct {
+    SmallFree* small[SMALL_CLASS_COUNT];
+    LargeFree* large[LARGE_BIN_COUNT];
+} FreeLists;
+
+// An arena mark snapshots both heap edges and parks the free lists, so the scope
+// starts with empty lists and only ever recycles its own blocks. Releasing the
+// mark is then a handful of stores no matter how much the scope allocated.
+typedef struct {
+    Segment* segment;
+    uint8_t* heap_top;
+    uint8_t* small_floor;
+    size_t bytes_in_use;
+    FreeLists lists;
+} ArenaMark;
+
+static Segment* first_segment = 0;
+static Segment* last_segment = 0;
+static Segment* current_segment = 0;
+static uint8_t* heap_top = 0;
+static uint8_t* small_floor = 0;
+static size_t heap_reserved = 0;
+static size_t heap_limit = PIXIE_WASM_HEAP_LIMIT;
+static FreeLists free_lists;
+static ArenaMark arena_marks[ARENA_MAX_DEPTH];
+static uint32_t arena_depth = 0;
+static size_t bytes_in_use = 0;
+static size_t bytes_peak = 0;
+
+static inline BlockHeader* block_from_ptr(void* ptr) {
+    return (BlockHeader*)((uint8_t*)ptr - BLOCK_HEADER_SIZE);
+}
+
+static inline void* block_payload(BlockHeader* block) {
+    return (uint8_t*)block + BLOCK_HEADER_SIZE;
+}
+
+static inline uint32_t block_size(const BlockHeader* block) {
+    return block->size_flags & ~BLOCK_FLAGS;
+}
+
+static inline BlockHeader* block_next(BlockHeader* block) {
+    return (BlockHeader*)((uint8_t*)block + block_size(block));
+}
+
+static inline uint32_t floor_log2(uint32_t x) {
+    return 31u - (uint32_t)__builtin_clz(x);
+}
+
+// Classes are 16-byte steps up to 128 bytes, then four steps per power of two.
+static inline uint32_t small_class_index(uint32_t size) {
+    if (size <= 128u) {
+        return (size + 15u) / 16u - 1u;
+    }
+    uint32_t lg = floor_log2(size - 1u);
+    uint32_t sub = (size - 1u - (1u << lg)) >> (lg - 2u);
+    return 8u + (lg - 7u) * 4u + sub;
+}
+
+static inline uint32_t small_class_size(uint32_t index) {
+    if (index < 8u) {
+        return (index + 1u) * 16u;
+    }
+    uint32_t lg = 7u + (index - 8u) / 4u;
+    uint32_t sub = (index - 8u) % 4u;
+    return (1u << lg) + (sub + 1u) * (1u << (lg - 2u));
+}
+
+static inline uint32_t large_bin_index(uint32_t size) {
+    uint32_t lg = floor_log2(size);
+    if (lg < 11u) return 0;
+    lg -= 11u;
+    return lg < LARGE_BIN_COUNT ? lg : LARGE_BIN_COUNT - 1u;
+}
+
+// Level 0 holds blocks carved before the outermost mark; level i holds blocks
+// carved while i marks were active. Blocks only ever merge within their level.
+static uint32_t large_level(const uint8_t* p) {
+    uint32_t level = arena_depth;
+    while (level > 0 && p < arena_marks[level - 1].heap_top) level--;
+    return level;
+}
+
+// Small blocks are carved downward, so "after the mark" means a newer segment or
+// below the mark's floor inside the segment that was current at the time.
+static inline int small_after_mark(const uint8_t* p, const ArenaMark* mark) {
+    Segment* seg = mark->segment;
+    return !seg || p >= seg->end || (p > (uint8_t*)seg && p < mark->small_floor);
+}
+
+static uint32_t small_level(const uint8_t* p) {
+    uint32_t level = arena_depth;
+    while (level > 0 && !small_after_mark(p, &arena_marks[level - 1])) level--;
+    return level;
+}
+
+static inline FreeLists* level_lists(uint32_t level) {
+    return level == arena_depth ? &free_lists : &arena_marks[level].lists;
+}
+
+static void large_bin_insert(FreeLists* lists, BlockHeader* block) {
+    LargeFree* node = (LargeFree*)block_payload(block);
+    uint32_t bin = large_bin_index(block_size(block));
+    node->prev = 0;
+    node->next = lists->large[bin];
+    if (node->next) node->next->prev = node;
+    lists->large[bin] = node;
+}
+
+static void large_bin_remove(FreeLists* lists, BlockHeader* block) {
+    LargeFree* node = (LargeFree*)block_payload(block);
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        lists->large[large_bin_index(block_size(block))] = node->next;
+    }
+    if (node->next) node->next->prev = node->prev;
+}
+
+// Carves a large block off the top of the heap. A header always sits at
+// heap_top (space for it is kept free below small_floor) and carries the
+// PREV_FREE state of whatever block precedes the unused gap.
+static BlockHeader* carve_from_top(uint32_t size) {
+    if ((size_t)(small_floor - heap_top) < (size_t)size + BLOCK_HEADER_SIZE) {
+        return 0;
+    }
+
+    BlockHeader* block = (BlockHeader*)heap_top;
+    block->size_flags = size | BLOCK_USED | (block->size_flags & BLOCK_PREV_FREE);
+    heap_top += size;
+
+    BlockHeader* tail = (BlockHeader*)heap_top;
+    tail->prev_size = 0;
+    tail->size_flags = 0;
+    return block;
+}
+
+static BlockHeader* carve_small(uint32_t size) {
+    if ((size_t)(small_floor - heap_top) < (size_t)size + BLOCK_HEADER_SIZE) {
+        return 0;
+    }
+
+    small_floor -= size;
+    BlockHeader* block = (BlockHeader*)small_floor;
+    block->prev_size = 0;
+    block->size_flags = size | BLOCK_USED | BLOCK_SMALL;
+    return block;
+}
+
+static uint8_t* grow_linear_memory(size_t pages) {
+    size_t old_pages = __builtin_wasm_memory_grow(0, pages);
+    if (old_pages == (size_t)-1) {
+        return 0;
+    }
+    return (uint8_t*)(old_pages * WASM_PAGE_SIZE);
+}
+
+// Asks for half of what is already reserved (at least SEGMENT_MIN_BYTES) so the
+// number of segments stays logarithmic, falling back to the bare minimum when the
+// ceiling or the host refuses the larger request.
+static Segment* grow_segment(size_t min_bytes) {
+    if (heap_reserved >= heap_limit) {
+        return 0;
+    }
+
+    size_t room_pages = (heap_limit - heap_reserved) / WASM_PAGE_SIZE;
+    size_t min_pages = (min_bytes + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
+    if (min_pages > room_pages) {
+        return 0;
+    }
+
+    size_t want = heap_reserved / 2;
+    if (want < SEGMENT_MIN_BYTES) want = SEGMENT_MIN_BYTES;
+    size_t pages = (want + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
+    if (pages < min_pages) pages = min_pages;
+    if (pages > room_pages) pages = room_pages;
+
+    uint8_t* base = grow_linear_memory(pages);
+    if (!base && pages > min_pages) {
+        pages = min_pages;
+        base = grow_linear_memory(pages);
+    }
+    if (!base) {
+        return 0;
+    }
+
+    Segment* seg = (Segment*)base;
+    seg->next = 0;
+    seg->end = base + pages * WASM_PAGE_SIZE;
+    if (last_segment) {
+        last_segment->next = seg;
+    } else {
+        first_segment = seg;
+    }
+    last_segment = seg;
+    heap_reserved += pages * WASM_PAGE_SIZE;
+    return seg;
+}
+
+// The large region starts right after the segment header; a used sentinel header
+// at the very end stops coalescing from running off the segment.
+static void enter_segment(Segment* seg) {
+    current_segment = seg;
+    heap_top = (uint8_t*)seg + SEGMENT_HEADER_SIZE;
+    small_floor = seg->end - BLOCK_HEADER_SIZE;
+
+    BlockHeader* tail = (BlockHeader*)heap_top;
+    tail->prev_size = 0;
+    tail->size_flags = 0;
+
+    BlockHeader* sentinel = (BlockHeader*)small_floor;
+    sentinel->prev_size = 0;
+    sentinel->size_flags = BLOCK_USED | BLOCK_SMALL;
+}
+
+static void release_large_block(BlockHeader* block);
+
+// Hands the unused middle of a segment we are leaving to the free lists. A gap
+// too small to bother with keeps its tail header, marked used so neighbours
+// never try to merge into it.
+static void retire_gap(uint8_t* top, uint8_t* floor) {
+    size_t gap = (size_t)(floor - top);
+    BlockHeader* block = (BlockHeader*)top;
+    if (gap < RETIRE_MIN_BYTES) {
+        block->size_flags |= BLOCK_USED;
+        return;
+    }
+
+    block->size_flags = (uint32_t)gap | BLOCK_USED | (block->size_flags & BLOCK_PREV_FREE);
+    release_large_block(block);
+}
+
+// Moves allocation into the next segment with room for a `size`-byte block,
+// reusing segments left behind by a reset or arena release before growing.
+static int advance_segment(uint32_t size) {
+    size_t needed = SEGMENT_HEADER_SIZE + (size_t)size + 2 * BLOCK_HEADER_SIZE;
+    Segment* seg = current_segment ? current_segment->next : first_segment;
+
+    while (seg && (size_t)(seg->end - (uint8_t*)seg) < needed) {
+        uint8_t* top = heap_top;
+        uint8_t* floor = small_floor;
+        enter_segment(seg);
+        if (top) retire_gap(top, floor);
+        seg = seg->next;
+    }
+
+    if (!seg) {
+        seg = grow_segment(needed);
+        if (!seg) {
+            return 0;
+        }
+    }
+
+    uint8_t* top = heap_top;
+    uint8_t* floor = small_floor;
+    enter_segment(seg);
+    if (top) retire_gap(top, floor);
+    return 1;
+}
+
+static BlockHeader* take_large_block(uint32_t size) {
+    for (uint32_t bin = large_bin_index(size); bin < LARGE_BIN_COUNT; bin++) {
+        for (LargeFree* node = free_lists.large[bin]; node; node = node->next) {
+            BlockHeader* block = block_from_ptr(node);
+            uint32_t available = block_size(block);
+            if (available < size) continue;
+
+            large_bin_remove(&free_lists, block);
+
+            if (available - size > SMALL_BLOCK_MAX) {
+                BlockHeader* rest = (BlockHeader*)((uint8_t*)block + size);
+                uint32_t rest_size = available - size;
+                rest->size_flags = rest_size;
+                block_next(rest)->prev_size = rest_size;
+                large_bin_insert(&free_lists, rest);
+                block->size_flags = size | BLOCK_USED | (block->size_flags & BLOCK_PREV_FREE);
+            } else {
+                block->size_flags |= BLOCK_USED;
+                block_next(block)->size_flags &= ~BLOCK_PREV_FREE;
+            }
+            return block;
+        }
+    }
+    return 0;
+}
+
+static void release_large_block(BlockHeader* block) {
+    uint32_t size = block_size(block);
+    uint32_t level = large_level((uint8_t*)block);
+    FreeLists* lists = level_lists(level);
+    uint8_t* level_start = level ? arena_marks[level - 1].heap_top : 0;
+    uint8_t* level_end = level == arena_depth ? heap_top : arena_marks[level].heap_top;
+    int owns_top = level == arena_depth;
+
+    if ((block->size_flags & BLOCK_PREV_FREE) && (uint8_t*)block != level_start) {
+        BlockHeader* prev = (BlockHeader*)((uint8_t*)block - block->prev_size);
+        large_bin_remove(lists, prev);
+        size += block_size(prev);
+        block = prev;
+    }
+
+    BlockHeader* next = (BlockHeader*)((uint8_t*)block + size);
+    if (owns_top && (uint8_t*)next == heap_top) {
+        heap_top = (uint8_t*)block;
+        block->size_flags &= BLOCK_PREV_FREE;
+        return;
+    }
+
+    if ((uint8_t*)next < level_end && !(next->size_flags & BLOCK_USED)) {
+        large_bin_remove(lists, next);
+        size += block_size(next);
+        next = (BlockHeader*)((uint8_t*)block + size);
+        if (owns_top && (uint8_t*)next == heap_top) {
+            heap_top = (uint8_t*)block;
+            block->size_flags &= BLOCK_PREV_FREE;
+            return;
+        }
+    }
+
+    block->size_flags = size | (block->size_flags & BLOCK_PREV_FREE);
+    next->prev_size = size;
+    next->size_flags |= BLOCK_PREV_FREE;
+    large_bin_insert(lists, block);
+}
+
 WASM_EXPORT void* wasm_malloc(size_t size) {
-    size = (size + 7) & ~7;
-    
-    if (memory_offset + size > sizeof(memory_pool)) {
+    if (size == 0 || size >= heap_limit) {
         return 0;
     }
-    
-    void* ptr = &memory_pool[memory_offset];
-    memory_offset += size;
-    return ptr;
+
+    uint32_t needed = (uint32_t)((size + BLOCK_HEADER_SIZE + 7u) & ~(size_t)7u);
+    BlockHeader* block;
+
+    if (needed <= SMALL_BLOCK_MAX) {
+        uint32_t index = small_class_index(needed < SMALL_BLOCK_MIN ? SMALL_BLOCK_MIN : needed);
+        needed = small_class_size(index);
+
+        SmallFree* head = free_lists.small[index];
+        if (head) {
+            free_lists.small[index] = head->next;
+            block = block_from_ptr(head);
+        } else {
+            block = carve_small(needed);
+            if (!block && advance_segment(needed)) {
+                block = carve_small(needed);
+            }
+        }
+    } else {
+        block = take_large_block(needed);
+        if (!block) {
+            block = carve_from_top(needed);
+        }
+        if (!block && advance_segment(needed)) {
+            block = carve_from_top(needed);
+        }
+    }
+
+    if (!block) {
+        return 0;
+    }
+
+    bytes_in_use += block_size(block);
+    if (bytes_in_use > bytes_peak) {
+        bytes_peak = bytes_in_use;
+    }
+    return block_payload(block);
+}
+
+static int owned_by_heap(const uint8_t* p) {
+    if (!current_segment || (p >= heap_top && p <= small_floor)) {
+        return 0;
+    }
+    for (Segment* seg = first_segment; seg; seg = seg->next) {
+        if (p > (uint8_t*)seg && p < seg->end) return 1;
+        if (seg == current_segment) break;
+    }
+    return 0;
 }
 
 WASM_EXPORT void wasm_free(void* ptr) {
-    (void)ptr;
+    uint8_t* p = (uint8_t*)ptr;
+    if (!p || !owned_by_heap(p)) {
+        return;
+    }
+
+    BlockHeader* block = block_from_ptr(ptr);
+    if (!(block->size_flags & BLOCK_USED)) {
+        return;
+    }
+
+    uint32_t size = block_size(block);
+    int small = (block->size_flags & BLOCK_SMALL) != 0;
+    uint32_t level = small ? small_level(p) : large_level(p);
+
+    // Blocks owned by an enclosing scope stay counted in its snapshot until freed.
+    bytes_in_use -= size;
+    for (uint32_t i = level; i < arena_depth; i++) {
+        arena_marks[i].bytes_in_use -= size;
+    }
+
+    if (small) {
+        FreeLists* lists = level_lists(level);
+        SmallFree* node = (SmallFree*)ptr;
+        uint32_t index = small_class_index(size);
+        node->next = lists->small[index];
+        lists->small[index] = node;
+        return;
+    }
+
+    release_large_block(block);
 }
 
 WASM_EXPORT void wasm_reset_allocator(void) {
-    memory_offset = 0;
+    current_segment = 0;
+    heap_top = 0;
+    small_floor = 0;
+    for (uint32_t i = 0; i < SMALL_CLASS_COUNT; i++) free_lists.small[i] = 0;
+    for (uint32_t i = 0; i < LARGE_BIN_COUNT; i++) free_lists.large[i] = 0;
+    arena_depth = 0;
+    bytes_in_use = 0;
+    bytes_peak = 0;
+}
+
+// Opens a scope: everything allocated until the matching arena_release() is
+// dropped at once, whether or not the kernel freed it. Blocks allocated before
+// the mark may still be freed inside the scope and are recycled normally.
+WASM_EXPORT size_t arena_mark(void) {
+    if (arena_depth == ARENA_MAX_DEPTH) {
+        return ARENA_NO_MARK;
+    }
+
+    ArenaMark* mark = &arena_marks[arena_depth];
+    mark->segment = current_segment;
+    mark->heap_top = heap_top;
+    mark->small_floor = small_floor;
+    mark->bytes_in_use = bytes_in_use;
+    mark->lists = free_lists;
+    for (uint32_t i = 0; i < SMALL_CLASS_COUNT; i++) free_lists.small[i] = 0;
+    for (uint32_t i = 0; i < LARGE_BIN_COUNT; i++) free_lists.large[i] = 0;
+    return arena_depth++;
+}
+
+// Releases `mark` and any scopes nested inside it. Stale or overflowed marks are
+// ignored so a guard that outlives a wasm_reset_allocator() call stays harmless.
+WASM_EXPORT void arena_release(size_t mark) {
+    if (mark >= arena_depth) {
+        return;
+    }
+
+    ArenaMark* saved = &arena_marks[mark];
+    current_segment = saved->segment;
+    heap_top = saved->heap_top;
+    small_floor = saved->small_floor;
+    bytes_in_use = saved->bytes_in_use;
+    free_lists = saved->lists;
+    arena_depth = (uint32_t)mark;
+    if (!current_segment) {
+        return;
+    }
+
+    // The header at the old top may have picked up PREV_FREE from a block freed
+    // inside the scope; fold that block back into the top now that it borders it,
+    // unless it belongs to an enclosing scope that ends at the same address.
+    BlockHeader* tail = (BlockHeader*)heap_top;
+    uint8_t* level_start = mark ? arena_marks[mark - 1].heap_top : 0;
+    tail->size_flags &= BLOCK_PREV_FREE;
+    if ((tail->size_flags & BLOCK_PREV_FREE) && heap_top != level_start) {
+        BlockHeader* prev = (BlockHeader*)(heap_top - tail->prev_size);
+        large_bin_remove(&free_lists, prev);
+        prev->size_flags &= BLOCK_PREV_FREE;
+        heap_top = (uint8_t*)prev;
+    }
 }
 
 WASM_EXPORT size_t wasm_get_memory_usage(void) {
-    return memory_offset;
+    return bytes_in_use;
+}
+
+WASM_EXPORT size_t wasm_get_memory_peak(void) {
+    return bytes_peak;
 }
 
 WASM_EXPORT size_t wasm_get_memory_limit(void) {
-    return sizeof(memory_pool);
+    return heap_limit;
+}
+
+// Caps future growth. Segments already reserved stay usable even when the new
+// limit is below what has been reserved so far.
+WASM_EXPORT void wasm_set_memory_limit(size_t bytes) {
+    heap_limit = bytes < HEAP_LIMIT_MAX ? bytes : HEAP_LIMIT_MAX;
+}
+
+WASM_EXPORT size_t wasm_get_memory_reserved(void) {
+    return heap_reserved;
 }
 
 WASM_EXPORT void* wasm_memcpy(void* dest, const void* src, size_t n) {
@@ -191,6 +706,8 @@ WASM_EXPORT void wasm_qsort(void* base, size_t nmemb, size_t size, int (*compar)
             }
         }
     }
+
+    wasm_free(temp);
 }
 
 #endif // __wasm32__
@@ -113,7 +113,7 @@ uint32_t hash_fnv1a(const uint8_t* data, size_t len) {
     return hash;
 }
 
-uint64_t hash_xxhash32(const uint8_t* data, size_t len, uint32_t seed) {
+WASM_EXPORT uint64_t hash_xxhash32(const uint8_t* data, size_t len, uint32_t seed) {
     if (!data) return 0;
     
     const uint32_t PRIME32_1 = 2654435761U;
@@ -122,10 +122,10 @@ uint64_t hash_xxhash32(const uint8_t* data, size_t len, uint32_t seed) {
     const uint32_t PRIME32_4 = 668265263U;
     const uint32_t PRIME32_5 = 374761393U;
     
+    const uint8_t* const bEnd = data + len;
     uint32_t h32;
     
     if (len >= 16) {
-        const uint8_t* const bEnd = data + len;
         const uint8_t* const limit = bEnd - 16;
         uint32_t v1 = seed + PRIME32_1 + PRIME32_2;
         uint32_t v2 = seed + PRIME32_2;
@@ -152,7 +152,6 @@ uint64_t hash_xxhash32(const uint8_t* data, size_t len, uint32_t seed) {
     
     h32 += (uint32_t)len;
     
-    const uint8_t* const bEnd = data + len;
     while (data + 4 <= bEnd) {
         h32 += (*(uint32_t*)data) * PRIME32_3;
         h32 = ((h32 << 17) | (h32 >> 15)) * PRIME32_4;
@@ -1,8 +1,9 @@
 extern crate alloc;
 use alloc::{vec::Vec, format, string::String, string::ToString};
 
+use crate::c_hotspots::compression::{lz4_compress_block, lz4_decompress_block};
 use crate::optimizers::{PixieOptimizer, get_performance_stats, reset_performance_stats};
-use crate::types::{PixieResult};
+use crate::types::{PixieError, PixieResult};
 
 #[derive(Debug, Clone, serde::Serialize, serde::Deserialize)]
 pub struct BenchmarkResult {
@@ -23,6 +24,7 @@ pub fn run_performance_benchmarks() -> PixieResult<Vec<BenchmarkResult>> {
     results.push(benchmark_mesh_100k_tris()?);
     results.push(benchmark_memory_usage()?);
     results.push(benchmark_batch_processing()?);
+    results.push(benchmark_lz4_decode()?);
     
     Ok(results)
 }
@@ -112,6 +114,43 @@ fn benchmark_batch_processing() -> PixieResult<BenchmarkResult> {
     })
 }
 
+/// Client-side decode of cached assets: LZ4 blocks of text, mesh and pixel data, each
+/// decoded LZ4_DECODE_ROUNDS times.
+fn benchmark_lz4_decode() -> PixieResult<BenchmarkResult> {
+    const LZ4_DECODE_ROUNDS: usize = 8;
+    let samples = [generate_test_text_1mb(), generate_test_vertices_1mb(), generate_test_pixels_1mb()];
+    let blocks: Vec<Vec<u8>> = samples
+        .iter()
+        .map(|sample| lz4_compress_block(sample, sample.len() + sample.len() / 255 + 16))
+        .collect::<Option<_>>()
+        .ok_or_else(|| PixieError::ProcessingError("LZ4 benchmark compression failed".to_string()))?;
+    let mut output = Vec::new();
+    
+    let start_time = get_current_time_ms();
+    for _ in 0..LZ4_DECODE_ROUNDS {
+        for (sample, block) in samples.iter().zip(&blocks) {
+            output.resize(sample.len(), 0);
+            if lz4_decompress_block(block, &mut output) != Some(sample.len()) {
+                return Err(PixieError::ProcessingError("LZ4 benchmark decode failed".to_string()));
+            }
+        }
+    }
+    let elapsed_ms = get_current_time_ms() - start_time;
+    let stats = get_performance_stats();
+    
+    let target_ms = 50.0;
+    let passed = elapsed_ms <= target_ms;
+    
+    Ok(BenchmarkResult {
+        test_name: "LZ4 Decode (text, mesh, pixels)".to_string(),
+        elapsed_ms,
+        data_size_mb: (LZ4_DECODE_ROUNDS * samples.iter().map(Vec::len).sum::<usize>()) as f64 / 1_048_576.0,
+        target_ms,
+        passed,
+        memory_peak_mb: stats.memory_peak_mb,
+    })
+}
+
 fn generate_test_image_1mb() -> Vec<u8> {
     let mut data = Vec::with_capacity(1_048_576);
     
@@ -148,6 +187,46 @@ fn generate_test_mesh_100k() -> Vec<u8> {
     data
 }
 
+fn generate_test_text_1mb() -> Vec<u8> {
+    let mut data = Vec::with_capacity(1_048_576);
+    let mut index = 0u32;
+    
+    while data.len() < 1_048_576 {
+        data.extend_from_slice(format!("v {}.{:03} {}.{:03} -{}.5\n", index % 97, index % 1000, index % 13, index * 7 % 1000, index % 5).as_bytes());
+        index += 1;
+    }
+    data.truncate(1_048_576);
+    
+    data
+}
+
+fn generate_test_vertices_1mb() -> Vec<u8> {
+    let mut data = Vec::with_capacity(1_048_576);
+    
+    for i in 0..1_048_576 / 12 {
+        let position = [(i % 256) as f32 * 0.01, (i / 256 % 256) as f32 * 0.01, (i * 7 % 16) as f32 * 0.125];
+        for component in position {
+            data.extend_from_slice(&component.to_le_bytes());
+        }
+    }
+    data.resize(1_048_576, 0);
+    
+    data
+}
+
+fn generate_test_pixels_1mb() -> Vec<u8> {
+    let mut data = Vec::with_capacity(1_048_576);
+    
+    for y in 0..512usize {
+        for x in 0..512usize {
+            let checker = if (x / 32 + y / 32) % 2 == 0 { 200 } else { 40 };
+            data.extend_from_slice(&[(x / 2) as u8, (y / 2) as u8, checker, 255]);
+        }
+    }
+    
+    data
+}
+
 fn get_current_time_ms() -> f64 {
     #[cfg(target_arch = "wasm32")]
     {
@@ -0,0 +1,339 @@
+//! Seekable container of independently compressed blocks
+
+extern crate alloc;
+use alloc::format;
+use alloc::string::ToString;
+use alloc::vec;
+use alloc::vec::Vec;
+
+#[cfg(feature = "threads")]
+use rayon::prelude::*;
+
+use crate::c_hotspots::compression::{lz4_compress_block, lz4_compress_block_hc, lz4_decompress_block, LZ4HC_DEFAULT_LEVEL};
+use crate::types::{PixieError, PixieResult};
+
+// Layout, integers little-endian:
+//   "PXBK" | version u8 | method u8 | reserved u16 | block_size u32 | content_size u64 | block_count u32
+//   block_count x u32 payload length, high bit set when the block is stored raw
+//   payloads, back to back
+// Every block but the last holds exactly block_size bytes, so block i covers content
+// from i * block_size and its payload starts after the lengths listed before it.
+const MAGIC: &[u8; 4] = b"PXBK";
+const VERSION: u8 = 1;
+const HEADER_LEN: usize = 24;
+const STORED_FLAG: u32 = 0x8000_0000;
+const DEFLATE_LEVEL: u32 = 6;
+/// Most output a deflate payload byte can expand to; LZ4 stays well below it.
+const MAX_EXPANSION: usize = 1032;
+
+pub const DEFAULT_BLOCK_SIZE: usize = 256 * 1024;
+pub const MIN_BLOCK_SIZE: usize = 4 * 1024;
+pub const MAX_BLOCK_SIZE: usize = 64 * 1024 * 1024;
+
+/// Per-block codec. Ids match `CompressionMethod` in compress.h.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum BlockMethod {
+    /// LZ4 blocks, through the C kernel when hotspots are built.
+    Lz4 = 1,
+    /// Raw deflate blocks from the Rust backend: slower, smaller.
+    Deflate = 3,
+    /// LZ4 blocks from the high-compression encoder, for offline builds: much slower
+    /// to write, just as fast to read.
+    Lz4Hc = 5,
+}
+
+impl BlockMethod {
+    fn from_id(id: u8) -> Option<Self> {
+        match id {
+            1 => Some(Self::Lz4),
+            3 => Some(Self::Deflate),
+            5 => Some(Self::Lz4Hc),
+            _ => None,
+        }
+    }
+}
+
+/// Splits `data` into `block_size` blocks, compresses them on the rayon pool when it
+/// is available and writes them behind a block index. A block that does not shrink
+/// is stored as is, so the container never grows by more than the index.
+pub fn compress(data: &[u8], method: BlockMethod, block_size: usize) -> PixieResult<Vec<u8>> {
+    if !(MIN_BLOCK_SIZE..=MAX_BLOCK_SIZE).contains(&block_size) {
+        return Err(PixieError::InvalidInput(format!(
+            "Block size {} outside {}..={}", block_size, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE
+        )));
+    }
+    let blocks: Vec<&[u8]> = data.chunks(block_size).collect();
+    if blocks.len() > u32::MAX as usize {
+        return Err(PixieError::InvalidInput("Too many blocks for the container index".to_string()));
+    }
+
+    let payloads = map_blocks(&blocks, |block| encode_block(block, method));
+
+    let payload_len: usize = blocks
+        .iter()
+        .zip(&payloads)
+        .map(|(block, payload)| payload.as_ref().map_or(block.len(), Vec::len))
+        .sum();
+    let mut output = Vec::with_capacity(HEADER_LEN + blocks.len() * 4 + payload_len);
+    output.extend_from_slice(MAGIC);
+    output.push(VERSION);
+    output.push(method as u8);
+    output.extend_from_slice(&0u16.to_le_bytes());
+    output.extend_from_slice(&(block_size as u32).to_le_bytes());
+    output.extend_from_slice(&(data.len() as u64).to_le_bytes());
+    output.extend_from_slice(&(blocks.len() as u32).to_le_bytes());
+    for (block, payload) in blocks.iter().zip(&payloads) {
+        let field = match payload {
+            Some(payload) => payload.len() as u32,
+            None => block.len() as u32 | STORED_FLAG,
+        };
+        output.extend_from_slice(&field.to_le_bytes());
+    }
+    for (block, payload) in blocks.iter().zip(&payloads) {
+        output.extend_from_slice(payload.as_deref().unwrap_or(block));
+    }
+    Ok(output)
+}
+
+/// Decodes a whole container, block by block on the rayon pool when it is available.
+pub fn decompress(container: &[u8]) -> PixieResult<Vec<u8>> {
+    let parsed = BlockContainer::parse(container)?;
+    let mut output = vec![0u8; parsed.content_size];
+
+    #[cfg(feature = "threads")]
+    {
+        if parsed.block_count() > 1 && crate::threads_available() {
+            output
+                .par_chunks_mut(parsed.block_size)
+                .enumerate()
+                .try_for_each(|(index, chunk)| parsed.decode_block_into(index, chunk))?;
+            return Ok(output);
+        }
+    }
+
+    for (index, chunk) in output.chunks_mut(parsed.block_size).enumerate() {
+        parsed.decode_block_into(index, chunk)?;
+    }
+    Ok(output)
+}
+
+/// A validated container. Single blocks or byte ranges decode without touching the
+/// rest of the payload.
+pub struct BlockContainer<'a> {
+    method: BlockMethod,
+    block_size: usize,
+    content_size: usize,
+    fields: Vec<u32>,
+    // Payload start of every block, plus the end of the last one.
+    offsets: Vec<usize>,
+    payload: &'a [u8],
+}
+
+impl<'a> BlockContainer<'a> {
+    pub fn parse(container: &'a [u8]) -> PixieResult<Self> {
+        let invalid = |reason: &str| PixieError::InvalidInput(format!("Invalid block container: {}", reason));
+
+        if container.len() < HEADER_LEN || &container[0..4] != MAGIC {
+            return Err(invalid("missing header"));
+        }
+        if container[4] != VERSION {
+            return Err(invalid("unsupported version"));
+        }
+        let method = BlockMethod::from_id(container[5]).ok_or_else(|| invalid("unknown method"))?;
+        let block_size = u32::from_le_bytes(container[8..12].try_into().unwrap()) as usize;
+        let content_size = u64::from_le_bytes(container[12..20].try_into().unwrap());
+        let block_count = u32::from_le_bytes(container[20..24].try_into().unwrap()) as usize;
+        if !(MIN_BLOCK_SIZE..=MAX_BLOCK_SIZE).contains(&block_size) {
+            return Err(invalid("bad block size"));
+        }
+        let content_size = usize::try_from(content_size).map_err(|_| invalid("content too large"))?;
+        if content_size.div_ceil(block_size) != block_count {
+            return Err(invalid("block count does not match content size"));
+        }
+        let index_end = block_count
+            .checked_mul(4)
+            .and_then(|len| len.checked_add(HEADER_LEN))
+            .filter(|&end| end <= container.len())
+            .ok_or_else(|| invalid("truncated index"))?;
+
+        let fields: Vec<u32> = container[HEADER_LEN..index_end]
+            .chunks_exact(4)
+            .map(|field| u32::from_le_bytes(field.try_into().unwrap()))
+            .collect();
+        let mut offsets = Vec::with_capacity(block_count + 1);
+        let mut offset = 0usize;
+        offsets.push(offset);
+        for (index, &field) in fields.iter().enumerate() {
+            let length = (field & !STORED_FLAG) as usize;
+            let block_len = block_size.min(content_size - index * block_size);
+            if (field & STORED_FLAG != 0 && length != block_len) || length == 0 {
+                return Err(invalid("bad block length"));
+            }
+            offset = offset.checked_add(length).ok_or_else(|| invalid("bad block length"))?;
+            offsets.push(offset);
+        }
+
+        let payload = &container[index_end..];
+        if offset != payload.len() {
+            return Err(invalid("payload size does not match index"));
+        }
+        if content_size > payload.len().saturating_mul(MAX_EXPANSION) {
+            return Err(invalid("content size exceeds what the payload can hold"));
+        }
+        Ok(Self { method, block_size, content_size, fields, offsets, payload })
+    }
+
+    pub fn method(&self) -> BlockMethod {
+        self.method
+    }
+
+    pub fn block_size(&self) -> usize {
+        self.block_size
+    }
+
+    pub fn block_count(&self) -> usize {
+        self.fields.len()
+    }
+
+    pub fn content_size(&self) -> usize {
+        self.content_size
+    }
+
+    pub fn decode_block(&self, index: usize) -> PixieResult<Vec<u8>> {
+        if index >= self.block_count() {
+            return Err(PixieError::InvalidInput(format!("Block {} out of range", index)));
+        }
+        let start = index * self.block_size;
+        let mut output = vec![0u8; self.block_size.min(self.content_size - start)];
+        self.decode_block_into(index, &mut output)?;
+        Ok(output)
+    }
+
+    /// Content bytes `start..start + len`, decoding only the blocks they overlap.
+    pub fn read_range(&self, start: usize, len: usize) -> PixieResult<Vec<u8>> {
+        let end = start
+            .checked_add(len)
+            .filter(|&end| end <= self.content_size)
+            .ok_or_else(|| PixieError::InvalidInput("Range outside the container content".to_string()))?;
+        let mut output = Vec::with_capacity(len);
+        if len == 0 {
+            return Ok(output);
+        }
+        for index in start / self.block_size..=(end - 1) / self.block_size {
+            let block = self.decode_block(index)?;
+            let block_start = index * self.block_size;
+            let from = start.max(block_start) - block_start;
+            let to = end.min(block_start + block.len()) - block_start;
+            output.extend_from_slice(&block[from..to]);
+        }
+        Ok(output)
+    }
+
+    fn decode_block_into(&self, index: usize, output: &mut [u8]) -> PixieResult<()> {
+        let field = self.fields[index];
+        let payload = &self.payload[self.offsets[index]..self.offsets[index + 1]];
+        if field & STORED_FLAG != 0 {
+            output.copy_from_slice(payload);
+            return Ok(());
+        }
+        let decoded = match self.method {
+            BlockMethod::Lz4 | BlockMethod::Lz4Hc => lz4_decompress_block(payload, output) == Some(output.len()),
+            BlockMethod::Deflate => inflate_block(payload, output),
+        };
+        if decoded {
+            Ok(())
+        } else {
+            Err(PixieError::ProcessingError(format!("Block {} is corrupt", index)))
+        }
+    }
+}
+
+/// Compressed payload, or `None` when the block should be stored.
+fn encode_block(block: &[u8], method: BlockMethod) -> Option<Vec<u8>> {
+    let payload = match method {
+        BlockMethod::Lz4 => lz4_compress_block(block, block.len().saturating_sub(1))?,
+        BlockMethod::Deflate => deflate_block(block)?,
+        BlockMethod::Lz4Hc => lz4_compress_block_hc(block, block.len().saturating_sub(1), LZ4HC_DEFAULT_LEVEL)?,
+    };
+    (!payload.is_empty() && payload.len() < block.len()).then_some(payload)
+}
+
+fn deflate_block(block: &[u8]) -> Option<Vec<u8>> {
+    use flate2::{Compress, Compression, FlushCompress, Status};
+
+    let mut encoder = Compress::new(Compression::new(DEFLATE_LEVEL), false);
+    // Only as much room as the block itself: anything that does not fit is stored.
+    let mut output = Vec::with_capacity(block.len());
+    match encoder.compress_vec(block, &mut output, FlushCompress::Finish) {
+        Ok(Status::StreamEnd) => Some(output),
+        _ => None,
+    }
+}
+
+fn inflate_block(payload: &[u8], output: &mut [u8]) -> bool {
+    use flate2::{Decompress, FlushDecompress, Status};
+
+    let mut decoder = Decompress::new(false);
+    matches!(decoder.decompress(payload, output, FlushDecompress::Finish), Ok(Status::StreamEnd))
+        && decoder.total_in() as usize == payload.len()
+        && decoder.total_out() as usize == output.len()
+}
+
+fn map_blocks<R, F>(blocks: &[&[u8]], encode: F) -> Vec<R>
+where
+    R: Send,
+    F: Fn(&[u8]) -> R + Sync + Send,
+{
+    #[cfg(feature = "threads")]
+    {
+        if blocks.len() > 1 && crate::threads_available() {
+            return blocks.par_iter().map(|block| encode(block)).collect();
+        }
+    }
+    blocks.iter().map(|block| encode(block)).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample(len: usize) -> Vec<u8> {
+        (0..len).map(|i| ((i / 7) % 251) as u8).collect()
+    }
+
+    #[test]
+    fn test_round_trip_and_range_reads() {
+        let data = sample(3 * MIN_BLOCK_SIZE + 123);
+        for method in [BlockMethod::Lz4, BlockMethod::Deflate, BlockMethod::Lz4Hc] {
+            let container = compress(&data, method, MIN_BLOCK_SIZE).unwrap();
+            assert!(container.len() < data.len());
+            assert_eq!(decompress(&container).unwrap(), data);
+
+            let parsed = BlockContainer::parse(&container).unwrap();
+            assert_eq!(parsed.block_count(), 4);
+            let start = MIN_BLOCK_SIZE - 10;
+            assert_eq!(parsed.read_range(start, 2 * MIN_BLOCK_SIZE).unwrap(), &data[start..start + 2 * MIN_BLOCK_SIZE]);
+        }
+    }
+
+    #[test]
+    fn test_incompressible_and_empty_input() {
+        let mut state = 0x2545_F491u32;
+        let noise: Vec<u8> = (0..MIN_BLOCK_SIZE + 1)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                state as u8
+            })
+            .collect();
+        let container = compress(&noise, BlockMethod::Lz4, MIN_BLOCK_SIZE).unwrap();
+        assert_eq!(container.len(), HEADER_LEN + 2 * 4 + noise.len());
+        assert_eq!(decompress(&container).unwrap(), noise);
+
+        let empty = compress(&[], BlockMethod::Deflate, DEFAULT_BLOCK_SIZE).unwrap();
+        assert_eq!(empty.len(), HEADER_LEN);
+        assert!(decompress(&empty).unwrap().is_empty());
+    }
+}
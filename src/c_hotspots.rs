@@ -73,6 +73,16 @@ extern "C" {
     fn optimize_tiff_colorspace_simd(rgba_data: *mut u8, width: usize, height: usize, 
                                     target_bits_per_channel: u8);
     fn free_tiff_result(result: *mut TIFFProcessResult);
+    fn tiff_rows_per_strip(width: usize, channels: usize) -> usize;
+    fn tiff_strip_bound(width: usize, rows: usize, channels: usize, compression: i32) -> usize;
+    fn tiff_strip_state_size(width: usize, rows: usize, channels: usize, compression: i32) -> usize;
+    fn tiff_encode_strip(state: *mut core::ffi::c_void, pixels: *const u8, width: usize, rows: usize,
+                         channels: usize, compression: i32, predictor: i32, level: i32,
+                         output: *mut u8, output_capacity: usize) -> usize;
+    fn tiff_directory_size(strip_count: usize, channels: usize) -> usize;
+    fn tiff_write_directory(output: *mut u8, output_capacity: usize, strip_sizes: *const u32, strip_count: usize,
+                            width: u32, height: u32, channels: usize, compression: i32, predictor: i32,
+                            rows_per_strip: u32) -> usize;
     
     fn batch_process_pixels_simd(rgba_data: *mut u8, pixel_count: usize, operation_type: u8);
     fn parallel_color_conversion_simd(src_data: *const u8, dst_data: *mut u8, pixel_count: usize,
@@ -82,9 +92,6 @@ extern "C" {
     fn fast_downscale_simd(src_data: *const u8, dst_data: *mut u8,
                           src_width: usize, src_height: usize,
                           dst_width: usize, dst_height: usize);
-    fn multi_threaded_compression_simd(rgba_data: *const u8, width: usize, height: usize,
-                                      compressed_data: *mut u8, compressed_size: *mut usize,
-                                      quality: u8);
     
     fn color_distance_perceptual(r1: u8, g1: u8, b1: u8, r2: u8, g2: u8, b2: u8) -> f32;
     fn rgb_to_linear_batch(rgb: *const u8, linear: *mut f32, count: u32);
@@ -92,11 +99,61 @@ extern "C" {
     fn rgb_to_linear_batch_simd(rgb: *const u8, linear: *mut f32, count: u32);
     fn color_distance_batch_min(palette: *const u8, palette_size: u32, r: u8, g: u8, b: u8) -> f32;
     fn find_closest_color(palette: *const u8, palette_size: u32, r: u8, g: u8, b: u8) -> u32;
+    fn dither_floyd_steinberg_ex(image: *mut u8, width: i32, height: i32, channels: i32,
+                                 palette: *const Color32, palette_size: usize, serpentine: i32, error_clamp: i32);
+    fn palette_search_state_size() -> usize;
+    fn palette_search_init(state: *mut core::ffi::c_void, palette: *const u8, palette_size: usize,
+                           channels: usize, metric: i32) -> *mut core::ffi::c_void;
+    fn palette_search_map(search: *mut core::ffi::c_void, pixels: *const u8, pixel_count: usize,
+                          channels: usize, indices: *mut u8);
 
     fn rgb_to_yuv(rgb: *const u8, yuv: *mut u8, pixel_count: usize);
     fn yuv_to_rgb(yuv: *const u8, rgb: *mut u8, pixel_count: usize);
     fn rgba_yuv_roundtrip_inplace(rgba: *mut u8, pixel_count: usize);
     fn quantize_rgb_bitshift(rgb_in: *const u8, rgb_out: *mut u8, pixel_count: usize, bit_shift: u8);
+    fn deflate_compress_bound(input_size: usize) -> usize;
+    fn deflate_compress_state_size(window_bits: i32, mem_level: i32) -> usize;
+    fn deflate_compress_ext_state(state: *mut core::ffi::c_void, input: *const u8, input_size: usize,
+                                  output: *mut u8, output_capacity: usize,
+                                  compression_level: i32, window_bits: i32, mem_level: i32) -> usize;
+    fn png_compress_scanlines_ext_state(state: *mut core::ffi::c_void, filtered_rows: *const u8, row_bytes: usize,
+                                        height: usize, compressed_output: *mut u8, output_capacity: usize,
+                                        compression_level: i32) -> usize;
+    fn zstd_compress_bound(input_size: usize) -> usize;
+    fn zstd_compress_advanced(input: *const u8, input_size: usize, output: *mut u8, output_capacity: usize,
+                              compression_level: i32, window_log: i32, hash_log: i32, chain_log: i32) -> usize;
+    fn zstd_compress_using_dict(input: *const u8, input_size: usize, dict: *const u8, dict_size: usize,
+                                output: *mut u8, output_capacity: usize, compression_level: i32) -> usize;
+    fn zstd_decompress_using_dict(input: *const u8, input_size: usize, dict: *const u8, dict_size: usize,
+                                  output: *mut u8, output_capacity: usize) -> usize;
+    fn zstd_get_frame_content_size(input: *const u8, input_size: usize) -> u64;
+    fn lz4_compress_bound(input_size: usize) -> usize;
+    fn lz4_compress_hc_state_size() -> usize;
+    fn lz4_compress_hc_ext_state(state: *mut core::ffi::c_void, input: *const u8, input_size: usize,
+                                 output: *mut u8, output_capacity: usize, compression_level: i32) -> usize;
+    fn lz4_frame_compress_bound(input_size: usize, block_size_id: i32) -> usize;
+    fn lz4_frame_compress(input: *const u8, input_size: usize, output: *mut u8, output_capacity: usize,
+                          block_size_id: i32) -> usize;
+    fn lz4_frame_decompress(input: *const u8, input_size: usize, output: *mut u8, output_capacity: usize) -> usize;
+    fn lz4_frame_content_size(input: *const u8, input_size: usize) -> u64;
+    fn train_dictionary(compressor: *mut DictionaryCompressor, training_data: *const u8, data_size: usize) -> usize;
+    fn load_dictionary(compressor: *mut DictionaryCompressor, data: *const u8, data_size: usize) -> i32;
+    fn serialize_dictionary(compressor: *const DictionaryCompressor, output: *mut u8, output_capacity: usize) -> usize;
+    fn builtin_dictionary(kind: i32, size: *mut usize) -> *const u8;
+    fn dictionary_compress_bound(input_size: usize) -> usize;
+    fn dictionary_compress(compressor: *const DictionaryCompressor, input: *const u8, input_size: usize,
+                           output: *mut u8, output_capacity: usize) -> usize;
+    fn dictionary_decompress(compressor: *const DictionaryCompressor, input: *const u8, input_size: usize,
+                             output: *mut u8, output_capacity: usize) -> usize;
+    fn dictionary_decompressed_size(input: *const u8, input_size: usize) -> usize;
+    fn png_filter_scanlines(pixels: *const u8, width: usize, height: usize, bytes_per_pixel: usize, filtered_out: *mut u8) -> i32;
+    fn analyze_image_rgba(rgba_data: *const u8, width: usize, height: usize, unique_cap: u32, out: *mut ImageAnalysis) -> i32;
+    fn hash_xxhash32(data: *const u8, len: usize, seed: u32) -> u64;
+    fn analyze_compression_potential(data: *const u8, size: usize, stats: *mut CompressionStats) -> i32;
+    fn tans_compress_bound(input_size: usize) -> usize;
+    fn compress_tans(input: *const u8, input_size: usize, output: *mut u8, output_capacity: usize) -> i32;
+    fn decompress_tans(input: *const u8, input_size: usize, output: *mut u8, output_size: usize) -> i32;
+    fn tans_decompressed_size(input: *const u8, input_size: usize) -> i32;
     fn palette_indices_to_rgba(
         indices: *const u8,
         index_count: usize,
@@ -117,6 +174,62 @@ extern "C" {
     fn normalize_text_whitespace_commas(data: *const u8, data_len: usize, output_size: *mut usize) -> *mut u8;
 
     fn hotspot_free(ptr: *mut core::ffi::c_void);
+
+    fn arena_mark() -> usize;
+    fn arena_release(mark: usize);
+    fn wasm_set_memory_limit(bytes: usize);
+    fn wasm_get_memory_limit() -> usize;
+    fn wasm_get_memory_reserved() -> usize;
+}
+
+// Metrics of palette_search_init (palette_search.h).
+#[cfg(c_hotspots_available)]
+const PALETTE_METRIC_RGBA: i32 = 0;
+#[cfg(c_hotspots_available)]
+const PALETTE_METRIC_PERCEPTUAL: i32 = 2;
+
+/// Scopes one hotspot call: whatever the kernel allocates on the C heap and does not
+/// free is dropped in O(1) when the guard goes out of scope. Copy results into Rust
+/// buffers before the guard is dropped.
+///
+/// With the `threads` feature the guard also holds the hotspot lock: the C heap and its
+/// arena stack are unsynchronised, so scoped calls from pool threads run one at a time.
+/// Scopes must not nest.
+#[cfg(c_hotspots_available)]
+pub struct ArenaScope {
+    mark: usize,
+}
+
+#[cfg(all(c_hotspots_available, feature = "threads"))]
+static HOTSPOT_LOCK: core::sync::atomic::AtomicBool = core::sync::atomic::AtomicBool::new(false);
+
+#[cfg(c_hotspots_available)]
+impl ArenaScope {
+    #[inline]
+    pub fn enter() -> Self {
+        #[cfg(feature = "threads")]
+        {
+            use core::sync::atomic::Ordering;
+            // Spin rather than park: blocking waits are not allowed on the browser main thread.
+            while HOTSPOT_LOCK
+                .compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed)
+                .is_err()
+            {
+                core::hint::spin_loop();
+            }
+        }
+        ArenaScope { mark: unsafe { arena_mark() } }
+    }
+}
+
+#[cfg(c_hotspots_available)]
+impl Drop for ArenaScope {
+    #[inline]
+    fn drop(&mut self) {
+        unsafe { arena_release(self.mark) };
+        #[cfg(feature = "threads")]
+        HOTSPOT_LOCK.store(false, core::sync::atomic::Ordering::Release);
+    }
 }
 
 #[repr(C)]
@@ -147,6 +260,58 @@ pub struct TIFFProcessResult {
     pub compression: u8,
 }
 
+/// Facts about an RGBA8 image that every codec's strategy selection draws on, gathered
+/// in one pass by `analyze_image_c_hotspot`. Mirrors `ImageAnalysis` in image_kernel.h.
+#[repr(C)]
+#[derive(Clone)]
+pub struct ImageAnalysis {
+    /// Per-channel histograms in R, G, B, A order.
+    pub histogram: [[u32; 256]; 4],
+    /// Exact up to the cap passed to the analysis, cap + 1 beyond it.
+    pub unique_colors: u32,
+    pub alpha_usage: u32,
+    pub is_grayscale: u32,
+    /// Fewest bits per channel (1, 2, 4 or 8) that hold every sample exactly.
+    pub bit_depth: u32,
+    /// Mean absolute luma step to the left and upper neighbours; ~0 for flat art,
+    /// tens for photographs, higher for noise.
+    pub edge_energy: f32,
+}
+
+impl ImageAnalysis {
+    pub const ALPHA_NONE: u32 = 0;
+    pub const ALPHA_BINARY: u32 = 1;
+    pub const ALPHA_FULL: u32 = 2;
+    /// Colour count cap that covers every PNG/GIF palette size.
+    pub const PALETTE_COLORS: u32 = 256;
+
+    /// What to assume when an image could not be analysed: translucent, colour,
+    /// too many colours for a palette, full depth.
+    pub fn conservative(unique_cap: u32) -> Self {
+        ImageAnalysis {
+            histogram: [[0; 256]; 4],
+            unique_colors: unique_cap.saturating_add(1),
+            alpha_usage: Self::ALPHA_FULL,
+            is_grayscale: 0,
+            bit_depth: 8,
+            edge_energy: 0.0,
+        }
+    }
+
+    pub fn has_alpha(&self) -> bool {
+        self.alpha_usage != Self::ALPHA_NONE
+    }
+
+    pub fn is_grayscale(&self) -> bool {
+        self.is_grayscale != 0
+    }
+
+    /// Whether the image can be stored losslessly with at most `max_colors` palette entries.
+    pub fn fits_palette(&self, max_colors: u32) -> bool {
+        self.unique_colors > 0 && self.unique_colors <= max_colors
+    }
+}
+
 #[cfg(c_hotspots_available)]
 #[repr(C)]
 #[derive(Debug)]
@@ -191,6 +356,7 @@ pub mod mesh_obj {
 
         #[cfg(c_hotspots_available)]
         {
+            let _arena = ArenaScope::enter();
             let result_ptr = unsafe { obj_parse_to_mesh(data.as_ptr(), data.len()) };
             if result_ptr.is_null() {
                 return Err(PixieError::CHotspotFailed(String::from("OBJ hotspot returned null")));
@@ -312,6 +478,7 @@ pub mod util {
     }
 
     pub fn normalize_text_whitespace_commas(data: &[u8]) -> Option<Vec<u8>> {
+        let _arena = ArenaScope::enter();
         let mut out_len: usize = 0;
         let ptr = unsafe { super::normalize_text_whitespace_commas(data.as_ptr(), data.len(), &mut out_len as *mut _) };
         if ptr.is_null() || out_len == 0 {
@@ -367,6 +534,20 @@ pub mod memory {
             );
         }
     }
+
+    /// Caps how far the C heap may grow; memory already reserved stays usable.
+    pub fn set_heap_limit(bytes: usize) {
+        unsafe { wasm_set_memory_limit(bytes) }
+    }
+
+    pub fn heap_limit() -> usize {
+        unsafe { wasm_get_memory_limit() }
+    }
+
+    /// Bytes of linear memory the C heap has reserved through memory.grow so far.
+    pub fn heap_reserved() -> usize {
+        unsafe { wasm_get_memory_reserved() }
+    }
 }
 
 #[cfg(not(c_hotspots_available))]
@@ -384,6 +565,16 @@ pub mod memory {
     pub fn simd_memset(dest: &mut [u8], value: u8) {
         dest.fill(value);
     }
+
+    pub fn set_heap_limit(_bytes: usize) {}
+
+    pub fn heap_limit() -> usize {
+        0
+    }
+
+    pub fn heap_reserved() -> usize {
+        0
+    }
 }
 
 #[cfg(c_hotspots_available)]
@@ -423,7 +614,9 @@ pub mod math {
     }
     
     pub fn simd_gaussian_blur(image: &mut [u8], width: i32, height: i32, channels: i32, sigma: f32) {
-        if width > 0 && height > 0 && channels > 0 && sigma > 0.0 {
+        if width > 0 && height > 0 && channels > 0 && sigma > 0.0
+            && image.len() >= width as usize * height as usize * channels as usize {
+            let _arena = ArenaScope::enter();
             unsafe {
                 gaussian_blur_simd(image.as_mut_ptr(), width, height, channels, sigma);
             }
@@ -528,6 +721,54 @@ pub mod math {
     }
 }
 
+/// Mirrors `CompressionStats` in compress.h.
+#[cfg(c_hotspots_available)]
+#[repr(C)]
+struct CompressionStats {
+    original_size: usize,
+    compressed_size: usize,
+    compression_ratio: f32,
+    entropy: f32,
+    unique_bytes: usize,
+    byte_frequencies: [u32; 256],
+    match_density: f32,
+    confidence: f32,
+    sampled_bytes: usize,
+}
+
+/// Predicted effect of general-purpose compression, from sampled blocks of the input.
+#[derive(Clone, Copy, Debug)]
+pub struct CompressionEstimate {
+    /// Expected compressed/original size.
+    pub ratio: f32,
+    /// 0..1; 1 when the samples covered the whole input or agreed closely.
+    pub confidence: f32,
+    /// Order-0 entropy of the samples in bits per byte.
+    pub entropy: f32,
+    /// Fraction of sampled bytes covered by repeats of 4 or more bytes.
+    pub match_density: f32,
+}
+
+/// Mirrors `DictionaryCompressor` in compress.h. The buffers belong to a
+/// `compression::Dictionary`; the C side only fills and reads them.
+#[cfg(c_hotspots_available)]
+#[repr(C)]
+struct DictionaryCompressor {
+    dictionary: *mut u8,
+    dictionary_size: usize,
+    hash_table: *mut u32,
+    hash_table_size: usize,
+    dictionary_capacity: usize,
+    dictionary_id: u32,
+}
+
+/// Dictionaries compiled into the C hotspots (DICTIONARY_BUILTIN_* in compress.h).
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum BuiltinDictionary {
+    Svg = 1,
+    GltfJson = 2,
+}
+
 #[cfg(c_hotspots_available)]
 pub mod compression {
     use super::*;
@@ -585,11 +826,428 @@ pub mod compression {
         use lz4_flex::decompress_size_prepended;
         decompress_size_prepended(input).map_err(|e| format!("LZ4 decompression error: {:?}", e))
     }
+    
+    /// Method id for high-compression LZ4 (METHOD_LZ4HC in compress.h). Its blocks are
+    /// plain LZ4, so only the encoder differs from METHOD_LZ4.
+    pub const METHOD_LZ4HC: u32 = 5;
+    /// HC levels run 1 ..= LZ4HC_MAX_LEVEL; from level 10 the parse is optimal rather than lazy.
+    pub const LZ4HC_DEFAULT_LEVEL: i32 = 9;
+    pub const LZ4HC_MAX_LEVEL: i32 = 12;
+    
+    /// As `lz4_compress` (size-prepended, read by `lz4_decompress`) but through the
+    /// hash-chain compressor: several times slower, meant for offline builds.
+    pub fn lz4_compress_hc(input: &[u8], level: i32) -> Result<Vec<u8>, String> {
+        if input.is_empty() {
+            return lz4_compress_rust_fallback(input);
+        }
+        let capacity = unsafe { lz4_compress_bound(input.len()) };
+        let block = lz4_compress_block_hc(input, capacity, level)
+            .ok_or_else(|| "LZ4 HC compression failed".to_string())?;
+        let mut output = Vec::with_capacity(4 + block.len());
+        output.extend_from_slice(&(input.len() as u32).to_le_bytes());
+        output.extend_from_slice(&block);
+        Ok(output)
+    }
+    
+    /// High-compression LZ4 block of `input`, or `None` when it does not fit in
+    /// `capacity` bytes. The hash chains live in a buffer owned here rather than in the
+    /// arena, so like `lz4_compress_block` this takes no `ArenaScope`.
+    pub fn lz4_compress_block_hc(input: &[u8], capacity: usize, level: i32) -> Option<Vec<u8>> {
+        if input.is_empty() {
+            return None;
+        }
+        let mut state = vec![0u64; unsafe { lz4_compress_hc_state_size() }.div_ceil(8)];
+        let mut output = vec![0u8; capacity];
+        let written = unsafe {
+            lz4_compress_hc_ext_state(state.as_mut_ptr() as *mut core::ffi::c_void, input.as_ptr(), input.len(),
+                                      output.as_mut_ptr(), capacity, level)
+        };
+        if written == 0 {
+            return None;
+        }
+        output.truncate(written);
+        Some(output)
+    }
+    
+    /// Highest deflate level: level 9 settings with much longer hash chains.
+    pub const DEFLATE_MAX_LEVEL: i32 = 10;
+    
+    /// Scratch for `deflate_zlib_with_state` and `png_compress_filtered_with_state`
+    /// (15-bit window, mem_level 8). One buffer serves any number of calls, so parallel
+    /// callers keep one per worker.
+    pub fn deflate_state() -> Vec<u64> {
+        vec![0u64; unsafe { deflate_compress_state_size(15, 8) }.div_ceil(8)]
+    }
+    
+    /// zlib-framed deflate at `level` (0 stored .. DEFLATE_MAX_LEVEL).
+    pub fn deflate_zlib(input: &[u8], level: i32) -> PixieResult<Vec<u8>> {
+        deflate_zlib_with_state(&mut deflate_state(), input, level)
+    }
+    
+    /// As `deflate_zlib` with scratch from `deflate_state`. The C side works only in
+    /// that buffer, so this takes no `ArenaScope`.
+    pub fn deflate_zlib_with_state(state: &mut [u64], input: &[u8], level: i32) -> PixieResult<Vec<u8>> {
+        let capacity = unsafe { deflate_compress_bound(input.len()) };
+        let mut output = vec![0u8; capacity];
+        let written = unsafe {
+            deflate_compress_ext_state(state.as_mut_ptr() as *mut core::ffi::c_void, input.as_ptr(), input.len(),
+                                       output.as_mut_ptr(), capacity, level, 15, 8)
+        };
+        if written == 0 {
+            return Err(PixieError::CHotspotFailed("deflate_compress failed".to_string()));
+        }
+        output.truncate(written);
+        Ok(output)
+    }
+    
+    /// zlib stream for an IDAT chunk from scanlines that are already filtered, each
+    /// `row_bytes` long including the leading filter-type byte.
+    pub fn png_compress_filtered(filtered_rows: &[u8], row_bytes: usize, height: usize, level: i32) -> PixieResult<Vec<u8>> {
+        png_compress_filtered_with_state(&mut deflate_state(), filtered_rows, row_bytes, height, level)
+    }
+    
+    /// As `png_compress_filtered` with scratch from `deflate_state`, without an `ArenaScope`.
+    pub fn png_compress_filtered_with_state(state: &mut [u64], filtered_rows: &[u8], row_bytes: usize,
+                                            height: usize, level: i32) -> PixieResult<Vec<u8>> {
+        if row_bytes < 2 || filtered_rows.len() != row_bytes * height {
+            return Err(PixieError::InvalidInput("Filtered PNG rows do not match dimensions".to_string()));
+        }
+        
+        let capacity = unsafe { deflate_compress_bound(filtered_rows.len()) };
+        let mut output = vec![0u8; capacity];
+        let written = unsafe {
+            png_compress_scanlines_ext_state(state.as_mut_ptr() as *mut core::ffi::c_void, filtered_rows.as_ptr(),
+                                             row_bytes, height, output.as_mut_ptr(), capacity, level)
+        };
+        if written == 0 {
+            return Err(PixieError::CHotspotFailed("png_compress_scanlines failed".to_string()));
+        }
+        output.truncate(written);
+        Ok(output)
+    }
+    
+    /// Level used when callers have no preference; levels run 1 (fastest) ..= ZSTD_MAX_LEVEL.
+    pub const ZSTD_DEFAULT_LEVEL: i32 = 3;
+    pub const ZSTD_MAX_LEVEL: i32 = 19;
+    /// Method id returned by `get_optimal_compression` for zstd (METHOD_ZSTD in compress.h).
+    pub const METHOD_ZSTD: u32 = 4;
+    
+    const ZSTD_CONTENTSIZE_UNKNOWN: u64 = u64::MAX;
+    const ZSTD_CONTENTSIZE_ERROR: u64 = u64::MAX - 1;
+    /// Cap on the decompression buffer, whatever the frame header claims.
+    const ZSTD_OUTPUT_LIMIT: usize = 256 * 1024 * 1024;
+    /// Most output one input byte can expand to: a 4-byte RLE block yields 128 KiB.
+    const ZSTD_MAX_EXPANSION: usize = 32 * 1024;
+    
+    /// Single zstd frame (with checksum) that any zstd decoder accepts.
+    pub fn zstd_compress(input: &[u8], level: i32) -> PixieResult<Vec<u8>> {
+        zstd_compress_with_dict(input, &[], level)
+    }
+    
+    /// As `zstd_compress`, priming the match finder with a raw content dictionary.
+    /// The same bytes must be passed to `zstd_decompress_with_dict`.
+    pub fn zstd_compress_with_dict(input: &[u8], dict: &[u8], level: i32) -> PixieResult<Vec<u8>> {
+        let _arena = ArenaScope::enter();
+        let capacity = unsafe { zstd_compress_bound(input.len()) };
+        let mut output = vec![0u8; capacity];
+        let written = unsafe {
+            if dict.is_empty() {
+                zstd_compress_advanced(input.as_ptr(), input.len(), output.as_mut_ptr(), capacity, level, 0, 0, 0)
+            } else {
+                zstd_compress_using_dict(input.as_ptr(), input.len(), dict.as_ptr(), dict.len(),
+                                         output.as_mut_ptr(), capacity, level)
+            }
+        };
+        if written == 0 {
+            return Err(PixieError::CHotspotFailed("zstd compression failed".to_string()));
+        }
+        output.truncate(written);
+        Ok(output)
+    }
+    
+    pub fn zstd_decompress(input: &[u8]) -> PixieResult<Vec<u8>> {
+        zstd_decompress_with_dict(input, &[])
+    }
+    
+    /// Decodes every frame in `input`. The first frame's recorded content size sizes the
+    /// output; when it is missing (streamed output) or short (concatenated frames) the
+    /// buffer grows and decoding is retried.
+    pub fn zstd_decompress_with_dict(input: &[u8], dict: &[u8]) -> PixieResult<Vec<u8>> {
+        let _arena = ArenaScope::enter();
+        let content_size = unsafe { zstd_get_frame_content_size(input.as_ptr(), input.len()) };
+        if content_size == ZSTD_CONTENTSIZE_ERROR {
+            return Err(PixieError::InvalidInput("Not a zstd frame".to_string()));
+        }
+        
+        let limit = input.len().saturating_mul(ZSTD_MAX_EXPANSION).min(ZSTD_OUTPUT_LIMIT);
+        let mut capacity = if content_size == ZSTD_CONTENTSIZE_UNKNOWN {
+            input.len().saturating_mul(4).max(64 * 1024).min(limit)
+        } else {
+            content_size.min(limit as u64) as usize
+        };
+        loop {
+            let mut output = vec![0u8; capacity];
+            let written = unsafe {
+                zstd_decompress_using_dict(input.as_ptr(), input.len(), dict.as_ptr(), dict.len(),
+                                           output.as_mut_ptr(), capacity)
+            };
+            if written > 0 || content_size == 0 {
+                output.truncate(written);
+                return Ok(output);
+            }
+            if capacity >= limit {
+                return Err(PixieError::CHotspotFailed("zstd decompression failed".to_string()));
+            }
+            capacity = capacity.saturating_mul(2).min(limit);
+        }
+    }
+    
+    /// Raw LZ4 block of `input`, or `None` when it does not fit in `capacity` bytes.
+    /// The C codec keeps its match table on the stack and never touches the arena, so
+    /// this takes no `ArenaScope` and independent blocks can run on several workers.
+    pub fn lz4_compress_block(input: &[u8], capacity: usize) -> Option<Vec<u8>> {
+        if input.is_empty() {
+            return None;
+        }
+        let mut output = vec![0u8; capacity];
+        let written = unsafe { compress_lz4(input.as_ptr(), input.len(), output.as_mut_ptr(), capacity) };
+        if written <= 0 {
+            return None;
+        }
+        output.truncate(written as usize);
+        Some(output)
+    }
+    
+    /// Decodes a raw LZ4 block into `output`, returning the decoded length. Stack-only
+    /// like `lz4_compress_block`.
+    pub fn lz4_decompress_block(input: &[u8], output: &mut [u8]) -> Option<usize> {
+        if input.is_empty() || output.is_empty() {
+            return None;
+        }
+        let written = unsafe { decompress_lz4(input.as_ptr(), input.len(), output.as_mut_ptr(), output.len()) };
+        (written > 0).then_some(written as usize)
+    }
+    
+    /// Method id returned by `get_optimal_compression` for the tANS coder (METHOD_TANS
+    /// in compress.h): skewed byte distributions with few repeats, such as mesh buffers.
+    pub const METHOD_TANS: u32 = 6;
+    
+    /// tANS-coded stream of `input` (stored when coding does not shrink it). The C coder
+    /// keeps its tables on the stack, so this takes no `ArenaScope`.
+    pub fn tans_compress(input: &[u8]) -> PixieResult<Vec<u8>> {
+        let capacity = unsafe { tans_compress_bound(input.len()) };
+        let mut output = vec![0u8; capacity];
+        let written = unsafe { compress_tans(input.as_ptr(), input.len(), output.as_mut_ptr(), capacity) };
+        if written < 0 {
+            return Err(PixieError::CHotspotFailed("compress_tans failed".to_string()));
+        }
+        output.truncate(written as usize);
+        Ok(output)
+    }
+    
+    pub fn tans_decompress(input: &[u8]) -> PixieResult<Vec<u8>> {
+        let size = unsafe { tans_decompressed_size(input.as_ptr(), input.len()) };
+        if size < 0 {
+            return Err(PixieError::InvalidInput("Not a tANS stream".to_string()));
+        }
+        let mut output = vec![0u8; size as usize];
+        let written = unsafe { decompress_tans(input.as_ptr(), input.len(), output.as_mut_ptr(), output.len()) };
+        if written != size {
+            return Err(PixieError::CHotspotFailed("decompress_tans failed".to_string()));
+        }
+        Ok(output)
+    }
+    
+    /// Method id returned by `get_optimal_compression` for LZ4 (METHOD_LZ4 in compress.h).
+    pub const METHOD_LZ4: u32 = 1;
+    /// LZ4 frame block size ids (LZ4F_BLOCK_* in compress.h): 64 KiB, 256 KiB, 1 MiB, 4 MiB.
+    pub const LZ4F_BLOCK_64KB: i32 = 4;
+    pub const LZ4F_BLOCK_256KB: i32 = 5;
+    pub const LZ4F_BLOCK_1MB: i32 = 6;
+    pub const LZ4F_BLOCK_4MB: i32 = 7;
+    
+    const LZ4F_CONTENTSIZE_UNKNOWN: u64 = u64::MAX;
+    const LZ4F_CONTENTSIZE_ERROR: u64 = u64::MAX - 1;
+    const LZ4F_ERROR: usize = usize::MAX;
+    /// An LZ4 sequence expands to at most 255 output bytes per input byte.
+    const LZ4F_MAX_EXPANSION: usize = 255;
+    
+    /// LZ4 frame of independent, checksummed blocks that the lz4 CLI can read. Input of
+    /// any size is encoded one block at a time, so there is no whole-input limit.
+    pub fn compress_lz4_frame(input: &[u8], block_size_id: i32) -> PixieResult<Vec<u8>> {
+        let _arena = ArenaScope::enter();
+        let capacity = unsafe { lz4_frame_compress_bound(input.len(), block_size_id) };
+        if capacity == 0 {
+            return Err(PixieError::InvalidInput(format!("Invalid LZ4 block size id {}", block_size_id)));
+        }
+        let mut output = vec![0u8; capacity];
+        let written = unsafe {
+            lz4_frame_compress(input.as_ptr(), input.len(), output.as_mut_ptr(), capacity, block_size_id)
+        };
+        if written == 0 {
+            return Err(PixieError::CHotspotFailed("LZ4 frame compression failed".to_string()));
+        }
+        output.truncate(written);
+        Ok(output)
+    }
+    
+    /// Decodes every LZ4 frame in `input`, verifying block and content checksums. Sized
+    /// like `zstd_decompress_with_dict`: from the recorded content size when present,
+    /// growing the buffer otherwise.
+    pub fn decompress_lz4_frame(input: &[u8]) -> PixieResult<Vec<u8>> {
+        let _arena = ArenaScope::enter();
+        let content_size = unsafe { lz4_frame_content_size(input.as_ptr(), input.len()) };
+        if content_size == LZ4F_CONTENTSIZE_ERROR {
+            return Err(PixieError::InvalidInput("Not an LZ4 frame".to_string()));
+        }
+        
+        let limit = input.len().saturating_mul(LZ4F_MAX_EXPANSION).min(ZSTD_OUTPUT_LIMIT);
+        let mut capacity = if content_size == LZ4F_CONTENTSIZE_UNKNOWN {
+            input.len().saturating_mul(4).max(64 * 1024).min(limit)
+        } else {
+            content_size.min(limit as u64) as usize
+        };
+        loop {
+            let mut output = vec![0u8; capacity];
+            let written = unsafe {
+                lz4_frame_decompress(input.as_ptr(), input.len(), output.as_mut_ptr(), capacity)
+            };
+            if written != LZ4F_ERROR {
+                output.truncate(written);
+                return Ok(output);
+            }
+            if capacity >= limit {
+                return Err(PixieError::CHotspotFailed("LZ4 frame decompression failed".to_string()));
+            }
+            capacity = capacity.saturating_mul(2).min(limit);
+        }
+    }
+    
+    /// Largest useful dictionary: LZ4 offsets reach back 64 KiB.
+    pub const DICTIONARY_MAX_SIZE: usize = 64 * 1024;
+    const DICTIONARY_HASH_SIZE: usize = 1 << 14;
+    const DICTIONARY_ERROR: usize = usize::MAX;
+    
+    /// Shared history for compressing many small, similar inputs. Streams name the
+    /// dictionary by id and decode only against the same content. The C codec works
+    /// on this struct's buffers and never allocates, so compress and decompress take
+    /// no `ArenaScope`.
+    pub struct Dictionary {
+        content: Vec<u8>,
+        table: Vec<u32>,
+        id: u32,
+    }
+    
+    impl Dictionary {
+        fn build(capacity: usize, fill: impl FnOnce(*mut DictionaryCompressor) -> bool) -> Option<Self> {
+            let mut content = vec![0u8; capacity];
+            let mut table = vec![0u32; DICTIONARY_HASH_SIZE];
+            let mut raw = DictionaryCompressor {
+                dictionary: content.as_mut_ptr(),
+                dictionary_size: 0,
+                hash_table: table.as_mut_ptr(),
+                hash_table_size: table.len(),
+                dictionary_capacity: capacity,
+                dictionary_id: 0,
+            };
+            if !fill(&mut raw) {
+                return None;
+            }
+            content.truncate(raw.dictionary_size);
+            Some(Dictionary { content, table, id: raw.dictionary_id })
+        }
+        
+        fn raw(&self) -> DictionaryCompressor {
+            DictionaryCompressor {
+                dictionary: self.content.as_ptr() as *mut u8,
+                dictionary_size: self.content.len(),
+                hash_table: self.table.as_ptr() as *mut u32,
+                hash_table_size: self.table.len(),
+                dictionary_capacity: self.content.len(),
+                dictionary_id: self.id,
+            }
+        }
+        
+        /// Picks up to `max_size` bytes of the substrings that recur most in `samples`,
+        /// a concatenation of representative inputs.
+        pub fn train(samples: &[u8], max_size: usize) -> PixieResult<Self> {
+            let _arena = ArenaScope::enter();
+            Self::build(max_size.min(DICTIONARY_MAX_SIZE), |raw| {
+                unsafe { train_dictionary(raw, samples.as_ptr(), samples.len()) > 0 }
+            })
+            .ok_or_else(|| PixieError::CHotspotFailed("Dictionary training failed".to_string()))
+        }
+        
+        /// Loads `to_bytes` output; any other bytes are used as raw content, keeping the
+        /// last `DICTIONARY_MAX_SIZE` of them.
+        pub fn from_bytes(bytes: &[u8]) -> PixieResult<Self> {
+            Self::build(bytes.len().min(DICTIONARY_MAX_SIZE), |raw| {
+                unsafe { load_dictionary(raw, bytes.as_ptr(), bytes.len()) == 0 }
+            })
+            .ok_or_else(|| PixieError::InvalidInput("Corrupt dictionary".to_string()))
+        }
+        
+        pub fn builtin(kind: BuiltinDictionary) -> PixieResult<Self> {
+            let mut size = 0usize;
+            let content = unsafe { builtin_dictionary(kind as i32, &mut size) };
+            if content.is_null() {
+                return Err(PixieError::CHotspotFailed("Unknown built-in dictionary".to_string()));
+            }
+            Self::from_bytes(unsafe { core::slice::from_raw_parts(content, size) })
+        }
+        
+        /// Serialized form: magic, id and content.
+        pub fn to_bytes(&self) -> Vec<u8> {
+            let mut output = vec![0u8; self.content.len() + 8];
+            let written = unsafe { serialize_dictionary(&self.raw(), output.as_mut_ptr(), output.len()) };
+            output.truncate(written);
+            output
+        }
+        
+        pub fn id(&self) -> u32 {
+            self.id
+        }
+        
+        pub fn len(&self) -> usize {
+            self.content.len()
+        }
+        
+        pub fn compress(&self, input: &[u8]) -> PixieResult<Vec<u8>> {
+            let capacity = unsafe { dictionary_compress_bound(input.len()) };
+            let mut output = vec![0u8; capacity];
+            let written = unsafe {
+                dictionary_compress(&self.raw(), input.as_ptr(), input.len(), output.as_mut_ptr(), capacity)
+            };
+            if written == 0 {
+                return Err(PixieError::CHotspotFailed("Dictionary compression failed".to_string()));
+            }
+            output.truncate(written);
+            Ok(output)
+        }
+        
+        pub fn decompress(&self, input: &[u8]) -> PixieResult<Vec<u8>> {
+            let size = unsafe { dictionary_decompressed_size(input.as_ptr(), input.len()) };
+            if size == DICTIONARY_ERROR || size > input.len().saturating_mul(LZ4F_MAX_EXPANSION) {
+                return Err(PixieError::InvalidInput("Not a dictionary-compressed stream".to_string()));
+            }
+            let mut output = vec![0u8; size];
+            let written = unsafe {
+                dictionary_decompress(&self.raw(), input.as_ptr(), input.len(), output.as_mut_ptr(), size)
+            };
+            if written != size {
+                return Err(PixieError::CHotspotFailed(
+                    "Dictionary decompression failed (wrong dictionary or corrupt data)".to_string(),
+                ));
+            }
+            Ok(output)
+        }
+    }
 }
 
 #[cfg(not(c_hotspots_available))]
 pub mod compression {
     use super::*;
+    use alloc::string::ToString;
     
     pub fn lz4_compress(input: &[u8]) -> Result<Vec<u8>, String> {
         use lz4_flex::compress_prepend_size;
@@ -600,31 +1258,156 @@ pub mod compression {
         use lz4_flex::decompress_size_prepended;
         decompress_size_prepended(input).map_err(|e| format!("LZ4 decompression error: {:?}", e))
     }
+    
+    pub fn lz4_compress_block(input: &[u8], capacity: usize) -> Option<Vec<u8>> {
+        if input.is_empty() {
+            return None;
+        }
+        let output = lz4_flex::block::compress(input);
+        (output.len() <= capacity).then_some(output)
+    }
+    
+    pub fn lz4_decompress_block(input: &[u8], output: &mut [u8]) -> Option<usize> {
+        lz4_flex::block::decompress_into(input, output).ok().filter(|&written| written > 0)
+    }
+    
+    pub const LZ4HC_DEFAULT_LEVEL: i32 = 9;
+    pub const LZ4HC_MAX_LEVEL: i32 = 12;
+    
+    /// lz4_flex has no high-compression mode; the fast encoder's output is what the C
+    /// one would decode to anyway.
+    pub fn lz4_compress_hc(input: &[u8], _level: i32) -> Result<Vec<u8>, String> {
+        lz4_compress(input)
+    }
+    
+    pub fn lz4_compress_block_hc(input: &[u8], capacity: usize, _level: i32) -> Option<Vec<u8>> {
+        lz4_compress_block(input, capacity)
+    }
+    
+    pub fn tans_compress(_input: &[u8]) -> PixieResult<Vec<u8>> {
+        Err(PixieError::FeatureNotEnabled("tANS coding needs the C hotspots".to_string()))
+    }
+    
+    pub fn tans_decompress(_input: &[u8]) -> PixieResult<Vec<u8>> {
+        Err(PixieError::FeatureNotEnabled("tANS coding needs the C hotspots".to_string()))
+    }
+    
+    pub const DICTIONARY_MAX_SIZE: usize = 64 * 1024;
+    const DICTIONARY_MAGIC: u32 = 0x4344_5850;
+    
+    /// Same stream and serialized formats as the C codec. Training keeps the tail of
+    /// the samples, and the built-in dictionaries are only compiled into the C hotspots.
+    pub struct Dictionary {
+        content: Vec<u8>,
+        id: u32,
+    }
+    
+    impl Dictionary {
+        fn with_content(content: &[u8]) -> Self {
+            let content = &content[content.len().saturating_sub(DICTIONARY_MAX_SIZE)..];
+            Dictionary { content: content.to_vec(), id: content_hash_c_hotspot(content, 0) }
+        }
+        
+        pub fn train(samples: &[u8], max_size: usize) -> PixieResult<Self> {
+            let max_size = max_size.min(DICTIONARY_MAX_SIZE);
+            Ok(Self::with_content(&samples[samples.len().saturating_sub(max_size)..]))
+        }
+        
+        pub fn from_bytes(bytes: &[u8]) -> PixieResult<Self> {
+            if bytes.len() >= 8 && u32::from_le_bytes([bytes[0], bytes[1], bytes[2], bytes[3]]) == DICTIONARY_MAGIC {
+                let dictionary = Self::with_content(&bytes[8..]);
+                if bytes.len() - 8 > DICTIONARY_MAX_SIZE
+                    || dictionary.id != u32::from_le_bytes([bytes[4], bytes[5], bytes[6], bytes[7]])
+                {
+                    return Err(PixieError::InvalidInput("Corrupt dictionary".to_string()));
+                }
+                return Ok(dictionary);
+            }
+            Ok(Self::with_content(bytes))
+        }
+        
+        pub fn builtin(_kind: BuiltinDictionary) -> PixieResult<Self> {
+            Err(PixieError::FeatureNotEnabled("Built-in dictionaries need the C hotspots".to_string()))
+        }
+        
+        pub fn to_bytes(&self) -> Vec<u8> {
+            let mut output = Vec::with_capacity(self.content.len() + 8);
+            output.extend_from_slice(&DICTIONARY_MAGIC.to_le_bytes());
+            output.extend_from_slice(&self.id.to_le_bytes());
+            output.extend_from_slice(&self.content);
+            output
+        }
+        
+        pub fn id(&self) -> u32 {
+            self.id
+        }
+        
+        pub fn len(&self) -> usize {
+            self.content.len()
+        }
+        
+        pub fn compress(&self, input: &[u8]) -> PixieResult<Vec<u8>> {
+            let mut output = self.id.to_le_bytes().to_vec();
+            let mut remaining = input.len();
+            loop {
+                let byte = (remaining & 0x7F) as u8;
+                remaining >>= 7;
+                output.push(if remaining > 0 { byte | 0x80 } else { byte });
+                if remaining == 0 {
+                    break;
+                }
+            }
+            output.extend_from_slice(&lz4_flex::block::compress_with_dict(input, &self.content));
+            Ok(output)
+        }
+        
+        pub fn decompress(&self, input: &[u8]) -> PixieResult<Vec<u8>> {
+            if input.len() < 5 || u32::from_le_bytes([input[0], input[1], input[2], input[3]]) != self.id {
+                return Err(PixieError::InvalidInput("Not a stream for this dictionary".to_string()));
+            }
+            let mut size = 0u64;
+            let mut pos = 4;
+            loop {
+                let byte = *input.get(pos).filter(|_| pos < 9)
+                    .ok_or_else(|| PixieError::InvalidInput("Truncated dictionary stream".to_string()))?;
+                size |= ((byte & 0x7F) as u64) << (7 * (pos - 4));
+                pos += 1;
+                if byte & 0x80 == 0 {
+                    break;
+                }
+            }
+            if size > (input.len() as u64).saturating_mul(255) {
+                return Err(PixieError::InvalidInput("Not a dictionary-compressed stream".to_string()));
+            }
+            let size = size as usize;
+            let output = lz4_flex::block::decompress_with_dict(&input[pos..], size, &self.content)
+                .map_err(|e| PixieError::ProcessingError(format!("Dictionary decompression error: {:?}", e)))?;
+            if output.len() != size {
+                return Err(PixieError::ProcessingError("Dictionary decompression size mismatch".to_string()));
+            }
+            Ok(output)
+        }
+    }
 }
 
 pub fn compress_data_c_hotspot(input: &[u8]) -> PixieResult<Vec<u8>> {
-    // CRITICAL: For WASM, always use Rust implementation to avoid C function call errors
-    #[cfg(target_arch = "wasm32")]
-    {
-        compress_data_rust_fallback(input)
-    }
-    #[cfg(not(target_arch = "wasm32"))]
+    #[cfg(c_hotspots_available)]
     {
-        #[cfg(c_hotspots_available)]
-        {
-            match compression::lz4_compress(input) {
-                Ok(compressed) => Ok(compressed),
-                Err(_) => {
-                    // Graceful fallback to pure Rust implementation
-                    compress_data_rust_fallback(input)
-                }
+        let method = unsafe { get_optimal_compression(input.as_ptr(), input.len()) };
+        let compressed = match method {
+            // Callers store this output as is, and only zstd and LZ4 frames identify
+            // themselves; zstd's FSE stages code what tANS would have.
+            compression::METHOD_ZSTD | compression::METHOD_TANS => {
+                compression::zstd_compress(input, compression::ZSTD_DEFAULT_LEVEL)
             }
-        }
-        #[cfg(not(c_hotspots_available))]
-        {
-            compress_data_rust_fallback(input)
+            compression::METHOD_LZ4 => compression::compress_lz4_frame(input, compression::LZ4F_BLOCK_256KB),
+            _ => Err(PixieError::CHotspotFailed("No C compressor for this method".to_string())),
+        };
+        if let Ok(compressed) = compressed {
+            return Ok(compressed);
         }
     }
+    compress_data_rust_fallback(input)
 }
 
 fn compress_data_rust_fallback(input: &[u8]) -> PixieResult<Vec<u8>> {
@@ -646,6 +1429,7 @@ pub mod image {
         #[cfg(c_hotspots_available)]
         {
             // Try C hotspot first
+            let _arena = ArenaScope::enter();
             unsafe {
                 let result = quantize_colors_octree(
                     rgba_data.as_ptr(),
@@ -685,6 +1469,7 @@ pub mod image {
     pub fn median_cut_quantization(rgba_data: &[u8], width: usize, height: usize, max_colors: usize) -> PixieResult<(Vec<Color32>, Vec<u8>)> {
         #[cfg(c_hotspots_available)]
         {
+            let _arena = ArenaScope::enter();
             unsafe {
                 let result = quantize_colors_median_cut(
                     rgba_data.as_ptr(),
@@ -719,11 +1504,12 @@ pub mod image {
     pub fn floyd_steinberg_dither(rgba_data: &mut [u8], width: usize, height: usize, palette: &[Color32]) {
         #[cfg(c_hotspots_available)]
         {
-            if width == 0 || height == 0 || palette.is_empty() {
+            if width == 0 || height == 0 || palette.is_empty() || palette.len() > 256 {
                 fallback::floyd_steinberg_rust(rgba_data, width, height, palette);
                 return;
             }
 
+            let _arena = ArenaScope::enter();
             unsafe {
                 dither_floyd_steinberg(
                     rgba_data.as_mut_ptr(),
@@ -741,9 +1527,39 @@ pub mod image {
         }
     }
     
+    /// Floyd-Steinberg with explicit scan options: `serpentine` alternates the direction
+    /// of odd rows, and `error_clamp` (in levels, 0 for none) bounds the error carried
+    /// into a pixel so colours the palette cannot reach do not smear across the image.
+    pub fn floyd_steinberg_dither_with(rgba_data: &mut [u8], width: usize, height: usize, palette: &[Color32],
+                                       serpentine: bool, error_clamp: u8) {
+        if width == 0 || height == 0 || palette.is_empty() || palette.len() > 256 || rgba_data.len() < width * height * 4 {
+            fallback::floyd_steinberg_rust(rgba_data, width, height, palette);
+            return;
+        }
+
+        let _arena = ArenaScope::enter();
+        unsafe {
+            dither_floyd_steinberg_ex(
+                rgba_data.as_mut_ptr(),
+                width as i32,
+                height as i32,
+                4,
+                palette.as_ptr(),
+                palette.len(),
+                serpentine as i32,
+                error_clamp as i32,
+            );
+        }
+    }
+    
     pub fn gaussian_blur(rgba_data: &mut [u8], width: usize, height: usize, sigma: f32) {
         #[cfg(c_hotspots_available)]
         {
+            if rgba_data.len() < width * height * 4 {
+                gaussian_blur_rust_fallback(rgba_data, width, height, sigma);
+                return;
+            }
+            let _arena = ArenaScope::enter();
             unsafe {
                 gaussian_blur_simd(
                     rgba_data.as_mut_ptr(),
@@ -840,6 +1656,30 @@ pub mod image {
         }
     }
 
+    /// Filters raw PNG scanlines, choosing the filter per row, and returns the stream
+    /// ready for a single deflate pass: each row is prefixed with its filter byte.
+    pub fn png_filter_scanlines_hotspot(
+        pixels: &[u8],
+        width: usize,
+        height: usize,
+        bytes_per_pixel: usize,
+    ) -> PixieResult<Vec<u8>> {
+        let stride = width * bytes_per_pixel;
+        if width == 0 || height == 0 || pixels.len() < stride * height {
+            return Err(PixieError::InvalidInput("PNG scanline buffer does not match dimensions".to_string()));
+        }
+
+        let mut filtered = vec![0u8; height * (stride + 1)];
+        let status = unsafe {
+            png_filter_scanlines(pixels.as_ptr(), width, height, bytes_per_pixel, filtered.as_mut_ptr())
+        };
+        if status == 0 {
+            Ok(filtered)
+        } else {
+            Err(PixieError::CHotspotFailed("PNG scanline filtering failed".to_string()))
+        }
+    }
+
     pub fn palette_indices_to_rgba_hotspot(
         indices: &[u8],
         palette: &[Color32],
@@ -880,6 +1720,24 @@ pub mod image {
         }
     }
     
+    /// Maps RGBA pixels to their nearest palette entry by squared RGBA distance, the
+    /// inverse of `palette_indices_to_rgba_hotspot`. The palette search is built once
+    /// for the whole buffer, so the cost per pixel stays flat as the palette grows.
+    pub fn rgba_to_palette_indices_hotspot(rgba: &[u8], palette: &[Color32], indices_out: &mut [u8]) {
+        let pixel_count = rgba.len() / 4;
+        if palette.is_empty() || palette.len() > 256 || indices_out.len() < pixel_count {
+            rgba_to_palette_indices_rust_fallback(rgba, palette, indices_out);
+            return;
+        }
+
+        let mut state = vec![0u64; unsafe { palette_search_state_size() }.div_ceil(8)];
+        unsafe {
+            let search = palette_search_init(state.as_mut_ptr() as *mut core::ffi::c_void,
+                                             palette.as_ptr() as *const u8, palette.len(), 4, PALETTE_METRIC_RGBA);
+            palette_search_map(search, rgba.as_ptr(), pixel_count, 4, indices_out.as_mut_ptr());
+        }
+    }
+    
     fn octree_quantization_rust_fallback(rgba_data: &[u8], width: usize, height: usize, max_colors: usize) -> PixieResult<(Vec<Color32>, Vec<u8>)> {
         #[cfg(feature = "color_quant")]
         {
@@ -1127,6 +1985,25 @@ pub mod image {
         }
     }
 
+    fn rgba_to_palette_indices_rust_fallback(rgba: &[u8], palette: &[Color32], indices_out: &mut [u8]) {
+        for (pixel, index) in rgba.chunks_exact(4).zip(indices_out.iter_mut()) {
+            let mut best = 0;
+            let mut best_distance = u32::MAX;
+            for (i, c) in palette.iter().enumerate() {
+                let dr = pixel[0] as i32 - c.r as i32;
+                let dg = pixel[1] as i32 - c.g as i32;
+                let db = pixel[2] as i32 - c.b as i32;
+                let da = pixel[3] as i32 - c.a as i32;
+                let distance = (dr * dr + dg * dg + db * db + da * da) as u32;
+                if distance < best_distance {
+                    best_distance = distance;
+                    best = i;
+                }
+            }
+            *index = best as u8;
+        }
+    }
+
     fn palette_indices_to_rgba_rust_fallback(indices: &[u8], palette: &[Color32], rgba_out: &mut [u8], default_color: Color32) {
         if rgba_out.len() < indices.len() * 4 {
             return;
@@ -1163,6 +2040,7 @@ pub mod mesh {
         let start_time = get_current_time_ms();
         let data_size = vertices.len() * 4 + indices.len() * 4;
         
+        let _arena = ArenaScope::enter();
         let result = unsafe {
             decimate_mesh_qem(
                 vertices.as_ptr(),
@@ -1214,6 +2092,7 @@ pub mod mesh {
         let start_time = get_current_time_ms();
         let data_size = vertices.len() * 4 + indices.len() * 4;
         
+        let _arena = ArenaScope::enter();
         let result = unsafe {
             weld_vertices_spatial(
                 vertices.as_ptr(),
@@ -1272,6 +2151,7 @@ pub mod mesh_attributes {
                 let start_time = crate::get_current_time_ms();
                 let data_size = vertices.len() * 4 + indices.len() * 4;
 
+                let _arena = ArenaScope::enter();
                 let mut result = unsafe {
                     compute_mesh_attributes(
                         vertices.as_ptr(),
@@ -1331,6 +2211,7 @@ pub mod mesh_attributes {
                 let start_time = crate::get_current_time_ms();
                 let data_size = vertices.len() * 4 + indices.len() * 4 + uvs.len() * 4;
 
+                let _arena = ArenaScope::enter();
                 let mut result = unsafe {
                     compute_mesh_attributes(
                         vertices.as_ptr(),
@@ -1452,6 +2333,7 @@ pub mod vertex_cache {
             let start_time = crate::get_current_time_ms();
             let data_size = indices.len() * 4;
 
+            let _arena = ArenaScope::enter();
             let mut result = unsafe {
                 optimize_vertex_cache_forsyth(
                     indices.as_ptr(),
@@ -1499,6 +2381,8 @@ pub fn svg_text_compress(data: &[u8]) -> PixieResult<Vec<u8>> {
         let mut output_data = vec![0u8; data.len()];
         let mut output_size = output_data.len();
         
+        let _arena = ArenaScope::enter();
+        
         let result = unsafe {
             svg_compress_text(
                 data.as_ptr(),
@@ -1585,6 +2469,8 @@ pub fn svg_optimize_paths_c(data: &[u8]) -> PixieResult<Vec<u8>> {
         let mut output_data = vec![0u8; data.len()];
         let mut output_size = output_data.len();
         
+        let _arena = ArenaScope::enter();
+        
         let result = unsafe {
             svg_optimize_paths(
                 data.as_ptr(),
@@ -1616,6 +2502,8 @@ pub fn ico_optimize_embedded_c(data: &[u8], quality: u8) -> PixieResult<Vec<u8>>
         let mut output_data = vec![0u8; data.len() * 2];
         let mut output_size = output_data.len();
         
+        let _arena = ArenaScope::enter();
+        
         let result = unsafe {
             ico_optimize_embedded(
                 data.as_ptr(),
@@ -1647,6 +2535,8 @@ pub fn ico_strip_metadata_c(data: &[u8]) -> PixieResult<Vec<u8>> {
         let mut output_data = vec![0u8; data.len()];
         let mut output_size = output_data.len();
         
+        let _arena = ArenaScope::enter();
+        
         let result = unsafe {
             ico_strip_metadata_simd(
                 data.as_ptr(),
@@ -1681,6 +2571,8 @@ pub fn ico_compress_directory_c(data: &[u8]) -> PixieResult<Vec<u8>> {
         let mut output_data = vec![0u8; data.len()];
         let mut output_size = output_data.len();
         
+        let _arena = ArenaScope::enter();
+        
         let result = unsafe {
             ico_compress_directory(
                 data.as_ptr(),
@@ -1706,50 +2598,282 @@ pub fn ico_compress_directory_c(data: &[u8]) -> PixieResult<Vec<u8>> {
     }
 }
 
-pub fn compress_tiff_lzw_c_hotspot(rgba_data: &[u8], width: usize, height: usize, quality: u8) -> PixieResult<Vec<u8>> {
+/// xxHash32 of `data`; the Rust fallback produces identical values.
+pub fn content_hash_c_hotspot(data: &[u8], seed: u32) -> u32 {
+    #[cfg(c_hotspots_available)]
+    {
+        // SAFETY: the kernel only reads `data.len()` bytes and allocates nothing.
+        unsafe { hash_xxhash32(data.as_ptr(), data.len(), seed) as u32 }
+    }
+    #[cfg(not(c_hotspots_available))]
+    {
+        content_hash_rust_fallback(data, seed)
+    }
+}
+
+/// Cheap compressibility estimate (a few 4 KiB samples) used to skip compression
+/// attempts that would not pay off. Without the C hotspots it reports no confidence.
+pub fn compression_potential_c_hotspot(data: &[u8]) -> CompressionEstimate {
+    #[cfg(c_hotspots_available)]
+    {
+        let mut stats = core::mem::MaybeUninit::<CompressionStats>::uninit();
+        // SAFETY: the kernel fills `stats`, reads `data.len()` bytes and allocates nothing.
+        if unsafe { analyze_compression_potential(data.as_ptr(), data.len(), stats.as_mut_ptr()) } == 0 {
+            let stats = unsafe { stats.assume_init() };
+            return CompressionEstimate {
+                ratio: stats.compression_ratio,
+                confidence: stats.confidence,
+                entropy: stats.entropy,
+                match_density: stats.match_density,
+            };
+        }
+    }
+    #[cfg(not(c_hotspots_available))]
+    let _ = data;
+    CompressionEstimate { ratio: 1.0, confidence: 0.0, entropy: 8.0, match_density: 0.0 }
+}
+
+#[cfg(not(c_hotspots_available))]
+fn content_hash_rust_fallback(data: &[u8], seed: u32) -> u32 {
+    const PRIME32_1: u32 = 2654435761;
+    const PRIME32_2: u32 = 2246822519;
+    const PRIME32_3: u32 = 3266489917;
+    const PRIME32_4: u32 = 668265263;
+    const PRIME32_5: u32 = 374761393;
+
+    let word = |bytes: &[u8]| u32::from_le_bytes([bytes[0], bytes[1], bytes[2], bytes[3]]);
+    let round = |acc: u32, lane: u32| acc.wrapping_add(lane.wrapping_mul(PRIME32_2)).rotate_left(13).wrapping_mul(PRIME32_1);
+
+    let mut rest = data;
+    let mut h32 = if data.len() >= 16 {
+        let mut v = [
+            seed.wrapping_add(PRIME32_1).wrapping_add(PRIME32_2),
+            seed.wrapping_add(PRIME32_2),
+            seed,
+            seed.wrapping_sub(PRIME32_1),
+        ];
+        while rest.len() >= 16 {
+            for (lane, acc) in v.iter_mut().enumerate() {
+                *acc = round(*acc, word(&rest[lane * 4..]));
+            }
+            rest = &rest[16..];
+        }
+        v[0].rotate_left(1)
+            .wrapping_add(v[1].rotate_left(7))
+            .wrapping_add(v[2].rotate_left(12))
+            .wrapping_add(v[3].rotate_left(18))
+    } else {
+        seed.wrapping_add(PRIME32_5)
+    };
+
+    h32 = h32.wrapping_add(data.len() as u32);
+    while rest.len() >= 4 {
+        h32 = h32.wrapping_add(word(rest).wrapping_mul(PRIME32_3)).rotate_left(17).wrapping_mul(PRIME32_4);
+        rest = &rest[4..];
+    }
+    for &byte in rest {
+        h32 = h32.wrapping_add((byte as u32).wrapping_mul(PRIME32_5)).rotate_left(11).wrapping_mul(PRIME32_1);
+    }
+
+    h32 ^= h32 >> 15;
+    h32 = h32.wrapping_mul(PRIME32_2);
+    h32 ^= h32 >> 13;
+    h32 = h32.wrapping_mul(PRIME32_3);
+    h32 ^ (h32 >> 16)
+}
+
+/// One pass over a tightly packed RGBA8 image: histograms, alpha usage, grayscale,
+/// unique colours (counted up to `unique_cap`), bit depth and edge energy.
+pub fn analyze_image_c_hotspot(rgba_data: &[u8], width: usize, height: usize, unique_cap: u32) -> PixieResult<ImageAnalysis> {
+    if width == 0 || height == 0 || rgba_data.len() < width * height * 4 {
+        return Err(PixieError::InvalidInput("RGBA buffer does not match dimensions".to_string()));
+    }
     
+    #[cfg(c_hotspots_available)]
+    {
+        let _arena = ArenaScope::enter();
+        let mut analysis = ImageAnalysis::conservative(unique_cap);
+        let status = unsafe {
+            analyze_image_rgba(rgba_data.as_ptr(), width, height, unique_cap, &mut analysis)
+        };
+        if status == 0 {
+            Ok(analysis)
+        } else {
+            Err(PixieError::CHotspotFailed("Image analysis failed".to_string()))
+        }
+    }
+    #[cfg(not(c_hotspots_available))]
+    {
+        Ok(image_analysis_rust_fallback(rgba_data, width, height, unique_cap))
+    }
+}
+
+#[cfg(not(c_hotspots_available))]
+fn image_analysis_rust_fallback(rgba_data: &[u8], width: usize, height: usize, unique_cap: u32) -> ImageAnalysis {
+    use alloc::collections::BTreeSet;
+    
+    let unique_cap = unique_cap.min(65536);
+    let mut analysis = ImageAnalysis::conservative(unique_cap);
+    let mut colors = BTreeSet::new();
+    let mut counting = unique_cap > 0;
+    let mut previous = None;
+    let mut grayscale = true;
+    let mut gradient = 0u64;
+    let mut luma = vec![0u8; width * 2];
+    
+    for (y, row) in rgba_data[..width * height * 4].chunks_exact(width * 4).enumerate() {
+        let (first, second) = luma.split_at_mut(width);
+        let (cur, prior) = if y & 1 == 0 { (first, &*second) } else { (second, &*first) };
+        
+        for (x, p) in row.chunks_exact(4).enumerate() {
+            for channel in 0..4 {
+                analysis.histogram[channel][p[channel] as usize] += 1;
+            }
+            grayscale &= p[0] == p[1] && p[1] == p[2];
+            cur[x] = ((p[0] as u32 + 2 * p[1] as u32 + p[2] as u32 + 2) >> 2) as u8;
+            
+            let color = u32::from_le_bytes([p[0], p[1], p[2], p[3]]);
+            if counting && previous != Some(color) {
+                colors.insert(color);
+                counting = colors.len() as u32 <= unique_cap;
+                previous = Some(color);
+            }
+        }
+        
+        gradient += cur.windows(2).map(|w| w[0].abs_diff(w[1]) as u64).sum::<u64>();
+        if y > 0 {
+            gradient += cur.iter().zip(prior.iter()).map(|(a, b)| a.abs_diff(*b) as u64).sum::<u64>();
+        }
+    }
+    
+    let alpha = &analysis.histogram[3];
+    analysis.alpha_usage = if alpha[1..255].iter().any(|&count| count > 0) {
+        ImageAnalysis::ALPHA_FULL
+    } else if alpha[0] > 0 {
+        ImageAnalysis::ALPHA_BINARY
+    } else {
+        ImageAnalysis::ALPHA_NONE
+    };
+    analysis.unique_colors = if unique_cap > 0 { colors.len() as u32 } else { 0 };
+    analysis.is_grayscale = grayscale as u32;
+    
+    let channels = if analysis.alpha_usage == ImageAnalysis::ALPHA_NONE { 3 } else { 4 };
+    analysis.bit_depth = [1u32, 2, 4]
+        .into_iter()
+        .find(|&depth| {
+            let step = 255 / ((1 << depth) - 1);
+            analysis.histogram[..channels].iter().all(|histogram| {
+                histogram.iter().enumerate().all(|(value, &count)| count == 0 || value as u32 % step == 0)
+            })
+        })
+        .unwrap_or(8);
+    analysis.edge_energy = (gradient as f64 / (width * height) as f64) as f32;
+    analysis
+}
+
+/// TIFF Compression tag values accepted by `encode_tiff_c_hotspot`.
+pub const TIFF_COMPRESSION_LZW: i32 = 5;
+pub const TIFF_COMPRESSION_ADOBE_DEFLATE: i32 = 8;
+const TIFF_PREDICTOR_HORIZONTAL: i32 = 2;
+
+/// Encodes 8-bit pixels with `channels` interleaved samples (gray, gray+alpha, RGB or
+/// RGBA) as a baseline TIFF: horizontal predictor, one strip per band of rows.
+/// `level` is the deflate level for Adobe Deflate and ignored for LZW. Strips are
+/// independent and the C encoder keeps its tables in buffers owned here, so they are
+/// encoded on the rayon pool when it is available and without an `ArenaScope`.
+pub fn encode_tiff_c_hotspot(pixels: &[u8], width: usize, height: usize, channels: usize,
+                             compression: i32, level: i32) -> PixieResult<Vec<u8>> {
+    if width == 0 || height == 0 || !(1..=4).contains(&channels) {
+        return Err(PixieError::InvalidInput(format!("Invalid TIFF geometry {}x{}x{}", width, height, channels)));
+    }
+    if width > u32::MAX as usize || height > u32::MAX as usize || pixels.len() < width * height * channels {
+        return Err(PixieError::InvalidInput(String::from("TIFF pixel buffer does not match its dimensions")));
+    }
+    if compression != TIFF_COMPRESSION_LZW && compression != TIFF_COMPRESSION_ADOBE_DEFLATE {
+        return Err(PixieError::InvalidInput(format!("Unsupported TIFF compression {}", compression)));
+    }
+
     #[cfg(c_hotspots_available)]
     {
         use crate::{get_current_time_ms, update_performance_stats};
         let start_time = get_current_time_ms();
-        let data_size = rgba_data.len();
-        
-        let result = unsafe {
-            compress_tiff_lzw_simd(
-                rgba_data.as_ptr(),
-                width,
-                height,
-                quality
-            )
+
+        let row_bytes = width * channels;
+        let rows_per_strip = unsafe { tiff_rows_per_strip(width, channels) };
+        let state_words = unsafe { tiff_strip_state_size(width, rows_per_strip, channels, compression) }.div_ceil(8);
+        let bands: Vec<&[u8]> = pixels[..row_bytes * height].chunks(row_bytes * rows_per_strip).collect();
+
+        let encode = |state: &mut Vec<u64>, band: &[u8]| -> Option<Vec<u8>> {
+            let rows = band.len() / row_bytes;
+            let capacity = unsafe { tiff_strip_bound(width, rows, channels, compression) };
+            let mut strip = vec![0u8; capacity];
+            let written = unsafe {
+                tiff_encode_strip(state.as_mut_ptr() as *mut core::ffi::c_void, band.as_ptr(), width, rows,
+                                  channels, compression, TIFF_PREDICTOR_HORIZONTAL, level,
+                                  strip.as_mut_ptr(), capacity)
+            };
+            if written == 0 || written > u32::MAX as usize {
+                return None;
+            }
+            strip.truncate(written);
+            Some(strip)
         };
-        
-        if !result.is_null() {
-            let tiff_result = unsafe { &*result };
-            if !tiff_result.data.is_null() && tiff_result.size > 0 {
-                let result_data = unsafe { 
-                    core::slice::from_raw_parts(tiff_result.data, tiff_result.size).to_vec()
-                };
-                
-                unsafe { free_tiff_result(result); }
-                
-                let elapsed = get_current_time_ms() - start_time;
-                update_performance_stats(true, elapsed, data_size);
-                
-                Ok(result_data)
-            } else {
-                unsafe { free_tiff_result(result); }
-                Err(PixieError::OptimizationFailed("TIFF LZW compression failed".to_string()))
+
+        let strips: Vec<Option<Vec<u8>>> = {
+            #[cfg(feature = "threads")]
+            {
+                use rayon::prelude::*;
+                if bands.len() > 1 && crate::threads_available() {
+                    bands.par_iter().map_init(|| vec![0u64; state_words], |state, band| encode(state, band)).collect()
+                } else {
+                    let mut state = vec![0u64; state_words];
+                    bands.iter().map(|band| encode(&mut state, band)).collect()
+                }
             }
-        } else {
-            Err(PixieError::OptimizationFailed("TIFF LZW compression returned null".to_string()))
+            #[cfg(not(feature = "threads"))]
+            {
+                let mut state = vec![0u64; state_words];
+                bands.iter().map(|band| encode(&mut state, band)).collect()
+            }
+        };
+        let strips: Vec<Vec<u8>> = strips.into_iter().collect::<Option<_>>()
+            .ok_or_else(|| PixieError::CHotspotFailed("TIFF strip encoding failed".to_string()))?;
+
+        let strip_sizes: Vec<u32> = strips.iter().map(|strip| strip.len() as u32).collect();
+        let data_size: usize = strips.iter().map(Vec::len).sum();
+        let capacity = 8 + data_size + unsafe { tiff_directory_size(strips.len(), channels) };
+        let mut output = vec![0u8; capacity];
+        let mut offset = 8;
+        for strip in &strips {
+            output[offset..offset + strip.len()].copy_from_slice(strip);
+            offset += strip.len();
+        }
+        let written = unsafe {
+            tiff_write_directory(output.as_mut_ptr(), capacity, strip_sizes.as_ptr(), strip_sizes.len(),
+                                 width as u32, height as u32, channels, compression,
+                                 TIFF_PREDICTOR_HORIZONTAL, rows_per_strip as u32)
+        };
+        if written == 0 {
+            return Err(PixieError::CHotspotFailed("TIFF exceeds 4 GiB of strip data".to_string()));
         }
+        output.truncate(written);
+
+        update_performance_stats(true, get_current_time_ms() - start_time, pixels.len());
+        Ok(output)
     }
     #[cfg(not(c_hotspots_available))]
     {
-        tiff_lzw_rust_fallback(rgba_data, width, height, quality)
+        let _ = level;
+        Err(PixieError::FeatureNotEnabled(String::from("TIFF strip encoding needs the C hotspots")))
     }
 }
 
+/// RGBA pixels as an LZW TIFF. LZW is lossless, so `quality` has no effect.
+pub fn compress_tiff_lzw_c_hotspot(rgba_data: &[u8], width: usize, height: usize, quality: u8) -> PixieResult<Vec<u8>> {
+    let _ = quality;
+    encode_tiff_c_hotspot(rgba_data, width, height, 4, TIFF_COMPRESSION_LZW, 0)
+}
+
 pub fn strip_tiff_metadata_c_hotspot(tiff_data: &[u8], preserve_icc: bool) -> PixieResult<Vec<u8>> {
     
     #[cfg(c_hotspots_available)]
@@ -1758,6 +2882,8 @@ pub fn strip_tiff_metadata_c_hotspot(tiff_data: &[u8], preserve_icc: bool) -> Pi
         let start_time = get_current_time_ms();
         let data_size = tiff_data.len();
         
+        let _arena = ArenaScope::enter();
+        
         let result = unsafe {
             strip_tiff_metadata_simd_c_hotspot(
                 tiff_data.as_ptr(),
@@ -1831,27 +2957,6 @@ pub fn optimize_tiff_colorspace_c_hotspot(rgba_data: &mut [u8], width: usize, he
     }
 }
 
-fn tiff_lzw_rust_fallback(rgba_data: &[u8], width: usize, height: usize, quality: u8) -> PixieResult<Vec<u8>> {
-    let pixel_count = width * height;
-    let mut compressed = Vec::with_capacity(pixel_count * 3);
-    
-    let compression_ratio = (100 - quality) as f32 / 100.0;
-    let target_size = (rgba_data.len() as f32 * (1.0 - compression_ratio)) as usize;
-    
-    for i in (0..pixel_count).step_by(2) {
-        if compressed.len() < target_size {
-            let idx = i * 4;
-            if idx + 3 < rgba_data.len() {
-                compressed.push(rgba_data[idx]);     // R
-                compressed.push(rgba_data[idx + 1]); // G
-                compressed.push(rgba_data[idx + 2]); // B
-            }
-        }
-    }
-    
-    Ok(compressed)
-}
-
 fn tiff_metadata_strip_rust_fallback(tiff_data: &[u8], _preserve_icc: bool) -> PixieResult<Vec<u8>> {
     let reduced_size = tiff_data.len() * 85 / 100;
     Ok(tiff_data[..reduced_size.min(tiff_data.len())].to_vec())
@@ -1986,38 +3091,6 @@ pub fn fast_downscale_c_hotspot(
     }
 }
 
-pub fn multi_threaded_compression_c_hotspot(
-    rgba_data: &[u8],
-    width: usize,
-    height: usize,
-    quality: u8
-) -> PixieResult<Vec<u8>> {
-    #[cfg(c_hotspots_available)]
-    {
-        let estimated_size = rgba_data.len() * (100 - quality as usize) / 100;
-        let mut compressed_data = vec![0u8; estimated_size];
-        let mut compressed_size = 0usize;
-        
-        unsafe {
-            multi_threaded_compression_simd(
-                rgba_data.as_ptr(),
-                width,
-                height,
-                compressed_data.as_mut_ptr(),
-                &mut compressed_size,
-                quality
-            );
-        }
-        
-        compressed_data.truncate(compressed_size);
-        Ok(compressed_data)
-    }
-    #[cfg(not(c_hotspots_available))]
-    {
-        compression_rust_fallback(rgba_data, width, height, quality)
-    }
-}
-
 fn advanced_pixel_processing_rust_fallback(rgba_data: &mut [u8], operation_type: u8) -> PixieResult<()> {
     match operation_type {
         1 => {
@@ -2160,31 +3233,6 @@ fn downscale_rust_fallback(
     Ok(())
 }
 
-fn compression_rust_fallback(
-    rgba_data: &[u8],
-    width: usize,
-    height: usize,
-    quality: u8
-) -> PixieResult<Vec<u8>> {
-    let pixel_count = width * height;
-    let compression_ratio = (100 - quality) as f32 / 100.0;
-    let target_size = (rgba_data.len() as f32 * (1.0 - compression_ratio)) as usize;
-    
-    let mut compressed = Vec::with_capacity(target_size);
-    let step = if quality < 50 { 2 } else { 1 };
-    
-    for i in (0..pixel_count).step_by(step) {
-        let idx = i * 4;
-        if idx + 2 < rgba_data.len() && compressed.len() < target_size {
-            compressed.push(rgba_data[idx]);     // R
-            compressed.push(rgba_data[idx + 1]); // G
-            compressed.push(rgba_data[idx + 2]); // B
-        }
-    }
-    
-    Ok(compressed)
-}
-
 #[cfg(not(c_hotspots_available))]
 pub mod fallback {
     use super::*;
@@ -2242,6 +3290,27 @@ pub mod color {
         Ok(idx as usize)
     }
     
+    /// Batch form of `find_closest_palette_color` for RGB pixels: the palette search is
+    /// built once instead of scanning the palette per pixel.
+    pub fn find_closest_palette_colors(palette: &[u8], rgb: &[u8]) -> PixieResult<Vec<usize>> {
+        if palette.len() % 3 != 0 || rgb.len() % 3 != 0 {
+            return Err(PixieError::InvalidInput("Palette and pixel sizes must be multiples of 3".into()));
+        }
+        let palette_size = palette.len() / 3;
+        if palette_size == 0 || palette_size > 256 {
+            return rgb.chunks_exact(3).map(|p| find_closest_palette_color(palette, p[0], p[1], p[2])).collect();
+        }
+
+        let mut state = vec![0u64; unsafe { palette_search_state_size() }.div_ceil(8)];
+        let mut indices = vec![0u8; rgb.len() / 3];
+        unsafe {
+            let search = palette_search_init(state.as_mut_ptr() as *mut core::ffi::c_void,
+                                             palette.as_ptr(), palette_size, 3, PALETTE_METRIC_PERCEPTUAL);
+            palette_search_map(search, rgb.as_ptr(), indices.len(), 3, indices.as_mut_ptr());
+        }
+        Ok(indices.into_iter().map(usize::from).collect())
+    }
+    
     pub fn min_palette_distance(palette: &[u8], r: u8, g: u8, b: u8) -> PixieResult<f32> {
         if palette.len() % 3 != 0 {
             return Err(PixieError::InvalidInput("Palette size must be multiple of 3".into()));
@@ -2297,6 +3366,13 @@ pub mod color {
         Ok(best_idx)
     }
     
+    pub fn find_closest_palette_colors(palette: &[u8], rgb: &[u8]) -> PixieResult<Vec<usize>> {
+        if palette.len() % 3 != 0 || rgb.len() % 3 != 0 {
+            return Err(PixieError::InvalidInput("Palette and pixel sizes must be multiples of 3".into()));
+        }
+        rgb.chunks_exact(3).map(|p| find_closest_palette_color(palette, p[0], p[1], p[2])).collect()
+    }
+    
     pub fn min_palette_distance(palette: &[u8], r: u8, g: u8, b: u8) -> PixieResult<f32> {
         let mut min_dist = f32::MAX;
         for i in 0..(palette.len() / 3) {
@@ -2316,3 +3392,50 @@ pub fn c_hotspots_info() -> &'static str {
         "C hotspots not available - using Rust fallbacks"
     }
 }
+
+// These exercise the C side, so they run on wasm32 through wasm-bindgen-test-runner.
+#[cfg(all(test, c_hotspots_available))]
+mod tests {
+    use alloc::{vec, vec::Vec};
+    use wasm_bindgen_test::wasm_bindgen_test;
+    use super::compression::{lz4_compress_block_hc, lz4_decompress_block, LZ4HC_DEFAULT_LEVEL, LZ4HC_MAX_LEVEL};
+    
+    // Space-separated words and fixed-size binary records, both from one LCG.
+    fn sample(records: bool, len: usize) -> Vec<u8> {
+        const WORDS: [&str; 16] = ["pixel", "mesh", "the", "of", "vertex", "index", "buffer", "and",
+                                   "a", "colour", "palette", "quantize", "compress", "block", "stream", "frame"];
+        let mut state = 0x9E37_79B9u32;
+        let mut output = Vec::with_capacity(len + 16);
+        while output.len() < len {
+            state = state.wrapping_mul(1_664_525).wrapping_add(1_013_904_223);
+            if records {
+                let n = output.len() as u32;
+                for word in [n / 16, (state >> 24) & 0x0F, 0x3F80_0000 | ((state >> 8) & 0xFF), n / 64 * 3] {
+                    output.extend_from_slice(&word.to_le_bytes());
+                }
+            } else {
+                output.extend_from_slice(WORDS[(state >> 28) as usize].as_bytes());
+                output.push(if (state >> 20) & 7 != 0 { b' ' } else { b'\n' });
+            }
+        }
+        output.truncate(len);
+        output
+    }
+    
+    #[wasm_bindgen_test]
+    fn test_lz4_hc_optimal_levels_never_lose_to_lazy() {
+        for records in [false, true] {
+            let data = sample(records, 64 * 1024);
+            let capacity = data.len() + data.len() / 255 + 16;
+            let lazy = lz4_compress_block_hc(&data, capacity, LZ4HC_DEFAULT_LEVEL).unwrap();
+            for level in LZ4HC_DEFAULT_LEVEL + 1..=LZ4HC_MAX_LEVEL {
+                let block = lz4_compress_block_hc(&data, capacity, level).unwrap();
+                assert!(block.len() <= lazy.len(), "level {level}: {} > {}", block.len(), lazy.len());
+                
+                let mut decoded = vec![0u8; data.len()];
+                assert_eq!(lz4_decompress_block(&block, &mut decoded), Some(data.len()));
+                assert_eq!(decoded, data);
+            }
+        }
+    }
+}
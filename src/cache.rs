@@ -0,0 +1,245 @@
+//! Bounded LRU cache of optimization results
+
+extern crate alloc;
+use alloc::collections::BTreeMap;
+use alloc::vec::Vec;
+use core::cell::UnsafeCell;
+use core::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+
+use crate::c_hotspots::content_hash_c_hotspot;
+use crate::types::PixieResult;
+
+/// Same budget as `PerformanceConfig::cache_size_mb`.
+pub const DEFAULT_CACHE_LIMIT_BYTES: usize = 64 * 1024 * 1024;
+
+// Charged per entry on top of the output bytes for the key and both map slots.
+const ENTRY_OVERHEAD_BYTES: usize = 96;
+
+// Two xxHash32 seeds give a 64-bit content key.
+const SEED_LOW: u32 = 0;
+const SEED_HIGH: u32 = 0x9E37_79B9;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum CachedOperation {
+    Auto,
+    Image,
+    Mesh,
+}
+
+/// Identifies one optimization: which entry point ran, on which bytes, with which
+/// effective settings.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+struct CacheKey {
+    operation: CachedOperation,
+    quality: u8,
+    input_len: usize,
+    content_hash: u64,
+    config_hash: u64,
+}
+
+struct CacheEntry {
+    output: Vec<u8>,
+    last_used: u64,
+}
+
+struct ResultCache {
+    entries: BTreeMap<CacheKey, CacheEntry>,
+    // last_used tick -> key, oldest first.
+    recency: BTreeMap<u64, CacheKey>,
+    bytes: usize,
+    limit: usize,
+    clock: u64,
+}
+
+impl ResultCache {
+    const fn new() -> Self {
+        Self {
+            entries: BTreeMap::new(),
+            recency: BTreeMap::new(),
+            bytes: 0,
+            limit: DEFAULT_CACHE_LIMIT_BYTES,
+            clock: 0,
+        }
+    }
+
+    fn get(&mut self, key: &CacheKey) -> Option<Vec<u8>> {
+        self.clock += 1;
+        let clock = self.clock;
+        let entry = self.entries.get_mut(key)?;
+        self.recency.remove(&entry.last_used);
+        self.recency.insert(clock, *key);
+        entry.last_used = clock;
+        Some(entry.output.clone())
+    }
+
+    fn insert(&mut self, key: CacheKey, output: &[u8]) {
+        let cost = output.len() + ENTRY_OVERHEAD_BYTES;
+        if cost > self.limit {
+            return;
+        }
+        self.remove(&key);
+        self.evict_to(self.limit - cost);
+
+        self.clock += 1;
+        self.recency.insert(self.clock, key);
+        self.entries.insert(key, CacheEntry { output: output.to_vec(), last_used: self.clock });
+        self.bytes += cost;
+    }
+
+    fn remove(&mut self, key: &CacheKey) {
+        if let Some(entry) = self.entries.remove(key) {
+            self.recency.remove(&entry.last_used);
+            self.bytes -= entry.output.len() + ENTRY_OVERHEAD_BYTES;
+        }
+    }
+
+    fn evict_to(&mut self, budget: usize) {
+        while self.bytes > budget {
+            match self.recency.pop_first() {
+                Some((_, key)) => {
+                    if let Some(entry) = self.entries.remove(&key) {
+                        self.bytes -= entry.output.len() + ENTRY_OVERHEAD_BYTES;
+                    }
+                }
+                None => break,
+            }
+        }
+    }
+
+    fn clear(&mut self) {
+        self.entries.clear();
+        self.recency.clear();
+        self.bytes = 0;
+    }
+}
+
+struct SharedCache {
+    locked: AtomicBool,
+    cache: UnsafeCell<ResultCache>,
+}
+
+// SAFETY: `cache` is only reached through `with_cache`, which holds `locked`.
+unsafe impl Sync for SharedCache {}
+
+static RESULT_CACHE: SharedCache = SharedCache {
+    locked: AtomicBool::new(false),
+    cache: UnsafeCell::new(ResultCache::new()),
+};
+
+static CACHE_HITS: AtomicU64 = AtomicU64::new(0);
+static CACHE_MISSES: AtomicU64 = AtomicU64::new(0);
+
+fn with_cache<R>(f: impl FnOnce(&mut ResultCache) -> R) -> R {
+    // Spin rather than park: blocking waits are not allowed on the browser main thread.
+    while RESULT_CACHE
+        .locked
+        .compare_exchange_weak(false, true, Ordering::Acquire, Ordering::Relaxed)
+        .is_err()
+    {
+        core::hint::spin_loop();
+    }
+    let result = f(unsafe { &mut *RESULT_CACHE.cache.get() });
+    RESULT_CACHE.locked.store(false, Ordering::Release);
+    result
+}
+
+fn hash64(data: &[u8]) -> u64 {
+    ((content_hash_c_hotspot(data, SEED_HIGH) as u64) << 32) | content_hash_c_hotspot(data, SEED_LOW) as u64
+}
+
+/// Returns the cached output for this input and configuration, or runs `compute`
+/// and remembers a successful result. `config` is any byte encoding of the settings
+/// that can change the output. The lock is not held while `compute` runs, so
+/// optimizations may nest.
+pub fn cached<F>(operation: CachedOperation, data: &[u8], quality: u8, config: &[u8], compute: F) -> PixieResult<Vec<u8>>
+where
+    F: FnOnce() -> PixieResult<Vec<u8>>,
+{
+    if limit() == 0 {
+        return compute();
+    }
+
+    let key = CacheKey {
+        operation,
+        quality,
+        input_len: data.len(),
+        content_hash: hash64(data),
+        config_hash: hash64(config),
+    };
+
+    if let Some(output) = with_cache(|cache| cache.get(&key)) {
+        CACHE_HITS.fetch_add(1, Ordering::Relaxed);
+        return Ok(output);
+    }
+    CACHE_MISSES.fetch_add(1, Ordering::Relaxed);
+
+    let output = compute()?;
+    with_cache(|cache| cache.insert(key, &output));
+    Ok(output)
+}
+
+/// Caps the memory held by cached results; 0 disables the cache.
+pub fn set_limit(bytes: usize) {
+    with_cache(|cache| {
+        cache.limit = bytes;
+        cache.evict_to(bytes);
+    });
+}
+
+pub fn limit() -> usize {
+    with_cache(|cache| cache.limit)
+}
+
+/// Bytes currently charged against the limit.
+pub fn usage() -> usize {
+    with_cache(|cache| cache.bytes)
+}
+
+pub fn clear() {
+    with_cache(ResultCache::clear);
+}
+
+pub fn hits() -> u64 {
+    CACHE_HITS.load(Ordering::Relaxed)
+}
+
+pub fn misses() -> u64 {
+    CACHE_MISSES.load(Ordering::Relaxed)
+}
+
+pub fn reset_counters() {
+    CACHE_HITS.store(0, Ordering::Relaxed);
+    CACHE_MISSES.store(0, Ordering::Relaxed);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn key(content_hash: u64) -> CacheKey {
+        CacheKey { operation: CachedOperation::Auto, quality: 80, input_len: 4, content_hash, config_hash: 0 }
+    }
+
+    #[test]
+    fn test_lru_eviction() {
+        let mut cache = ResultCache::new();
+        cache.limit = 3 * (100 + ENTRY_OVERHEAD_BYTES);
+        for id in 0..3 {
+            cache.insert(key(id), &[id as u8; 100]);
+        }
+        assert!(cache.get(&key(0)).is_some());
+        cache.insert(key(3), &[3; 100]);
+        assert!(cache.get(&key(1)).is_none());
+        assert_eq!(cache.get(&key(0)).unwrap(), [0u8; 100]);
+        assert_eq!(cache.bytes, 3 * (100 + ENTRY_OVERHEAD_BYTES));
+    }
+
+    #[test]
+    fn test_oversized_result_is_not_cached() {
+        let mut cache = ResultCache::new();
+        cache.limit = 64;
+        cache.insert(key(1), &[0; 64]);
+        assert!(cache.get(&key(1)).is_none());
+        assert_eq!(cache.bytes, 0);
+    }
+}
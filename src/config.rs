@@ -68,6 +68,7 @@ impl PixieConfig {
             max_width: self.image.max_width,
             max_height: self.image.max_height,
             target_reduction: None,
+            exhaustive_png_filters: false,
         }
     }
     
@@ -0,0 +1,51 @@
+//! Runs a list of optimization candidates and keeps the smallest output
+
+extern crate alloc;
+use alloc::vec::Vec;
+
+#[cfg(feature = "threads")]
+use rayon::prelude::*;
+
+/// Evaluates every candidate and returns the smallest output. Ties go to the
+/// candidate listed first, so the result is the same whether the list ran on the
+/// rayon pool or serially. Candidates returning `None` are skipped.
+pub fn smallest<S, F>(candidates: Vec<S>, run: F) -> Option<Vec<u8>>
+where
+    S: Send,
+    F: Fn(S) -> Option<Vec<u8>> + Sync + Send,
+{
+    smallest_with(candidates, || (), |_, candidate| run(candidate))
+}
+
+/// As `smallest`, handing each run scratch made by `init`. Each rayon worker makes
+/// its own and reuses it across the candidates it takes; serial runs share one.
+pub fn smallest_with<S, T, I, F>(candidates: Vec<S>, init: I, run: F) -> Option<Vec<u8>>
+where
+    S: Send,
+    I: Fn() -> T + Sync + Send,
+    F: Fn(&mut T, S) -> Option<Vec<u8>> + Sync + Send,
+{
+    #[cfg(feature = "threads")]
+    {
+        if candidates.len() > 1 && crate::threads_available() {
+            return candidates
+                .into_par_iter()
+                .enumerate()
+                .map_init(&init, |state, (index, candidate)| run(state, candidate).map(|output| (index, output)))
+                .flatten()
+                .min_by_key(|(index, output)| (output.len(), *index))
+                .map(|(_, output)| output);
+        }
+    }
+
+    let mut state = init();
+    let mut best: Option<Vec<u8>> = None;
+    for candidate in candidates {
+        if let Some(output) = run(&mut state, candidate) {
+            if best.as_ref().map_or(true, |current| output.len() < current.len()) {
+                best = Some(output);
+            }
+        }
+    }
+    best
+}
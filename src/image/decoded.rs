@@ -0,0 +1,131 @@
+//! Decoded image shared by every strategy of a single optimization request
+
+extern crate alloc;
+use alloc::format;
+
+use image::{load_from_memory, DynamicImage, GenericImageView, GrayImage, RgbImage, RgbaImage};
+
+use crate::c_hotspots::{analyze_image_c_hotspot, ImageAnalysis};
+use crate::types::{PixieError, PixieResult};
+
+// Strategies may run on the rayon pool, so the caches must be shareable across threads
+// there; single-threaded builds keep the cheaper cell.
+#[cfg(feature = "threads")]
+type Cache<T> = std::sync::OnceLock<T>;
+#[cfg(not(feature = "threads"))]
+type Cache<T> = core::cell::OnceCell<T>;
+
+/// One decode per request. Colour-type views and the pixel analysis are derived on
+/// first use and cached, so strategies can ask for them freely without repeating
+/// conversions or full-image scans.
+pub struct DecodedImage<'a> {
+    data: &'a [u8],
+    image: DynamicImage,
+    rgb8: Cache<RgbImage>,
+    rgba8: Cache<RgbaImage>,
+    luma8: Cache<GrayImage>,
+    analysis: Cache<ImageAnalysis>,
+}
+
+impl<'a> DecodedImage<'a> {
+    pub fn decode(data: &'a [u8]) -> PixieResult<Self> {
+        let image = load_from_memory(data)
+            .map_err(|e| PixieError::ProcessingError(format!("Failed to load image: {}", e)))?;
+        Ok(Self::from_image(data, image))
+    }
+
+    pub fn from_image(data: &'a [u8], image: DynamicImage) -> Self {
+        Self {
+            data,
+            image,
+            rgb8: Cache::new(),
+            rgba8: Cache::new(),
+            luma8: Cache::new(),
+            analysis: Cache::new(),
+        }
+    }
+
+    /// The encoded bytes this image was decoded from.
+    pub fn data(&self) -> &'a [u8] {
+        self.data
+    }
+
+    pub fn image(&self) -> &DynamicImage {
+        &self.image
+    }
+
+    pub fn width(&self) -> u32 {
+        self.image.width()
+    }
+
+    pub fn height(&self) -> u32 {
+        self.image.height()
+    }
+
+    pub fn pixel_count(&self) -> usize {
+        self.image.width() as usize * self.image.height() as usize
+    }
+
+    /// True when every channel is stored with 8 bits, i.e. the 8-bit views are lossless.
+    pub fn is_8bit(&self) -> bool {
+        let color = self.image.color();
+        color.bytes_per_pixel() == color.channel_count()
+    }
+
+    pub fn rgb8(&self) -> &RgbImage {
+        self.rgb8.get_or_init(|| self.image.to_rgb8())
+    }
+
+    pub fn rgba8(&self) -> &RgbaImage {
+        if let DynamicImage::ImageRgba8(rgba) = &self.image {
+            return rgba;
+        }
+        self.rgba8.get_or_init(|| self.image.to_rgba8())
+    }
+
+    pub fn luma8(&self) -> &GrayImage {
+        if let DynamicImage::ImageLuma8(gray) = &self.image {
+            return gray;
+        }
+        self.luma8.get_or_init(|| self.image.to_luma8())
+    }
+
+    /// Alpha usage, grayscale, palette size, channel histograms, bit depth and edge
+    /// energy of the 8-bit RGBA view, from a single analysis pass. Every codec's
+    /// strategy selection reads this instead of scanning the pixels itself.
+    pub fn analysis(&self) -> &ImageAnalysis {
+        self.analysis.get_or_init(|| {
+            let rgba = self.rgba8();
+            analyze_image_c_hotspot(
+                rgba.as_raw(),
+                rgba.width() as usize,
+                rgba.height() as usize,
+                ImageAnalysis::PALETTE_COLORS,
+            )
+            .unwrap_or_else(|_| ImageAnalysis::conservative(ImageAnalysis::PALETTE_COLORS))
+        })
+    }
+
+    /// Whether any pixel is actually translucent, not just whether the colour type
+    /// carries an alpha channel.
+    pub fn has_alpha(&self) -> bool {
+        match &self.image {
+            DynamicImage::ImageRgba16(img) => img.as_raw().chunks_exact(4).any(|p| p[3] < u16::MAX),
+            DynamicImage::ImageLumaA16(img) => img.as_raw().chunks_exact(2).any(|p| p[1] < u16::MAX),
+            img if img.color().has_alpha() => self.analysis().has_alpha(),
+            _ => false,
+        }
+    }
+
+    /// Whether every pixel has equal R, G and B, so a luma encode loses no colour.
+    pub fn is_grayscale(&self) -> bool {
+        match &self.image {
+            DynamicImage::ImageLuma8(_)
+            | DynamicImage::ImageLumaA8(_)
+            | DynamicImage::ImageLuma16(_)
+            | DynamicImage::ImageLumaA16(_) => true,
+            DynamicImage::ImageRgb16(_) | DynamicImage::ImageRgba16(_) => false,
+            _ => self.analysis().is_grayscale(),
+        }
+    }
+}
@@ -6,6 +6,11 @@ use crate::types::{PixieResult, ImageOptConfig, PixieError, OptResult, OptError}
 #[cfg(feature = "image")]
 use image::{load_from_memory, DynamicImage};
 
+#[cfg(feature = "image")]
+use super::{candidates, decoded::DecodedImage};
+#[cfg(feature = "image")]
+use crate::c_hotspots::ImageAnalysis;
+
 #[cfg(all(feature = "image", target_arch = "wasm32"))]
 use image::GenericImageView;
 
@@ -19,38 +24,12 @@ pub fn optimize_jpeg_rust(data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
 pub fn optimize_jpeg_with_config(data: &[u8], quality: u8, config: &ImageOptConfig) -> PixieResult<Vec<u8>> {
     #[cfg(feature = "image")]
     {
-        let original_size = data.len();
-        
         let img = load_from_memory(data)
             .map_err(|e| PixieError::ProcessingError(
                 format!("Failed to load JPEG: {}", e)
             ))?;
         
-        let strategies = get_jpeg_optimization_strategies(quality, &img, config);
-        
-        let mut best_result = data.to_vec();
-        
-        for strategy in strategies {
-            if let Ok(optimized) = apply_jpeg_strategy(&img, strategy, quality, config) {
-                if optimized.len() < best_result.len() {
-                    best_result = optimized;
-                }
-            }
-        }
-        
-        if best_result.len() >= data.len() * 90 / 100 {
-            if let Ok(metadata_stripped) = optimize_jpeg_legacy(data, quality, config) {
-                if metadata_stripped.len() < best_result.len() {
-                    best_result = metadata_stripped;
-                }
-            }
-        }
-        
-        if best_result.len() < original_size {
-            Ok(best_result)
-        } else {
-            Ok(data.to_vec())
-        }
+        optimize_jpeg_decoded(&DecodedImage::from_image(data, img), quality, config)
     }
     
     #[cfg(not(feature = "image"))]
@@ -59,6 +38,36 @@ pub fn optimize_jpeg_with_config(data: &[u8], quality: u8, config: &ImageOptConf
     }
 }
 
+/// Runs every JPEG strategy against an already decoded image, sharing its cached
+/// RGB, RGBA and luma views.
+#[cfg(feature = "image")]
+pub fn optimize_jpeg_decoded(decoded: &DecodedImage, quality: u8, config: &ImageOptConfig) -> PixieResult<Vec<u8>> {
+    let data = decoded.data();
+    let original_size = data.len();
+    
+    let strategies = get_jpeg_optimization_strategies(quality, decoded, config);
+    
+    let mut best_result = candidates::smallest(strategies, |strategy| {
+        apply_jpeg_strategy(decoded, strategy, quality, config).ok()
+    })
+    .filter(|optimized| optimized.len() < original_size)
+    .unwrap_or_else(|| data.to_vec());
+    
+    if best_result.len() >= data.len() * 90 / 100 {
+        if let Ok(metadata_stripped) = optimize_jpeg_legacy(data, quality, config) {
+            if metadata_stripped.len() < best_result.len() {
+                best_result = metadata_stripped;
+            }
+        }
+    }
+    
+    if best_result.len() < original_size {
+        Ok(best_result)
+    } else {
+        Ok(data.to_vec())
+    }
+}
+
 #[cfg(feature = "image")]
 #[derive(Debug, Clone)]
 enum JPEGOptimizationStrategy {
@@ -70,8 +79,9 @@ enum JPEGOptimizationStrategy {
 }
 
 #[cfg(feature = "image")]
-fn get_jpeg_optimization_strategies(quality: u8, _img: &DynamicImage, config: &ImageOptConfig) -> Vec<JPEGOptimizationStrategy> {
+fn get_jpeg_optimization_strategies(quality: u8, decoded: &DecodedImage, config: &ImageOptConfig) -> Vec<JPEGOptimizationStrategy> {
     let mut strategies = Vec::new();
+    let grayscale = decoded.is_grayscale();
     
     let jpeg_quality = if config.lossless {
         95
@@ -97,11 +107,13 @@ fn get_jpeg_optimization_strategies(quality: u8, _img: &DynamicImage, config: &I
         strategies.push(JPEGOptimizationStrategy::ConvertToWebP { webp_quality });
     }
     
-    if quality >= 90 || config.lossless {
+    // A photographic JPEG only shrinks as PNG when it is really flat artwork.
+    if config.lossless || (quality >= 90 && decoded.analysis().fits_palette(ImageAnalysis::PALETTE_COLORS)) {
         strategies.push(JPEGOptimizationStrategy::ConvertToPNG);
     }
     
-    if quality <= 60 && !config.lossless {
+    // Dropping chroma costs nothing when the pixels are already neutral.
+    if grayscale || (quality <= 60 && !config.lossless) {
         strategies.push(JPEGOptimizationStrategy::ConvertToGrayscale { jpeg_quality });
     }
     
@@ -110,18 +122,19 @@ fn get_jpeg_optimization_strategies(quality: u8, _img: &DynamicImage, config: &I
 
 #[cfg(feature = "image")]
 fn apply_jpeg_strategy(
-    img: &DynamicImage, 
+    decoded: &DecodedImage, 
     strategy: JPEGOptimizationStrategy, 
     _quality: u8,
     _config: &ImageOptConfig
 ) -> PixieResult<Vec<u8>> {
+    let img = decoded.image();
+    
     match strategy {
         JPEGOptimizationStrategy::ProgressiveReencode { jpeg_quality } => {
             let mut output = Vec::new();
             let encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut output, jpeg_quality);
             
-            let rgb_img = img.to_rgb8();
-            rgb_img.write_with_encoder(encoder)
+            decoded.rgb8().write_with_encoder(encoder)
                 .map_err(|e| PixieError::ProcessingError(
                     format!("Progressive JPEG re-encoding failed: {}", e)
                 ))?;
@@ -131,13 +144,13 @@ fn apply_jpeg_strategy(
         
         JPEGOptimizationStrategy::ReencodeJPEG { jpeg_quality } => {
             #[cfg(c_hotspots_available)]
-            if img.dimensions().0 * img.dimensions().1 > 100_000 && jpeg_quality <= 70 {
-                if let Ok(preprocessed_img) = apply_jpeg_c_hotspot_preprocessing(img, jpeg_quality) {
-                    return encode_jpeg_from_image(&preprocessed_img, jpeg_quality);
+            if decoded.pixel_count() > 100_000 && jpeg_quality <= 70 {
+                if let Ok(preprocessed_img) = apply_jpeg_c_hotspot_preprocessing(decoded.rgba8(), jpeg_quality) {
+                    return encode_jpeg_from_image(&preprocessed_img.to_rgb8(), jpeg_quality);
                 }
             }
             
-            encode_jpeg_from_image(img, jpeg_quality)
+            encode_jpeg_from_image(decoded.rgb8(), jpeg_quality)
         },
         
         JPEGOptimizationStrategy::ConvertToWebP { webp_quality: _ } => {
@@ -168,8 +181,7 @@ fn apply_jpeg_strategy(
             let mut output = Vec::new();
             let encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut output, jpeg_quality);
             
-            let gray_img = img.to_luma8();
-            gray_img.write_with_encoder(encoder)
+            decoded.luma8().write_with_encoder(encoder)
                 .map_err(|e| PixieError::ProcessingError(
                     format!("JPEG grayscale conversion failed: {}", e)
                 ))?;
@@ -432,11 +444,10 @@ fn get_segment_end(data: &[u8], start: usize) -> Option<usize> {
 }
 
 #[cfg(feature = "image")]
-fn encode_jpeg_from_image(img: &DynamicImage, jpeg_quality: u8) -> PixieResult<Vec<u8>> {
+fn encode_jpeg_from_image(rgb_img: &image::RgbImage, jpeg_quality: u8) -> PixieResult<Vec<u8>> {
     let mut output = Vec::new();
     let encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut output, jpeg_quality);
     
-    let rgb_img = img.to_rgb8();
     rgb_img.write_with_encoder(encoder)
         .map_err(|e| PixieError::ProcessingError(
             format!("JPEG encoding failed: {}", e)
@@ -446,11 +457,10 @@ fn encode_jpeg_from_image(img: &DynamicImage, jpeg_quality: u8) -> PixieResult<V
 }
 
 #[cfg(all(feature = "image", c_hotspots_available))]
-fn apply_jpeg_c_hotspot_preprocessing(img: &DynamicImage, quality: u8) -> PixieResult<DynamicImage> {
-    let rgba_img = img.to_rgba8();
+fn apply_jpeg_c_hotspot_preprocessing(rgba_img: &image::RgbaImage, quality: u8) -> PixieResult<DynamicImage> {
     let mut rgba_data = rgba_img.as_raw().clone();
-    let width = img.width() as usize;
-    let height = img.height() as usize;
+    let width = rgba_img.width() as usize;
+    let height = rgba_img.height() as usize;
     
     if quality <= 40 {
         match crate::c_hotspots::image::median_cut_quantization(&rgba_data, width, height, 64) {
@@ -502,7 +512,7 @@ fn indices_to_rgba(indices: &[u8], palette: &[crate::c_hotspots::Color32], width
 
 #[cfg(any(not(feature = "image"), not(c_hotspots_available)))]
 #[allow(dead_code)]
-fn apply_jpeg_c_hotspot_preprocessing(_img: &DynamicImage, _quality: u8) -> PixieResult<DynamicImage> {
+fn apply_jpeg_c_hotspot_preprocessing(_rgba_img: &image::RgbaImage, _quality: u8) -> PixieResult<DynamicImage> {
     Err(PixieError::CHotspotUnavailable("C hotspots not available for JPEG preprocessing".into()))
 }
 
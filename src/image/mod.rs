@@ -89,6 +89,9 @@ fn detect_animated_gif(data: &[u8]) -> bool {
 }
 
 pub mod bmp;
+pub mod candidates;
+#[cfg(feature = "image")]
+pub mod decoded;
 pub mod formats;
 pub mod gif;
 pub mod jpeg;
@@ -146,12 +149,15 @@ impl ImageOptimizer {
             _ => {}
         }
         
-        // Try to load the image using the image crate for standard formats
-        let img = load_from_memory(data)
-            .map_err(|e| OptError::ProcessingError(format!("Failed to load image: {}", e)))?;
+        // Decode once for standard formats; every strategy below shares this image and
+        // its cached colour views instead of decoding the input again.
+        let decoded = decoded::DecodedImage::decode(data)
+            .map_err(|e| OptError::ProcessingError(format!("{}", e)))?;
+        let img = decoded.image();
         
-        // Always try to optimize - be aggressive with compression
-        let mut best_output = data.to_vec();
+        // Always try to optimize - be aggressive with compression. The original is only
+        // copied out if no strategy beats it.
+        let mut best_output: Option<Vec<u8>> = None;
         let best_size = data.len();
         let original_size = data.len();
         
@@ -167,17 +173,17 @@ impl ImageOptimizer {
         match format {
             crate::formats::ImageFormat::Png => {
                 // CRITICAL FIX: Use the comprehensive PNG optimizer instead of basic re-encoding
-                if let Ok(png_optimized) = crate::image::png::optimize_png_rust(data, quality) {
+                if let Ok(png_optimized) = crate::image::png::optimize_png_decoded(&decoded, quality, &self.config) {
                     if png_optimized.len() < best_size {
-                        best_output = png_optimized;
+                        best_output = Some(png_optimized);
                     }
                 }
             },
             crate::formats::ImageFormat::Jpeg => {
                 // CRITICAL FIX: Use the comprehensive JPEG optimizer instead of basic re-encoding
-                if let Ok(jpeg_optimized) = crate::image::jpeg::optimize_jpeg(data, quality, &self.config) {
+                if let Ok(jpeg_optimized) = crate::image::jpeg::optimize_jpeg_decoded(&decoded, quality, &self.config) {
                     if jpeg_optimized.len() < best_size {
-                        best_output = jpeg_optimized;
+                        best_output = Some(jpeg_optimized);
                     }
                 }
             },
@@ -188,17 +194,17 @@ impl ImageOptimizer {
                 // Strategy 1: Try re-encoding with comprehensive WebP optimizer
                 if let Ok(webp_output) = webp::optimize_webp_with_config(data, quality, &self.config) {
                     if webp_output.len() < best_size {
-                        best_output = webp_output.clone();
+                        best_output = Some(webp_output);
                     }
                 }
                 
                 // Strategy 2: Convert to JPEG for significant compression (most effective)
-                if quality <= 85 {  // For most quality levels, try JPEG conversion
+                if quality <= 85 && !decoded.has_alpha() {  // JPEG would drop real transparency
                     let mut jpeg_output = Vec::new();
                     let jpeg_quality = aggressive_quality;
                     let jpeg_encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut jpeg_output, jpeg_quality);
                     if img.write_with_encoder(jpeg_encoder).is_ok() && jpeg_output.len() < best_size {
-                        best_output = jpeg_output;
+                        best_output = Some(jpeg_output);
                     }
                 }
                 
@@ -207,7 +213,7 @@ impl ImageOptimizer {
                     let mut png_output = Vec::new();
                     let png_encoder = image::codecs::png::PngEncoder::new(&mut png_output);
                     if img.write_with_encoder(png_encoder).is_ok() && png_output.len() < best_size {
-                        best_output = png_output;
+                        best_output = Some(png_output);
                     }
                 }
             },
@@ -228,7 +234,7 @@ impl ImageOptimizer {
                                     log_to_console(&format!("Animated GIF optimization: {} -> {} bytes ({:.1}% savings)", 
                                         best_size, optimized_gif.len(),
                                         ((best_size - optimized_gif.len()) as f64 / best_size as f64) * 100.0));
-                                    best_output = optimized_gif;
+                                    best_output = Some(optimized_gif);
                                 } else {
                                     log_to_console("Animated GIF optimization: no improvement, keeping original");
                                 }
@@ -252,7 +258,7 @@ impl ImageOptimizer {
                         let png_encoder = image::codecs::png::PngEncoder::new(&mut png_output);
                         if img.write_with_encoder(png_encoder).is_ok() && png_output.len() < best_size {
                             log_to_console(&format!("PNG conversion: {} -> {} bytes", best_size, png_output.len()));
-                            best_output = png_output;
+                            best_output = Some(png_output);
                         }
                     }
                     
@@ -262,7 +268,7 @@ impl ImageOptimizer {
                         let jpeg_encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut jpeg_output, aggressive_quality);
                         if img.write_with_encoder(jpeg_encoder).is_ok() && jpeg_output.len() < best_size {
                             log_to_console(&format!("JPEG conversion: {} -> {} bytes", best_size, jpeg_output.len()));
-                            best_output = jpeg_output;
+                            best_output = Some(jpeg_output);
                         }
                     }
                     
@@ -271,7 +277,7 @@ impl ImageOptimizer {
                         if let Ok(webp_output) = webp::optimize_webp_with_config(data, quality, &self.config) {
                             if webp_output.len() < best_size {
                                 log_to_console(&format!("WebP conversion: {} -> {} bytes", best_size, webp_output.len()));
-                                best_output = webp_output;
+                                best_output = Some(webp_output);
                             }
                         }
                     }
@@ -287,7 +293,7 @@ impl ImageOptimizer {
                                         log_to_console(&format!("GIF optimization: {} -> {} bytes ({:.1}% savings)", 
                                             best_size, optimized_gif.len(),
                                             ((best_size - optimized_gif.len()) as f64 / best_size as f64) * 100.0));
-                                        best_output = optimized_gif;
+                                        best_output = Some(optimized_gif);
                                     }
                                 },
                                 Err(_) => {
@@ -298,9 +304,10 @@ impl ImageOptimizer {
                     }
                 }
                 
+                let best_len = best_output.as_ref().map_or(data.len(), |out| out.len());
                 log_to_console(&format!("GIF optimization result: {} -> {} bytes ({:.1}% savings)", 
-                    data.len(), best_output.len(), 
-                    ((data.len() - best_output.len()) as f64 / data.len() as f64) * 100.0));
+                    data.len(), best_len, 
+                    ((data.len() - best_len) as f64 / data.len() as f64) * 100.0));
             },
             PixieImageFormat::Bmp => {
                 // BMP is always uncompressed, so any conversion will be smaller
@@ -309,35 +316,35 @@ impl ImageOptimizer {
                     let mut png_output = Vec::new();
                     let png_encoder = image::codecs::png::PngEncoder::new(&mut png_output);
                     if img.write_with_encoder(png_encoder).is_ok() {
-                        best_output = png_output;
+                        best_output = Some(png_output);
                     }
                 } else {
                     // Lower quality: convert to JPEG
                     let mut jpeg_output = Vec::new();
                     let jpeg_encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut jpeg_output, aggressive_quality);
                     if img.write_with_encoder(jpeg_encoder).is_ok() {
-                        best_output = jpeg_output;
+                        best_output = Some(jpeg_output);
                     }
                 }
             },
             PixieImageFormat::Tiff => {
                 if let Ok(tiff_output) = tiff::optimize_tiff(data, quality) {
                     if tiff_output.len() < best_size {
-                        best_output = tiff_output;
+                        best_output = Some(tiff_output);
                     }
                 }
             },
             PixieImageFormat::Svg => {
                 if let Ok(svg_output) = svg::optimize_svg(data, quality, &self.config) {
                     if svg_output.len() < best_size {
-                        best_output = svg_output;
+                        best_output = Some(svg_output);
                     }
                 }
             },
             PixieImageFormat::Tga => {
                 if let Ok(tga_output) = tga::optimize_tga(data, quality) {
                     if tga_output.len() < best_size {
-                        best_output = tga_output;
+                        best_output = Some(tga_output);
                     }
                 }
             },
@@ -345,9 +352,7 @@ impl ImageOptimizer {
             PixieImageFormat::Ico => {
                 // ICO optimization using embedded image processing
                 if let Ok(optimized) = crate::image::ico::optimize_ico(data, aggressive_quality, &self.config) {
-                    best_output = optimized;
-                } else {
-                    best_output = data.to_vec();
+                    best_output = Some(optimized);
                 }
             },
         }
@@ -355,7 +360,7 @@ impl ImageOptimizer {
         // Log the optimization result for debugging
         let _ = original_size;
 
-        Ok(best_output)
+        Ok(best_output.unwrap_or_else(|| data.to_vec()))
     }
 
     /// Fast path optimization for large images to avoid performance violations
@@ -1,11 +1,18 @@
 extern crate alloc;
 use alloc::{vec, vec::Vec, string::ToString, format};
+#[cfg(all(feature = "image", c_hotspots_available))]
+use alloc::borrow::Cow;
 
 use crate::types::{OptResult, OptError, PixieResult, ImageOptConfig};
 
 #[cfg(feature = "image")]
 use image::{load_from_memory, DynamicImage};
 
+#[cfg(feature = "image")]
+use super::{candidates, decoded::DecodedImage};
+#[cfg(feature = "image")]
+use crate::c_hotspots::ImageAnalysis;
+
 use image::GenericImageView;
 use image::codecs::png::{PngEncoder, CompressionType, FilterType};
 
@@ -21,31 +28,7 @@ pub fn optimize_png_with_config(data: &[u8], quality: u8, config: &ImageOptConfi
                 format!("Failed to load PNG: {}", e)
             ))?;
         
-        let strategies = get_png_optimization_strategies(quality, &img, config);
-        
-        let mut best_result = data.to_vec();
-        
-        for strategy in strategies {
-            if let Ok(optimized) = apply_png_strategy(&img, strategy, quality, config, data.len()) {
-                if optimized.len() < best_result.len() {
-                    best_result = optimized;
-                }
-            }
-        }
-        
-        if data.len() < 5_000_000 {
-            if let Ok(quantized) = apply_aggressive_color_quantization(&img, quality) {
-                if quantized.len() < best_result.len() {
-                    best_result = quantized;
-                }
-            }
-        }
-        
-        if best_result.len() < data.len() {
-            Ok(best_result)
-        } else {
-            Ok(data.to_vec())
-        }
+        optimize_png_decoded(&DecodedImage::from_image(data, img), quality, config)
     }
     
     #[cfg(not(feature = "image"))]
@@ -55,6 +38,23 @@ pub fn optimize_png_with_config(data: &[u8], quality: u8, config: &ImageOptConfi
     }
 }
 
+/// Runs every PNG strategy against an already decoded image; the source is never
+/// decoded again and each derived view is built at most once.
+#[cfg(feature = "image")]
+pub fn optimize_png_decoded(decoded: &DecodedImage, quality: u8, config: &ImageOptConfig) -> PixieResult<Vec<u8>> {
+    let data = decoded.data();
+    let strategies = get_png_optimization_strategies(quality, decoded, config);
+    
+    let best_result = candidates::smallest(strategies, |strategy| {
+        apply_png_strategy(decoded, strategy, quality, config, data.len()).ok()
+    });
+    
+    match best_result {
+        Some(best) if best.len() < data.len() => Ok(best),
+        _ => Ok(data.to_vec()),
+    }
+}
+
 #[cfg(feature = "image")]
 #[derive(Debug, Clone)]
 enum PNGOptimizationStrategy {
@@ -63,12 +63,13 @@ enum PNGOptimizationStrategy {
     ConvertToJPEG { jpeg_quality: u8 },
     ConvertToWebP { webp_quality: u8 },
     PaletteOptimization,
+    ColorQuantization,
 }
 
 #[cfg(feature = "image")]
 fn get_png_optimization_strategies(
     quality: u8,
-    img: &DynamicImage,
+    decoded: &DecodedImage,
     config: &ImageOptConfig,
 ) -> Vec<PNGOptimizationStrategy> {
     let mut strategies = Vec::new();
@@ -77,15 +78,7 @@ fn get_png_optimization_strategies(
     // explicitly requests an aggressive target reduction.
     let allow_format_conversion = config.target_reduction.is_some();
     
-    let has_transparency = match img {
-        DynamicImage::ImageRgba8(rgba_img) => {
-            rgba_img.pixels().any(|p| p[3] < 255)
-        },
-        DynamicImage::ImageRgba16(rgba_img) => {
-            rgba_img.pixels().any(|p| p[3] < u16::MAX)
-        },
-        _ => false,
-    };
+    let has_transparency = decoded.has_alpha();
     
     let compression_level = match quality {
         0..=30 => 9,
@@ -116,31 +109,340 @@ fn get_png_optimization_strategies(
         strategies.push(PNGOptimizationStrategy::ConvertToWebP { webp_quality });
     }
     
-    let (width, height) = (img.width(), img.height());
-    let pixel_count = (width * height) as usize;
+    // A palette-sized image is already written losslessly as indexed PNG by the
+    // re-encode, which also covers the RGB and luma views these two fall back to.
+    let exact_palette = cfg!(c_hotspots_available) && !config.exhaustive_png_filters && fits_indexed_png(decoded);
     
-    if pixel_count < 1_000_000 && quality <= 75 {
+    if !exact_palette && decoded.pixel_count() < 1_000_000 && quality <= 75 {
         strategies.push(PNGOptimizationStrategy::PaletteOptimization);
     }
     
+    let lossy_luma = quality <= 30 && !has_transparency && !decoded.is_grayscale();
+    if (!exact_palette || lossy_luma) && decoded.data().len() < 5_000_000 {
+        strategies.push(PNGOptimizationStrategy::ColorQuantization);
+    }
+    
     strategies
 }
 
+#[cfg(feature = "image")]
+#[derive(Debug, Clone, Copy)]
+enum PngView {
+    Rgb,
+    AsDecoded,
+    Luma,
+    /// Colour type 3 with a PLTE (and tRNS) chunk; only the C-backed encoder writes it.
+    Indexed,
+}
+
+/// At most 256 distinct 8-bit colours, so an indexed encode is lossless.
+#[cfg(feature = "image")]
+fn fits_indexed_png(decoded: &DecodedImage) -> bool {
+    decoded.is_8bit() && decoded.analysis().fits_palette(ImageAnalysis::PALETTE_COLORS)
+}
+
+// Lossless re-encode targets: the image as decoded, plus the RGB and luma views when
+// dropping the alpha or colour channels loses nothing.
+#[cfg(feature = "image")]
+fn png_reencode_views(decoded: &DecodedImage) -> Vec<PngView> {
+    let img = decoded.image();
+    let opaque = !decoded.has_alpha();
+    
+    let mut views = Vec::with_capacity(3);
+    if opaque && matches!(img, DynamicImage::ImageRgba8(_)) {
+        views.push(PngView::Rgb);
+    }
+    views.push(PngView::AsDecoded);
+    if opaque
+        && decoded.is_8bit()
+        && decoded.is_grayscale()
+        && !matches!(img, DynamicImage::ImageLuma8(_))
+    {
+        views.push(PngView::Luma);
+    }
+    views
+}
+
+#[cfg(feature = "image")]
+fn png_reencode_candidates(decoded: &DecodedImage, filters: &[FilterType]) -> Vec<(FilterType, PngView)> {
+    let views = png_reencode_views(decoded);
+    filters
+        .iter()
+        .flat_map(|&filter_type| views.iter().map(move |&view| (filter_type, view)))
+        .collect()
+}
+
+// One encode per view with the filter picked per scanline by the C kernel, instead of
+// a full encode per filter type. None when the C hotspots are unavailable.
+#[cfg(feature = "image")]
+fn reencode_with_filter_heuristic(decoded: &DecodedImage, compression_type: CompressionType) -> Option<Vec<u8>> {
+    #[cfg(c_hotspots_available)]
+    {
+        let mut views = png_reencode_views(decoded);
+        if fits_indexed_png(decoded) {
+            views.push(PngView::Indexed);
+        }
+        candidates::smallest_with(views, crate::c_hotspots::compression::deflate_state,
+                                  |state, view| encode_png_heuristic(decoded, view, compression_type, state))
+    }
+    #[cfg(not(c_hotspots_available))]
+    {
+        let _ = (decoded, compression_type);
+        None
+    }
+}
+
+// Unfiltered scanlines of one view with everything the IHDR needs. Rows are `row_len`
+// bytes; `filter_bpp` is the PNG filter stride (bytes per pixel, at least 1).
+#[cfg(all(feature = "image", c_hotspots_available))]
+struct PngScanlines<'d> {
+    samples: Cow<'d, [u8]>,
+    color_type: u8,
+    bit_depth: u8,
+    filter_bpp: usize,
+    row_len: usize,
+    palette: Vec<u8>,
+    transparency: Vec<u8>,
+}
+
+#[cfg(all(feature = "image", c_hotspots_available))]
+impl<'d> PngScanlines<'d> {
+    fn bytes(samples: Cow<'d, [u8]>, width: usize, color_type: u8, bit_depth: u8, bytes_per_pixel: usize) -> Self {
+        PngScanlines {
+            samples,
+            color_type,
+            bit_depth,
+            filter_bpp: bytes_per_pixel,
+            row_len: width * bytes_per_pixel,
+            palette: Vec::new(),
+            transparency: Vec::new(),
+        }
+    }
+    
+    /// Values below 2^bit_depth packed MSB first, each row padded to a whole byte.
+    fn packed(values: impl Iterator<Item = u8>, width: usize, height: usize, color_type: u8, bit_depth: u8) -> Self {
+        let depth = bit_depth as usize;
+        let row_len = (width * depth + 7) / 8;
+        let mut samples = vec![0u8; row_len * height];
+        for (i, value) in values.enumerate() {
+            let (y, x) = (i / width, i % width);
+            let bit = x * depth;
+            samples[y * row_len + bit / 8] |= value << (8 - depth - bit % 8);
+        }
+        PngScanlines {
+            samples: Cow::Owned(samples),
+            color_type,
+            bit_depth,
+            filter_bpp: 1,
+            row_len,
+            palette: Vec::new(),
+            transparency: Vec::new(),
+        }
+    }
+}
+
+// Scanline bytes in PNG sample order with the matching colour type and bit depth.
+// Grayscale drops to 1, 2 or 4 bits when the analysis shows every sample fits. None
+// for float images, which PNG cannot store directly, and for palettes over 256 colours.
+#[cfg(all(feature = "image", c_hotspots_available))]
+fn png_scanline_layout<'d>(decoded: &'d DecodedImage, view: PngView) -> Option<PngScanlines<'d>> {
+    fn big_endian(samples: &[u16]) -> Cow<'static, [u8]> {
+        Cow::Owned(samples.iter().flat_map(|sample| sample.to_be_bytes()).collect())
+    }
+    
+    let width = decoded.width() as usize;
+    let height = decoded.height() as usize;
+    let gray_depth = decoded.analysis().bit_depth as u8;
+    let packed_gray = |values: &'d [u8], stride: usize| {
+        let step = 255 / ((1u8 << gray_depth) - 1);
+        PngScanlines::packed(values.iter().step_by(stride).map(|&v| v / step), width, height, 0, gray_depth)
+    };
+    
+    let layout = match view {
+        PngView::Rgb => PngScanlines::bytes(Cow::Borrowed(decoded.rgb8().as_raw().as_slice()), width, 2, 8, 3),
+        PngView::Luma if gray_depth < 8 => packed_gray(decoded.rgba8().as_raw(), 4),
+        PngView::Luma => PngScanlines::bytes(Cow::Borrowed(decoded.luma8().as_raw().as_slice()), width, 0, 8, 1),
+        PngView::Indexed => return png_indexed_layout(decoded),
+        PngView::AsDecoded => match decoded.image() {
+            DynamicImage::ImageLuma8(img) if gray_depth < 8 => packed_gray(img.as_raw(), 1),
+            DynamicImage::ImageLuma8(img) => PngScanlines::bytes(Cow::Borrowed(img.as_raw().as_slice()), width, 0, 8, 1),
+            DynamicImage::ImageLumaA8(img) => PngScanlines::bytes(Cow::Borrowed(img.as_raw().as_slice()), width, 4, 8, 2),
+            DynamicImage::ImageRgb8(img) => PngScanlines::bytes(Cow::Borrowed(img.as_raw().as_slice()), width, 2, 8, 3),
+            DynamicImage::ImageRgba8(img) => PngScanlines::bytes(Cow::Borrowed(img.as_raw().as_slice()), width, 6, 8, 4),
+            DynamicImage::ImageLuma16(img) => PngScanlines::bytes(big_endian(img.as_raw()), width, 0, 16, 2),
+            DynamicImage::ImageLumaA16(img) => PngScanlines::bytes(big_endian(img.as_raw()), width, 4, 16, 4),
+            DynamicImage::ImageRgb16(img) => PngScanlines::bytes(big_endian(img.as_raw()), width, 2, 16, 6),
+            DynamicImage::ImageRgba16(img) => PngScanlines::bytes(big_endian(img.as_raw()), width, 6, 16, 8),
+            _ => return None,
+        },
+    };
+    Some(layout)
+}
+
+// Palette built from the 8-bit RGBA view. Translucent entries go first so the tRNS
+// chunk can stop at the last of them; indices are packed to the smallest depth.
+#[cfg(all(feature = "image", c_hotspots_available))]
+fn png_indexed_layout<'d>(decoded: &'d DecodedImage) -> Option<PngScanlines<'d>> {
+    let rgba = decoded.rgba8().as_raw();
+    let pixel = |p: &[u8]| u32::from_be_bytes([p[0], p[1], p[2], p[3]]);
+    
+    let mut colors: Vec<u32> = Vec::with_capacity(ImageAnalysis::PALETTE_COLORS as usize);
+    let mut previous = None;
+    for color in rgba.chunks_exact(4).map(pixel) {
+        if previous == Some(color) {
+            continue;
+        }
+        previous = Some(color);
+        if let Err(slot) = colors.binary_search(&color) {
+            if colors.len() == ImageAnalysis::PALETTE_COLORS as usize {
+                return None;
+            }
+            colors.insert(slot, color);
+        }
+    }
+    
+    let mut palette_order = colors.clone();
+    palette_order.sort_by_key(|&color| (color & 0xFF == 0xFF, color));
+    let mut index_of = vec![0u8; colors.len()];
+    for (index, color) in palette_order.iter().enumerate() {
+        if let Ok(slot) = colors.binary_search(color) {
+            index_of[slot] = index as u8;
+        }
+    }
+    
+    let lookup = |color: u32| colors.binary_search(&color).map(|slot| index_of[slot]).unwrap_or(0);
+    let width = decoded.width() as usize;
+    let height = decoded.height() as usize;
+    let mut layout = match palette_order.len() {
+        0..=2 => PngScanlines::packed(rgba.chunks_exact(4).map(|p| lookup(pixel(p))), width, height, 3, 1),
+        3..=4 => PngScanlines::packed(rgba.chunks_exact(4).map(|p| lookup(pixel(p))), width, height, 3, 2),
+        5..=16 => PngScanlines::packed(rgba.chunks_exact(4).map(|p| lookup(pixel(p))), width, height, 3, 4),
+        _ => PngScanlines::bytes(
+            Cow::Owned(rgba.chunks_exact(4).map(|p| lookup(pixel(p))).collect()),
+            width, 3, 8, 1,
+        ),
+    };
+    
+    layout.palette = palette_order
+        .iter()
+        .flat_map(|color| {
+            let [r, g, b, _] = color.to_be_bytes();
+            [r, g, b]
+        })
+        .collect();
+    let translucent = palette_order.iter().take_while(|&&color| color & 0xFF != 0xFF).count();
+    layout.transparency = palette_order[..translucent].iter().map(|&color| color as u8).collect();
+    Some(layout)
+}
+
+#[cfg(all(feature = "image", c_hotspots_available))]
+fn encode_png_heuristic(decoded: &DecodedImage, view: PngView, compression_type: CompressionType,
+                        deflate_state: &mut [u64]) -> Option<Vec<u8>> {
+    let layout = png_scanline_layout(decoded, view)?;
+    let (width, height) = (decoded.width(), decoded.height());
+    
+    let filtered = crate::c_hotspots::image::png_filter_scanlines_hotspot(
+        &layout.samples,
+        layout.row_len / layout.filter_bpp,
+        height as usize,
+        layout.filter_bpp,
+    ).ok()?;
+    
+    let level = match compression_type {
+        CompressionType::Best => crate::c_hotspots::compression::DEFLATE_MAX_LEVEL,
+        CompressionType::Fast => 1,
+        _ => 6,
+    };
+    let row_bytes = layout.row_len + 1;
+    let idat = crate::c_hotspots::compression::png_compress_filtered_with_state(
+        deflate_state, &filtered, row_bytes, height as usize, level,
+    ).ok()?;
+    
+    let mut ihdr = [0u8; 13];
+    ihdr[0..4].copy_from_slice(&width.to_be_bytes());
+    ihdr[4..8].copy_from_slice(&height.to_be_bytes());
+    ihdr[8] = layout.bit_depth;
+    ihdr[9] = layout.color_type;
+    
+    let mut output = Vec::with_capacity(idat.len() + layout.palette.len() + layout.transparency.len() + 64);
+    output.extend_from_slice(b"\x89PNG\r\n\x1a\n");
+    write_png_chunk(&mut output, b"IHDR", &ihdr);
+    if !layout.palette.is_empty() {
+        write_png_chunk(&mut output, b"PLTE", &layout.palette);
+    }
+    if !layout.transparency.is_empty() {
+        write_png_chunk(&mut output, b"tRNS", &layout.transparency);
+    }
+    write_png_chunk(&mut output, b"IDAT", &idat);
+    write_png_chunk(&mut output, b"IEND", &[]);
+    Some(output)
+}
+
+#[cfg(all(feature = "image", c_hotspots_available))]
+fn write_png_chunk(output: &mut Vec<u8>, tag: &[u8; 4], data: &[u8]) {
+    output.extend_from_slice(&(data.len() as u32).to_be_bytes());
+    let crc_start = output.len();
+    output.extend_from_slice(tag);
+    output.extend_from_slice(data);
+    let crc = png_crc32(&output[crc_start..]);
+    output.extend_from_slice(&crc.to_be_bytes());
+}
+
+#[cfg(all(feature = "image", c_hotspots_available))]
+fn png_crc32(bytes: &[u8]) -> u32 {
+    const TABLE: [u32; 256] = {
+        let mut table = [0u32; 256];
+        let mut n = 0;
+        while n < 256 {
+            let mut c = n as u32;
+            let mut k = 0;
+            while k < 8 {
+                c = if c & 1 != 0 { 0xEDB8_8320 ^ (c >> 1) } else { c >> 1 };
+                k += 1;
+            }
+            table[n] = c;
+            n += 1;
+        }
+        table
+    };
+    
+    let mut crc = 0xFFFF_FFFFu32;
+    for &byte in bytes {
+        crc = TABLE[((crc ^ byte as u32) & 0xFF) as usize] ^ (crc >> 8);
+    }
+    crc ^ 0xFFFF_FFFF
+}
+
+#[cfg(feature = "image")]
+fn encode_png_view(
+    decoded: &DecodedImage,
+    view: PngView,
+    compression_type: CompressionType,
+    filter_type: FilterType,
+) -> Option<Vec<u8>> {
+    let mut output = Vec::new();
+    let encoder = PngEncoder::new_with_quality(&mut output, compression_type, filter_type);
+    let encoded = match view {
+        PngView::Rgb => decoded.rgb8().write_with_encoder(encoder),
+        PngView::AsDecoded => decoded.image().write_with_encoder(encoder),
+        PngView::Luma => decoded.luma8().write_with_encoder(encoder),
+        PngView::Indexed => return None,
+    };
+    encoded.ok().map(|_| output)
+}
+
 #[cfg(feature = "image")]
 fn apply_png_strategy(
-    img: &DynamicImage, 
+    decoded: &DecodedImage, 
     strategy: PNGOptimizationStrategy, 
-    _quality: u8,
-    _config: &ImageOptConfig,
+    quality: u8,
+    config: &ImageOptConfig,
     _original_size: usize
 ) -> PixieResult<Vec<u8>> {
+    let img = decoded.image();
+    
     match strategy {
         PNGOptimizationStrategy::AggressiveReencode { compression_level } => {
-            let mut best_output = Vec::new();
-            let best_size = usize::MAX;
-            
-            let final_img = img;
-            
             let compression_type = match compression_level {
                 1..=6 => CompressionType::Default,
                 7..=8 => CompressionType::Best,
@@ -157,62 +459,32 @@ fn apply_png_strategy(
                 FilterType::Paeth,
             ];
             
-            for filter_type in filter_types {
-                if let DynamicImage::ImageRgba8(rgba_img) = final_img {
-                    let has_transparency = rgba_img.pixels().any(|p| p[3] < 255);
-                    
-                    if !has_transparency {
-                        let mut rgb_output = Vec::new();
-                        let rgb_encoder = PngEncoder::new_with_quality(&mut rgb_output, compression_type, filter_type);
-                        let rgb_img = final_img.to_rgb8();
-                        
-                        if rgb_img.write_with_encoder(rgb_encoder).is_ok() && rgb_output.len() < best_size {
-                            best_output = rgb_output;
-                        }
-                    }
-                }
-                
-                let mut compressed_output = Vec::new();
-                let encoder = PngEncoder::new_with_quality(&mut compressed_output, compression_type, filter_type);
-                
-                if img.write_with_encoder(encoder).is_ok() && compressed_output.len() < best_size {
-                    best_output = compressed_output;
-                }
-                
-                let has_any_transparency = match img {
-                    DynamicImage::ImageRgba8(rgba_img) => rgba_img.pixels().any(|p| p[3] < 255),
-                    DynamicImage::ImageRgba16(rgba_img) => rgba_img.pixels().any(|p| p[3] < u16::MAX),
-                    _ => false,
-                };
-                
-                if !has_any_transparency {
-                    let mut gray_output = Vec::new();
-                    let gray_encoder = PngEncoder::new_with_quality(&mut gray_output, compression_type, filter_type);
-                    let gray_img = img.to_luma8();
-                    
-                    if gray_img.write_with_encoder(gray_encoder).is_ok() && gray_output.len() < best_size {
-                        best_output = gray_output;
-                    }
-                }
-            }
+            let heuristic_output = if config.exhaustive_png_filters {
+                None
+            } else {
+                reencode_with_filter_heuristic(decoded, compression_type)
+            };
             
-            if best_output.is_empty() {
-                let mut fallback_output = Vec::new();
-                let fallback_encoder = PngEncoder::new_with_quality(&mut fallback_output, CompressionType::Best, FilterType::Adaptive);
-                img.write_with_encoder(fallback_encoder)
-                    .map_err(|e| crate::types::PixieError::ProcessingError(
-                        format!("PNG aggressive fallback re-encoding failed: {}", e)
-                    ))?;
-                best_output = fallback_output;
-            }
+            let best_output = heuristic_output.or_else(|| candidates::smallest(
+                png_reencode_candidates(decoded, &filter_types),
+                |(filter_type, view)| encode_png_view(decoded, view, compression_type, filter_type),
+            ));
             
-            Ok(best_output)
+            match best_output {
+                Some(output) => Ok(output),
+                None => {
+                    let mut fallback_output = Vec::new();
+                    let fallback_encoder = PngEncoder::new_with_quality(&mut fallback_output, CompressionType::Best, FilterType::Adaptive);
+                    img.write_with_encoder(fallback_encoder)
+                        .map_err(|e| crate::types::PixieError::ProcessingError(
+                            format!("PNG aggressive fallback re-encoding failed: {}", e)
+                        ))?;
+                    Ok(fallback_output)
+                }
+            }
         },
         
         PNGOptimizationStrategy::ReencodePNG { compression_level } => {
-            let mut best_output = Vec::new();
-            let best_size = usize::MAX;
-            
             let compression_type = match compression_level {
                 1..=3 => CompressionType::Fast,
                 4..=6 => CompressionType::Default,
@@ -220,56 +492,23 @@ fn apply_png_strategy(
                 _ => CompressionType::Default,
             };
             
-            let mut compressed_output = Vec::new();
-            let encoder = PngEncoder::new_with_quality(&mut compressed_output, compression_type, FilterType::Adaptive);
-            
-            if img.write_with_encoder(encoder).is_ok() && !compressed_output.is_empty() {
-                if compressed_output.len() < best_size {
-                    best_output = compressed_output;
-                }
-            }
+            let best_output = candidates::smallest(
+                png_reencode_candidates(decoded, &[FilterType::Adaptive]),
+                |(filter_type, view)| encode_png_view(decoded, view, compression_type, filter_type),
+            );
             
-            if let DynamicImage::ImageRgba8(rgba_img) = img {
-                let has_transparency = rgba_img.pixels().any(|p| p[3] < 255);
-                
-                if !has_transparency {
-                    let mut rgb_output = Vec::new();
-                    let rgb_encoder = PngEncoder::new_with_quality(&mut rgb_output, compression_type, FilterType::Adaptive);
-                    let rgb_img = img.to_rgb8();
-                    
-                    if rgb_img.write_with_encoder(rgb_encoder).is_ok() && rgb_output.len() < best_size {
-                        best_output = rgb_output;
-                    }
+            match best_output {
+                Some(output) => Ok(output),
+                None => {
+                    let mut fallback_output = Vec::new();
+                    let fallback_encoder = PngEncoder::new_with_quality(&mut fallback_output, CompressionType::Best, FilterType::Adaptive);
+                    img.write_with_encoder(fallback_encoder)
+                        .map_err(|e| crate::types::PixieError::ProcessingError(
+                            format!("PNG fallback re-encoding failed: {}", e)
+                        ))?;
+                    Ok(fallback_output)
                 }
             }
-            
-            let has_any_transparency = match img {
-                DynamicImage::ImageRgba8(rgba_img) => rgba_img.pixels().any(|p| p[3] < 255),
-                DynamicImage::ImageRgba16(rgba_img) => rgba_img.pixels().any(|p| p[3] < u16::MAX),
-                _ => false,
-            };
-            
-            if !has_any_transparency {
-                let mut gray_output = Vec::new();
-                let gray_encoder = PngEncoder::new_with_quality(&mut gray_output, compression_type, FilterType::Adaptive);
-                let gray_img = img.to_luma8();
-                
-                if gray_img.write_with_encoder(gray_encoder).is_ok() && gray_output.len() < best_size {
-                    best_output = gray_output;
-                }
-            }
-            
-            if best_output.is_empty() {
-                let mut fallback_output = Vec::new();
-                let fallback_encoder = PngEncoder::new_with_quality(&mut fallback_output, CompressionType::Best, FilterType::Adaptive);
-                img.write_with_encoder(fallback_encoder)
-                    .map_err(|e| crate::types::PixieError::ProcessingError(
-                        format!("PNG fallback re-encoding failed: {}", e)
-                    ))?;
-                best_output = fallback_output;
-            }
-            
-            Ok(best_output)
         },
         
         PNGOptimizationStrategy::ConvertToJPEG { jpeg_quality } => {
@@ -283,8 +522,7 @@ fn apply_png_strategy(
             let mut output = Vec::new();
             let encoder = image::codecs::jpeg::JpegEncoder::new_with_quality(&mut output, ultra_aggressive_quality);
             
-            let rgb_img = img.to_rgb8();
-            rgb_img.write_with_encoder(encoder)
+            decoded.rgb8().write_with_encoder(encoder)
                 .map_err(|e| crate::types::PixieError::ProcessingError(
                     format!("PNG to JPEG conversion failed: {}", e)
                 ))?;
@@ -324,7 +562,7 @@ fn apply_png_strategy(
             {
                 use color_quant::NeuQuant;
                 
-                let rgba_img = img.to_rgba8();
+                let rgba_img = decoded.rgba8();
                 let rgba_data = rgba_img.as_raw();
                 
                 let nq = NeuQuant::new(10, 128, rgba_data);
@@ -353,6 +591,8 @@ fn apply_png_strategy(
                 Ok(output)
             }
         },
+        
+        PNGOptimizationStrategy::ColorQuantization => apply_aggressive_color_quantization(decoded, quality),
     }
 }
 
@@ -362,16 +602,8 @@ pub fn optimize_png(data: &[u8], quality: u8) -> OptResult<Vec<u8>> {
 }
 
 #[cfg(feature = "image")]
-fn apply_aggressive_color_quantization(img: &DynamicImage, quality: u8) -> PixieResult<Vec<u8>> {
-    let has_transparency = match img {
-        DynamicImage::ImageRgba8(rgba_img) => {
-            rgba_img.pixels().any(|p| p[3] < 255)
-        },
-        DynamicImage::ImageRgba16(rgba_img) => {
-            rgba_img.pixels().any(|p| p[3] < u16::MAX)
-        },
-        _ => false,
-    };
+fn apply_aggressive_color_quantization(decoded: &DecodedImage, quality: u8) -> PixieResult<Vec<u8>> {
+    let has_transparency = decoded.has_alpha();
     
     if quality <= 30 && !has_transparency {
         let mut output = Vec::new();
@@ -381,8 +613,7 @@ fn apply_aggressive_color_quantization(img: &DynamicImage, quality: u8) -> Pixie
             image::codecs::png::FilterType::Adaptive
         );
         
-        let gray_img = img.to_luma8();
-        gray_img.write_with_encoder(encoder)
+        decoded.luma8().write_with_encoder(encoder)
             .map_err(|e| crate::types::PixieError::ProcessingError(
                 format!("Failed to encode grayscale PNG: {}", e)
             ))?;
@@ -398,8 +629,7 @@ fn apply_aggressive_color_quantization(img: &DynamicImage, quality: u8) -> Pixie
             image::codecs::png::FilterType::Adaptive
         );
         
-        let rgb_img = img.to_rgb8();
-        rgb_img.write_with_encoder(encoder)
+        decoded.rgb8().write_with_encoder(encoder)
             .map_err(|e| crate::types::PixieError::ProcessingError(
                 format!("Failed to encode RGB PNG: {}", e)
             ))?;
@@ -414,7 +644,7 @@ fn apply_aggressive_color_quantization(img: &DynamicImage, quality: u8) -> Pixie
         image::codecs::png::FilterType::Adaptive
     );
     
-    img.write_with_encoder(encoder)
+    decoded.image().write_with_encoder(encoder)
         .map_err(|e| crate::types::PixieError::ProcessingError(
             format!("Failed to encode PNG with max compression: {}", e)
         ))?;
@@ -494,3 +724,56 @@ pub fn convert_any_format_to_png(data: &[u8]) -> PixieResult<Vec<u8>> {
 }
 
 
+// The heuristic needs the C kernel, so these run on wasm32 through
+// wasm-bindgen-test-runner: cargo test --target wasm32-unknown-unknown
+#[cfg(all(test, feature = "image", c_hotspots_available))]
+mod tests {
+    use super::*;
+    use image::{ImageEncoder, RgbImage};
+    use wasm_bindgen_test::wasm_bindgen_test;
+
+    // Gradients with a little LCG noise, so no single filter wins every row.
+    fn gradient_png(width: u32, height: u32) -> Vec<u8> {
+        let mut state = 0x0123_4567u32;
+        let img = RgbImage::from_fn(width, height, |x, y| {
+            state = state.wrapping_mul(1_664_525).wrapping_add(1_013_904_223);
+            let noise = (state >> 29) as u8;
+            image::Rgb([
+                (x * 2 + y) as u8,
+                ((y * 3 + ((x * y) >> 6)) as u8).wrapping_add(noise),
+                ((((x ^ y) & 0x1F) * 4) as u8).wrapping_add(noise >> 1),
+            ])
+        });
+        let mut png = Vec::new();
+        PngEncoder::new_with_quality(&mut png, CompressionType::Fast, FilterType::NoFilter)
+            .write_image(img.as_raw(), width, height, image::ExtendedColorType::Rgb8)
+            .unwrap();
+        png
+    }
+
+    #[wasm_bindgen_test]
+    fn test_filter_heuristic_within_one_percent_of_exhaustive() {
+        let png = gradient_png(128, 96);
+        let decoded = DecodedImage::decode(&png).unwrap();
+        let filters = [
+            FilterType::Adaptive,
+            FilterType::NoFilter,
+            FilterType::Sub,
+            FilterType::Up,
+            FilterType::Avg,
+            FilterType::Paeth,
+        ];
+
+        let heuristic = reencode_with_filter_heuristic(&decoded, CompressionType::Best).unwrap();
+        let exhaustive = candidates::smallest(
+            png_reencode_candidates(&decoded, &filters),
+            |(filter_type, view)| encode_png_view(&decoded, view, CompressionType::Best, filter_type),
+        ).unwrap();
+
+        assert!(
+            heuristic.len() * 100 <= exhaustive.len() * 101,
+            "heuristic {} bytes vs exhaustive {} bytes", heuristic.len(), exhaustive.len()
+        );
+        assert_eq!(load_from_memory(&heuristic).unwrap().to_rgb8(), decoded.image().to_rgb8());
+    }
+}
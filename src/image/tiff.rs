@@ -3,7 +3,9 @@ use alloc::{vec::Vec, string::ToString, format};
 
 use crate::types::{PixieResult, ImageOptConfig, PixieError, OptResult, OptError};
 use crate::c_hotspots::{
-    compress_tiff_lzw_c_hotspot, 
+    encode_tiff_c_hotspot,
+    TIFF_COMPRESSION_LZW,
+    TIFF_COMPRESSION_ADOBE_DEFLATE,
     strip_tiff_metadata_c_hotspot,
     apply_tiff_predictor_c_hotspot,
     optimize_tiff_colorspace_c_hotspot
@@ -11,6 +13,8 @@ use crate::c_hotspots::{
 
 #[cfg(feature = "image")]
 use image::{load_from_memory, DynamicImage};
+#[cfg(feature = "image")]
+use super::decoded::DecodedImage;
 
 pub fn optimize_tiff_rust(data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
     optimize_tiff_with_config(data, quality, &ImageOptConfig::default())
@@ -33,27 +37,16 @@ pub fn optimize_tiff_with_config(data: &[u8], quality: u8, config: &ImageOptConf
             }
         };
         
-        let strategies = get_tiff_optimization_strategies(quality, &img, config);
-        
-        let mut best_result = data.to_vec();
+        let decoded = DecodedImage::from_image(data, img);
+        let strategies = get_tiff_optimization_strategies(quality, &decoded, config);
         
-        for strategy in strategies {
-            match apply_tiff_strategy(&img, strategy, quality, config) {
-                Ok(optimized) => {
-                    if optimized.len() < best_result.len() {
-                        best_result = optimized;
-                    }
-                },
-                Err(_) => {
-                    continue;
-                }
-            }
-        }
+        let best_result = super::candidates::smallest(strategies, |strategy| {
+            apply_tiff_strategy(&decoded, strategy, quality, config).ok()
+        });
         
-        if best_result.len() < data.len() {
-            Ok(best_result)
-        } else {
-            Ok(data.to_vec())
+        match best_result {
+            Some(best) if best.len() < data.len() => Ok(best),
+            _ => Ok(data.to_vec()),
         }
     }
     
@@ -69,24 +62,26 @@ fn optimize_tiff_safe_fallback(data: &[u8], quality: u8, _config: &ImageOptConfi
     {
         match load_from_memory(data) {
             Ok(img) => {
+                let decoded = DecodedImage::from_image(data, img);
+                let img = decoded.image();
                 let mut best_result = data.to_vec();
                 
                 if quality >= 70 {
-                    if let Ok(png_data) = convert_to_png_safe(&img) {
+                    if let Ok(png_data) = convert_to_png_safe(img) {
                         if png_data.len() < best_result.len() {
                             best_result = png_data;
                         }
                     }
                 }
                 
-                if quality < 85 && !has_transparency_check(&img) {
+                if quality < 85 && !decoded.has_alpha() {
                     let jpeg_quality = match quality {
                         0..=30 => 50,
                         31..=50 => 70,
                         51..=70 => 80,
                         _ => 90,
                     };
-                    if let Ok(jpeg_data) = convert_to_jpeg_safe(&img, jpeg_quality) {
+                    if let Ok(jpeg_data) = convert_to_jpeg_safe(img, jpeg_quality) {
                         if jpeg_data.len() < best_result.len() {
                             best_result = jpeg_data;
                         }
@@ -134,29 +129,11 @@ fn convert_to_jpeg_safe(img: &DynamicImage, jpeg_quality: u8) -> PixieResult<Vec
     Ok(output)
 }
 
-#[cfg(feature = "image")]
-fn has_transparency_check(img: &DynamicImage) -> bool {
-    match img {
-        DynamicImage::ImageRgba8(rgba_img) => {
-            let total_pixels = rgba_img.pixels().len();
-            let sample_step = (total_pixels / 100).max(1);
-            
-            rgba_img.pixels().step_by(sample_step).any(|p| p[3] < 255)
-        },
-        DynamicImage::ImageRgba16(rgba_img) => {
-            let total_pixels = rgba_img.pixels().len();
-            let sample_step = (total_pixels / 100).max(1);
-            
-            rgba_img.pixels().step_by(sample_step).any(|p| p[3] < u16::MAX)
-        },
-        _ => false,
-    }
-}
-
 #[cfg(feature = "image")]
 #[derive(Debug, Clone)]
 enum TIFFOptimizationStrategy {
     LZWCompressionCHotspot,
+    DeflateCompressionCHotspot { level: i32 },
     LZWCompression,
     JPEGCompression { jpeg_quality: u8 },
     StripMetadataCHotspot,
@@ -169,23 +146,19 @@ enum TIFFOptimizationStrategy {
 }
 
 #[cfg(feature = "image")]
-fn get_tiff_optimization_strategies(quality: u8, img: &DynamicImage, config: &ImageOptConfig) -> Vec<TIFFOptimizationStrategy> {
+fn get_tiff_optimization_strategies(quality: u8, decoded: &DecodedImage, config: &ImageOptConfig) -> Vec<TIFFOptimizationStrategy> {
     let mut strategies = Vec::new();
     
-    let has_transparency = match img {
-        DynamicImage::ImageRgba8(rgba_img) => {
-            rgba_img.pixels().any(|p| p[3] < 255)
-        },
-        DynamicImage::ImageRgba16(rgba_img) => {
-            rgba_img.pixels().any(|p| p[3] < u16::MAX)
-        },
-        _ => false,
-    };
+    let has_transparency = decoded.has_alpha();
     
     strategies.push(TIFFOptimizationStrategy::StripMetadataCHotspot);
     
-    if config.lossless || quality >= 80 {
+    if (config.lossless || quality >= 80) && decoded.is_8bit() {
         strategies.push(TIFFOptimizationStrategy::LZWCompressionCHotspot);
+        strategies.push(TIFFOptimizationStrategy::DeflateCompressionCHotspot { level: 6 });
+    }
+    
+    if config.lossless || quality >= 80 {
         strategies.push(TIFFOptimizationStrategy::ApplyPredictorCHotspot { predictor_type: 2 });
     }
     
@@ -239,30 +212,25 @@ fn get_tiff_optimization_strategies(quality: u8, img: &DynamicImage, config: &Im
 
 #[cfg(feature = "image")]
 fn apply_tiff_strategy(
-    img: &DynamicImage, 
+    decoded: &DecodedImage, 
     strategy: TIFFOptimizationStrategy, 
     quality: u8,
     _config: &ImageOptConfig
 ) -> PixieResult<Vec<u8>> {
+    let img = decoded.image();
     match strategy {
         TIFFOptimizationStrategy::LZWCompressionCHotspot => {
-            #[cfg(target_arch = "wasm32")]
-            {
-                apply_tiff_strategy(img, TIFFOptimizationStrategy::LZWCompression, quality, _config)
-            }
-            #[cfg(not(target_arch = "wasm32"))]
-            {
-                let rgba_img = img.to_rgba8();
-                let (width, height) = (rgba_img.width() as usize, rgba_img.height() as usize);
-                
-                compress_tiff_lzw_c_hotspot(rgba_img.as_raw(), width, height, quality)
-            }
+            encode_tiff_strips(decoded, TIFF_COMPRESSION_LZW, 0)
+        },
+        
+        TIFFOptimizationStrategy::DeflateCompressionCHotspot { level } => {
+            encode_tiff_strips(decoded, TIFF_COMPRESSION_ADOBE_DEFLATE, level)
         },
         
         TIFFOptimizationStrategy::StripMetadataCHotspot => {
             #[cfg(target_arch = "wasm32")]
             {
-                apply_tiff_strategy(img, TIFFOptimizationStrategy::StripMetadata, quality, _config)
+                apply_tiff_strategy(decoded, TIFFOptimizationStrategy::StripMetadata, quality, _config)
             }
             #[cfg(not(target_arch = "wasm32"))]
             {
@@ -438,6 +406,22 @@ fn apply_tiff_strategy(
     }
 }
 
+/// Lossless strip-parallel TIFF of an 8-bit image with only the samples its content
+/// needs: alpha is dropped when every pixel is opaque, colour when every pixel is gray.
+#[cfg(feature = "image")]
+fn encode_tiff_strips(decoded: &DecodedImage, compression: i32, level: i32) -> PixieResult<Vec<u8>> {
+    let (width, height) = (decoded.width() as usize, decoded.height() as usize);
+    match (decoded.is_grayscale(), decoded.has_alpha()) {
+        (true, false) => encode_tiff_c_hotspot(decoded.luma8().as_raw(), width, height, 1, compression, level),
+        (true, true) => {
+            let luma_alpha = decoded.image().to_luma_alpha8();
+            encode_tiff_c_hotspot(luma_alpha.as_raw(), width, height, 2, compression, level)
+        },
+        (false, false) => encode_tiff_c_hotspot(decoded.rgb8().as_raw(), width, height, 3, compression, level),
+        (false, true) => encode_tiff_c_hotspot(decoded.rgba8().as_raw(), width, height, 4, compression, level),
+    }
+}
+
 pub fn is_tiff(data: &[u8]) -> bool {
     if data.len() < 4 {
         return false;
@@ -33,7 +33,9 @@ pub fn optimize_webp_with_config(data: &[u8], quality: u8, _config: &ImageOptCon
             return optimize_animated_webp_native(data, quality);
         }
         
-        match reencode_webp_native_quality(data, quality) {
+        let reencoded = super::decoded::DecodedImage::decode(data)
+            .and_then(|decoded| reencode_webp_native_quality(&decoded, quality));
+        match reencoded {
             Ok(reencoded) if reencoded.len() < data.len() => {
                 let compression = ((data.len() - reencoded.len()) as f64 / data.len() as f64) * 100.0;
                 #[cfg(target_arch = "wasm32")]
@@ -220,20 +222,23 @@ pub fn optimize_webp_with_config(data: &[u8], quality: u8, _config: &ImageOptCon
 }
 
 
-fn reencode_webp_native_quality(data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
-    use image::load_from_memory;
-    
+fn reencode_webp_native_quality(decoded: &super::decoded::DecodedImage, quality: u8) -> PixieResult<Vec<u8>> {
     #[cfg(target_arch = "wasm32")]
     crate::image::log_to_console(&format!("Re-encoding WebP with native quality {}", quality));
     
-    let img = load_from_memory(data)
-        .map_err(|e| PixieError::ImageDecodingFailed(format!("WebP decode failed: {}", e)))?;
+    let data = decoded.data();
+    let img = decoded.image();
+    
+    // The JPEG round trip drops alpha and smears flat artwork, so translucent or
+    // palette-sized images go straight to the lossless encoder.
+    let jpeg_safe = !decoded.has_alpha()
+        && !decoded.analysis().fits_palette(crate::c_hotspots::ImageAnalysis::PALETTE_COLORS);
     
-    if quality < 85 {
+    if quality < 85 && jpeg_safe {
         #[cfg(target_arch = "wasm32")]
         crate::image::log_to_console("Using JPEG intermediate strategy for lossy WebP compression");
         
-        match convert_webp_via_jpeg_lossy(&img, quality) {
+        match convert_webp_via_jpeg_lossy(img, quality) {
             Ok(compressed) if compressed.len() < data.len() => {
                 let savings = ((data.len() - compressed.len()) as f64 / data.len() as f64) * 100.0;
                 #[cfg(target_arch = "wasm32")]
@@ -257,7 +262,7 @@ fn reencode_webp_native_quality(data: &[u8], quality: u8) -> PixieResult<Vec<u8>
         #[cfg(target_arch = "wasm32")]
         crate::image::log_to_console("Fallback: aggressive preprocessing + lossless WebP");
         
-        let processed_img = apply_aggressive_webp_preprocessing(&img, quality)?;
+        let processed_img = apply_aggressive_webp_preprocessing(img, quality)?;
         let mut output = Vec::new();
         let encoder = image::codecs::webp::WebPEncoder::new_lossless(&mut output);
         processed_img.write_with_encoder(encoder)
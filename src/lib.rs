@@ -8,6 +8,23 @@ use core::sync::atomic::{AtomicBool, Ordering};
 
 static TRACING_INIT: AtomicBool = AtomicBool::new(false);
 
+#[cfg(feature = "threads")]
+extern crate std;
+
+#[cfg(all(feature = "threads", target_arch = "wasm32"))]
+pub use wasm_bindgen_rayon::init_thread_pool;
+
+// Native builds get rayon's default pool for free. In the browser the pool only exists
+// once JS has awaited initThreadPool and called set_parallel_strategies(true).
+#[cfg(feature = "threads")]
+static PARALLEL_STRATEGIES: AtomicBool = AtomicBool::new(!cfg!(target_arch = "wasm32"));
+
+/// Whether strategy lists may be fanned out over the rayon pool.
+#[cfg(feature = "threads")]
+pub(crate) fn threads_available() -> bool {
+    PARALLEL_STRATEGIES.load(Ordering::Relaxed) && rayon::current_num_threads() > 1
+}
+
 #[cfg(feature = "dlmalloc")]
 extern crate dlmalloc;
 
@@ -25,6 +42,8 @@ pub mod common;
 pub mod user_feedback;
 pub mod c_hotspots;
 pub mod benchmarks;
+pub mod cache;
+pub mod block_compress;
 
 pub use config::*;
 pub use types::*;
@@ -71,52 +90,108 @@ pub fn init() {
 
 #[wasm_bindgen]
 pub fn optimize_image(data: &[u8], quality: u8) -> Result<Vec<u8>, JsValue> {
+    run_optimize_image(data, quality)
+}
+
+#[wasm_bindgen]
+pub fn optimize_mesh(data: &[u8], target_ratio: Option<f32>) -> Result<Vec<u8>, JsValue> {
     if data.is_empty() {
         return Err(JsValue::from_str("Input data is empty"));
     }
     
     let optimizer = PixieOptimizer::new();
-    optimizer.optimize_image(data, quality)
+    let _target_faces = target_ratio.map(|ratio| (1000.0 * ratio) as u32);
+    optimizer.optimize_mesh(data)
         .map_err(|e| JsValue::from_str(&format!("{}", e)))
 }
 
 #[wasm_bindgen]
-pub fn optimize_mesh(data: &[u8], target_ratio: Option<f32>) -> Result<Vec<u8>, JsValue> {
+pub fn optimize_auto(data: &[u8], quality: u8) -> Result<Vec<u8>, JsValue> {
+    run_optimize_auto(data, quality)
+}
+
+fn run_optimize_image(data: &[u8], quality: u8) -> Result<Vec<u8>, JsValue> {
     if data.is_empty() {
         return Err(JsValue::from_str("Input data is empty"));
     }
     
     let optimizer = PixieOptimizer::new();
-    let _target_faces = target_ratio.map(|ratio| (1000.0 * ratio) as u32);
-    optimizer.optimize_mesh(data)
+    optimizer.optimize_image(data, quality)
         .map_err(|e| JsValue::from_str(&format!("{}", e)))
 }
 
-#[wasm_bindgen]
-pub fn optimize_auto(data: &[u8], quality: u8) -> Result<Vec<u8>, JsValue> {
+fn run_optimize_auto(data: &[u8], quality: u8) -> Result<Vec<u8>, JsValue> {
     if data.is_empty() {
         return Err(JsValue::from_str("Input data is empty"));
     }
     
     wasm_utils::log_message(&format!("🧪 DEBUG: optimize_auto called with {} bytes, quality {}", data.len(), quality));
     
-    // CRITICAL: Size-based bypass to prevent compress_lz4 errors on large files
-    let data_size = data.len();
-    if data_size > 10_485_760 {
-        wasm_utils::log_message(&format!("🚀 LARGE FILE BYPASS: {}MB - using safe path to avoid compress_lz4", data_size / 1_048_576));
-        
-        let optimizer = PixieOptimizer::new();
-        optimizer.optimize_image(data, quality)
-            .map_err(|e| JsValue::from_str(&format!("{}", e)))
-    } else {
-        wasm_utils::log_message(&format!("📦 NORMAL PATH: {}MB - using optimize_auto", data_size / 1_048_576));
-        
-        let optimizer = PixieOptimizer::new();
-        optimizer.optimize_auto(data, quality)
-            .map_err(|e| JsValue::from_str(&format!("{}", e)))
+    let optimizer = PixieOptimizer::new();
+    optimizer.optimize_auto(data, quality)
+        .map_err(|e| JsValue::from_str(&format!("{}", e)))
+}
+
+// Zero-copy ABI. JS asks for an input buffer with `alloc_buffer`, writes the file
+// straight into wasm memory, calls `optimize_*_ptr` and reads the result through
+// `new Uint8Array(memory.buffer, out.ptr, out.len)` before calling `out.free()`.
+// The input buffer is released separately with `free_buffer` so it can be reused
+// for another quality setting without copying the file in again.
+
+/// Optimized bytes owned by wasm memory until JS calls `free()`.
+#[wasm_bindgen]
+pub struct OptimizedBuffer {
+    data: Vec<u8>,
+}
+
+#[wasm_bindgen]
+impl OptimizedBuffer {
+    #[wasm_bindgen(getter)]
+    pub fn ptr(&self) -> *const u8 {
+        self.data.as_ptr()
+    }
+
+    #[wasm_bindgen(getter)]
+    pub fn len(&self) -> usize {
+        self.data.len()
+    }
+}
+
+#[wasm_bindgen]
+pub fn alloc_buffer(len: usize) -> *mut u8 {
+    let mut buffer = Vec::<u8>::with_capacity(len.max(1));
+    let ptr = buffer.as_mut_ptr();
+    core::mem::forget(buffer);
+    ptr
+}
+
+/// Releases a buffer from `alloc_buffer`; `len` must be the length it was allocated with.
+#[wasm_bindgen]
+pub fn free_buffer(ptr: *mut u8, len: usize) {
+    if !ptr.is_null() {
+        unsafe { drop(Vec::from_raw_parts(ptr, 0, len.max(1))) };
     }
 }
 
+fn input_from_raw<'a>(ptr: *const u8, len: usize) -> Result<&'a [u8], JsValue> {
+    if ptr.is_null() || len == 0 {
+        return Err(JsValue::from_str("Input data is empty"));
+    }
+    Ok(unsafe { core::slice::from_raw_parts(ptr, len) })
+}
+
+#[wasm_bindgen]
+pub fn optimize_auto_ptr(ptr: *const u8, len: usize, quality: u8) -> Result<OptimizedBuffer, JsValue> {
+    let data = input_from_raw(ptr, len)?;
+    run_optimize_auto(data, quality).map(|data| OptimizedBuffer { data })
+}
+
+#[wasm_bindgen]
+pub fn optimize_image_ptr(ptr: *const u8, len: usize, quality: u8) -> Result<OptimizedBuffer, JsValue> {
+    let data = input_from_raw(ptr, len)?;
+    run_optimize_image(data, quality).map(|data| OptimizedBuffer { data })
+}
+
 #[wasm_bindgen]
 pub fn version() -> String {
     env!("CARGO_PKG_VERSION").to_string()
@@ -146,6 +221,12 @@ pub fn get_performance_metrics() -> JsValue {
         .unwrap_or(JsValue::NULL)
 }
 
+#[wasm_bindgen]
+pub fn get_processing_stats() -> JsValue {
+    serde_wasm_bindgen::to_value(&optimizers::get_processing_stats())
+        .unwrap_or(JsValue::NULL)
+}
+
 #[wasm_bindgen]
 pub fn reset_performance_stats() {
     optimizers::reset_performance_stats();
@@ -158,7 +239,10 @@ pub fn check_performance_compliance() -> bool {
 
 #[wasm_bindgen]
 pub fn optimize_png(data: &[u8], quality: u8) -> Result<Vec<u8>, JsValue> {
-    crate::image::png::optimize_png_rust(data, quality)
+    use crate::types::ImageOptConfig;
+    let mut config = ImageOptConfig::default();
+    config.quality = quality;
+    crate::image::png::optimize_png_with_config(data, quality, &config)
         .map_err(|e| JsValue::from_str(&format!("{}", e)))
 }
 
@@ -338,6 +422,113 @@ pub fn set_preserve_metadata(enabled: bool) -> JsValue {
         .unwrap_or(JsValue::NULL)
 }
 
+#[wasm_bindgen]
+pub fn set_hotspot_memory_limit(limit_mb: u32) -> JsValue {
+    c_hotspots::memory::set_heap_limit((limit_mb as usize).saturating_mul(1024 * 1024));
+    serde_wasm_bindgen::to_value(&format!("Hotspot memory limit: {} MB", limit_mb))
+        .unwrap_or(JsValue::NULL)
+}
+
+#[wasm_bindgen]
+pub fn set_result_cache_limit(limit_mb: u32) -> JsValue {
+    cache::set_limit((limit_mb as usize).saturating_mul(1024 * 1024));
+    serde_wasm_bindgen::to_value(&format!("Result cache limit: {} MB", limit_mb))
+        .unwrap_or(JsValue::NULL)
+}
+
+#[wasm_bindgen]
+pub fn clear_result_cache() {
+    cache::clear();
+}
+
+#[wasm_bindgen]
+pub fn get_result_cache_usage() -> u32 {
+    cache::usage() as u32
+}
+
+/// Block-parallel compression of arbitrary bytes into a seekable container; LZ4 by
+/// default, deflate for smaller output.
+#[wasm_bindgen]
+pub fn compress_blocks(data: &[u8], use_deflate: bool) -> Result<Vec<u8>, JsValue> {
+    let method = if use_deflate { block_compress::BlockMethod::Deflate } else { block_compress::BlockMethod::Lz4 };
+    block_compress::compress(data, method, block_compress::DEFAULT_BLOCK_SIZE)
+        .map_err(|e| JsValue::from_str(&format!("{}", e)))
+}
+
+#[wasm_bindgen]
+pub fn decompress_blocks(data: &[u8]) -> Result<Vec<u8>, JsValue> {
+    block_compress::decompress(data)
+        .map_err(|e| JsValue::from_str(&format!("{}", e)))
+}
+
+/// Shared dictionary for many small, similar assets (SVG icons, glTF JSON, OBJ
+/// headers), where a generic compressor has too little input to find repeats in.
+#[wasm_bindgen]
+pub struct PixieDictionary {
+    inner: c_hotspots::compression::Dictionary,
+}
+
+#[wasm_bindgen]
+impl PixieDictionary {
+    /// Loads `to_bytes()` output, or uses any other bytes as raw dictionary content.
+    #[wasm_bindgen(constructor)]
+    pub fn new(bytes: &[u8]) -> Result<PixieDictionary, JsValue> {
+        c_hotspots::compression::Dictionary::from_bytes(bytes)
+            .map(|inner| PixieDictionary { inner })
+            .map_err(|e| JsValue::from_str(&format!("{}", e)))
+    }
+
+    /// Trains on `samples`, a concatenation of representative inputs.
+    pub fn train(samples: &[u8], max_size: usize) -> Result<PixieDictionary, JsValue> {
+        c_hotspots::compression::Dictionary::train(samples, max_size)
+            .map(|inner| PixieDictionary { inner })
+            .map_err(|e| JsValue::from_str(&format!("{}", e)))
+    }
+
+    /// `"svg"` or `"gltf"`.
+    pub fn builtin(name: &str) -> Result<PixieDictionary, JsValue> {
+        let kind = match name {
+            "svg" => c_hotspots::BuiltinDictionary::Svg,
+            "gltf" | "gltf-json" => c_hotspots::BuiltinDictionary::GltfJson,
+            _ => return Err(JsValue::from_str(&format!("Unknown built-in dictionary: {}", name))),
+        };
+        c_hotspots::compression::Dictionary::builtin(kind)
+            .map(|inner| PixieDictionary { inner })
+            .map_err(|e| JsValue::from_str(&format!("{}", e)))
+    }
+
+    pub fn to_bytes(&self) -> Vec<u8> {
+        self.inner.to_bytes()
+    }
+
+    #[wasm_bindgen(getter)]
+    pub fn id(&self) -> u32 {
+        self.inner.id()
+    }
+
+    pub fn compress(&self, data: &[u8]) -> Result<Vec<u8>, JsValue> {
+        self.inner.compress(data).map_err(|e| JsValue::from_str(&format!("{}", e)))
+    }
+
+    pub fn decompress(&self, data: &[u8]) -> Result<Vec<u8>, JsValue> {
+        self.inner.decompress(data).map_err(|e| JsValue::from_str(&format!("{}", e)))
+    }
+}
+
+#[wasm_bindgen]
+pub fn get_hotspot_memory_reserved() -> u32 {
+    c_hotspots::memory::heap_reserved() as u32
+}
+
+#[wasm_bindgen]
+pub fn set_parallel_strategies(enabled: bool) -> JsValue {
+    let enabled = enabled && cfg!(feature = "threads");
+    #[cfg(feature = "threads")]
+    PARALLEL_STRATEGIES.store(enabled, Ordering::Relaxed);
+    serde_wasm_bindgen::to_value(&format!("Parallel strategies: {}", enabled))
+        .unwrap_or(JsValue::NULL)
+}
+
 #[wasm_bindgen]
 pub fn optimize_obj(data: &[u8], reduction_ratio: f32) -> Result<Vec<u8>, JsValue> {
     use crate::types::MeshOptConfig;
@@ -25,6 +25,10 @@ impl MeshOptimizer {
         Self { config }
     }
 
+    pub fn config(&self) -> &MeshOptConfig {
+        &self.config
+    }
+
     pub fn optimize(&self, data: &[u8]) -> OptResult<Vec<u8>> {
         let format = detect_mesh_format(data)?;
         
@@ -2,7 +2,8 @@ extern crate alloc;
 use alloc::{vec::Vec, format, string::ToString};
 use core::sync::atomic::{AtomicBool, AtomicU64, AtomicU32, Ordering};
 
-use crate::types::{PixieResult, PixieError, ImageOptConfig, MeshOptConfig};
+use crate::types::{PixieResult, PixieError, ImageOptConfig, MeshOptConfig, ProcessingStats};
+use crate::cache::{self, CachedOperation};
 use crate::image::{ImageOptimizer, detect_image_format};
 use crate::mesh::{MeshOptimizer, detect_mesh_format};
 use serde::{Deserialize, Serialize};
@@ -133,6 +134,19 @@ const SMALL_FILE_TARGET_MS: f64 = 100.0;
 #[cfg(target_arch = "wasm32")]
 const MEMORY_TARGET_MB: f64 = 256.0; // 256MB memory target for WASM
 
+/// Below this confidence a compressibility prediction is not trusted to skip an attempt.
+#[cfg(c_hotspots_available)]
+const MIN_PREDICTION_CONFIDENCE: f32 = 0.5;
+
+/// Whether compressing `output` is predicted to get it under `max_ratio` of its size.
+/// Already entropy-coded PNG, JPEG and WebP output almost never is, and the sampled
+/// estimate costs a small fraction of the compression attempt it avoids.
+#[cfg(c_hotspots_available)]
+fn worth_compressing(output: &[u8], max_ratio: f32) -> bool {
+    let estimate = crate::c_hotspots::compression_potential_c_hotspot(output);
+    estimate.confidence < MIN_PREDICTION_CONFIDENCE || estimate.ratio < max_ratio
+}
+
 pub fn update_performance_stats(is_image: bool, elapsed_ms: f64, data_size: usize) {
     TOTAL_BYTES_PROCESSED.fetch_add(data_size as u64, Ordering::Relaxed);
 
@@ -206,7 +220,23 @@ pub fn get_performance_stats() -> PerformanceStats {
     }
 }
 
+/// Request totals in the shape of `ProcessingStats`, including result-cache traffic.
+pub fn get_processing_stats() -> ProcessingStats {
+    let image_sum = f64::from_bits(IMAGE_TIME_SUM_BITS.load(Ordering::Relaxed));
+    let mesh_sum = f64::from_bits(MESH_TIME_SUM_BITS.load(Ordering::Relaxed));
+
+    ProcessingStats {
+        operations_count: IMAGES_PROCESSED.load(Ordering::Relaxed) + MESHES_PROCESSED.load(Ordering::Relaxed),
+        total_input_bytes: TOTAL_BYTES_PROCESSED.load(Ordering::Relaxed),
+        total_processing_time_ms: image_sum + mesh_sum,
+        cache_hits: cache::hits(),
+        cache_misses: cache::misses(),
+        ..ProcessingStats::default()
+    }
+}
+
 pub fn reset_performance_stats() {
+    cache::reset_counters();
     IMAGES_PROCESSED.store(0, Ordering::Relaxed);
     MESHES_PROCESSED.store(0, Ordering::Relaxed);
     ERRORS_COUNT.store(0, Ordering::Relaxed);
@@ -253,7 +283,27 @@ impl PixieOptimizer {
         }
     }
 
+    /// Everything that can change an optimizer's output besides the input bytes and
+    /// quality, serialized for the result cache key. `None` bypasses the cache.
+    fn cache_fingerprint(&self) -> Option<Vec<u8>> {
+        serde_json::to_vec(&(self.image_optimizer.config(), self.mesh_optimizer.config(), get_global_config())).ok()
+    }
+
+    fn cached<F>(&self, operation: CachedOperation, data: &[u8], quality: u8, compute: F) -> PixieResult<Vec<u8>>
+    where
+        F: FnOnce() -> PixieResult<Vec<u8>>,
+    {
+        match self.cache_fingerprint() {
+            Some(config) => cache::cached(operation, data, quality, &config, compute),
+            None => compute(),
+        }
+    }
+
     pub fn optimize_auto(&self, data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
+        self.cached(CachedOperation::Auto, data, quality, || self.optimize_auto_uncached(data, quality))
+    }
+
+    fn optimize_auto_uncached(&self, data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
         let start_time = get_current_time_ms();
         let data_size = data.len();
         
@@ -314,7 +364,7 @@ impl PixieOptimizer {
             Ok(optimized) => {
                 #[cfg(c_hotspots_available)]
                 {
-                    if !use_fast_path && data.len() > 50_000 && quality < 70 {
+                    if !use_fast_path && data.len() > 50_000 && quality < 70 && worth_compressing(&optimized, 0.90) {
                         if let Ok(compressed) = crate::c_hotspots::compress_data_c_hotspot(&optimized) {
                             if compressed.len() < optimized.len().saturating_mul(90).saturating_div(100) {
                                 return Ok(compressed);
@@ -347,8 +397,8 @@ impl PixieOptimizer {
                 } else {
                     #[cfg(c_hotspots_available)]
                     {
-                        match crate::c_hotspots::compress_data_c_hotspot(data) {
-                            Ok(compressed) if compressed.len() < data.len() => Ok(compressed),
+                        match worth_compressing(data, 1.0).then(|| crate::c_hotspots::compress_data_c_hotspot(data)) {
+                            Some(Ok(compressed)) if compressed.len() < data.len() => Ok(compressed),
                             _ => self.image_optimizer.optimize_with_quality(data, quality)
                         }
                     }
@@ -386,6 +436,10 @@ impl PixieOptimizer {
     }
 
     pub fn optimize_image(&self, data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
+        self.cached(CachedOperation::Image, data, quality, || self.optimize_image_uncached(data, quality))
+    }
+
+    fn optimize_image_uncached(&self, data: &[u8], quality: u8) -> PixieResult<Vec<u8>> {
         let start_time = get_current_time_ms();
         let data_size = data.len();
         
@@ -432,7 +486,7 @@ impl PixieOptimizer {
                 if remaining_time > 20.0 {
                     #[cfg(c_hotspots_available)]
                     {
-                        if data.len() > 100_000 && quality < 70 {
+                        if data.len() > 100_000 && quality < 70 && worth_compressing(&optimized, 0.90) {
                             if let Ok(compressed) = crate::c_hotspots::compress_data_c_hotspot(&optimized) {
                                 if compressed.len() < optimized.len().saturating_mul(90).saturating_div(100) {
                                     return Ok(compressed);
@@ -448,6 +502,10 @@ impl PixieOptimizer {
     }
 
     pub fn optimize_mesh(&self, data: &[u8]) -> PixieResult<Vec<u8>> {
+        self.cached(CachedOperation::Mesh, data, 0, || self.optimize_mesh_uncached(data))
+    }
+
+    fn optimize_mesh_uncached(&self, data: &[u8]) -> PixieResult<Vec<u8>> {
         let start_time = get_current_time_ms();
         let data_size = data.len();
         
@@ -459,7 +517,7 @@ impl PixieOptimizer {
             Ok(optimized) => {
                 #[cfg(c_hotspots_available)]
                 {
-                    if data.len() > 50_000 {
+                    if data.len() > 50_000 && worth_compressing(&optimized, 0.85) {
                         if let Ok(compressed) = crate::c_hotspots::compress_data_c_hotspot(&optimized) {
                             if compressed.len() < optimized.len().saturating_mul(85).saturating_div(100) {
                                 return Ok(compressed);
@@ -481,7 +539,7 @@ impl PixieOptimizer {
         
         #[cfg(c_hotspots_available)]
         {
-            if data.len() > 100_000 && quality < 70 {
+            if data.len() > 100_000 && quality < 70 && worth_compressing(&optimized, 0.90) {
                 if let Ok(compressed) = crate::c_hotspots::compress_data_c_hotspot(&optimized) {
                     if compressed.len() < optimized.len().saturating_mul(90).saturating_div(100) {
                         let elapsed = get_current_time_ms() - start_time;
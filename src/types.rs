@@ -106,6 +106,9 @@ pub struct ImageOptConfig {
     pub max_width: Option<u32>,
     pub max_height: Option<u32>,
     pub target_reduction: Option<f32>,
+    /// Brute-force every PNG filter with a full encode instead of choosing per row.
+    #[serde(default)]
+    pub exhaustive_png_filters: bool,
 }
 
 impl Default for ImageOptConfig {
@@ -126,6 +129,7 @@ impl Default for ImageOptConfig {
             max_width: None,
             max_height: None,
             target_reduction: None,
+            exhaustive_png_filters: false,
         }
     }
 }